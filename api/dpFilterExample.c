@@ -0,0 +1,129 @@
+/*
+ * api/dpFilterExample.c
+ *
+ * An example of a filter module: a shared library with plug-in filters
+ * that dp_loadFilter adds to a running Tcl-DP, without rebuilding it.
+ * Built as libcaesar.so (caesar.dll on Windows), it is loaded with
+ *
+ *	dp_loadFilter ./libcaesar.so
+ *
+ * which calls Caesar_FilterInit and registers the filters "caesar" and
+ * "uncaesar". caesar adds a number (the -inset or -outset value, 13 by
+ * default) to every byte, modulo 256; uncaesar subtracts it. The filters
+ * use the version 2 filter interface (see generic/dpFilters.c).
+ *
+ * The module calls neither Tcl nor Tcl-DP, so it needs only their
+ * headers. This code also serves as the unit test of dp_loadFilter,
+ * which is executed by ../tests/loadfilter.test.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "generic/dp.h"
+
+#define DEFAULT_SHIFT 13
+
+/*
+ * The shift is small enough to be kept in *data itself, so the filters
+ * have nothing to allocate or free. It is stored plus one, so that a NULL
+ * *data means the default.
+ */
+
+#define GET_SHIFT(data) \
+	((*(data) == NULL) ? DEFAULT_SHIFT : (int) ((long) *(data) - 1))
+#define SET_SHIFT(data, shift) \
+	(*(data) = (void *) ((long) (shift) + 1))
+
+static int
+Shift(CONST84 char *inBuf, int inLength, int *inUsedPtr, char *outBuf,
+	int outSize, int *outLengthPtr, void **data, int mode, int sign)
+{
+    char value[16];
+    int i, shift;
+
+    switch (mode) {
+    case DP_FILTER_NORMAL:
+    case DP_FILTER_FLUSH:
+    case DP_FILTER_EOF:
+    case DP_FILTER_CLOSE:
+	if (inLength > outSize) {
+	    inLength = outSize;
+	}
+	shift = sign * GET_SHIFT(data);
+	for (i = 0; i < inLength; i++) {
+	    outBuf[i] = (char) (inBuf[i] + shift);
+	}
+	*inUsedPtr = inLength;
+	*outLengthPtr = inLength;
+	return 0;
+
+    case DP_FILTER_SET:
+	if ((inLength == 0) || (inLength >= (int) sizeof(value))) {
+	    return EINVAL;
+	}
+	memcpy(value, inBuf, inLength);
+	value[inLength] = '\0';
+	if ((sscanf(value, "%d%c", &shift, value) != 1)
+		|| (shift < 0) || (shift > 255)) {
+	    return EINVAL;
+	}
+	SET_SHIFT(data, shift);
+	return 0;
+
+    case DP_FILTER_GET:
+	sprintf(value, "%d", GET_SHIFT(data));
+	if ((int) strlen(value) > outSize) {
+	    *outLengthPtr = strlen(value);
+	    return ENOSPC;
+	}
+	memcpy(outBuf, value, strlen(value));
+	*outLengthPtr = strlen(value);
+	return 0;
+
+    default:
+	return EINVAL;
+    }
+}
+
+static int
+Caesar(CONST84 char *inBuf, int inLength, int *inUsedPtr, char *outBuf,
+	int outSize, int *outLengthPtr, void **data, Tcl_Interp *interp,
+	int mode)
+{
+    return Shift(inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr,
+	    data, mode, 1);
+}
+
+static int
+Uncaesar(CONST84 char *inBuf, int inLength, int *inUsedPtr, char *outBuf,
+	int outSize, int *outLengthPtr, void **data, Tcl_Interp *interp,
+	int mode)
+{
+    return Shift(inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr,
+	    data, mode, -1);
+}
+
+/*
+ * The filters of the module, and the module itself. Both must be in
+ * static memory.
+ */
+
+static Dp_PlugInFilter2 filters[] = {
+    {NULL, "caesar",	NULL, Caesar},
+    {NULL, "uncaesar",	NULL, Uncaesar},
+    {NULL, NULL,	NULL, NULL}
+};
+
+static Dp_FilterModule module = {DP_FILTER_MODULE_VERSION, filters};
+
+/*
+ * The entry point. A module that needs a newer Tcl-DP than the one
+ * loading it would check version here and return NULL.
+ */
+
+DLLEXPORT Dp_FilterModule *
+Caesar_FilterInit(Tcl_Interp *interp, int version)
+{
+    return &module;
+}
@@ -0,0 +1,431 @@
+/*
+ * bench/dpFilterBench.c
+ *
+ * Measures the speed, in MB/s, of the inner loops of the xor, hexin,
+ * hexout, uuencode, uudecode and checksum plug-in filters.  Each set of
+ * kernels in generic/dpFilterKernels.c that the processor supports is
+ * compared with the byte-at-a-time loops the filters used before
+ * ("orig"; for the checksum, a CRC computed a bit at a time).
+ *
+ * Usage: dpFilterBench ?-check? ?-size bytes? ?-repeat count?
+ *
+ * With -check, no timing is done: every kernel set is run on inputs of
+ * many lengths and key positions and compared with "orig".  This is run
+ * by ctest as the filterkernels test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include "generic/dpInt.h"
+
+#define UU_LINE 45	/* Bytes per uuencoded line. */
+
+static const char *setNames[] = {"scalar", "sse2", "ssse3", "sse42", "avx2",
+	NULL};
+
+static const char key[] = "a random string that is not too short";
+
+/*
+ * The loops the filters used before the kernels were added.
+ */
+
+static void
+OrigXor(unsigned char *to, const unsigned char *from, int length,
+	const unsigned char *xorString, int period, int *posPtr)
+{
+    int i;
+
+    for (i = 0; i < length; i++) {
+	to[i] = from[i] ^ xorString[(*posPtr)++];
+	if (*posPtr >= period) {
+	    *posPtr = 0;
+	}
+    }
+}
+
+static void
+OrigHexEncode(unsigned char *to, const unsigned char *from, int length)
+{
+    const char *table = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < length; i++) {
+	to[2 * i] = table[from[i] >> 4];
+	to[2 * i + 1] = table[from[i] & 0x0F];
+    }
+}
+
+static int
+OrigHexDecode(unsigned char *to, const unsigned char *from, int pairs)
+{
+    int i, t1, t2;
+
+    for (i = 0; i < pairs; i++) {
+	if (!isxdigit(from[2 * i]) || !isxdigit(from[2 * i + 1])) {
+	    break;
+	}
+	t1 = isdigit(from[2 * i]) ? from[2 * i] - '0'
+		: tolower(from[2 * i]) - 'a' + 10;
+	t2 = isdigit(from[2 * i + 1]) ? from[2 * i + 1] - '0'
+		: tolower(from[2 * i + 1]) - 'a' + 10;
+	to[i] = (t1 << 4) | t2;
+    }
+    return i;
+}
+
+static void
+OrigUuencode(unsigned char *to, const unsigned char *from, int groups)
+{
+    int i;
+
+    for (i = 0; i < 3 * groups; i += 3) {
+	*to++ = (from[i] >> 2) + ' ';
+	*to++ = (((from[i] & 0x03) << 4) | (from[i+1] >> 4)) + ' ';
+	*to++ = (((from[i+1] & 0x0f) << 2) | (from[i+2] >> 6)) + ' ';
+	*to++ = (from[i+2] & 0x3f) + ' ';
+    }
+}
+
+static void
+OrigUudecode(unsigned char *to, const unsigned char *from, int groups)
+{
+    int i;
+
+    for (i = 0; i < 4 * groups; i += 4) {
+	*to++ = ((from[i] - ' ') << 2) | ((from[i+1] - ' ') >> 4);
+	*to++ = ((from[i+1] - ' ') << 4) | ((from[i+2] - ' ') >> 2);
+	*to++ = ((from[i+2] - ' ') << 6) | (from[i+3] - ' ');
+    }
+}
+
+static unsigned int
+OrigCrc32c(unsigned int crc, const unsigned char *from, int length)
+{
+    int i, j;
+
+    crc = ~crc;
+    for (i = 0; i < length; i++) {
+	crc ^= from[i];
+	for (j = 0; j < 8; j++) {
+	    crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+	}
+    }
+    return ~crc;
+}
+
+/*
+ * One benchmark per filter.  Each runs a whole buffer through either the
+ * original loop (orig != 0) or the selected kernels.
+ */
+
+typedef struct {
+    unsigned char *data;	/* Random bytes. */
+    unsigned char *hex;		/* data in hex. */
+    unsigned char *uu;		/* data uuencoded, without line framing. */
+    unsigned char *out;		/* Output. */
+    unsigned char *stream;	/* Key for DpXorBytes. */
+    int size;			/* Bytes in data. */
+} Buffers;
+
+static void
+RunXor(Buffers *b, int orig)
+{
+    int pos = 0;
+
+    if (orig) {
+	OrigXor(b->out, b->data, b->size, (unsigned char *) key,
+		sizeof(key) - 1, &pos);
+    } else {
+	DpXorBytes(b->out, b->data, b->size, b->stream, sizeof(key) - 1, &pos);
+    }
+}
+
+static void
+RunHexIn(Buffers *b, int orig)
+{
+    if (orig) {
+	OrigHexEncode(b->out, b->data, b->size);
+    } else {
+	DpHexEncode(b->out, b->data, b->size);
+    }
+}
+
+static void
+RunHexOut(Buffers *b, int orig)
+{
+    if (orig) {
+	OrigHexDecode(b->out, b->hex, b->size);
+    } else {
+	DpHexDecode(b->out, b->hex, b->size);
+    }
+}
+
+static void
+RunUuencode(Buffers *b, int orig)
+{
+    int i;
+
+    for (i = 0; i + UU_LINE <= b->size; i += UU_LINE) {
+	if (orig) {
+	    OrigUuencode(b->out + (i / 3) * 4, b->data + i, UU_LINE / 3);
+	} else {
+	    DpUuencodeGroups(b->out + (i / 3) * 4, b->data + i, UU_LINE / 3);
+	}
+    }
+}
+
+static void
+RunUudecode(Buffers *b, int orig)
+{
+    int i;
+
+    for (i = 0; i + UU_LINE <= b->size; i += UU_LINE) {
+	if (orig) {
+	    OrigUudecode(b->out + i, b->uu + (i / 3) * 4, UU_LINE / 3);
+	} else {
+	    DpUudecodeGroups(b->out + i, b->uu + (i / 3) * 4, UU_LINE / 3);
+	}
+    }
+}
+
+static volatile unsigned int crcSink;
+
+static void
+RunCrc32c(Buffers *b, int orig)
+{
+    if (orig) {
+	crcSink = OrigCrc32c(0, b->data, b->size);
+    } else {
+	crcSink = DpCrc32c(0, b->data, b->size);
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(Buffers *b, int orig);
+} Bench;
+
+static Bench benches[] = {
+    {"xor",	 RunXor},
+    {"hexin",	 RunHexIn},
+    {"hexout",	 RunHexOut},
+    {"uuencode", RunUuencode},
+    {"uudecode", RunUudecode},
+    {"crc32c",	 RunCrc32c},
+    {NULL, NULL}
+};
+
+static double
+Time(Bench *benchPtr, Buffers *b, int orig, int repeat)
+{
+    clock_t start;
+    double seconds;
+    int i;
+
+    start = clock();
+    for (i = 0; i < repeat; i++) {
+	(benchPtr->run)(b, orig);
+    }
+    seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    if (seconds <= 0) {
+	return 0;
+    }
+    return (double) b->size * repeat / seconds / (1024 * 1024);
+}
+
+/*
+ * Compares every supported kernel set with the original loops, for all
+ * lengths up to max and, for xor, every starting position in the key.
+ */
+
+static int
+Check(int max)
+{
+    unsigned char *in, *hex, *ref, *out, *stream;
+    int period = sizeof(key) - 1;
+    int s, length, start, posRef, pos, errors = 0;
+    int nRef, n;
+    unsigned int crc;
+
+    in = malloc(max + 64);
+    hex = malloc(2 * max + 64);
+    ref = malloc(2 * max + 64);
+    out = malloc(2 * max + 64);
+    stream = malloc(period + DP_XOR_STREAM_PAD);
+    for (length = 0; length < max + 64; length++) {
+	in[length] = rand();
+    }
+    for (pos = 0; pos < period + DP_XOR_STREAM_PAD; pos++) {
+	stream[pos] = key[pos % period];
+    }
+
+    for (s = 0; setNames[s] != NULL; s++) {
+	if (DpFilterKernels(setNames[s]) == NULL) {
+	    continue;
+	}
+	for (length = 0; length <= max; length++) {
+	    for (start = 0; start < period; start++) {
+		posRef = pos = start;
+		OrigXor(ref, in, length, (unsigned char *) key, period, &posRef);
+		DpXorBytes(out, in, length, stream, period, &pos);
+		if ((pos != posRef) || memcmp(ref, out, length)) {
+		    printf("%s: xor of %d bytes from %d differs\n",
+			    setNames[s], length, start);
+		    errors++;
+		}
+	    }
+
+	    OrigHexEncode(ref, in, length);
+	    DpHexEncode(out, in, length);
+	    if (memcmp(ref, out, 2 * length)) {
+		printf("%s: hexin of %d bytes differs\n", setNames[s], length);
+		errors++;
+	    }
+
+	    /*
+	     * Decode upper case digits, then the same with one bad digit.
+	     */
+
+	    for (n = 0; n < 2 * length; n++) {
+		hex[n] = toupper(ref[n]);
+	    }
+	    nRef = OrigHexDecode(ref, hex, length);
+	    n = DpHexDecode(out, hex, length);
+	    if ((n != nRef) || memcmp(ref, out, n)) {
+		printf("%s: hexout of %d pairs differs\n", setNames[s], length);
+		errors++;
+	    }
+	    if (length > 0) {
+		hex[length] = (length & 1) ? 'g' : 0x80 + length % 64;
+		nRef = OrigHexDecode(ref, hex, length);
+		n = DpHexDecode(out, hex, length);
+		if ((n != nRef) || memcmp(ref, out, n)) {
+		    printf("%s: hexout of %d pairs with a bad digit differs\n",
+			    setNames[s], length);
+		    errors++;
+		}
+	    }
+
+	    OrigUuencode(ref, in, length / 3);
+	    DpUuencodeGroups(out, in, length / 3);
+	    if (memcmp(ref, out, 4 * (length / 3))) {
+		printf("%s: uuencode of %d groups differs\n", setNames[s],
+			length / 3);
+		errors++;
+	    }
+	    memcpy(hex, out, 4 * (length / 3));
+	    DpUudecodeGroups(out, hex, length / 3);
+	    if (memcmp(in, out, 3 * (length / 3))) {
+		printf("%s: uudecode of %d groups differs\n", setNames[s],
+			length / 3);
+		errors++;
+	    }
+
+	    /*
+	     * The checksum of the whole buffer, and of it in two pieces.
+	     */
+
+	    crc = OrigCrc32c(0, in, length);
+	    if ((DpCrc32c(0, in, length) != crc)
+		    || (DpCrc32c(DpCrc32c(0, in, length / 3), in + length / 3,
+			    length - length / 3) != crc)) {
+		printf("%s: crc32c of %d bytes differs\n", setNames[s], length);
+		errors++;
+	    }
+	}
+	printf("%s: %s\n", setNames[s], errors ? "FAILED" : "ok");
+    }
+
+    free(in);
+    free(hex);
+    free(ref);
+    free(out);
+    free(stream);
+    return errors;
+}
+
+int
+main(int argc, char **argv)
+{
+    Buffers b;
+    Bench *benchPtr;
+    int size = 1024 * 1024, repeat = 200, check = 0;
+    int i, s, period = sizeof(key) - 1;
+
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-check") == 0) {
+	    check = 1;
+	} else if ((strcmp(argv[i], "-size") == 0) && (i + 1 < argc)) {
+	    size = atoi(argv[++i]);
+	} else if ((strcmp(argv[i], "-repeat") == 0) && (i + 1 < argc)) {
+	    repeat = atoi(argv[++i]);
+	} else {
+	    fprintf(stderr,
+		    "usage: %s ?-check? ?-size bytes? ?-repeat count?\n",
+		    argv[0]);
+	    return 2;
+	}
+    }
+
+    /*
+     * Dp_Init normally picks the kernels; this program has to do it itself.
+     */
+
+    DpFilterKernels(NULL);
+
+    if (check) {
+	if (DpCrc32c(0, (unsigned char *) "123456789", 9) != 0xE3069283) {
+	    printf("crc32c of \"123456789\" is wrong\n");
+	    return 1;
+	}
+	return Check(300) ? 1 : 0;
+    }
+
+    size -= size % UU_LINE;
+    if (size <= 0) {
+	size = UU_LINE;
+    }
+    b.size = size;
+    b.data = malloc(size);
+    b.hex = malloc(2 * size);
+    b.uu = malloc(2 * size);
+    b.out = malloc(2 * size);
+    b.stream = malloc(period + DP_XOR_STREAM_PAD);
+    for (i = 0; i < size; i++) {
+	b.data[i] = rand();
+    }
+    for (i = 0; i < period + DP_XOR_STREAM_PAD; i++) {
+	b.stream[i] = key[i % period];
+    }
+    OrigHexEncode(b.hex, b.data, size);
+    OrigUuencode(b.uu, b.data, size / 3);
+
+    printf("%-9s %10s", "MB/s", "orig");
+    for (s = 0; setNames[s] != NULL; s++) {
+	printf(" %10s", setNames[s]);
+    }
+    printf("\n");
+
+    for (benchPtr = benches; benchPtr->name != NULL; benchPtr++) {
+	printf("%-9s %10.1f", benchPtr->name, Time(benchPtr, &b, 1, repeat));
+	for (s = 0; setNames[s] != NULL; s++) {
+	    if (DpFilterKernels(setNames[s]) == NULL) {
+		printf(" %10s", "-");
+	    } else {
+		printf(" %10.1f", Time(benchPtr, &b, 0, repeat));
+	    }
+	}
+	printf("\n");
+    }
+    printf("filters use: %s\n", DpFilterKernels(NULL));
+
+    free(b.data);
+    free(b.hex);
+    free(b.uu);
+    free(b.out);
+    free(b.stream);
+    return 0;
+}
@@ -50,9 +50,26 @@ typedef int (Dp_PlugInFilterProc)  _ANSI_ARGS_((CONST84 char *inBuf, int inLengt
 						void **data, Tcl_Interp *interp,
 						int mode));
 
+/*
+ * Type for version 2 plug-in functions. The channel owns outBuf and
+ * reuses it from call to call; the filter writes at most outSize bytes
+ * into it and reports how much of the input it consumed. See the
+ * comments at the top of generic/dpFilters.c. The output filters of a
+ * channel opened with "-threaded 1" run on another thread and get a
+ * NULL interp.
+ */
+
+typedef int (Dp_PlugInFilterProc2) _ANSI_ARGS_((CONST84 char *inBuf,
+						int inLength, int *inUsedPtr,
+						char *outBuf, int outSize,
+						int *outLengthPtr, void **data,
+						Tcl_Interp *interp, int mode));
+
 /*
  * Any new filter that is registered should provide a (ckallock-ed) pointer to
  * such a structure, whose "name" and "plugProc" fields must be set.
+ * Filters built against older releases pass this structure, so its layout
+ * must not change.
  */
 
 typedef struct _Dp_PlugInFilter {
@@ -61,6 +78,20 @@ typedef struct _Dp_PlugInFilter {
     Dp_PlugInFilterProc     * plugProc;
 } Dp_PlugInFilter;
 
+/*
+ * Version 2 filters are registered with Dp_RegisterPlugInFilter2 and this
+ * structure, in static memory, whose "name" and "plugProc2" fields must be
+ * set. "plugProc" may give a version 1 entry point for Dp_GetFilterPtr, or
+ * be NULL.
+ */
+
+typedef struct _Dp_PlugInFilter2 {
+    struct _Dp_PlugInFilter2 * nextPtr;
+    char                     * name;
+    Dp_PlugInFilterProc      * plugProc;
+    Dp_PlugInFilterProc2     * plugProc2;
+} Dp_PlugInFilter2;
+
 
 /*
  * Modes for the plug-in filter functions.
@@ -73,6 +104,32 @@ typedef struct _Dp_PlugInFilter {
 #define DP_FILTER_GET      5
 #define DP_FILTER_EOF      6
 
+/*
+ * Filter modules. A shared library loaded with dp_loadFilter exports
+ *
+ *	Dp_FilterModule *Prefix_FilterInit(Tcl_Interp *interp, int version)
+ *
+ * where Prefix is the name given to dp_loadFilter or, as with the load
+ * command, taken from the file name (libcaesar.so gives Caesar). version
+ * is the DP_FILTER_MODULE_VERSION of the library loading the module. The
+ * function does whatever setup the module needs and returns a pointer
+ * to a structure in static memory, or NULL (leaving an error message in
+ * interp) if the module can not be used. dp_loadFilter checks the version
+ * the module was built with, then registers its filters.
+ */
+
+#define DP_FILTER_MODULE_VERSION	1
+
+typedef struct Dp_FilterModule {
+    int                version;	/* DP_FILTER_MODULE_VERSION the module
+				 * was built with. */
+    Dp_PlugInFilter2 * filters;	/* Filters of the module, ended by an
+				 * element whose name is NULL. */
+} Dp_FilterModule;
+
+typedef Dp_FilterModule *(Dp_FilterInitProc) _ANSI_ARGS_((
+				Tcl_Interp *interp, int version));
+
 /*
  * Exported DP functions.
  */
@@ -86,12 +143,18 @@ EXTERN int		Dp_RegisterChannelType _ANSI_ARGS_((
 EXTERN int              Dp_RegisterPlugInFilter  _ANSI_ARGS_((
     			    Tcl_Interp * interp, Dp_PlugInFilter *plugInPtr));
 
+EXTERN int              Dp_RegisterPlugInFilter2  _ANSI_ARGS_((
+    			    Tcl_Interp * interp, Dp_PlugInFilter2 *plugInPtr));
+
 EXTERN Dp_PlugInFilterProc *Dp_GetFilterPtr  _ANSI_ARGS_((
                             Tcl_Interp * interp, CONST84 char * name));
 
 EXTERN char            *Dp_GetFilterName  _ANSI_ARGS_((
 			    Dp_PlugInFilterProc *filter));
 
+EXTERN Dp_PlugInFilter2 *Dp_GetFilter  _ANSI_ARGS_((
+                            Tcl_Interp * interp, CONST84 char * name));
+
 
 #endif /* _DP */
 
@@ -13,6 +13,8 @@
 #include <tcl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include "generic/dpInt.h"
 
 
@@ -28,6 +30,9 @@ static Dp_ChannelType * chanTypeList = (Dp_ChannelType *) NULL;
 
 static Dp_ChannelType builtInTypes[] = {
     {NULL,	"ipm",		DpOpenIpmChannel},
+#ifndef _WIN32
+    {NULL,	"rmcast",	DpOpenRmcastChannel},
+#endif
     {NULL,	"tcp",		DpOpenTcpChannel},
 #ifndef _WIN32
     {NULL,	"email",	DpCreateEmailChannel},
@@ -198,6 +203,287 @@ DpClose(interp, chan)
     return Tcl_GlobalEval(interp, cmd);
 }
 
+/*
+ * The identity, plugfilter and packoff channels normally wrap their
+ * subordinated channel: they have a name of their own and move data
+ * with Tcl_Read and Tcl_Write, so it goes through the buffers of both
+ * channels. Opened with "-stack 1" they are pushed onto it with
+ * Tcl_StackChannel instead. The stack keeps the name of the
+ * subordinated channel, the data moves with Tcl_ReadRaw and
+ * Tcl_WriteRaw, and events come straight from the channel below.
+ * Closing the channel closes the whole stack. The procedures below
+ * are shared by the three drivers.
+ */
+
+static void	DpStackTimerProc _ANSI_ARGS_((ClientData clientData));
+
+/*
+ *--------------------------------------------------------------
+ *
+ *  DpStackChannel --
+ *
+ *	Pushes a filter channel onto its subordinated channel.
+ *
+ * Results:
+ *	The new top of the stack, or NULL with an error message
+ *	in interp.
+ *
+ * Side effects:
+ *	Fills in *stackPtr. The channel is not registered again,
+ *	the stack already is.
+ *
+ *--------------------------------------------------------------
+ */
+
+Tcl_Channel
+DpStackChannel(interp, typePtr, instanceData, mask, parent, stackPtr)
+    Tcl_Interp *interp;			/* For error messages. */
+    Tcl_ChannelType *typePtr;		/* Driver of the filter. */
+    ClientData instanceData;		/* Instance data of the filter. */
+    int mask;				/* TCL_READABLE and/or TCL_WRITABLE,
+					 * as far as the subordinated
+					 * channel allows. */
+    Tcl_Channel parent;			/* Subordinated channel. */
+    DpStack *stackPtr;			/* (out) Stacking state. */
+{
+    Tcl_Channel chan;
+
+    stackPtr->self = NULL;
+    stackPtr->timer = NULL;
+
+    chan = Tcl_StackChannel(interp, typePtr, instanceData,
+	    mask & Tcl_GetChannelMode(parent), parent);
+    if (chan == NULL) {
+	return NULL;
+    }
+    stackPtr->self = chan;
+    return chan;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ *  DpStackRelease --
+ *
+ *	Called by the close procedure of a stacked filter channel.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Cancels the timer set by DpStackWatch.
+ *
+ *--------------------------------------------------------------
+ */
+
+void
+DpStackRelease(stackPtr)
+    DpStack *stackPtr;
+{
+    if (stackPtr->timer != NULL) {
+	Tcl_DeleteTimerHandler(stackPtr->timer);
+	stackPtr->timer = NULL;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ *  DpStackRead --
+ *
+ *	Reads from the subordinated channel of a filter channel,
+ *	with Tcl_ReadRaw if the filter is stacked on it.
+ *
+ * Results:
+ *	Number of bytes read, 0 if none are available, or -1 on
+ *	error.
+ *
+ * Side effects:
+ *	Reads from the subordinated channel.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+DpStackRead(stackPtr, parent, buf, toRead)
+    DpStack *stackPtr;			/* Stacking state. */
+    Tcl_Channel parent;			/* Subordinated channel. */
+    char *buf;				/* (out) Data read. */
+    int toRead;				/* Size of buf. */
+{
+    int n;
+
+    if (stackPtr->self == NULL) {
+	return Tcl_Read(parent, buf, toRead);
+    }
+    n = Tcl_ReadRaw(parent, buf, toRead);
+    if ((n == -1) && Tcl_InputBlocked(parent)) {
+	n = 0;
+    }
+    return n;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ *  DpStackWrite --
+ *
+ *	Writes to the subordinated channel of a filter channel,
+ *	with Tcl_WriteRaw if the filter is stacked on it.
+ *
+ * Results:
+ *	Number of bytes written, or -1 on error.
+ *
+ * Side effects:
+ *	Writes to the subordinated channel.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+DpStackWrite(stackPtr, parent, buf, toWrite)
+    DpStack *stackPtr;			/* Stacking state. */
+    Tcl_Channel parent;			/* Subordinated channel. */
+    CONST84 char *buf;			/* Data to write. */
+    int toWrite;			/* Number of bytes in buf. */
+{
+    if (stackPtr->self == NULL) {
+	return Tcl_Write(parent, buf, toWrite);
+    }
+    return Tcl_WriteRaw(parent, buf, toWrite);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ *  DpStackWatch --
+ *
+ *	Watch procedure of a stacked filter channel. The events
+ *	come from the channel below, but input the filter already
+ *	holds would not raise any, so a timer does it instead.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Calls the watch procedure of the subordinated channel and
+ *	sets or cancels the timer.
+ *
+ *--------------------------------------------------------------
+ */
+
+void
+DpStackWatch(stackPtr, parent, mask, pending)
+    DpStack *stackPtr;			/* Stacking state. */
+    Tcl_Channel parent;			/* Subordinated channel. */
+    int mask;				/* Events of interest. */
+    int pending;			/* Non-zero if the filter holds
+					 * input that can be read. */
+{
+    (Tcl_GetChannelType(parent)->watchProc)
+	    (Tcl_GetChannelInstanceData(parent), mask);
+
+    if ((mask & TCL_READABLE) && pending) {
+	if (stackPtr->timer == NULL) {
+	    stackPtr->timer = Tcl_CreateTimerHandler(0, DpStackTimerProc,
+		    (ClientData) stackPtr);
+	}
+    } else {
+	DpStackRelease(stackPtr);
+    }
+}
+
+static void
+DpStackTimerProc(clientData)
+    ClientData clientData;		/* Stacking state. */
+{
+    DpStack *stackPtr = (DpStack *) clientData;
+
+    stackPtr->timer = NULL;
+    Tcl_NotifyChannel(stackPtr->self, TCL_READABLE);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ *  DpStackHandler --
+ *
+ *	Handler procedure of a stacked filter channel: events from
+ *	the channel below are passed up as they are.
+ *
+ * Results:
+ *	interestMask.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+DpStackHandler(instanceData, interestMask)
+    ClientData instanceData;		/* Not used. */
+    int interestMask;			/* Events that happened. */
+{
+    return interestMask;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ *  DpStackGetOption --
+ *  DpStackSetOption --
+ *
+ *	Hand options a stacked filter channel does not know to the
+ *	driver of the channel below, so that "fconfigure" on the
+ *	stack still reaches, say, -peername of a TCP channel.
+ *
+ * Results:
+ *	Standard Tcl result.
+ *
+ * Side effects:
+ *	Whatever the driver below does.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+DpStackGetOption(parent, interp, optionName, dsPtr)
+    Tcl_Channel parent;			/* Subordinated channel. */
+    Tcl_Interp *interp;			/* For error messages. */
+    CONST84 char *optionName;		/* Option, NULL for all. */
+    Tcl_DString *dsPtr;			/* (out) Value(s). */
+{
+    Tcl_DriverGetOptionProc *getOptionProc;
+
+    getOptionProc = Tcl_GetChannelType(parent)->getOptionProc;
+    if (getOptionProc == NULL) {
+	if (optionName == NULL) {
+	    return TCL_OK;
+	}
+	return Tcl_BadChannelOption(interp, optionName, "");
+    }
+    return (*getOptionProc)(Tcl_GetChannelInstanceData(parent), interp,
+	    optionName, dsPtr);
+}
+
+int
+DpStackSetOption(parent, interp, optionName, optionValue)
+    Tcl_Channel parent;			/* Subordinated channel. */
+    Tcl_Interp *interp;			/* For error messages. */
+    CONST char *optionName;		/* Option to set. */
+    CONST char *optionValue;		/* Its new value. */
+{
+    Tcl_DriverSetOptionProc *setOptionProc;
+
+    setOptionProc = Tcl_GetChannelType(parent)->setOptionProc;
+    if (setOptionProc == NULL) {
+	return Tcl_BadChannelOption(interp, optionName, "");
+    }
+    return (*setOptionProc)(Tcl_GetChannelInstanceData(parent), interp,
+	    optionName, optionValue);
+}
+
 /*
  *--------------------------------------------------------------
  *
@@ -263,10 +549,29 @@ DpTranslateOption (name)
 	return DP_BAUDRATE;
     } else if ((c == 'c') && (strncmp(name, "charsize", len) == 0)) {
 	return DP_CHARSIZE;
+    } else if ((c == 'c') && (strncmp(name, "connect", len) == 0)) {
+	return DP_CONNECT;
+    } else if ((c == 'f') && (strncmp(name, "fromvar", len) == 0)) {
+	return DP_FROMVAR;
+    } else if ((c == 'f') && (strncmp(name, "fragment", len) == 0)) {
+	return DP_FRAGMENT;
+    } else if ((c == 'f') && (strncmp(name, "fragTimeout", len) == 0)) {
+	return DP_FRAGTIMEOUT;
+    } else if ((c == 'f') && (strncmp(name, "fragMemory", len) == 0)) {
+	return DP_FRAGMEMORY;
+    } else if ((c == 'g') && (strcmp(name, "gro") == 0)) {
+	/*
+	 * Not abbreviable: "gro" is also a prefix of "group".
+	 */
+	return DP_GRO;
     } else if ((c == 'g') && (strncmp(name, "group", len) == 0)) {
 	return DP_GROUP;
+    } else if ((c == 'g') && (strncmp(name, "gso", len) == 0)) {
+	return DP_GSO;
     } else if ((c == 'h') && (strncmp(name, "host", len) == 0)) {
 	return DP_HOST;
+    } else if ((c == 'h') && (strncmp(name, "heartbeat", len) == 0)) {
+	return DP_HEARTBEAT;
     } else if ((c == 'k') && (strncmp(name, "keepAlive", len) == 0)) {
 	return DP_KEEP_ALIVE;
     } else if ((c == 'l') && (strncmp(name, "linger", len) == 0)) {
@@ -275,20 +580,34 @@ DpTranslateOption (name)
 	return DP_MULTICAST_LOOP;
     } else if ((c == 'm') && (strncmp(name, "myport", len) == 0)) {
 	return DP_MYPORT;
+    } else if ((c == 'n') && (strncmp(name, "nackDelay", len) == 0)) {
+	return DP_NACKDELAY;
     } else if ((c == 'p') && (strncmp(name, "parity", len) == 0)) {
 	return DP_PARITY;
     } else if ((c == 'p') && (strncmp(name, "peek", len) == 0)) {
 	return DP_PEEK;
     } else if ((c == 'p') && (strncmp(name, "port", len) == 0)) {
 	return DP_PORT;
+    } else if ((c == 'r') && (strncmp(name, "rate", len) == 0)) {
+	return DP_RATE;
     } else if ((c == 'r') && (strncmp(name, "recvBuffer", len) == 0)) {
 	return DP_RECV_BUFFER_SIZE;
     } else if ((c == 'r') && (strncmp(name, "reuseAddr", len) == 0)) {
 	return DP_REUSEADDR;
+    } else if ((c == 'r') && (strncmp(name, "reusePort", len) == 0)) {
+	return DP_REUSEPORT;
     } else if ((c == 's') && (strncmp(name, "sendBuffer", len) == 0)) {
 	return DP_SEND_BUFFER_SIZE;
+    } else if ((c == 's') && (strncmp(name, "sendStamp", len) == 0)) {
+	return DP_SENDSTAMP;
     } else if ((c == 's') && (strncmp(name, "stopbits", len) == 0)) {
 	return DP_STOPBITS;
+    } else if ((c == 's') && (strncmp(name, "stats", len) == 0)) {
+	return DP_STATS;
+    } else if ((c == 't') && (strncmp(name, "timestamps", len) == 0)) {
+	return DP_TIMESTAMPS;
+    } else if ((c == 'w') && (strncmp(name, "window", len) == 0)) {
+	return DP_WINDOW;
     } else if ((c == 'm') && (strncmp(name, "myIpAddr", len) == 0)) {
 	return DP_MYIPADDR;
     } else if ((c == 'd') && (strncmp(name, "destIpAddr", len) == 0)) {
@@ -309,8 +628,16 @@ DpTranslateOption (name)
 	return DP_OUTFILTER;
     } else if ((c == 'i') && (strncmp(name, "inset", len) == 0)) {
 	return DP_INSET;
-    } else if ((c == 'o') && (strncmp(name, "outset", len) == 0))
+    } else if ((c == 'o') && (strncmp(name, "outset", len) == 0)) {
 	return DP_OUTSET;
+    } else if ((c == 't') && (strncmp(name, "threaded", len) == 0)) {
+	return DP_THREADED;
+    } else if ((c == 's') && (strncmp(name, "stack", len) == 0)) {
+	return DP_STACK;
+    } else if ((c == 'h') && (strncmp(name, "header", len) == 0)) {
+	return DP_HEADER;
+    } else if ((c == 'm') && (strncmp(name, "maxMessage", len) == 0))
+	return DP_MAXMESSAGE;
 
     return -1;
 }
@@ -322,32 +649,108 @@ DpTranslateOption (name)
  * This variable holds the list of registered plug-in filters.
  */
 
-static Dp_PlugInFilter *plugInList = (Dp_PlugInFilter *) NULL;
+static Dp_PlugInFilter2 *plugInList = (Dp_PlugInFilter2 *) NULL;
 
+static int	FilterRegisterCheck _ANSI_ARGS_((Tcl_Interp *interp,
+			    char *name, int hasProc));
 
 /*
- * All the built-in plug-in functions.
+ * Version 1 entry points of the built-in filters, which Dp_GetFilterPtr
+ * hands out. Each one passes its arguments on to CallFilter2 along with
+ * the version 2 function it stands for.
  */
 
-static Dp_PlugInFilter builtInPlugs[] = {
+static int	CallFilter2 _ANSI_ARGS_((Dp_PlugInFilterProc2 *proc2,
+			    CONST84 char *inBuf, int inLength, char **outBuf,
+			    int *outLength, void **data, Tcl_Interp *interp,
+			    int mode));
+static void	FreeFilterGetBuf _ANSI_ARGS_((ClientData clientData));
+
+#define FILTER_V1(name, proc2)						\
+static int								\
+name (inBuf, inLength, outBuf, outLength, data, interp, mode)		\
+    CONST84 char *inBuf; int inLength; char **outBuf; int *outLength;	\
+    void **data; Tcl_Interp *interp; int mode;				\
+{									\
+    return CallFilter2(proc2, inBuf, inLength, outBuf, outLength,	\
+	    data, interp, mode);					\
+}
+
+FILTER_V1(IdentityV1,		Identity)
+FILTER_V1(Plug1to2V1,		Plug1to2)
+FILTER_V1(Plug2to1V1,		Plug2to1)
+FILTER_V1(XorV1,		Xor)
+FILTER_V1(PackOnV1,		PackOn)
+FILTER_V1(UuencodeV1,		Uuencode)
+FILTER_V1(UudecodeV1,		Uudecode)
+FILTER_V1(TclFilterV1,		TclFilter)
+FILTER_V1(HexOutV1,		HexOut)
+FILTER_V1(HexInV1,		HexIn)
+FILTER_V1(ChecksumOnV1,		ChecksumOn)
+FILTER_V1(ChecksumOffV1,	ChecksumOff)
+#ifdef DP_ZLIB_FILTERS
+FILTER_V1(DeflateV1,		Deflate)
+FILTER_V1(InflateV1,		Inflate)
+FILTER_V1(GzipV1,		Gzip)
+FILTER_V1(GunzipV1,		Gunzip)
+#endif
+
+/*
+ * A version 1 filter keeps the description it returns for DP_FILTER_GET.
+ * CallFilter2 keeps the last one made on each thread here.
+ */
+
+typedef struct ThreadSpecificData {
+    char *getBuf;		/* Last DP_FILTER_GET description, or
+				 * NULL. */
+} ThreadSpecificData;
+
+static Tcl_ThreadDataKey dataKey;
+
+
+/*
+ * All the built-in plug-in functions.
+ */
 
-    {NULL,     "identity",     Identity},
-    {NULL,     "plug1to2",     Plug1to2},
-    {NULL,     "plug2to1",     Plug2to1},
-    {NULL,     "xor",          Xor},
-    {NULL,     "packon",       PackOn},
-    {NULL,     "uuencode",     Uuencode},
-    {NULL,     "uudecode",     Uudecode},
-    {NULL,     "tclfilter",    TclFilter},
-    {NULL,     "hexout",    HexOut},
-    {NULL,     "hexin",    HexIn},
+static Dp_PlugInFilter2 builtInPlugs[] = {
+
+    {NULL,     "identity",     IdentityV1,      Identity},
+    {NULL,     "plug1to2",     Plug1to2V1,      Plug1to2},
+    {NULL,     "plug2to1",     Plug2to1V1,      Plug2to1},
+    {NULL,     "xor",          XorV1,           Xor},
+    {NULL,     "packon",       PackOnV1,        PackOn},
+    {NULL,     "uuencode",     UuencodeV1,      Uuencode},
+    {NULL,     "uudecode",     UudecodeV1,      Uudecode},
+    {NULL,     "tclfilter",    TclFilterV1,     TclFilter},
+    {NULL,     "hexout",       HexOutV1,        HexOut},
+    {NULL,     "hexin",        HexInV1,         HexIn},
+    {NULL,     "checksumon",   ChecksumOnV1,    ChecksumOn},
+    {NULL,     "checksumoff",  ChecksumOffV1,   ChecksumOff},
 
     /*
      * This array must end with the following element.
      */
 
-    {NULL,	NULL,		NULL}
+    {NULL,	NULL,		NULL,	NULL}
+};
+
+#ifdef DP_ZLIB_FILTERS
+/*
+ * The compression filters. An older Tcl that loads this library through
+ * stubs has no zlib streams, so these are registered only if the running
+ * Tcl is 8.6 or later.
+ */
+
+static Dp_PlugInFilter2 zlibPlugs[] = {
+
+    {NULL,     "deflate",      DeflateV1,       Deflate},
+    {NULL,     "inflate",      InflateV1,       Inflate},
+    {NULL,     "gzip",         GzipV1,          Gzip},
+    {NULL,     "gunzip",       GunzipV1,        Gunzip},
+
+    {NULL,	NULL,		NULL,	NULL}
 };
+#endif
 
 
 
@@ -358,8 +761,9 @@ static Dp_PlugInFilter builtInPlugs[] = {
  *
  *	Registers a new type of filter that can be used in the DP
  *	user-level commands. newPlugInPtr must point to a Dp_PlugInFilter
- *	structure in *static memory*, the contents of which must not
- *	be modified after calling this function.
+ *	structure, whose "plugProc" is the (version 1) filter function.
+ *	The structure is copied; version 2 filters are registered with
+ *	Dp_RegisterPlugInFilter2.
  *
  * Results:
  *
@@ -367,9 +771,9 @@ static Dp_PlugInFilter builtInPlugs[] = {
  *	same name has already been registered.
  *
  * Side effects:
- *	On success,  newPlugInPtr is inserted to the head of the list
- *	of filter. Also, the next pointer of newPlugInPtr is
- *	modified.
+ *
+ *	On success, a copy of newPlugInPtr is inserted to the head of the
+ *	list of filters.
  *
  *--------------------------------------------------------------
  */
@@ -379,21 +783,108 @@ Dp_RegisterPlugInFilter (interp, newPlugInPtr)
     Tcl_Interp      * interp;       /* (in) Interpreter to report errors to. */
     Dp_PlugInFilter * newPlugInPtr; /* (in) Pointer to the filter function. */
 {
-    Dp_PlugInFilter *plugInPtr;
+    Dp_PlugInFilter2 *plugInPtr;
+
+    if (FilterRegisterCheck(interp, newPlugInPtr->name,
+	    newPlugInPtr->plugProc != NULL) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    plugInPtr = (Dp_PlugInFilter2 *) ckalloc(sizeof(Dp_PlugInFilter2));
+    plugInPtr->name = newPlugInPtr->name;
+    plugInPtr->plugProc = newPlugInPtr->plugProc;
+    plugInPtr->plugProc2 = NULL;
+    plugInPtr->nextPtr = plugInList;
+    plugInList = plugInPtr;
+
+    return TCL_OK;
+}
+
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Dp_RegisterPlugInFilter2 --
+ *
+ *	Registers a new type of version 2 filter. newPlugInPtr must point
+ *	to a Dp_PlugInFilter2 structure in *static memory*, the contents
+ *	of which must not be modified after calling this function.
+ *
+ * Results:
+ *
+ *	Standard TCL return value. Fails if a filter with the
+ *	same name has already been registered.
+ *
+ * Side effects:
+ *
+ *	On success,  newPlugInPtr is inserted to the head of the list
+ *	of filter. Also, the next pointer of newPlugInPtr is
+ *	modified.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+Dp_RegisterPlugInFilter2 (interp, newPlugInPtr)
+    Tcl_Interp       * interp;       /* (in) Interpreter to report errors to. */
+    Dp_PlugInFilter2 * newPlugInPtr; /* (in) Pointer to the filter function. */
+{
+    if (FilterRegisterCheck(interp, newPlugInPtr->name,
+	    newPlugInPtr->plugProc2 != NULL) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    newPlugInPtr->nextPtr = plugInList;
+    plugInList = newPlugInPtr;
+
+    return TCL_OK;
+}
+
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FilterRegisterCheck --
+ *
+ *	Checks that a filter about to be registered has a filter function
+ *	and a name that is not taken yet.
+ *
+ * Results:
+ *
+ *	Standard TCL return value, with an error message in interp.
+ *
+ * Side effects:
+ *
+ *	None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FilterRegisterCheck (interp, name, hasProc)
+    Tcl_Interp *interp;		/* (in) Interpreter to report errors to. */
+    char       *name;		/* (in) Name of the new filter. */
+    int         hasProc;	/* (in) Whether it has a filter function. */
+{
+    Dp_PlugInFilter2 *plugInPtr;
+
+    if (!hasProc) {
+	Tcl_AppendResult(interp, "Plug-in filter \"", name,
+		"\" has no filter function", NULL);
+	return TCL_ERROR;
+    }
 
     for (plugInPtr = plugInList; plugInPtr;
 	    plugInPtr = plugInPtr->nextPtr) {
 
-	if (strcmp(plugInPtr->name, newPlugInPtr->name)==0) {
-	    Tcl_AppendResult(interp, "Plug-in filter  \"", newPlugInPtr->name,
+	if (strcmp(plugInPtr->name, name)==0) {
+	    Tcl_AppendResult(interp, "Plug-in filter  \"", name,
 		"\" already exists", NULL);
 	    return TCL_ERROR;
 	}
     }
-
-    newPlugInPtr->nextPtr = plugInList;
-    plugInList = newPlugInPtr;
-
     return TCL_OK;
 }
 
@@ -402,14 +893,14 @@ Dp_RegisterPlugInFilter (interp, newPlugInPtr)
 /*
  *-----------------------------------------------------------------------------
  *
- * Dp_GetFilterPtr --
+ * Dp_GetFilter --
  *
- *	Returns a pointer to the filter function whose name was given.
+ *	Returns the registration record of the filter whose name was given.
  *
  * Results:
  *
- *	Pointer to the filter function or NULL if the name is not the name of
- *	a registered filter function.
+ *	Pointer to the filter's Dp_PlugInFilter2 structure or NULL if the name
+ *	is not the name of a registered filter function.
  *
  * Side effects:
  *
@@ -418,17 +909,17 @@ Dp_RegisterPlugInFilter (interp, newPlugInPtr)
  *-----------------------------------------------------------------------------
  */
 
-Dp_PlugInFilterProc *
-Dp_GetFilterPtr  (interp, name)
+Dp_PlugInFilter2 *
+Dp_GetFilter  (interp, name)
     Tcl_Interp  *interp;        /* (in) Interpreter to report errors to. */
     CONST84 char        *name;		/* (in) Name of the filter function. */
 {
-    Dp_PlugInFilter *plugInPtr;
+    Dp_PlugInFilter2 *plugInPtr;
 
     for (plugInPtr = plugInList; plugInPtr;
 	    plugInPtr = plugInPtr->nextPtr) {
 	if (strcmp(plugInPtr->name, name) == 0) {
-            return plugInPtr->plugProc;
+            return plugInPtr;
         }
     }
 
@@ -437,6 +928,46 @@ Dp_GetFilterPtr  (interp, name)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Dp_GetFilterPtr --
+ *
+ *	Returns a pointer to the version 1 filter function whose name was
+ *	given.
+ *
+ * Results:
+ *
+ *	Pointer to the filter function or NULL if the name is not the name of
+ *	a registered filter function, or the filter only has a version 2
+ *	entry point.
+ *
+ * Side effects:
+ *
+ *	None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Dp_PlugInFilterProc *
+Dp_GetFilterPtr  (interp, name)
+    Tcl_Interp  *interp;        /* (in) Interpreter to report errors to. */
+    CONST84 char        *name;		/* (in) Name of the filter function. */
+{
+    Dp_PlugInFilter2 *plugInPtr;
+
+    plugInPtr = Dp_GetFilter(interp, name);
+    if (plugInPtr == NULL) {
+	return NULL;
+    }
+    if (plugInPtr->plugProc == NULL) {
+	Tcl_AppendResult(interp, "plug-in function \"", name,
+		"\" has no version 1 entry point", NULL);
+    }
+    return plugInPtr->plugProc;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -460,11 +991,11 @@ char *
 Dp_GetFilterName  (filter)
     Dp_PlugInFilterProc *filter;    /* (in) Pointer to the filter function. */
 {
-    Dp_PlugInFilter *plugInPtr;
+    Dp_PlugInFilter2 *plugInPtr;
 
     for (plugInPtr = plugInList; plugInPtr;
 	    plugInPtr = plugInPtr->nextPtr) {
-	if (filter, plugInPtr->plugProc) {
+	if ((filter != NULL) && (filter == plugInPtr->plugProc)) {
             return plugInPtr->name;
         }
     }
@@ -472,6 +1003,153 @@ Dp_GetFilterName  (filter)
     return NULL;
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CallFilter2 --
+ *
+ *	Runs a version 2 filter function for a caller that expects a
+ *	version 1 one. The output goes to a buffer allocated here, which
+ *	is grown until the filter has consumed all the input.
+ *
+ * Results:
+ *
+ *	0 if everything went well, otherwise the POSIX error code returned
+ *	by the filter.
+ *
+ * Side effects:
+ *
+ *	Calls the filter. Any output is left in a ckalloc-ed buffer in
+ *	*outBuf, for the caller to free; in DP_FILTER_GET mode *outBuf
+ *	points to a string that is freed by the next such call on this
+ *	thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+CallFilter2 (proc2, inBuf, inLength, outBuf, outLength, data, interp, mode)
+    Dp_PlugInFilterProc2 *proc2;	/* (in) Version 2 filter to run. */
+    CONST84 char *inBuf;	/* (in) Data to filter. */
+    int inLength;		/* (in) Number of bytes in inBuf. */
+    char **outBuf;		/* (out) Output of the filter. */
+    int *outLength;		/* (out) Number of bytes in *outBuf. */
+    void **data;		/* (in/out) Internal state of the filter. */
+    Tcl_Interp *interp;		/* (in) Interpreter passed to the filter. */
+    int mode;			/* (in) Filter mode. */
+{
+    ThreadSpecificData *tsdPtr;
+    char *buf;
+    int error, size, used, inDone, inUsed, length, room;
+
+    if (mode == DP_FILTER_SET) {
+	inUsed = 0;
+	length = 0;
+	return (*proc2) (inBuf, inLength, &inUsed, NULL, 0, &length, data,
+		interp, mode);
+    }
+    if (inBuf == NULL) {
+	inLength = 0;
+    }
+
+    size = inLength + 256;
+    buf = ckalloc(size);
+    used = 0;
+    inDone = 0;
+    for (;;) {
+	/*
+	 * Keep a byte for the null that ends a DP_FILTER_GET description.
+	 */
+
+	room = size - used - 1;
+	inUsed = 0;
+	length = 0;
+	error = (*proc2) ((inBuf == NULL) ? NULL : inBuf + inDone,
+		inLength - inDone, &inUsed, buf + used, room, &length,
+		data, interp, mode);
+	if (error == ENOSPC) {
+	    if (length <= room) {
+		length = room + 1;
+	    }
+	    size = used + length + 1;
+	    buf = ckrealloc(buf, size);
+	    continue;
+	}
+	if (error != 0) {
+	    ckfree(buf);
+	    return error;
+	}
+	used += length;
+	inDone += inUsed;
+	if (inDone >= inLength) {
+	    break;
+	}
+	if ((inUsed == 0) && (length == 0)) {
+	    size *= 2;
+	    buf = ckrealloc(buf, size);
+	}
+    }
+
+    if (mode == DP_FILTER_GET) {
+	buf[used] = '\0';
+	tsdPtr = (ThreadSpecificData *) Tcl_GetThreadData(&dataKey,
+		sizeof(ThreadSpecificData));
+	if (tsdPtr->getBuf == NULL) {
+	    Tcl_CreateThreadExitHandler(FreeFilterGetBuf, NULL);
+	} else {
+	    ckfree(tsdPtr->getBuf);
+	}
+	tsdPtr->getBuf = buf;
+	*outBuf = buf;
+	if (outLength != NULL) {
+	    *outLength = used;
+	}
+	return 0;
+    }
+
+    if (used == 0) {
+	ckfree(buf);
+	*outLength = 0;
+	return 0;
+    }
+    *outBuf = buf;
+    *outLength = used;
+    return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FreeFilterGetBuf --
+ *
+ *	Frees the last DP_FILTER_GET description made by CallFilter2 on a
+ *	thread, when the thread exits.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	Frees memory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FreeFilterGetBuf (clientData)
+    ClientData clientData;	/* (in) Not used. */
+{
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+	    Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+
+    if (tsdPtr->getBuf != NULL) {
+	ckfree(tsdPtr->getBuf);
+	tsdPtr->getBuf = NULL;
+    }
+}
+
 
 
 /*
@@ -502,14 +1180,195 @@ DpInitPlugIn(interp)
 	if (builtInPlugs[i].name == NULL) {
 	    break;
 	} else {
-	    if (Dp_RegisterPlugInFilter(interp, &builtInPlugs[i]) != TCL_OK) {
+	    if (Dp_RegisterPlugInFilter2(interp, &builtInPlugs[i]) != TCL_OK) {
 		return TCL_ERROR;
 	    }
 	}
     }
 
+#ifdef DP_ZLIB_FILTERS
+    {
+	int major, minor;
+
+	Tcl_GetVersion(&major, &minor, NULL, NULL);
+	if ((major > 8) || ((major == 8) && (minor >= 6))) {
+	    for (i = 0; zlibPlugs[i].name != NULL; i++) {
+		if (Dp_RegisterPlugInFilter2(interp, &zlibPlugs[i]) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+	    }
+	}
+    }
+#endif
+
     return TCL_OK;
 }
 
 
 
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Dp_LoadFilterCmd --
+ *
+ *	This procedure is invoked to process the "dp_loadFilter" Tcl
+ *	command:
+ *
+ *		dp_loadFilter fileName ?prefix?
+ *
+ *	It loads a filter module (see Dp_FilterModule in dp.h) and
+ *	registers its filters.
+ *
+ * Results:
+ *
+ *	A standard Tcl result. The result is the list of the names of
+ *	the new filters.
+ *
+ * Side effects:
+ *
+ *	Loads a shared library, which is never unloaded.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+	/* ARGSUSED */
+int
+Dp_LoadFilterCmd(dummy, interp, argc, argv)
+    ClientData dummy;			/* Not used. */
+    Tcl_Interp *interp;			/* Current interpreter. */
+    int argc;				/* Number of arguments. */
+    CONST84 char **argv;		/* Argument strings. */
+{
+#ifdef DP_LOAD_FILTERS
+    CONST char *symbols[2];
+    CONST char *p;
+    Tcl_DString prefix;
+    Tcl_Obj *pathObj;
+    Tcl_LoadHandle handle;
+    Dp_FilterInitProc *initProc;
+    Dp_FilterModule *modPtr;
+    Dp_PlugInFilter2 *plugInPtr;
+    char version[TCL_INTEGER_SPACE * 2];
+    int major, minor, i, j, code;
+
+    if ((argc != 2) && (argc != 3)) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"",
+		argv[0], " fileName ?prefix?\"", NULL);
+	return TCL_ERROR;
+    }
+    if (Tcl_IsSafe(interp)) {
+	Tcl_AppendResult(interp, "can't load filters in a safe interpreter",
+		NULL);
+	return TCL_ERROR;
+    }
+    Tcl_GetVersion(&major, &minor, NULL, NULL);
+    if ((major == 8) && (minor < 6)) {
+	Tcl_AppendResult(interp, argv[0], " needs Tcl 8.6 or later", NULL);
+	return TCL_ERROR;
+    }
+
+    /*
+     * Work out the name of the entry point. Without a prefix, take the
+     * letters of the file name that follow "lib", as the load command
+     * does.
+     */
+
+    Tcl_DStringInit(&prefix);
+    if (argc == 3) {
+	Tcl_DStringAppend(&prefix, argv[2], -1);
+    } else {
+	p = strrchr(argv[1], '/');
+#ifdef _WIN32
+	if (strrchr(argv[1], '\\') > p) {
+	    p = strrchr(argv[1], '\\');
+	}
+#endif
+	p = (p == NULL) ? argv[1] : p + 1;
+	if (strncmp(p, "lib", 3) == 0) {
+	    p += 3;
+	}
+	for (i = 0; isalpha((unsigned char) p[i]); i++) {
+	    Tcl_DStringAppend(&prefix, p + i, 1);
+	}
+	if (i == 0) {
+	    Tcl_AppendResult(interp, "couldn't figure out prefix for ",
+		    argv[1], NULL);
+	    Tcl_DStringFree(&prefix);
+	    return TCL_ERROR;
+	}
+	Tcl_DStringValue(&prefix)[0] =
+		toupper((unsigned char) Tcl_DStringValue(&prefix)[0]);
+	for (i = 1; i < Tcl_DStringLength(&prefix); i++) {
+	    Tcl_DStringValue(&prefix)[i] =
+		    tolower((unsigned char) Tcl_DStringValue(&prefix)[i]);
+	}
+    }
+    Tcl_DStringAppend(&prefix, "_FilterInit", -1);
+
+    symbols[0] = Tcl_DStringValue(&prefix);
+    symbols[1] = NULL;
+    pathObj = Tcl_NewStringObj(argv[1], -1);
+    Tcl_IncrRefCount(pathObj);
+    code = Tcl_LoadFile(interp, pathObj, symbols, 0, (void *) &initProc,
+	    &handle);
+    Tcl_DecrRefCount(pathObj);
+    Tcl_DStringFree(&prefix);
+    if (code != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    modPtr = (*initProc)(interp, DP_FILTER_MODULE_VERSION);
+    if (modPtr == NULL) {
+	if (*Tcl_GetStringResult(interp) == '\0') {
+	    Tcl_AppendResult(interp, "filter module ", argv[1],
+		    " failed to initialize", NULL);
+	}
+	return TCL_ERROR;
+    }
+    if (modPtr->version != DP_FILTER_MODULE_VERSION) {
+	sprintf(version, "%d, not %d", modPtr->version,
+		DP_FILTER_MODULE_VERSION);
+	Tcl_AppendResult(interp, "filter module ", argv[1],
+		" was built for filter module interface version ", version,
+		NULL);
+	return TCL_ERROR;
+    }
+
+    /*
+     * Register all the filters or none of them. A name may be neither
+     * taken already nor used twice by the module itself.
+     */
+
+    for (i = 0; modPtr->filters[i].name != NULL; i++) {
+	for (j = 0; j < i; j++) {
+	    if (strcmp(modPtr->filters[j].name, modPtr->filters[i].name)
+		    == 0) {
+		Tcl_AppendResult(interp, "filter module ", argv[1],
+			" defines filter \"", modPtr->filters[i].name,
+			"\" twice", NULL);
+		return TCL_ERROR;
+	    }
+	}
+	for (plugInPtr = plugInList; plugInPtr;
+		plugInPtr = plugInPtr->nextPtr) {
+	    if (strcmp(plugInPtr->name, modPtr->filters[i].name) == 0) {
+		Tcl_AppendResult(interp, "Plug-in filter  \"",
+			plugInPtr->name, "\" already exists", NULL);
+		return TCL_ERROR;
+	    }
+	}
+    }
+    for (i = 0; modPtr->filters[i].name != NULL; i++) {
+	if (Dp_RegisterPlugInFilter2(interp, &(modPtr->filters[i]))
+		!= TCL_OK) {
+	    return TCL_ERROR;
+	}
+	Tcl_AppendElement(interp, modPtr->filters[i].name);
+    }
+    return TCL_OK;
+#else
+    Tcl_AppendResult(interp, argv[0], " needs Tcl 8.6 or later", NULL);
+    return TCL_ERROR;
+#endif
+}
@@ -29,6 +29,57 @@
 
 #define	TCL_READ_CHUNK_SIZE	4096
 
+/*
+ * A background "dp_copy -command" stops reading from its input while
+ * any output channel has more than this many bytes queued, so a slow
+ * consumer can't make the process buffer an unbounded amount of data.
+ */
+
+#define	DP_COPY_QUEUE_LIMIT	(64 * 1024)
+
+/*
+ * The default and largest number of datagrams "dp_recvBatch" reads
+ * at once.
+ */
+
+#define	DP_BATCH_DEFAULT	16
+#define	DP_BATCH_MAX		1024
+
+/*
+ * State of one background copy started with "dp_copy -command".
+ */
+
+typedef struct CopyState {
+    Tcl_Interp *interp;		/* Interp to run the callback in. */
+    Tcl_Channel inChan;		/* Channel we read from. */
+    Tcl_Channel *outChans;	/* Channels we write to. */
+    int numOutChans;		/* Number of entries in outChans. */
+    int *blocking;		/* Original -blocking setting of inChan,
+				 * followed by that of each outChan. */
+    int requested;		/* Bytes still to be copied. */
+    int total;			/* Bytes copied so far. */
+    int reading;		/* 1 while we still expect input. */
+    int inMask;			/* Handler mask set on inChan. */
+    int *outMasks;		/* Handler mask set on each outChan. */
+    Tcl_Obj *cmdPtr;		/* Callback prefix. */
+    char *buffer;		/* TCL_READ_CHUNK_SIZE bytes of scratch. */
+} CopyState;
+
+static int		CopyChannelIsRaw _ANSI_ARGS_((Tcl_Channel chan,
+			    int direction));
+static void		CopyStart _ANSI_ARGS_((Tcl_Interp *interp,
+			    Tcl_Channel inChan, Tcl_Channel *outChans,
+			    int numOutChans, int requested,
+			    CONST84 char *command));
+static void		CopyEventProc _ANSI_ARGS_((ClientData clientData,
+			    int mask));
+static void		CopyUpdateHandlers _ANSI_ARGS_((ClientData clientData));
+static int		CopyQueued _ANSI_ARGS_((Tcl_Channel chan));
+static void		CopyFinish _ANSI_ARGS_((CopyState *csPtr,
+			    Tcl_Obj *errorPtr));
+static SocketState *	GetDatagramChannel _ANSI_ARGS_((Tcl_Interp *interp,
+			    CONST84 char *chanName));
+
 
 /*
  *----------------------------------------------------------------------
@@ -156,38 +207,40 @@ Dp_CopyCmd(dummy, interp, argc, argv)
     int requested = INT_MAX;
     char *bufPtr = NULL;
     int actuallyRead, actuallyWritten, totalRead, toReadNow, mode;
-
+    CONST84 char *command = NULL;
 
     /*
-     * 1. Get the optional -size argument.
+     * 1. Get the optional -size and -command arguments.  Channel
+     * names never start with a '-', so stop at the first word that
+     * doesn't look like an option.
      */
 
     m = 1;
-    if (argc > 2) {
-	if (argv[1][0] == '-' && strcmp(argv[1], "-size")==0) {
-	    if (argc == 2) {
-		Tcl_AppendResult(interp, "value missing for \"-size\"", NULL);
-		goto error;
-	    }
-	    if (Tcl_GetInt(interp, argv[2], &requested) != TCL_OK) {
+    while ((m + 1 < argc) && (argv[m][0] == '-')) {
+	if (strcmp(argv[m], "-size") == 0) {
+	    if (Tcl_GetInt(interp, argv[m+1], &requested) != TCL_OK) {
 		goto error;
 	    }
 	    if (requested < 0) {
 		requested = INT_MAX;
 	    }
-
-	    /*
-	     * argv[m] is the in channel and argv[m+1, ...] are the out
-	     * channels.
-	     */
-	    m = 3;
+	} else if (strcmp(argv[m], "-command") == 0) {
+	    command = argv[m+1];
+	} else {
+	    break;
 	}
+	m += 2;
     }
 
+    /*
+     * argv[m] is the in channel and argv[m+1, ...] are the out
+     * channels.
+     */
+
     if (argc-m < 2) {
         Tcl_AppendResult(interp, "wrong # args: should be \"",
-                argv[0], " ?-size size? inChanId outChanId ?outChanId ...?\"",
-		(char *) NULL);
+                argv[0], " ?-size size? ?-command callback? inChanId ",
+		"outChanId ?outChanId ...?\"", (char *) NULL);
 	goto error;
     }
 
@@ -224,7 +277,59 @@ Dp_CopyCmd(dummy, interp, argc, argv)
     }
 
     /*
-     * 4. Copy the data.
+     * 4. With -command, the copy runs in the background from channel
+     * handlers and the callback is told when it's over.
+     */
+
+    if (command != NULL) {
+	CopyStart(interp, inChan, outChans, numOutChans, requested,
+		command);
+	ckfree((char *) outChans);
+	return TCL_OK;
+    }
+
+    /*
+     * 5. If every channel is a plain OS handle in raw blocking mode,
+     * let the platform layer move the data without bringing it up
+     * into user space.  A return value of 0 means nothing was moved
+     * and we should use the generic loop below.
+     */
+
+    totalRead = 0;
+    if (CopyChannelIsRaw(inChan, TCL_READABLE)) {
+	Tcl_Channel errChan;
+	int result;
+
+	for (i=0; i<numOutChans; i++) {
+	    if (!CopyChannelIsRaw(outChans[i], TCL_WRITABLE)) {
+		break;
+	    }
+	}
+	if (i == numOutChans) {
+	    for (i=0; i<numOutChans; i++) {
+		if (Tcl_Flush(outChans[i]) != TCL_OK) {
+		    Tcl_AppendResult(interp, argv[0], ": ",
+			    Tcl_GetChannelName(outChans[i]), " ",
+			    Tcl_PosixError(interp), (char *) NULL);
+		    goto error;
+		}
+	    }
+	    result = DppCopyChannels(inChan, outChans, numOutChans,
+		    requested, &totalRead, &errChan);
+	    if (result < 0) {
+		Tcl_AppendResult(interp, argv[0], ": ",
+			Tcl_GetChannelName(errChan), " ",
+			Tcl_PosixError(interp), (char *) NULL);
+		goto error;
+	    }
+	    if (result > 0) {
+		goto done;
+	    }
+	}
+    }
+
+    /*
+     * 6. Copy the data.
      */
 
     bufPtr = ckalloc((unsigned) TCL_READ_CHUNK_SIZE);
@@ -280,6 +385,411 @@ error:
     return TCL_ERROR;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * CopyStart --
+ *
+ *	Sets up a background copy for "dp_copy -command".  All the
+ *	channels are put in non-blocking mode and the copy then runs
+ *	from channel handlers.  The output channels' own Tcl buffers,
+ *	plus the send queue of DP's TCP driver, act as the per-output
+ *	queues; while any of them holds more than DP_COPY_QUEUE_LIMIT
+ *	bytes we wait for it to drain instead of reading more input.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Channel handlers are created and the channels are registered
+ *	so they can't go away while the copy is in progress.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CopyStart(interp, inChan, outChans, numOutChans, requested, command)
+    Tcl_Interp *interp;			/* Interp for the callback. */
+    Tcl_Channel inChan;			/* Channel to read from. */
+    Tcl_Channel *outChans;		/* Channels to write to. */
+    int numOutChans;			/* Number of entries in outChans. */
+    int requested;			/* Max number of bytes to copy. */
+    CONST84 char *command;		/* Completion callback. */
+{
+    CopyState *csPtr;
+    Tcl_DString ds;
+    int i;
+
+    csPtr = (CopyState *) ckalloc(sizeof(CopyState));
+    csPtr->interp = interp;
+    csPtr->inChan = inChan;
+    csPtr->numOutChans = numOutChans;
+    csPtr->outChans = (Tcl_Channel *)
+	    ckalloc(sizeof(Tcl_Channel) * numOutChans);
+    csPtr->blocking = (int *) ckalloc(sizeof(int) * (numOutChans + 1));
+    csPtr->outMasks = (int *) ckalloc(sizeof(int) * numOutChans);
+    csPtr->requested = requested;
+    csPtr->total = 0;
+    csPtr->reading = 1;
+    csPtr->inMask = 0;
+    csPtr->cmdPtr = Tcl_NewStringObj(command, -1);
+    Tcl_IncrRefCount(csPtr->cmdPtr);
+    csPtr->buffer = ckalloc((unsigned) TCL_READ_CHUNK_SIZE);
+
+    for (i = 0; i <= numOutChans; i++) {
+	Tcl_Channel chan = (i == 0) ? inChan : outChans[i-1];
+
+	if (i > 0) {
+	    csPtr->outChans[i-1] = chan;
+	    csPtr->outMasks[i-1] = 0;
+	}
+	Tcl_RegisterChannel((Tcl_Interp *) NULL, chan);
+	Tcl_DStringInit(&ds);
+	Tcl_GetChannelOption((Tcl_Interp *) NULL, chan, "-blocking", &ds);
+	csPtr->blocking[i] = (strcmp(Tcl_DStringValue(&ds), "0") != 0);
+	Tcl_DStringFree(&ds);
+	Tcl_SetChannelOption((Tcl_Interp *) NULL, chan, "-blocking", "0");
+    }
+    Tcl_Preserve((ClientData) interp);
+
+    /*
+     * Don't start until the dp_copy command has returned, so the
+     * callback can never run before its caller has seen the result.
+     */
+
+    if (requested == 0) {
+	csPtr->reading = 0;
+    }
+    Tcl_DoWhenIdle(CopyUpdateHandlers, (ClientData) csPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CopyQueued --
+ *
+ *	Counts the output a background copy has handed to a channel
+ *	that hasn't gone out yet: what Tcl has buffered and, for a DP
+ *	TCP channel, what the driver keeps in its send queue.
+ *
+ * Results:
+ *	The number of bytes.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CopyQueued(chan)
+    Tcl_Channel chan;			/* Output channel of the copy. */
+{
+    return Tcl_OutputBuffered(chan) + DpTcpQueued(chan);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CopyUpdateHandlers --
+ *
+ *	Works out what a background copy is waiting for and sets the
+ *	channel handlers to match: readable on the input while every
+ *	output has room, writable on each output that has data queued.
+ *	Once all input has been read and all outputs have drained, the
+ *	copy is finished.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Creates and deletes channel handlers; may call CopyFinish.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CopyUpdateHandlers(clientData)
+    ClientData clientData;		/* CopyState of the copy. */
+{
+    CopyState *csPtr = (CopyState *) clientData;
+    int i, mask, full, pending;
+
+    full = 0;
+    pending = 0;
+    for (i = 0; i < csPtr->numOutChans; i++) {
+	int queued = CopyQueued(csPtr->outChans[i]);
+
+	if (queued > 0) {
+	    pending = 1;
+	}
+	if (queued > DP_COPY_QUEUE_LIMIT) {
+	    full = 1;
+	}
+	mask = (queued > 0) ? TCL_WRITABLE : 0;
+	if (mask != csPtr->outMasks[i]) {
+	    if (csPtr->outMasks[i]) {
+		Tcl_DeleteChannelHandler(csPtr->outChans[i], CopyEventProc,
+			(ClientData) csPtr);
+	    }
+	    if (mask) {
+		Tcl_CreateChannelHandler(csPtr->outChans[i], mask,
+			CopyEventProc, (ClientData) csPtr);
+	    }
+	    csPtr->outMasks[i] = mask;
+	}
+    }
+
+    mask = (csPtr->reading && !full) ? TCL_READABLE : 0;
+    if (mask != csPtr->inMask) {
+	if (csPtr->inMask) {
+	    Tcl_DeleteChannelHandler(csPtr->inChan, CopyEventProc,
+		    (ClientData) csPtr);
+	}
+	if (mask) {
+	    Tcl_CreateChannelHandler(csPtr->inChan, mask, CopyEventProc,
+		    (ClientData) csPtr);
+	}
+	csPtr->inMask = mask;
+    }
+
+    if (!csPtr->reading && !pending) {
+	CopyFinish(csPtr, (Tcl_Obj *) NULL);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CopyEventProc --
+ *
+ *	Channel handler for a background copy.  Moves whatever input
+ *	is available (up to DP_COPY_QUEUE_LIMIT bytes per event, so
+ *	that many concurrent copies share the event loop fairly) to
+ *	every output channel.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Reads and writes the channels; may finish the copy.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CopyEventProc(clientData, mask)
+    ClientData clientData;		/* CopyState of the copy. */
+    int mask;				/* Not used. */
+{
+    CopyState *csPtr = (CopyState *) clientData;
+    Tcl_Obj *errorPtr;
+    int i, n, toRead, moved;
+
+    moved = 0;
+    while (csPtr->reading && (moved < DP_COPY_QUEUE_LIMIT)) {
+	for (i = 0; i < csPtr->numOutChans; i++) {
+	    if (CopyQueued(csPtr->outChans[i]) > DP_COPY_QUEUE_LIMIT) {
+		break;
+	    }
+	}
+	if (i < csPtr->numOutChans) {
+	    break;
+	}
+
+	toRead = csPtr->requested;
+	if (toRead > TCL_READ_CHUNK_SIZE) {
+	    toRead = TCL_READ_CHUNK_SIZE;
+	}
+	n = Tcl_Read(csPtr->inChan, csPtr->buffer, toRead);
+	if ((n < 0) && (Tcl_GetErrno() == EAGAIN)) {
+	    n = 0;
+	}
+	if (n < 0) {
+	    errorPtr = Tcl_NewStringObj("error reading \"", -1);
+	    Tcl_AppendStringsToObj(errorPtr,
+		    Tcl_GetChannelName(csPtr->inChan), "\": ",
+		    Tcl_ErrnoMsg(Tcl_GetErrno()), (char *) NULL);
+	    CopyFinish(csPtr, errorPtr);
+	    return;
+	}
+	if (n == 0) {
+	    if (Tcl_Eof(csPtr->inChan)) {
+		csPtr->reading = 0;
+	    }
+	    break;
+	}
+	for (i = 0; i < csPtr->numOutChans; i++) {
+	    if ((Tcl_Write(csPtr->outChans[i], csPtr->buffer, n) < 0)
+		    || (Tcl_Flush(csPtr->outChans[i]) != TCL_OK)) {
+		errorPtr = Tcl_NewStringObj("error writing \"", -1);
+		Tcl_AppendStringsToObj(errorPtr,
+			Tcl_GetChannelName(csPtr->outChans[i]), "\": ",
+			Tcl_ErrnoMsg(Tcl_GetErrno()), (char *) NULL);
+		CopyFinish(csPtr, errorPtr);
+		return;
+	    }
+	}
+	moved += n;
+	csPtr->total += n;
+	csPtr->requested -= n;
+	if (csPtr->requested == 0) {
+	    csPtr->reading = 0;
+	}
+    }
+    CopyUpdateHandlers((ClientData) csPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CopyFinish --
+ *
+ *	Ends a background copy: removes the channel handlers, restores
+ *	the channels' blocking modes and calls the callback with the
+ *	byte count and, if the copy failed, the error message.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees the CopyState and evaluates the callback at global level.
+ *	Errors in the callback are reported with Tcl_BackgroundError.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CopyFinish(csPtr, errorPtr)
+    CopyState *csPtr;
+    Tcl_Obj *errorPtr;			/* Error message, or NULL. */
+{
+    Tcl_Interp *interp = csPtr->interp;
+    Tcl_Obj *cmdPtr;
+    int i;
+
+    if (csPtr->inMask) {
+	Tcl_DeleteChannelHandler(csPtr->inChan, CopyEventProc,
+		(ClientData) csPtr);
+    }
+    for (i = 0; i < csPtr->numOutChans; i++) {
+	if (csPtr->outMasks[i]) {
+	    Tcl_DeleteChannelHandler(csPtr->outChans[i], CopyEventProc,
+		    (ClientData) csPtr);
+	}
+    }
+    for (i = 0; i <= csPtr->numOutChans; i++) {
+	Tcl_Channel chan = (i == 0) ? csPtr->inChan : csPtr->outChans[i-1];
+
+	if (csPtr->blocking[i]) {
+	    Tcl_SetChannelOption((Tcl_Interp *) NULL, chan, "-blocking", "1");
+	}
+	Tcl_UnregisterChannel((Tcl_Interp *) NULL, chan);
+    }
+
+    cmdPtr = Tcl_DuplicateObj(csPtr->cmdPtr);
+    Tcl_IncrRefCount(cmdPtr);
+    Tcl_ListObjAppendElement(interp, cmdPtr, Tcl_NewIntObj(csPtr->total));
+    if (errorPtr != NULL) {
+	Tcl_ListObjAppendElement(interp, cmdPtr, errorPtr);
+    }
+
+    Tcl_DecrRefCount(csPtr->cmdPtr);
+    ckfree(csPtr->buffer);
+    ckfree((char *) csPtr->outMasks);
+    ckfree((char *) csPtr->blocking);
+    ckfree((char *) csPtr->outChans);
+    ckfree((char *) csPtr);
+
+    if (!Tcl_InterpDeleted(interp)) {
+	if (Tcl_EvalObjEx(interp, cmdPtr, TCL_EVAL_GLOBAL) != TCL_OK) {
+	    Tcl_BackgroundError(interp);
+	}
+    }
+    Tcl_DecrRefCount(cmdPtr);
+    Tcl_Release((ClientData) interp);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CopyChannelIsRaw --
+ *
+ *	Decides whether dp_copy may bypass the Tcl I/O layer for the
+ *	given channel.  This is only the case for unstacked file, pipe
+ *	and TCP channels in blocking mode that do no end-of-line or
+ *	end-of-file character translation and, when reading, have
+ *	no data sitting in the Tcl buffers.
+ *
+ * Results:
+ *	1 if the channel's OS handle may be used directly, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CopyChannelIsRaw(chan, direction)
+    Tcl_Channel chan;			/* Channel to check. */
+    int direction;			/* TCL_READABLE or TCL_WRITABLE. */
+{
+    static CONST char *rawTypes[] = {"file", "pipe", "tcp", NULL};
+    static CONST char *options[] = {"-blocking", "-translation",
+	    "-eofchar", NULL};
+    static CONST char *wanted[] = {"1", "lf", ""};
+    CONST char *typeName;
+    CONST84 char **valueArgv;
+    Tcl_DString ds;
+    int i, valueArgc, raw;
+
+    if ((Tcl_GetStackedChannel(chan) != NULL)
+	    || (Tcl_GetTopChannel(chan) != chan)) {
+	return 0;
+    }
+    typeName = Tcl_ChannelName(Tcl_GetChannelType(chan));
+    for (i = 0; rawTypes[i] != NULL; i++) {
+	if (strcmp(typeName, rawTypes[i]) == 0) {
+	    break;
+	}
+    }
+    if (rawTypes[i] == NULL) {
+	return 0;
+    }
+    if ((direction == TCL_READABLE)
+	    && ((Tcl_InputBuffered(chan) != 0) || Tcl_Eof(chan))) {
+	return 0;
+    }
+
+    /*
+     * Channels open for both reading and writing report -translation
+     * and -eofchar as a two element list {input output}.
+     */
+
+    raw = 1;
+    for (i = 0; raw && (options[i] != NULL); i++) {
+	Tcl_DStringInit(&ds);
+	if ((Tcl_GetChannelOption(NULL, chan, options[i], &ds) != TCL_OK)
+		|| (Tcl_SplitList(NULL, Tcl_DStringValue(&ds), &valueArgc,
+			&valueArgv) != TCL_OK)) {
+	    Tcl_DStringFree(&ds);
+	    return 0;
+	}
+	if (valueArgc == 2) {
+	    raw = (strcmp(valueArgv[(direction == TCL_READABLE) ? 0 : 1],
+		    wanted[i]) == 0);
+	} else if (valueArgc == 1) {
+	    raw = (strcmp(valueArgv[0], wanted[i]) == 0);
+	} else {
+	    raw = (wanted[i][0] == '\0');
+	}
+	ckfree((char *) valueArgv);
+	Tcl_DStringFree(&ds);
+    }
+    return raw;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -319,30 +829,26 @@ Dp_NetInfoCmd(dummy, interp, argc, argv)
 	     * Get the service entry for service name or port number
 	     */
 	    if (strcmp(argv[1], "-service") == 0) {
-		struct servent *serviceEntry = NULL;
+		Tcl_DString name;
 		char port[10];
 		int portNum;
 		/*
-		 * First try argv[2] as a name
+		 * Try argv[2] as a name, then as a port number.  The
+		 * answer comes from the resolver cache if we've seen
+		 * this service recently.
 		 */
-		serviceEntry = getservbyname(argv[2], (char *) NULL);
-		if (serviceEntry == NULL) {
-		    /*
-		     * Now try argv[2] as a port number
-		     */
-		    portNum = atoi(argv[2]);
-		    serviceEntry = getservbyport(htons((unsigned short)portNum),
-					(char *) NULL);
-		    if (serviceEntry == NULL) {
-			Tcl_AppendResult(interp, argv[0],
-				" -service unknown service/port# \"",
-				argv[2], "\"", (char *) NULL);
-			return TCL_ERROR;
-		    }
+		Tcl_DStringInit(&name);
+		if (!DpGetService(argv[2], &name, &portNum)) {
+		    Tcl_DStringFree(&name);
+		    Tcl_AppendResult(interp, argv[0],
+			    " -service unknown service/port# \"",
+			    argv[2], "\"", (char *) NULL);
+		    return TCL_ERROR;
 		}
-		sprintf(port, "%4d", ntohs(serviceEntry->s_port));
-		Tcl_AppendResult(interp, serviceEntry->s_name, " ", port, " ",
-				(char *) NULL);
+		sprintf(port, "%4d", portNum);
+		Tcl_AppendResult(interp, Tcl_DStringValue(&name), " ", port,
+				" ", (char *) NULL);
+		Tcl_DStringFree(&name);
 		return TCL_OK;
 	    }
 	}
@@ -404,7 +910,10 @@ Dp_NetInfoCmd(dummy, interp, argc, argv)
  *
  *    Returns
  *
- *	TCL_OK with the amount sent or TCL_ERROR.
+ *	TCL_OK with the amount sent (or queued, for a
+ *	non-blocking TCP channel), which is less than the
+ *	length of the string if a non-blocking channel
+ *	fills up, or TCL_ERROR.
  *
  *    Side Effects
  *
@@ -422,7 +931,7 @@ Dp_SendCmd(dummy, interp, argc, argv)
 {
     Tcl_Channel chan;
     char writ[10];
-    int errorCode = 0, toWrite, written = 0, mode;
+    int errorCode = 0, toWrite, written = 0, mode, result;
 
     if (argc != 3) {
 	Tcl_AppendResult(interp, "wrong # args: should be \"",
@@ -436,20 +945,30 @@ Dp_SendCmd(dummy, interp, argc, argv)
 
     toWrite = strlen(argv[2]);
 
+    /*
+     * A short write is retried, but if the channel is non-blocking
+     * and the device can't take any more we stop and return what
+     * was sent so far instead of spinning.  The TCP driver queues
+     * what it can't send right away, but only up to a limit.
+     */
+
     while (toWrite > written) {
-	written += (Tcl_GetChannelType(chan)->outputProc)
+	result = (Tcl_GetChannelType(chan)->outputProc)
 		(Tcl_GetChannelInstanceData(chan), argv[2] + written,
 		toWrite - written, &errorCode);
-	if (errorCode > 0) {
+	if (result < 0) {
+	    if ((errorCode == EAGAIN) || (errorCode == EWOULDBLOCK)) {
+		errorCode = 0;
+	    } else if (errorCode == 0) {
+		errorCode = EIO;
+	    }
 	    break;
 	}
+	written += result;
     }
 
     if (errorCode > 0) {
-	/*
-	 * Translate error code to POSIX
-	 */
-	DppGetErrno();
+	Tcl_SetErrno(errorCode);
         Tcl_AppendResult(interp, "Error sending on channel \"", argv[1], "\":",
 		Tcl_PosixError(interp), (char *)NULL);
 	return TCL_ERROR;
@@ -536,4 +1055,327 @@ Dp_RecvCmd(dummy, interp, argc, argv)
     return TCL_OK;
 }
 
+/* ----------------------------------------------------
+ *
+ *    GetDatagramChannel --
+ *
+ *	Looks up a channel for dp_sendBatch and dp_recvBatch,
+ *	which only work on UDP and IPM channels.
+ *
+ *    Returns
+ *
+ *	The channel's socket state, or NULL with an error
+ *	message in interp.
+ *
+ *    Side Effects
+ *
+ *	None.
+ *
+ * -----------------------------------------------------
+ */
+
+static SocketState *
+GetDatagramChannel(interp, chanName)
+    Tcl_Interp *interp;			/* For error reporting. */
+    CONST84 char *chanName;		/* Name of the channel. */
+{
+    Tcl_Channel chan;
+    int mode;
+
+    if ((chan = Tcl_GetChannel(interp, chanName, &mode)) == NULL) {
+	return NULL;
+    }
+    if (!DpIsUdpChannel(chan) && !DpIsIpmChannel(chan)) {
+	Tcl_AppendResult(interp, "channel \"", chanName,
+		"\" is not a udp or ipm channel", (char *) NULL);
+	return NULL;
+    }
+    return (SocketState *) Tcl_GetChannelInstanceData(chan);
+}
+
+/* ----------------------------------------------------
+ *
+ *    Dp_RecvBatchCmd --
+ *
+ *	Implements "dp_recvBatch channelId ?-max count?",
+ *	which reads up to count datagrams from a UDP or IPM
+ *	channel in one system call, bypassing the Tcl I/O
+ *	subsystem like dp_recv.
+ *
+ *    Returns
+ *
+ *	TCL_OK with a list of {payload {host port}} pairs,
+ *	empty if the channel is non-blocking and nothing was
+ *	waiting, or TCL_ERROR.
+ *
+ *    Side Effects
+ *
+ *	The channel is read.
+ *
+ * -----------------------------------------------------
+ */
+
+int
+Dp_RecvBatchCmd(dummy, interp, argc, argv)
+    ClientData dummy;			/* Not used. */
+    Tcl_Interp *interp;			/* Current interpreter. */
+    int argc;				/* Number of arguments. */
+    CONST84 char **argv;		/* Argument strings. */
+{
+    SocketState *statePtr;
+    Tcl_Obj *listPtr;
+    int errorCode = 0, maxMsgs = DP_BATCH_DEFAULT;
+
+    if (((argc != 2) && (argc != 4))
+	    || ((argc == 4) && (strcmp(argv[2], "-max") != 0))) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"",
+		argv[0], " channelId ?-max count?\"", NULL);
+	return TCL_ERROR;
+    }
+    if (argc == 4) {
+	if (Tcl_GetInt(interp, argv[3], &maxMsgs) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	if ((maxMsgs <= 0) || (maxMsgs > DP_BATCH_MAX)) {
+	    Tcl_AppendResult(interp, "-max must be between 1 and 1024",
+		    (char *) NULL);
+	    return TCL_ERROR;
+	}
+    }
+
+    if ((statePtr = GetDatagramChannel(interp, argv[1])) == NULL) {
+	return TCL_ERROR;
+    }
+
+    listPtr = Tcl_NewObj();
+    if (DppRecvBatch(statePtr, maxMsgs, listPtr, &errorCode) < 0) {
+	if ((errorCode != EAGAIN) && (errorCode != EWOULDBLOCK)) {
+	    Tcl_DecrRefCount(listPtr);
+	    Tcl_SetErrno(errorCode);
+	    Tcl_AppendResult(interp, "Error receiving on channel \"", argv[1],
+		    "\":", Tcl_PosixError(interp), (char *)NULL);
+	    return TCL_ERROR;
+	}
+    }
+    Tcl_SetObjResult(interp, listPtr);
+    return TCL_OK;
+}
+
+/* ----------------------------------------------------
+ *
+ *    Dp_RecvFromCmd --
+ *
+ *	Implements "dp_recvfrom channelId", which reads one
+ *	datagram from a UDP or IPM channel like dp_recv and
+ *	returns it together with its sender.  On a UDP channel
+ *	with -fragment on it returns a whole message.  The {host port}
+ *	object is shared with the channel and reused while the
+ *	sender stays the same.  With -timestamps or -sendStamp on,
+ *	the receive and send times follow, in ns since the epoch.
+ *
+ *    Returns
+ *
+ *	TCL_OK with a {payload {host port}} list, or a
+ *	{payload {host port} recvNs sendNs} list, empty if the
+ *	channel is non-blocking and nothing was waiting, or
+ *	TCL_ERROR.
+ *
+ *    Side Effects
+ *
+ *	The channel is read.
+ *
+ * -----------------------------------------------------
+ */
+
+int
+Dp_RecvFromCmd(dummy, interp, argc, argv)
+    ClientData dummy;			/* Not used. */
+    Tcl_Interp *interp;			/* Current interpreter. */
+    int argc;				/* Number of arguments. */
+    CONST84 char **argv;		/* Argument strings. */
+{
+    SocketState *statePtr;
+    Tcl_Obj *pair[4];
+    int errorCode = 0, nread, n, numElems;
+
+    if (argc != 2) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"",
+		argv[0], " channelId\"", NULL);
+	return TCL_ERROR;
+    }
+    if ((statePtr = GetDatagramChannel(interp, argv[1])) == NULL) {
+	return TCL_ERROR;
+    }
+
+    /*
+     * Read straight into the result object.
+     */
+
+    pair[0] = Tcl_NewObj();
+    nread = (Tcl_GetChannelType(statePtr->channel)->inputProc)
+	    ((ClientData) statePtr,
+	    (char *) Tcl_SetByteArrayLength(pair[0], DP_DATAGRAM_MAX),
+	    DP_DATAGRAM_MAX, &errorCode);
+    if (nread < 0) {
+	Tcl_DecrRefCount(pair[0]);
+	if ((errorCode == EAGAIN) || (errorCode == EWOULDBLOCK)) {
+	    return TCL_OK;
+	}
+	Tcl_SetErrno(errorCode);
+	Tcl_AppendResult(interp, "Error receiving on channel \"", argv[1],
+		"\":", Tcl_PosixError(interp), (char *)NULL);
+	return TCL_ERROR;
+    }
+
+    /*
+     * A -fragment channel may hold a message bigger than one read;
+     * fetch the rest of it.
+     */
+
+    while (statePtr->messageLeft > 0) {
+	int more = statePtr->messageLeft;
+
+	n = (Tcl_GetChannelType(statePtr->channel)->inputProc)
+		((ClientData) statePtr,
+		(char *) Tcl_SetByteArrayLength(pair[0], nread + more) + nread,
+		more, &errorCode);
+	if (n <= 0) {
+	    break;
+	}
+	nread += n;
+    }
+    Tcl_SetByteArrayLength(pair[0], nread);
+    pair[1] = statePtr->fromObj;
+    numElems = 2;
+    if (statePtr->flags & (SOCKET_TIMESTAMPS|SOCKET_SENDSTAMP)) {
+	pair[2] = Tcl_NewWideIntObj(statePtr->recvStamp);
+	pair[3] = Tcl_NewWideIntObj(statePtr->sendStamp);
+	numElems = 4;
+    }
+    Tcl_SetObjResult(interp, Tcl_NewListObj(numElems, pair));
+    return TCL_OK;
+}
+
+/* ----------------------------------------------------
+ *
+ *    Dp_SendBatchCmd --
+ *
+ *	Implements "dp_sendBatch channelId {dest payload} ...",
+ *	which sends each payload as a datagram to dest, a
+ *	{host port} list, in one system call.  An empty dest
+ *	means the channel's own -host and -port.  Payloads are
+ *	taken as byte arrays, so binary data goes out as is,
+ *	the way dp_recvBatch returns it.
+ *
+ *    Returns
+ *
+ *	TCL_OK with the number of datagrams sent (fewer than
+ *	given if a non-blocking channel filled up) or
+ *	TCL_ERROR.
+ *
+ *    Side Effects
+ *
+ *	The channel is written to.
+ *
+ * -----------------------------------------------------
+ */
+
+int
+Dp_SendBatchCmd(dummy, interp, objc, objv)
+    ClientData dummy;			/* Not used. */
+    Tcl_Interp *interp;			/* Current interpreter. */
+    int objc;				/* Number of arguments. */
+    Tcl_Obj *CONST objv[];		/* Argument objects. */
+{
+    SocketState *statePtr;
+    DpSocketAddressIP *addrs;
+    CONST84 char **bufs;
+    int *lengths;
+    int i, numMsgs, msgObjc, destObjc, ipAddr, port, sent;
+    int errorCode = 0, result = TCL_ERROR;
+    Tcl_Obj **msgObjv, **destObjv, *payloadPtr;
+
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "channelId ?{dest payload} ...?");
+	return TCL_ERROR;
+    }
+    if ((statePtr = GetDatagramChannel(interp, Tcl_GetString(objv[1])))
+	    == NULL) {
+	return TCL_ERROR;
+    }
+
+    numMsgs = objc - 2;
+    addrs = (DpSocketAddressIP *)
+	    ckalloc((unsigned) (numMsgs + 1) * sizeof(DpSocketAddressIP));
+    bufs = (CONST84 char **)
+	    ckalloc((unsigned) (numMsgs + 1) * sizeof(char *));
+    lengths = (int *) ckalloc((unsigned) (numMsgs + 1) * sizeof(int));
+    memset((char *) addrs, 0, (numMsgs + 1) * sizeof(DpSocketAddressIP));
 
+    /*
+     * The destinations are all parsed before any payload is turned
+     * into a byte array, so that an object used as both can't pull
+     * the bytes out from under us.
+     */
+
+    for (i = 0; i < numMsgs; i++) {
+	if (Tcl_ListObjGetElements(interp, objv[i + 2], &msgObjc, &msgObjv)
+		!= TCL_OK) {
+	    goto done;
+	}
+	if (msgObjc != 2) {
+	    Tcl_AppendResult(interp, "bad datagram \"",
+		    Tcl_GetString(objv[i + 2]),
+		    "\": should be {dest payload}", (char *) NULL);
+	    goto done;
+	}
+	if (Tcl_ListObjGetElements(interp, msgObjv[0], &destObjc, &destObjv)
+		!= TCL_OK) {
+	    goto done;
+	}
+	if (destObjc == 0) {
+	    addrs[i] = statePtr->sockaddr;
+	    continue;
+	}
+	if ((destObjc != 2)
+		|| !DpHostToIpAddr(Tcl_GetString(destObjv[0]), &ipAddr)
+		|| (Tcl_GetIntFromObj(NULL, destObjv[1], &port) != TCL_OK)) {
+	    Tcl_AppendResult(interp, "bad destination \"",
+		    Tcl_GetString(msgObjv[0]),
+		    "\": should be {host port}", (char *) NULL);
+	    goto done;
+	}
+	addrs[i].sin_family = AF_INET;
+	addrs[i].sin_addr.s_addr = htonl(ipAddr);
+	addrs[i].sin_port = htons((unsigned short) port);
+    }
+    for (i = 0; i < numMsgs; i++) {
+	Tcl_ListObjIndex(NULL, objv[i + 2], 1, &payloadPtr);
+	bufs[i] = (CONST84 char *)
+		Tcl_GetByteArrayFromObj(payloadPtr, &lengths[i]);
+    }
+
+    sent = 0;
+    if (numMsgs > 0) {
+	sent = DppSendBatch(statePtr, numMsgs, addrs, bufs, lengths,
+		&errorCode);
+    }
+    if (sent < 0) {
+	if ((errorCode != EAGAIN) && (errorCode != EWOULDBLOCK)) {
+	    Tcl_SetErrno(errorCode);
+	    Tcl_AppendResult(interp, "Error sending on channel \"",
+		    Tcl_GetString(objv[1]), "\":", Tcl_PosixError(interp),
+		    (char *)NULL);
+	    goto done;
+	}
+	sent = 0;
+    }
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(sent));
+    result = TCL_OK;
+
+done:
+    ckfree((char *) lengths);
+    ckfree((char *) bufs);
+    ckfree((char *) addrs);
+    return result;
+}
@@ -0,0 +1,902 @@
+/*
+ * generic/dpFilterKernels.c --
+ *
+ * This file contains the inner loops of the xor, hexin/hexout,
+ * uuencode/uudecode and checksumon/checksumoff plug-in filters. Each loop
+ * has a portable version and, on x86 processors with gcc or clang,
+ * versions that use the SSE2, SSSE3, SSE4.2 or AVX2 instructions. The fastest version the processor supports
+ * is picked by DpFilterKernels, which Dp_Init calls once, before any filter
+ * or filter thread can run; the kernels and their tables are read-only
+ * after that.
+ *
+ * The functions in this file do not call Tcl, so that they can also be
+ * linked into the filter benchmark (bench/dpFilterBench.c).
+ */
+
+#include <string.h>
+#include "generic/dpInt.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DP_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+typedef void (XorProc) _ANSI_ARGS_((unsigned char *to,
+	CONST unsigned char *from, int length, CONST unsigned char *stream,
+	int period, int *posPtr));
+typedef void (HexEncodeProc) _ANSI_ARGS_((unsigned char *to,
+	CONST unsigned char *from, int length));
+typedef int (HexDecodeProc) _ANSI_ARGS_((unsigned char *to,
+	CONST unsigned char *from, int pairs));
+typedef void (UuProc) _ANSI_ARGS_((unsigned char *to,
+	CONST unsigned char *from, int groups));
+typedef unsigned int (CrcProc) _ANSI_ARGS_((unsigned int crc,
+	CONST unsigned char *from, int length));
+
+/*
+ * One set of kernels. The entries of a set are the fastest versions that
+ * run on processors that have the named instructions.
+ */
+
+typedef struct {
+    CONST char	  *name;	/* Name of the set, e.g. "avx2". */
+    int		   feature;	/* DP_CPU_* bit the set needs. */
+    XorProc	  *xorProc;
+    HexEncodeProc *hexEncodeProc;
+    HexDecodeProc *hexDecodeProc;
+    UuProc	  *uuencodeProc;
+    UuProc	  *uudecodeProc;
+    CrcProc	  *crc32cProc;
+} KernelSet;
+
+#define DP_CPU_SSE2	(1<<0)
+#define DP_CPU_SSSE3	(1<<1)
+#define DP_CPU_AVX2	(1<<2)
+#define DP_CPU_SSE42	(1<<3)
+
+static XorProc		XorScalar;
+static HexEncodeProc	HexEncodeScalar;
+static HexDecodeProc	HexDecodeScalar;
+static UuProc		UuencodeScalar;
+static UuProc		UudecodeScalar;
+static CrcProc		Crc32cScalar;
+
+#ifdef DP_X86_KERNELS
+static XorProc		XorSse2;
+static XorProc		XorAvx2;
+static HexEncodeProc	HexEncodeSse2;
+static HexEncodeProc	HexEncodeAvx2;
+static HexDecodeProc	HexDecodeSse2;
+static HexDecodeProc	HexDecodeAvx2;
+static UuProc		UuencodeSsse3;
+static UuProc		UudecodeSsse3;
+static CrcProc		Crc32cSse42;
+#endif
+
+/*
+ * The sets, slowest first.
+ */
+
+static KernelSet kernelSets[] = {
+    {"scalar", 0, XorScalar, HexEncodeScalar, HexDecodeScalar,
+	    UuencodeScalar, UudecodeScalar, Crc32cScalar},
+#ifdef DP_X86_KERNELS
+    {"sse2", DP_CPU_SSE2, XorSse2, HexEncodeSse2, HexDecodeSse2,
+	    UuencodeScalar, UudecodeScalar, Crc32cScalar},
+    {"ssse3", DP_CPU_SSE2|DP_CPU_SSSE3, XorSse2, HexEncodeSse2,
+	    HexDecodeSse2, UuencodeSsse3, UudecodeSsse3, Crc32cScalar},
+    {"sse42", DP_CPU_SSE2|DP_CPU_SSSE3|DP_CPU_SSE42, XorSse2, HexEncodeSse2,
+	    HexDecodeSse2, UuencodeSsse3, UudecodeSsse3, Crc32cSse42},
+    {"avx2", DP_CPU_SSE2|DP_CPU_SSSE3|DP_CPU_SSE42|DP_CPU_AVX2, XorAvx2,
+	    HexEncodeAvx2, HexDecodeAvx2, UuencodeSsse3, UudecodeSsse3,
+	    Crc32cSse42},
+#endif
+    {NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+static KernelSet *kernels = NULL;
+
+/*
+ * Tables for the portable hex loops. hexPairs holds the two digits for
+ * every byte value, hexValues the value of every digit, or -1.
+ */
+
+static char hexPairs[512];
+static signed char hexValues[256];
+
+/*
+ * Tables for the portable CRC32C loop, which handles 8 bytes per step
+ * ("slice by 8"). crcTables[0] is the usual byte at a time table.
+ */
+
+#define DP_CRC32C_POLY	0x82F63B78	/* Castagnoli, bits reversed. */
+
+static unsigned int crcTables[8][256];
+
+static int	CpuFeatures _ANSI_ARGS_((void));
+static void	InitTables _ANSI_ARGS_((void));
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DpFilterKernels --
+ *
+ *	Selects the set of filter kernels to use. With a NULL name, the
+ *	fastest set the processor supports is selected. Otherwise name is
+ *	one of "scalar", "sse2", "ssse3", "sse42" or "avx2".
+ *
+ * Results:
+ *
+ *	The name of the selected set, or NULL if the named set is unknown
+ *	or the processor does not support it (in which case the selection
+ *	is left alone).
+ *
+ * Side effects:
+ *
+ *	Builds the tables of the portable kernels. Changes the kernels
+ *	used by the filters of every channel. It must not be called while
+ *	a filter may be running on another thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+CONST char *
+DpFilterKernels (name)
+    CONST char *name;		/* (in) Set to select, or NULL. */
+{
+    KernelSet *setPtr, *bestPtr;
+    int features;
+
+    InitTables();
+    features = CpuFeatures();
+
+    bestPtr = NULL;
+    for (setPtr = kernelSets; setPtr->name != NULL; setPtr++) {
+	if ((setPtr->feature & features) != setPtr->feature) {
+	    continue;
+	}
+	if (name == NULL) {
+	    bestPtr = setPtr;
+	} else if (strcmp(name, setPtr->name) == 0) {
+	    bestPtr = setPtr;
+	    break;
+	}
+    }
+    if (bestPtr == NULL) {
+	return NULL;
+    }
+    kernels = bestPtr;
+    return kernels->name;
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DpXorBytes --
+ *
+ *	Xors length bytes with a repeating key. stream holds the key of
+ *	period bytes, followed by its first DP_XOR_STREAM_PAD bytes again
+ *	(repeated as many times as needed), so that the key can be read in
+ *	blocks from any position without wrapping around.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	Stores the result in to and the next position in the key in
+ *	*posPtr.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+DpXorBytes (to, from, length, stream, period, posPtr)
+    unsigned char *to;		/* (out) Result; may be the same as from. */
+    CONST unsigned char *from;	/* (in) Data to xor. */
+    int length;			/* (in) Number of bytes. */
+    CONST unsigned char *stream;/* (in) Expanded key. */
+    int period;			/* (in) Length of the key. */
+    int *posPtr;		/* (in/out) Position in the key. */
+{
+    (kernels->xorProc) (to, from, length, stream, period, posPtr);
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DpHexEncode --
+ *
+ *	Writes the two lower case hex digits of each of length bytes.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	Stores 2 * length characters in to.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+DpHexEncode (to, from, length)
+    unsigned char *to;		/* (out) Digits. */
+    CONST unsigned char *from;	/* (in) Bytes to encode. */
+    int length;			/* (in) Number of bytes. */
+{
+    (kernels->hexEncodeProc) (to, from, length);
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DpHexDecode --
+ *
+ *	Converts pairs of hex digits (in either case) to bytes.
+ *
+ * Results:
+ *
+ *	The number of pairs converted. It is less than pairs if a character
+ *	that is not a hex digit was found; the pair that holds it is not
+ *	converted.
+ *
+ * Side effects:
+ *
+ *	Stores the bytes in to.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+DpHexDecode (to, from, pairs)
+    unsigned char *to;		/* (out) Bytes. */
+    CONST unsigned char *from;	/* (in) Digits to decode. */
+    int pairs;			/* (in) Number of pairs of digits. */
+{
+    return (kernels->hexDecodeProc) (to, from, pairs);
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DpUuencodeGroups --
+ *
+ *	Uuencodes groups of 3 bytes into groups of 4 characters.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	Stores 4 * groups characters in to.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+DpUuencodeGroups (to, from, groups)
+    unsigned char *to;		/* (out) Characters. */
+    CONST unsigned char *from;	/* (in) 3 * groups bytes. */
+    int groups;			/* (in) Number of groups. */
+{
+    (kernels->uuencodeProc) (to, from, groups);
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DpUudecodeGroups --
+ *
+ *	Decodes groups of 4 uuencoded characters into groups of 3 bytes.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	Stores 3 * groups bytes in to.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+DpUudecodeGroups (to, from, groups)
+    unsigned char *to;		/* (out) Bytes. */
+    CONST unsigned char *from;	/* (in) 4 * groups characters. */
+    int groups;			/* (in) Number of groups. */
+{
+    (kernels->uudecodeProc) (to, from, groups);
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DpCrc32c --
+ *
+ *	Continues the CRC32C (Castagnoli) checksum crc over length more
+ *	bytes. The checksum of no bytes is 0, so a new checksum starts
+ *	with crc = 0, and checksumming a buffer in pieces gives the same
+ *	result as checksumming it at once.
+ *
+ * Results:
+ *
+ *	The new checksum.
+ *
+ * Side effects:
+ *
+ *	None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+unsigned int
+DpCrc32c (crc, from, length)
+    unsigned int crc;		/* (in) Checksum so far. */
+    CONST unsigned char *from;	/* (in) Bytes to add. */
+    int length;			/* (in) Number of bytes. */
+{
+    return ~(kernels->crc32cProc) (~crc, from, length);
+}
+
+/*
+ * Processor feature detection.
+ */
+
+static int
+CpuFeatures ()
+{
+    int features = 0;
+
+#ifdef DP_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+	features |= DP_CPU_SSE2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+	features |= DP_CPU_SSSE3;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+	features |= DP_CPU_SSE42;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+	features |= DP_CPU_AVX2;
+    }
+#endif
+    return features;
+}
+
+static void
+InitTables ()
+{
+    static CONST char digits[] = "0123456789abcdef";
+    unsigned int crc;
+    int i, j;
+
+    if (hexPairs[0] != 0) {
+	return;
+    }
+    for (i = 0; i < 256; i++) {
+	crc = i;
+	for (j = 0; j < 8; j++) {
+	    crc = (crc >> 1) ^ ((crc & 1) ? DP_CRC32C_POLY : 0);
+	}
+	crcTables[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+	crc = crcTables[0][i];
+	for (j = 1; j < 8; j++) {
+	    crc = (crc >> 8) ^ crcTables[0][crc & 0xFF];
+	    crcTables[j][i] = crc;
+	}
+    }
+    for (i = 0; i < 256; i++) {
+	hexValues[i] = -1;
+    }
+    for (i = 0; i < 10; i++) {
+	hexValues['0' + i] = i;
+    }
+    for (i = 0; i < 6; i++) {
+	hexValues['a' + i] = 10 + i;
+	hexValues['A' + i] = 10 + i;
+    }
+    for (i = 255; i >= 0; i--) {
+	hexPairs[2 * i + 1] = digits[i & 0x0F];
+	hexPairs[2 * i] = digits[i >> 4];
+    }
+}
+
+/*
+ * Portable kernels.
+ */
+
+static void
+XorScalar (to, from, length, stream, period, posPtr)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int length;
+    CONST unsigned char *stream;
+    int period;
+    int *posPtr;
+{
+    int i, n, pos;
+
+    pos = *posPtr;
+    while (length > 0) {
+	n = period - pos;
+	if (n > length) {
+	    n = length;
+	}
+	for (i = 0; i < n; i++) {
+	    to[i] = from[i] ^ stream[pos + i];
+	}
+	to += n;
+	from += n;
+	length -= n;
+	pos += n;
+	if (pos == period) {
+	    pos = 0;
+	}
+    }
+    *posPtr = pos;
+}
+
+static void
+HexEncodeScalar (to, from, length)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int length;
+{
+    int i;
+
+    for (i = 0; i < length; i++) {
+	to[2 * i] = hexPairs[2 * from[i]];
+	to[2 * i + 1] = hexPairs[2 * from[i] + 1];
+    }
+}
+
+static int
+HexDecodeScalar (to, from, pairs)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int pairs;
+{
+    int i, hi, lo;
+
+    for (i = 0; i < pairs; i++) {
+	hi = hexValues[from[2 * i]];
+	lo = hexValues[from[2 * i + 1]];
+	if ((hi < 0) || (lo < 0)) {
+	    break;
+	}
+	to[i] = (unsigned char) ((hi << 4) | lo);
+    }
+    return i;
+}
+
+static void
+UuencodeScalar (to, from, groups)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int groups;
+{
+    int i;
+
+    for (i = 0; i < groups; i++, from += 3, to += 4) {
+	to[0] = (from[0] >> 2) + ' ';
+	to[1] = (((from[0] & 0x03) << 4) | (from[1] >> 4)) + ' ';
+	to[2] = (((from[1] & 0x0f) << 2) | (from[2] >> 6)) + ' ';
+	to[3] = (from[2] & 0x3f) + ' ';
+    }
+}
+
+static void
+UudecodeScalar (to, from, groups)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int groups;
+{
+    int i;
+
+    for (i = 0; i < groups; i++, from += 4, to += 3) {
+	to[0] = ((from[0] - ' ') << 2) | ((from[1] - ' ') >> 4);
+	to[1] = ((from[1] - ' ') << 4) | ((from[2] - ' ') >> 2);
+	to[2] = ((from[2] - ' ') << 6) | (from[3] - ' ');
+    }
+}
+
+/*
+ * The CRC kernels work on the bit-inverted checksum; DpCrc32c does the
+ * inversions.
+ */
+
+static unsigned int
+Crc32cScalar (crc, from, length)
+    unsigned int crc;
+    CONST unsigned char *from;
+    int length;
+{
+    unsigned int lo, hi;
+
+    for (; length >= 8; length -= 8, from += 8) {
+	lo = crc ^ (from[0] | (from[1] << 8) | (from[2] << 16)
+		| ((unsigned int) from[3] << 24));
+	hi = from[4] | (from[5] << 8) | (from[6] << 16)
+		| ((unsigned int) from[7] << 24);
+	crc = crcTables[7][lo & 0xFF] ^ crcTables[6][(lo >> 8) & 0xFF]
+		^ crcTables[5][(lo >> 16) & 0xFF] ^ crcTables[4][lo >> 24]
+		^ crcTables[3][hi & 0xFF] ^ crcTables[2][(hi >> 8) & 0xFF]
+		^ crcTables[1][(hi >> 16) & 0xFF] ^ crcTables[0][hi >> 24];
+    }
+    for (; length > 0; length--, from++) {
+	crc = (crc >> 8) ^ crcTables[0][(crc ^ *from) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef DP_X86_KERNELS
+
+/*
+ * x86 kernels. Each one handles whole blocks and leaves the rest to the
+ * portable kernel.
+ */
+
+__attribute__((target("sse2")))
+static void
+XorSse2 (to, from, length, stream, period, posPtr)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int length;
+    CONST unsigned char *stream;
+    int period;
+    int *posPtr;
+{
+    int i, pos;
+    __m128i d, k;
+
+    pos = *posPtr;
+    for (i = 0; i + 16 <= length; i += 16) {
+	d = _mm_loadu_si128((CONST __m128i *) (from + i));
+	k = _mm_loadu_si128((CONST __m128i *) (stream + pos));
+	_mm_storeu_si128((__m128i *) (to + i), _mm_xor_si128(d, k));
+	pos += 16;
+	if (pos >= period) {
+	    pos %= period;
+	}
+    }
+    *posPtr = pos;
+    XorScalar(to + i, from + i, length - i, stream, period, posPtr);
+}
+
+__attribute__((target("avx2")))
+static void
+XorAvx2 (to, from, length, stream, period, posPtr)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int length;
+    CONST unsigned char *stream;
+    int period;
+    int *posPtr;
+{
+    int i, pos;
+    __m256i d, k;
+
+    pos = *posPtr;
+    for (i = 0; i + 32 <= length; i += 32) {
+	d = _mm256_loadu_si256((CONST __m256i *) (from + i));
+	k = _mm256_loadu_si256((CONST __m256i *) (stream + pos));
+	_mm256_storeu_si256((__m256i *) (to + i), _mm256_xor_si256(d, k));
+	pos += 32;
+	if (pos >= period) {
+	    pos %= period;
+	}
+    }
+    *posPtr = pos;
+    XorScalar(to + i, from + i, length - i, stream, period, posPtr);
+}
+
+/*
+ * Nibbles (0..15) to lower case hex digits: '0' + n, plus 39 more to get
+ * from ':' to 'a' when n > 9.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i
+NibblesToHexSse2 (__m128i n)
+{
+    __m128i gt9 = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')),
+	    _mm_and_si128(gt9, _mm_set1_epi8(39)));
+}
+
+__attribute__((target("sse2")))
+static void
+HexEncodeSse2 (to, from, length)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int length;
+{
+    int i;
+    __m128i v, hi, lo, mask = _mm_set1_epi8(0x0F);
+
+    for (i = 0; i + 16 <= length; i += 16) {
+	v = _mm_loadu_si128((CONST __m128i *) (from + i));
+	hi = NibblesToHexSse2(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+	lo = NibblesToHexSse2(_mm_and_si128(v, mask));
+	_mm_storeu_si128((__m128i *) (to + 2 * i), _mm_unpacklo_epi8(hi, lo));
+	_mm_storeu_si128((__m128i *) (to + 2 * i + 16),
+		_mm_unpackhi_epi8(hi, lo));
+    }
+    HexEncodeScalar(to + 2 * i, from + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+NibblesToHexAvx2 (__m256i n)
+{
+    __m256i gt9 = _mm256_cmpgt_epi8(n, _mm256_set1_epi8(9));
+
+    return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')),
+	    _mm256_and_si256(gt9, _mm256_set1_epi8(39)));
+}
+
+__attribute__((target("avx2")))
+static void
+HexEncodeAvx2 (to, from, length)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int length;
+{
+    int i;
+    __m256i v, hi, lo, a, b, mask = _mm256_set1_epi8(0x0F);
+
+    for (i = 0; i + 32 <= length; i += 32) {
+	v = _mm256_loadu_si256((CONST __m256i *) (from + i));
+	hi = NibblesToHexAvx2(_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+	lo = NibblesToHexAvx2(_mm256_and_si256(v, mask));
+
+	/*
+	 * The unpacks work within 128 bit lanes: a holds bytes 0-7 and
+	 * 16-23, b bytes 8-15 and 24-31.
+	 */
+
+	a = _mm256_unpacklo_epi8(hi, lo);
+	b = _mm256_unpackhi_epi8(hi, lo);
+	_mm256_storeu_si256((__m256i *) (to + 2 * i),
+		_mm256_permute2x128_si256(a, b, 0x20));
+	_mm256_storeu_si256((__m256i *) (to + 2 * i + 32),
+		_mm256_permute2x128_si256(a, b, 0x31));
+    }
+    HexEncodeScalar(to + 2 * i, from + i, length - i);
+}
+
+/*
+ * Hex digits to values. Returns 0 if any of the 16 characters is not a
+ * digit. Characters of 0x80 and above compare as negative, so they fail
+ * both range checks.
+ */
+
+__attribute__((target("sse2")))
+static inline int
+HexValuesSse2 (__m128i c, __m128i *valuePtr)
+{
+    __m128i lower, isDigit, isAlpha;
+
+    isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+	    _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    isAlpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+	    _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xFFFF) {
+	return 0;
+    }
+    *valuePtr = _mm_or_si128(
+	    _mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+	    _mm_and_si128(isAlpha,
+		    _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+    return 1;
+}
+
+/*
+ * Joins the pairs of values in v into bytes, as 16 bit words: the first
+ * digit of a pair is the low byte of the word.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i
+JoinPairsSse2 (__m128i v)
+{
+    return _mm_or_si128(
+	    _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00FF)), 4),
+	    _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static int
+HexDecodeSse2 (to, from, pairs)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int pairs;
+{
+    int i;
+    __m128i v0, v1;
+
+    for (i = 0; i + 16 <= pairs; i += 16) {
+	if (!HexValuesSse2(_mm_loadu_si128((CONST __m128i *) (from + 2 * i)),
+		&v0) || !HexValuesSse2(
+		_mm_loadu_si128((CONST __m128i *) (from + 2 * i + 16)), &v1)) {
+	    break;
+	}
+	_mm_storeu_si128((__m128i *) (to + i),
+		_mm_packus_epi16(JoinPairsSse2(v0), JoinPairsSse2(v1)));
+    }
+    return i + HexDecodeScalar(to + i, from + 2 * i, pairs - i);
+}
+
+__attribute__((target("avx2")))
+static inline int
+HexValuesAvx2 (__m256i c, __m256i *valuePtr)
+{
+    __m256i lower, isDigit, isAlpha;
+
+    isDigit = _mm256_and_si256(
+	    _mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+	    _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+    lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    isAlpha = _mm256_and_si256(
+	    _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+	    _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    if (_mm256_movemask_epi8(_mm256_or_si256(isDigit, isAlpha)) != -1) {
+	return 0;
+    }
+    *valuePtr = _mm256_or_si256(
+	    _mm256_and_si256(isDigit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+	    _mm256_and_si256(isAlpha,
+		    _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+    return 1;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+JoinPairsAvx2 (__m256i v)
+{
+    return _mm256_or_si256(
+	    _mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x00FF)), 4),
+	    _mm256_srli_epi16(v, 8));
+}
+
+__attribute__((target("avx2")))
+static int
+HexDecodeAvx2 (to, from, pairs)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int pairs;
+{
+    int i;
+    __m256i v0, v1, packed;
+
+    for (i = 0; i + 32 <= pairs; i += 32) {
+	if (!HexValuesAvx2(
+		_mm256_loadu_si256((CONST __m256i *) (from + 2 * i)), &v0)
+		|| !HexValuesAvx2(_mm256_loadu_si256(
+		(CONST __m256i *) (from + 2 * i + 32)), &v1)) {
+	    break;
+	}
+
+	/*
+	 * The pack works within 128 bit lanes, leaving the quarters in
+	 * the order 0, 2, 1, 3.
+	 */
+
+	packed = _mm256_packus_epi16(JoinPairsAvx2(v0), JoinPairsAvx2(v1));
+	_mm256_storeu_si256((__m256i *) (to + i),
+		_mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    return i + HexDecodeSse2(to + i, from + 2 * i, pairs - i);
+}
+
+/*
+ * The uuencode kernels work on 4 groups at a time, but load and store 16
+ * bytes, so they stop 6 groups before the end and leave the rest to the
+ * portable code.
+ */
+
+__attribute__((target("ssse3")))
+static void
+UuencodeSsse3 (to, from, groups)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int groups;
+{
+    int g;
+    __m128i in, t0, t1, t2, t3;
+
+    for (g = 0; g + 6 <= groups; g += 4) {
+	in = _mm_loadu_si128((CONST __m128i *) (from + 3 * g));
+
+	/*
+	 * Put bytes b0 b1 b2 of each group in a 32 bit word as b1 b0 b2 b1,
+	 * then shift each 6 bit field to the bottom of its own byte.
+	 */
+
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+		4, 5, 3, 4, 1, 2, 0, 1));
+	t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+	t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+	t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	_mm_storeu_si128((__m128i *) (to + 4 * g),
+		_mm_add_epi8(_mm_or_si128(t1, t3), _mm_set1_epi8(' ')));
+    }
+    UuencodeScalar(to + 4 * g, from + 3 * g, groups - g);
+}
+
+__attribute__((target("ssse3")))
+static void
+UudecodeSsse3 (to, from, groups)
+    unsigned char *to;
+    CONST unsigned char *from;
+    int groups;
+{
+    int g;
+    __m128i in;
+
+    for (g = 0; g + 6 <= groups; g += 4) {
+	in = _mm_loadu_si128((CONST __m128i *) (from + 4 * g));
+	in = _mm_and_si128(_mm_sub_epi8(in, _mm_set1_epi8(' ')),
+		_mm_set1_epi8(0x3F));
+
+	/*
+	 * Join the four 6 bit fields of each group into a 24 bit value,
+	 * then pick its bytes from the top down.
+	 */
+
+	in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+	in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(-1, -1, -1, -1, 12, 13, 14,
+		8, 9, 10, 4, 5, 6, 0, 1, 2));
+	_mm_storeu_si128((__m128i *) (to + 3 * g), in);
+    }
+    UudecodeScalar(to + 3 * g, from + 4 * g, groups - g);
+}
+
+/*
+ * SSE4.2 has an instruction for CRC32C. It takes 8 bytes at a time on
+ * 64 bit processors, 4 otherwise.
+ */
+
+__attribute__((target("sse4.2")))
+static unsigned int
+Crc32cSse42 (crc, from, length)
+    unsigned int crc;
+    CONST unsigned char *from;
+    int length;
+{
+#ifdef __x86_64__
+    unsigned long long c = crc, word;
+
+    for (; length >= 8; length -= 8, from += 8) {
+	memcpy(&word, from, 8);
+	c = _mm_crc32_u64(c, word);
+    }
+    crc = (unsigned int) c;
+#else
+    unsigned int word;
+
+    for (; length >= 4; length -= 4, from += 4) {
+	memcpy(&word, from, 4);
+	crc = _mm_crc32_u32(crc, word);
+    }
+#endif
+    for (; length > 0; length--, from++) {
+	crc = _mm_crc32_u8(crc, *from);
+    }
+    return crc;
+}
+
+#endif /* DP_X86_KERNELS */
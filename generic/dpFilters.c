@@ -1,6 +1,7 @@
-#include "generic/dp.h"
+#include "generic/dpInt.h"
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 
 /*
  * You will find below a description of the filter functions.
@@ -91,16 +92,145 @@
  * RETURN VALUE: If no error is detected, the return value must be zero. A
  * non-zero return value signals an error. The user should use POSIX error codes
  * to differentiate the possible error cases.
+ *
+ *
+ * VERSION 2: The filters described above allocate a new output buffer on
+ * every call, which the channel copies from and frees. A filter registered
+ * with Dp_RegisterPlugInFilter2 and a plugProc2 function writes into a
+ * buffer owned by the channel instead, which is reused from call to call:
+ *
+ * PROTOTYPE: int Filter (char *inBuf, int inLength, int *inUsedPtr,
+ *                        char *outBuf, int outSize, int *outLengthPtr,
+ *                        void **data, Tcl_Interp *interp, int mode)
+ *
+ * inBuf, inLength, data, interp and mode are as above. The channel sets
+ * *inUsedPtr and *outLengthPtr to 0 before each call.
+ *
+ * (out) inUsedPtr: The number of input bytes the filter consumed. A filter
+ * that runs out of room in outBuf may consume only part of the input; the
+ * channel makes room and calls it again with the rest.
+ *
+ * (in) outBuf, outSize: Where to put the output, and how many bytes fit.
+ *
+ * (out) outLengthPtr: The number of bytes written to outBuf.
+ *
+ * If the filter can't make any progress in outSize bytes (for example, a
+ * header and its packet must be output together), it returns ENOSPC with
+ * the room it needs in *outLengthPtr, without changing its state; the
+ * channel grows outBuf and calls it again. In DP_FILTER_SET mode outBuf is
+ * NULL. In DP_FILTER_GET mode the filter copies its description into outBuf
+ * instead of returning a pointer to it.
  */
 
 typedef struct {
-  char *xorString;         /* Pointer to the encoding string. */
+  char *xorString;         /* Pointer to the encoding string, followed by */
+			   /* DP_XOR_STREAM_PAD more bytes of it (see     */
+			   /* DpXorBytes).                                */
   int   xorStringLength;   /* The length of the encoding string. */
   int   counter;           /* Position in the encoding string of the next */
 			   /* byte that will be used for encoding.        */
 } xorFilterData;
 
 
+/*
+ * Description returned by DP_FILTER_GET for filters without parameters.
+ */
+
+static char noArgs[] = "{no internal arguments}";
+
+/*
+ * Filter data of packon when it writes varint headers; it is NULL for
+ * decimal headers.
+ */
+
+static char packVarint[] = "varint";
+
+/*
+ * A decimal packon header: the length of the packet in 6 digits.
+ */
+
+#define PACK_HEADER_LENGTH	6
+#define PACK_MAX_LENGTH		999999
+
+static int FilterGetString _ANSI_ARGS_((CONST char *str, int length,
+				char *outBuf, int outSize,
+				int *outLengthPtr));
+static int PackHeader _ANSI_ARGS_((unsigned int length, char *header));
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FilterGetString --
+ *
+ *	Copies the description a version 2 filter returns for DP_FILTER_GET
+ *	into the channel's buffer.
+ *
+ * Results:
+ *
+ *	0 if everything is OK, ENOSPC with the room needed in *outLengthPtr
+ *	if outBuf is too small.
+ *
+ * Side effects:
+ *
+ *	None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FilterGetString (str, length, outBuf, outSize, outLengthPtr)
+	CONST char *str;   /* (in)  Description of the filter's state. */
+	int    length;     /* (in)  Its length, or -1 to use strlen(). */
+	char  *outBuf;     /* (in)  Where to copy it. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Bytes copied, or needed. */
+{
+    if (length < 0) {
+        length = strlen(str);
+    }
+    *outLengthPtr = length;
+    if (length > outSize) {
+        return ENOSPC;
+    }
+    memcpy(outBuf, str, length);
+    return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PackHeader --
+ *
+ *	Formats the decimal packon header of a packet, as written by packon
+ *	and checksumon.
+ *
+ * Results:
+ *
+ *	0 if everything is OK, EINVAL if length needs more than
+ *	PACK_HEADER_LENGTH digits.
+ *
+ * Side effects:
+ *
+ *	Stores the digits, and a terminating null, in header.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+PackHeader (length, header)
+	unsigned int length; /* (in)  Length of the packet. */
+	char  *header;     /* (out) PACK_HEADER_LENGTH + 1 bytes. */
+{
+    if (length > PACK_MAX_LENGTH) {
+        return EINVAL;
+    }
+    snprintf(header, PACK_HEADER_LENGTH + 1, "%06u", length);
+    return 0;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -117,25 +247,28 @@ typedef struct {
  *
  * Side effects:
  *
- *	Allocates memory for the filtered output.
+ *	None.
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-Plug1to2  (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+Plug1to2  (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
 			   /*       close modes. Ignored in this case.      */
 {
-    static char internal[] = "{no internal arguments}";
-    int i;
-    char *iTmp, *oTmp;
+    int i, n;
+    CONST84 char *iTmp;
+    char *oTmp;
 
 
     switch(mode) {
@@ -144,29 +277,21 @@ Plug1to2  (inBuf, inLength, outBuf, outLength, data, interp, mode)
     case DP_FILTER_FLUSH:
     case DP_FILTER_EOF:
 
-        if(inLength == 0) {
-            *outBuf = 0;
-            return 0;
-        }
-
-        if ((*outBuf = (char *)ckalloc(2 * inLength)) == NULL) {
-            return ENOMEM;
-        }
+        n = (inLength < outSize / 2) ? inLength : outSize / 2;
 
-        for (i = inLength, oTmp = *outBuf, iTmp = inBuf; i; i--, oTmp++, iTmp++) {
+        for (i = n, oTmp = outBuf, iTmp = inBuf; i; i--, oTmp++, iTmp++) {
             *oTmp++ = *iTmp;
             *oTmp = *iTmp;
         }
 
-        *outLength = 2 * inLength;
+        *inUsedPtr = n;
+        *outLengthPtr = 2 * n;
 
         break;
 
 
     case DP_FILTER_CLOSE:
 
-        *outLength = 0;
-
         break;
 
     case DP_FILTER_SET:
@@ -176,9 +301,7 @@ Plug1to2  (inBuf, inLength, outBuf, outLength, data, interp, mode)
         
     case DP_FILTER_GET:
         
-        *outBuf = internal;
-
-        break;
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
 
     default:
         
@@ -190,7 +313,7 @@ Plug1to2  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
 }
 
-
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -207,25 +330,28 @@ Plug1to2  (inBuf, inLength, outBuf, outLength, data, interp, mode)
  *
  * Side effects:
  *
- *	Allocates memory for the filtered output.
+ *	None.
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-Plug2to1 (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+Plug2to1 (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
 			   /*       close modes. Ignored in this case.      */
 {
-    static char internal[] = "{no internal arguments}";
-    int i;
-    char *iTmp, *oTmp;
+    int i, n;
+    CONST84 char *iTmp;
+    char *oTmp;
 
     switch(mode) {
 
@@ -233,26 +359,20 @@ Plug2to1 (inBuf, inLength, outBuf, outLength, data, interp, mode)
     case DP_FILTER_FLUSH:
     case DP_FILTER_EOF:
 
-        if(inLength == 0) {
-            *outBuf = 0;
-            return 0;
-        }
-        if ((*outBuf = (char *)ckalloc(inLength / 2)) == NULL) {
-            return ENOMEM;
-        };
-        
-        for (i = inLength / 2, oTmp = *outBuf, iTmp = inBuf; i; i--, iTmp++) {
+        n = (inLength / 2 < outSize) ? inLength / 2 : outSize;
+
+        for (i = n, oTmp = outBuf, iTmp = inBuf; i; i--, iTmp++) {
             *oTmp++ = *iTmp++;
         }
         
-        *outLength = inLength / 2;
+        /* As before, an odd byte at the end of the input is dropped. */
+        *inUsedPtr = (n == inLength / 2) ? inLength : 2 * n;
+        *outLengthPtr = n;
 
         break;
 
     case DP_FILTER_CLOSE:
 
-        *outLength = 0;
-
         break;
 
     case DP_FILTER_SET:
@@ -262,9 +382,7 @@ Plug2to1 (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
     case DP_FILTER_GET:
 
-        *outBuf = internal;
-
-        break;
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
 
     default:
 
@@ -276,7 +394,7 @@ Plug2to1 (inBuf, inLength, outBuf, outLength, data, interp, mode)
 }
 
 
-
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -290,23 +408,26 @@ Plug2to1 (inBuf, inLength, outBuf, outLength, data, interp, mode)
  *
  * Side effects:
  *
- *	Allocates memory for the filtered output.
+ *	None.
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-Identity (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+Identity (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
 			   /*       close modes. Ignored in this case.      */
 {
-    static char internal[] = "{no internal arguments}";
+    int n;
 
     switch(mode) {
 
@@ -314,24 +435,15 @@ Identity (inBuf, inLength, outBuf, outLength, data, interp, mode)
     case DP_FILTER_FLUSH:
     case DP_FILTER_EOF:
 
-        if(inLength == 0) {
-            *outBuf = 0;
-            return 0;
-        }
-
-        if ((*outBuf = (char *)ckalloc(inLength)) == NULL) {
-            return ENOMEM;
-        };
-        
-        memcpy(*outBuf, inBuf, inLength);
-        *outLength = inLength;
+        n = (inLength < outSize) ? inLength : outSize;
+        memcpy(outBuf, inBuf, n);
+        *inUsedPtr = n;
+        *outLengthPtr = n;
 
         break;
 
     case DP_FILTER_CLOSE:
 
-        *outLength = 0;
-        
         break;
 
     case DP_FILTER_SET:
@@ -341,9 +453,7 @@ Identity (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
     case DP_FILTER_GET:
 
-        *outBuf = internal;
-
-        break;
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
 
     default:
         
@@ -354,7 +464,7 @@ Identity (inBuf, inLength, outBuf, outLength, data, interp, mode)
 }
 
 
-
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -371,18 +481,20 @@ Identity (inBuf, inLength, outBuf, outLength, data, interp, mode)
  *
  * Side effects:
  *
- *	Allocates memory for the filtered output. Manages dynamic local
- *	datastructure (xoprFilterData).
+ *	Manages dynamic local datastructure (xoprFilterData).
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-Xor  (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+Xor  (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
@@ -428,26 +540,17 @@ Xor  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
       if(inLength > 0) {
         
-          int   i;
-          char *s, *d;
-          
-          *outBuf = (char *)ckalloc(inLength);
+          int n;
           
-          if(*outBuf == NULL) {
-              return ENOMEM;
-          }
-          
-          for(i = 0, s = inBuf, d = *outBuf; i < inLength; i++, s++, d++) {
-              *d = *s ^ (fD->xorString[(fD->counter)++]);
-              if((fD->counter) >= (fD->xorStringLength)) {
-                  fD->counter = 0;
-              }
-          }
-      } else {
-          *outBuf = NULL;
-      }
+          n = (inLength < outSize) ? inLength : outSize;
 
-      *outLength = inLength;
+          DpXorBytes((unsigned char *) outBuf, (unsigned char *) inBuf, n,
+                  (unsigned char *) fD->xorString, fD->xorStringLength,
+                  &(fD->counter));
+
+          *inUsedPtr = n;
+          *outLengthPtr = n;
+      }
 
       break;
 
@@ -457,9 +560,6 @@ Xor  (inBuf, inLength, outBuf, outLength, data, interp, mode)
        * only the storage space for xorString has to be freed.
        */
 
-      *outBuf = NULL;
-      *outLength = 0;
-      
      	if (fD->xorString != NULL) {
 	    ckfree(fD->xorString);
 	    fD->xorString = NULL;
@@ -471,16 +571,22 @@ Xor  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
   case DP_FILTER_SET: /* Set the string that will be used to xor data. */
 
-    if (fD->xorString != NULL) {
+    if ((fD->xorString != NULL) || (inLength == 0)) {
         return EINVAL;
     }
 
-    fD->xorString = (char *)ckalloc(inLength);
+    fD->xorString = (char *)ckalloc(inLength + DP_XOR_STREAM_PAD);
     if (fD->xorString == NULL) {
 	return ENOMEM;
     }
 
-    memcpy(fD->xorString, inBuf, inLength);
+    {
+        int i;
+
+        for(i = 0; i < inLength + DP_XOR_STREAM_PAD; i++) {
+            fD->xorString[i] = inBuf[i % inLength];
+        }
+    }
     fD->xorStringLength = inLength;
 
     /* Start using the string from the beginning. */
@@ -491,11 +597,11 @@ Xor  (inBuf, inLength, outBuf, outLength, data, interp, mode)
   case DP_FILTER_GET: /* Return the string that is used to xor data. */
 
     if (fD->xorString == NULL) {
-	*outBuf = "{xor string not set}";
-    } else {
-	*outBuf = fD->xorString;
+	return FilterGetString("{xor string not set}", -1, outBuf, outSize,
+		outLengthPtr);
     }
-    break;
+    return FilterGetString(fD->xorString, fD->xorStringLength, outBuf,
+	    outSize, outLengthPtr);
 
   default:
     return EINVAL;
@@ -506,7 +612,7 @@ Xor  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 }
 
 
-
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -521,78 +627,395 @@ Xor  (inBuf, inLength, outBuf, outLength, data, interp, mode)
  *      be translated into several packets. Though the filter will work both for
  *	input and output, it is more likely that the filter will be used for 
  *	automatically attaching the packet length to outgoing (written)
- *	messages. No internal parameters.
+ *	messages. The internal parameter "varint" replaces the decimal
+ *	header with the length as a varint (7 bits per byte, least
+ *	significant first, high bit set in all bytes but the last), which
+ *	has no size limit; "decimal" goes back to the 6 byte header.
  *
  * Results:
  *
  *	0 if everything is OK, a POSIX error code if there was an error.
+ *	ENOSPC if the header and the packet don't fit in outBuf.
  *
  * Side effects:
  *
- *	Allocates memory for the filtered output.
+ *	None.
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-PackOn  (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+PackOn  (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
 			   /*       close modes. Ignored in this case.      */
 {
+    char header[8];	/* A varint or PACK_HEADER_LENGTH digits. */
+    int  headerLength, n;
+
     switch(mode) {
 
     case DP_FILTER_NORMAL:
     case DP_FILTER_FLUSH:
     case DP_FILTER_EOF:
 
-        if(inLength > 1000000) {
-            return EINVAL;
+        if(*data == (void *)packVarint) {
+            headerLength = 0;
+            n = inLength;
+            do {
+                header[headerLength] = n & 0x7f;
+                n >>= 7;
+                if(n != 0) {
+                    header[headerLength] |= 0x80;
+                }
+                headerLength++;
+            } while(n != 0);
+        } else {
+            if((inLength < 0)
+		    || (PackHeader((unsigned int) inLength, header) != 0)) {
+                return EINVAL;
+            }
+            headerLength = PACK_HEADER_LENGTH;
         }
 
-        *outBuf = (char *)ckalloc(inLength + 6);
+        /* The header and its packet must go out together. */
 
-        if(*outBuf == NULL) {
+        if(outSize < inLength + headerLength) {
+            *outLengthPtr = inLength + headerLength;
+            return ENOSPC;
+        }
+
+        memcpy(outBuf, header, headerLength);
+        memcpy(outBuf + headerLength, inBuf, inLength);
+        *inUsedPtr = inLength;
+        *outLengthPtr = inLength + headerLength;
+
+        break;
+
+    case DP_FILTER_CLOSE:
+        /* Last call before the channel is closed. There is no buffering. */
+
+        *data = NULL;
+        break;
+
+    case DP_FILTER_SET: /* The header: "decimal" or "varint". */
+
+        if((inLength == 7) && (strncmp(inBuf, "decimal", 7) == 0)) {
+            *data = NULL;
+        } else if((inLength == 6) && (strncmp(inBuf, "varint", 6) == 0)) {
+            *data = (void *)packVarint;
+        } else {
             return EINVAL;
         }
+        break;
 
-        sprintf(*outBuf, "%.6d", inLength);
-        memcpy((*outBuf) + 6, inBuf, inLength);
-        *outLength = inLength + 6;
+    case DP_FILTER_GET: /* Return the header in use. */
+
+        return FilterGetString((*data == (void *)packVarint) ? packVarint
+		: "decimal", -1, outBuf, outSize, outLengthPtr);
+
+    default:
+        return EINVAL;
+    }
+
+    return 0;
+
+}
+
+
+/*
+ * The checksum filters send each packet as a packon header (6 decimal
+ * digits), the data, and the CRC32C of the data in 4 bytes, most
+ * significant byte first. The length in the header includes the CRC, so
+ * that a packoff channel at the other end can split the stream too.
+ * Longer packets are split into several frames of at most CHECKSUM_FRAME
+ * bytes of data.
+ */
+
+#define CHECKSUM_FRAME	65536
+#define CHECKSUM_HEADER	PACK_HEADER_LENGTH
+
+/* Data kept by checksumoff: the beginning of a frame not yet complete. */
+
+typedef struct {
+    char *buf;			/* Bytes received, or NULL. */
+    int   length;		/* Number of bytes in buf. */
+    int   size;			/* Size of buf. */
+} checksumData;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ChecksumOn --
+ *
+ *	Frames the data as described above, adding a CRC32C to every frame.
+ *	No internal parameters.
+ *
+ * Results:
+ *
+ *	0 if everything is OK, a POSIX error code if there was an error.
+ *	ENOSPC if the frames don't fit in outBuf.
+ *
+ * Side effects:
+ *
+ *	None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+	/* ARGSUSED */
+int
+ChecksumOn (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
+	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
+	void **data;       /* (in)  Place where filter function data is stored. */
+	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
+	int    mode;       /* (in)  Distinguishes between normal, flush and */
+			   /*       close modes. Ignored in this case.      */
+{
+    char header[CHECKSUM_HEADER + 1];
+    unsigned int crc;
+    int frames, length, done, n;
+
+    switch(mode) {
+
+    case DP_FILTER_NORMAL:
+    case DP_FILTER_FLUSH:
+    case DP_FILTER_EOF:
+    case DP_FILTER_CLOSE:
+
+        frames = (inLength + CHECKSUM_FRAME - 1) / CHECKSUM_FRAME;
+        length = inLength + frames * (CHECKSUM_HEADER + 4);
+        if(outSize < length) {
+            *outLengthPtr = length;
+            return ENOSPC;
+        }
+
+        for(done = 0, length = 0; done < inLength; done += n) {
+            n = inLength - done;
+            if(n > CHECKSUM_FRAME) {
+                n = CHECKSUM_FRAME;
+            }
+            crc = DpCrc32c(0, (unsigned char *) inBuf + done, n);
+
+            PackHeader((unsigned int) (n + 4), header);
+            memcpy(outBuf + length, header, CHECKSUM_HEADER);
+            length += CHECKSUM_HEADER;
+            memcpy(outBuf + length, inBuf + done, n);
+            length += n;
+            outBuf[length++] = (char) (crc >> 24);
+            outBuf[length++] = (char) (crc >> 16);
+            outBuf[length++] = (char) (crc >> 8);
+            outBuf[length++] = (char) crc;
+        }
+        *inUsedPtr = inLength;
+        *outLengthPtr = length;
+
+        break;
+
+    case DP_FILTER_SET: /* No setup is allowed for this filter. */
+
+        return EINVAL;
+
+    case DP_FILTER_GET:
+
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
+
+    default:
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ChecksumOff --
+ *
+ *	Checks and removes the framing added by checksumon. The frames can
+ *	be split and joined in any way by the channel they come through;
+ *	the beginning of an incomplete frame is kept until the rest of it
+ *	arrives. No internal parameters.
+ *
+ * Results:
+ *
+ *	0 if everything is OK, a POSIX error code if there was an error.
+ *	EIO if a frame has a bad header or a bad CRC, or if the data ends
+ *	in the middle of a frame. A frame with a bad CRC is dropped, and
+ *	the frames after it can still be read; after a bad header, the
+ *	rest of the data received so far is dropped.
+ *
+ * Side effects:
+ *
+ *	Allocates the buffer for incomplete frames, frees it on
+ *	DP_FILTER_CLOSE.
+ *
+ *-----------------------------------------------------------------------------
+ */
+	/* ARGSUSED */
+int
+ChecksumOff (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
+	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
+	void **data;       /* (in)  Place where filter function data is stored. */
+	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
+	int    mode;       /* (in)  Distinguishes between normal, flush and */
+			   /*       close modes. */
+{
+    checksumData *cD = (checksumData *) *data;
+    unsigned char *frame;
+    unsigned int crc;
+    int i, n, pos, length, error;
+
+    if(cD == NULL) {
+        if(mode == DP_FILTER_CLOSE) {
+            return 0;
+        }
+        cD = (checksumData *) ckalloc(sizeof(checksumData));
+        cD->buf = NULL;
+        cD->length = 0;
+        cD->size = 0;
+        *data = (void *) cD;
+    }
+
+    switch(mode) {
+
+    case DP_FILTER_NORMAL:
+    case DP_FILTER_FLUSH:
+    case DP_FILTER_EOF:
+
+        /* The data out is never longer than the data in. */
+
+        if(outSize < cD->length + inLength) {
+            *outLengthPtr = cD->length + inLength;
+            return ENOSPC;
+        }
+
+        if(cD->length + inLength > cD->size) {
+            n = cD->length + inLength;
+            if(n < CHECKSUM_FRAME + CHECKSUM_HEADER + 4) {
+                n = CHECKSUM_FRAME + CHECKSUM_HEADER + 4;
+            }
+            cD->buf = ckrealloc(cD->buf, n);
+            cD->size = n;
+        }
+        memcpy(cD->buf + cD->length, inBuf, inLength);
+        cD->length += inLength;
+        *inUsedPtr = inLength;
+
+        error = 0;
+        length = 0;
+        pos = 0;
+        while(cD->length - pos >= CHECKSUM_HEADER) {
+            frame = (unsigned char *) cD->buf + pos;
+            for(i = 0, n = 0; i < CHECKSUM_HEADER; i++) {
+                if(!isdigit(frame[i])) {
+                    break;
+                }
+                n = 10 * n + (frame[i] - '0');
+            }
+            if((i < CHECKSUM_HEADER) || (n < 4)
+                    || (n > CHECKSUM_FRAME + 4)) {
+                /* We lost track of the frames; drop everything. */
+
+                if(length == 0) {
+                    pos = cD->length;
+                    error = EIO;
+                }
+                break;
+            }
+            if(cD->length - pos < CHECKSUM_HEADER + n) {
+                break;
+            }
+
+            frame += CHECKSUM_HEADER;
+            n -= 4;
+            crc = ((unsigned int) frame[n] << 24) | (frame[n + 1] << 16)
+                    | (frame[n + 2] << 8) | frame[n + 3];
+            if(DpCrc32c(0, frame, n) != crc) {
+                /*
+                 * Hand out the good frames first; the error is reported
+                 * by the next call.
+                 */
+
+                if(length == 0) {
+                    pos += CHECKSUM_HEADER + n + 4;
+                    error = EIO;
+                }
+                break;
+            }
+            memcpy(outBuf + length, frame, n);
+            length += n;
+            pos += CHECKSUM_HEADER + n + 4;
+        }
+
+        if(pos > 0) {
+            memmove(cD->buf, cD->buf + pos, cD->length - pos);
+            cD->length -= pos;
+        }
+
+        if((mode == DP_FILTER_EOF) && (error == 0) && (length == 0)
+                && (cD->length > 0)) {
+            /* The data ended in the middle of a frame. */
+
+            cD->length = 0;
+            error = EIO;
+        }
+        if(error != 0) {
+            return error;
+        }
+        *outLengthPtr = length;
 
         break;
 
     case DP_FILTER_CLOSE:
-        /* Last call before the channel is closed. Since there is no
-         * buffering, only the storage space for xorString has to be freed.
+
+        /*
+         * Nobody will read anything now, so an incomplete frame does not
+         * matter.
          */
 
-        *outBuf = NULL;
-        *outLength = 0;
-   
+        if(cD->buf != NULL) {
+            ckfree(cD->buf);
+        }
+        ckfree((char *) cD);
+        *data = NULL;
+
         break;
 
     case DP_FILTER_SET: /* No setup is allowed for this filter. */
 
         return EINVAL;
 
-    case DP_FILTER_GET: /* No filter option can be set here. */
+    case DP_FILTER_GET:
 
-        *outBuf = "{no internal arguments}";
-      
-        break;
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
 
     default:
         return EINVAL;
     }
 
     return 0;
-
 }
 
 
@@ -612,6 +1035,7 @@ static void uuencode _ANSI_ARGS_((unsigned char *from, unsigned char *to,
                                   int howMany));
 static void uudecode _ANSI_ARGS_((unsigned char *from, unsigned char *to,
                                   int howMany));
+static int HexDigit _ANSI_ARGS_((int c));
 
 
 /*
@@ -625,21 +1049,24 @@ static void uudecode _ANSI_ARGS_((unsigned char *from, unsigned char *to,
  * Results:
  *
  *	0 if everything is OK, a POSIX error code if there was an error.
+ *	ENOSPC if the encoded lines don't fit in outBuf.
  *
  * Side effects:
  *
- *	Allocates memory for the filtered output. Manages dynamic local
- *      datastructure (encodeData).
+ *	Manages dynamic local datastructure (encodeData).
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-Uuencode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+Uuencode  (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
@@ -667,7 +1094,7 @@ Uuencode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
         int  firstEOFCall;     /* Identifies first call with mode == DP_FILTER_EOF */
     } encodeData;
 
-    int   headerLength, trailerLength, spaceNeeded;
+    int   headerLength, trailerLength, spaceNeeded, needed;
     char *putHere;
 
     encodeData *eD;
@@ -706,45 +1133,37 @@ Uuencode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
                 eD->firstEOFCall = 0;
                 goto jump_eof;
             }
-            eD->firstEOFCall = 0;
         }
 
         if(inLength == 0) {
-            *outLength = 0;
             return 0;
         }
 
+        headerLength = eD->first ? strlen(header) : 0;
         spaceNeeded = ((4 * UU_LINE) / 3 + 2) * ((eD->used + inLength) / UU_LINE);
 
-        if(eD->first) {
-
-            /* If this is the first call, insert the header first. */
-
-            headerLength = strlen(header);
-
-            *outBuf = putHere = (char *)ckalloc(spaceNeeded + headerLength);
-
-            if(*outBuf == NULL) {
-                return EINVAL;
-            }
+        if(outSize < spaceNeeded + headerLength) {
+            *outLengthPtr = spaceNeeded + headerLength;
+            return ENOSPC;
+        }
 
-            *outLength = spaceNeeded + headerLength;
+        if(mode == DP_FILTER_EOF) {
+            eD->firstEOFCall = 0;
+        }
 
-            eD->first = 0;
+        *inUsedPtr = inLength;
+        *outLengthPtr = spaceNeeded + headerLength;
+        putHere = outBuf;
 
-            memcpy(putHere, header, headerLength);
+        if(eD->first) {
 
-            putHere += headerLength;
+            /* If this is the first call, insert the header first. */
 
-        } else {
+            eD->first = 0;
 
-            *outBuf = putHere = (char *)ckalloc(spaceNeeded);
-            
-            if(*outBuf == NULL) {
-                return EINVAL;
-            }
+            memcpy(putHere, header, headerLength);
 
-            *outLength = spaceNeeded;
+            putHere += headerLength;
 
         }
 
@@ -784,8 +1203,8 @@ Uuencode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
              * activity. 
              */
 
-            *outBuf = NULL;
-            *outLength = 0;
+            ckfree((void *)eD);
+            *data = NULL;
             break;
 
         }
@@ -797,42 +1216,27 @@ Uuencode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
         if(!(eD->trailerOutput)) {
             trailerLength = strlen(trailer);
 
-            if(eD->used == 0) {
+            /* Establish how many bytes will be needed to encode the incomplete
+             * line we are trying to output.
+             */
 
-                *outBuf = putHere = (char *)ckalloc(trailerLength);
-                
-                if(*outBuf == NULL) {
-                    return ENOMEM;
-                }
+            needed = (eD->used == 0) ? 0 : 2 + 4 * ((eD->used + 2) / 3);
 
-                *outLength = trailerLength;
-                
-            } else {
-                
-                /* Establish how many bytes will be needed to encode the incomplete
-                 * line we are trying to output.
-                 */
-                
-                int needed = 2 + (4 * (((eD->used + 2) / 3) * 3)) / 3;
-                
-                *outBuf = putHere = (char *)ckalloc(needed + trailerLength);
-                
-                if(*outBuf == NULL) {
-                    return ENOMEM;
-                }
-                
+            if(outSize < needed + trailerLength) {
+                *outLengthPtr = needed + trailerLength;
+                return ENOSPC;
+            }
+
+            putHere = outBuf;
+            if(eD->used != 0) {
                 uuencode(eD->buffer, putHere, eD->used);
                 putHere += needed;
-                *outLength = trailerLength + needed;
             }
+            *outLengthPtr = trailerLength + needed;
             
             memcpy(putHere, trailer, trailerLength);
 
             eD->trailerOutput = 1;
-        } else {
-            if(mode == DP_FILTER_EOF) {
-                *outLength = 0;
-            }
         }
 
         if(mode == DP_FILTER_CLOSE) {
@@ -851,9 +1255,7 @@ Uuencode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
     case DP_FILTER_GET: 
       
-        *outBuf = "{no internal arguments}";
-      
-        break;
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
 
     default:
 
@@ -875,18 +1277,13 @@ uuencode (from, to, howMany)
     unsigned char *to;       /* (in) Where to put the encoded data to. */
     int            howMany;  /* (in) Number of bytes to encode. */
 {
-    int i;
+    int groups = (howMany + 2) / 3;
 
     *to++ = howMany + ' ';
 
-    for(i = 0; i < howMany; i += 3) {
-        *to++ = (from[i] >> 2) + ' ';
-        *to++ = (((from[i] & 0x03) << 4) | (from[i+1] >> 4)) + ' '; 
-        *to++ = (((from[i+1] & 0x0f) << 2) | (from[i+2] >> 6)) + ' ';
-        *to++ = (from[i+2] & 0x3f) + ' ';
-    }
+    DpUuencodeGroups(to, from, groups);
 
-    *to = '\n';
+    to[4 * groups] = '\n';
 
     return;
 }
@@ -904,21 +1301,24 @@ uuencode (from, to, howMany)
  * Results:
  *
  *	0 if everything is OK, a POSIX error code if there was an error.
+ *	ENOSPC if the decoded lines don't fit in outBuf.
  *
  * Side effects:
  *
- *	Allocates memory for the filtered output. Manages dynamic local
- *      datastructure (decodeData).
+ *	Manages dynamic local datastructure (decodeData).
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+Uudecode  (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
@@ -940,7 +1340,7 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
     }
         decodeData;
 
-    int maxSpaceNeeded;
+    int maxSpaceNeeded, total = inLength;
 
     decodeData *dD;
 
@@ -978,6 +1378,14 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
         while(!(dD->headerSeen)) {
 
+            /* Nothing to look at until more input arrives. */
+            if(inLength == 0) {
+
+                *inUsedPtr = total;
+
+                return 0;
+            }
+
             if(dD->justWaitForEOL) {
 
                 /* Either we already identified the "begin XXX " part header, 
@@ -1006,8 +1414,7 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
                 /* No more input, but no output yet. */
                 if(inLength == 0) {
 
-                    *outBuf = NULL;
-                    *outLength = 0;
+                    *inUsedPtr = total;
 
                     return 0;
                 }
@@ -1061,26 +1468,28 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
         /* No output will be generated after the end marker was found. */
         if(dD->endSeen) {
 
-            *outBuf = NULL;
-            *outLength = 0;
+            *inUsedPtr = total;
 
             break;
         }
 
-        /* Alloc all the space that might be needed in conversion: round up to
-         * the next multiple of 4 for the input, and see how much output could
-         * that produce.
+        /* Make sure there is room for all the output that might be
+         * generated: round up to the next multiple of 4 for the input, and
+         * see how much output could that produce. If the header was just
+         * consumed, report that first so the state stays consistent.
          */
 
         maxSpaceNeeded = ((dD->used + inLength + 3) / 4) * 3;
-        *outBuf = (char *)ckalloc(maxSpaceNeeded);
 
-        if(*outBuf == NULL) {
-            return ENOMEM;
+        if(outSize < maxSpaceNeeded) {
+            if(inLength < total) {
+                *inUsedPtr = total - inLength;
+                return 0;
+            }
+            *outLengthPtr = maxSpaceNeeded;
+            return ENOSPC;
         }
 
-        *outLength = 0;
-
         while(inLength > 0) {
 
             int i, eolSeen, lineLength;
@@ -1115,6 +1524,7 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
                     /* Reset filter data, so that recovery is possible. */
                     dD->used = 0;
+                    *outLengthPtr = 0;
 
                     return EINVAL;
                 }
@@ -1126,16 +1536,12 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
                     /* Yes. This is the ending line of the uuencode file. */
                     dD->endSeen = 1;
 
-                    if(*outLength == 0) {
-                        ckfree(*outBuf);
-                    }
-
                     break;
                 }
                 
                 /* No. This is a genuine data line. */
-                uudecode(dD->buffer + 1, *outBuf + *outLength, dD->used - 2);
-                *outLength += lineLength;
+                uudecode(dD->buffer + 1, outBuf + *outLengthPtr, dD->used - 2);
+                *outLengthPtr += lineLength;
                 dD->used = 0;
                 
             } else {
@@ -1144,13 +1550,10 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
                     /* The line is too long; this is an error. */
 
-                    ckfree(*outBuf);
-
                     /* Reset filter data, so that recovery is possible. */
                     dD->used = 0;
 
-                    *outBuf = 0;
-                    *outLength = 0;
+                    *outLengthPtr = 0;
 
                     return EINVAL;
 
@@ -1160,7 +1563,6 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
                     memcpy(dD->buffer + dD->used, inBuf, inLength);
                     dD->used += inLength;
                     inLength = 0;
-                    inBuf += inLength;
 
                 }
 
@@ -1168,6 +1570,8 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
         }
 
+        *inUsedPtr = total;
+
         break;
 
 
@@ -1177,9 +1581,6 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
          * have been incomplete), if it exists in the buffer, is ignored.
          */
         
-        *outBuf = NULL;
-        *outLength = 0;
-
         ckfree((void *)dD);
         *data = NULL;
 
@@ -1194,9 +1595,7 @@ Uudecode  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
   case DP_FILTER_GET: 
       
-      *outBuf = "{no internal arguments}";
-      
-      break;
+      return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
 
   default:
 
@@ -1221,13 +1620,7 @@ uudecode (from, to, howMany)
     unsigned char *to;       /* (in) Where to put the encoded data to. */
     int            howMany;  /* (in) Number of bytes to decode. */
 {
-    int i;
-
-    for(i = 0; i < howMany; i += 4) {
-        *to++ = ((from[i] - ' ') << 2) | ((from[i+1] - ' ') >> 4);
-        *to++ = ((from[i+1] - ' ') << 4) | ((from[i+2] - ' ') >> 2);
-        *to++ = ((from[i+2] - ' ') << 6) | (from[i+3] - ' ');
-    }
+    DpUudecodeGroups(to, from, (howMany + 3) / 4);
 
     return;
 }
@@ -1247,46 +1640,62 @@ uudecode (from, to, howMany)
  *	can have the values "normal", "flush", "close", "eof". The output value is a
  *	string that will be returned as a result (the output can have length 0).
  *	Arguments: the name of the tcl command must be setup before the first use.
+ *	The name can also be a list, a command prefix to which the two
+ *	arguments are appended.
+ *
+ *	The input is passed as a byte array and the result is taken as one,
+ *	so the procedure sees and returns binary data unchanged, and neither
+ *	is parsed as a script.
  *
  * Results:
  *
  *	0 if everything is OK, a POSIX error code if there was an error.
+ *	ENOSPC if the result does not fit in outBuf; the result is kept,
+ *	and handed out by the next call instead of calling the procedure
+ *	again.
  *
  * Side effects:
  *
- *	Allocates memory for the filtered output. Manages dynamic local
+ *	Whatever the tcl procedure does. Manages dynamic local
  *      datastructure (tclData).
  *
  *----------------------------------------------------------------------------- 
  */
 
 int
-TclFilter (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+TclFilter (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
-			   /*       close modes. Ignored in this case.      */
+			   /*       close modes. */
 {
 
-#define BUFFER_CHUNK  4096
-
 typedef struct {
-    char *buffer;    /* Stores the name of the Tcl commmand. */
-    char *cmd;       /* Buffer for creating the Tcl comand. */
-    int   cmdLength; /* Length of command buffer. */
+    Tcl_Obj *prefix;   /* The name of the Tcl command, as a list. */
+    Tcl_Obj *outObj;   /* Result that did not fit in outBuf, or NULL. */
 } tclData;
 
     char *modeStr;
-    int   temp, needed;
+    unsigned char *bytes;
+    int   prefixc, objc, i, length, error;
+    Tcl_Obj **prefixv, **objv;
+    Tcl_Obj *staticObjv[8];
     tclData *tD;
 
     if(*data == NULL) {
     
         /* No filter specific data was allocated. */
+
+        if(mode == DP_FILTER_CLOSE) {
+            return 0;
+        }
     
         tD = (tclData *)ckalloc(sizeof(tclData));
         if(tD == NULL) {
@@ -1295,9 +1704,8 @@ typedef struct {
     
         *data = (void *)tD;
 
-        tD->buffer    = NULL;
-        tD->cmd       = NULL;
-        tD->cmdLength = 0;
+        tD->prefix = NULL;
+        tD->outObj = NULL;
     
     } else {
         tD = (tclData *)(*data);
@@ -1326,7 +1734,7 @@ typedef struct {
 	    break;
 
 	case DP_FILTER_SET:
-	    if(tD->buffer != NULL) {
+	    if(tD->prefix != NULL) {
 		/* We do not allow for the change of the tcl filter. */
 		return EINVAL;
 	    }
@@ -1334,101 +1742,120 @@ typedef struct {
 		/* We do not allow for null-length procedure name. */
 		return EINVAL;
 	    }
-	    tD->buffer = (char *)ckalloc(inLength + 1);
-	    memcpy(tD->buffer, inBuf, inLength);
-	    (tD->buffer)[inLength] = '\0';
+	    tD->prefix = Tcl_NewStringObj(inBuf, inLength);
+	    Tcl_IncrRefCount(tD->prefix);
+	    if((Tcl_ListObjLength(NULL, tD->prefix, &length) != TCL_OK)
+		    || (length == 0)) {
+		Tcl_DecrRefCount(tD->prefix);
+		tD->prefix = NULL;
+		return EINVAL;
+	    }
 	    return 0;
 
 	case DP_FILTER_GET:
-	    if(tD->buffer == NULL) {
-		*outBuf = "{tcl filter name not set}";
-	    } else {
-		*outBuf = tD->buffer;
+	    if(tD->prefix == NULL) {
+		return FilterGetString("{tcl filter name not set}", -1,
+			outBuf, outSize, outLengthPtr);
 	    }
-	    return 0;
+	    return FilterGetString(Tcl_GetString(tD->prefix), -1,
+		    outBuf, outSize, outLengthPtr);
+
 	default:
 	    return EINVAL;
     } 
 
-    /* Refuse to do filtering if the name of the Tcl procedure was not given. */
+    error = 0;
 
-    if(tD->buffer == NULL) {
-	return EINVAL;
-    }
-
-    temp = strlen(tD->buffer);
+    if(tD->outObj == NULL) {
 
-    /* 6 = max{strlen(modeStr)}; 3 = number of spaces; 1 = space for '\0' */
-    needed = temp + inLength + 3 + 6 + 1;
-
-    /* Do we have enough place to create the command? */
+        if(tD->prefix == NULL) {
+            /*
+             * Refuse to do filtering if the name of the Tcl procedure was
+             * not given; there is nothing to clean up at close, though.
+             */
 
-    if(tD->cmdLength < needed) {
+            error = EINVAL;
+        } else {
+            Tcl_ListObjGetElements(NULL, tD->prefix, &prefixc, &prefixv);
+            objc = prefixc + 2;
+            if(objc <= (int) (sizeof(staticObjv) / sizeof(Tcl_Obj *))) {
+                objv = staticObjv;
+            } else {
+                objv = (Tcl_Obj **) ckalloc(objc * sizeof(Tcl_Obj *));
+            }
+            for(i = 0; i < prefixc; i++) {
+                objv[i] = prefixv[i];
+            }
+            objv[prefixc] = Tcl_NewByteArrayObj((unsigned char *) inBuf,
+                    inLength);
+            objv[prefixc + 1] = Tcl_NewStringObj(modeStr, -1);
+            for(i = 0; i < objc; i++) {
+                Tcl_IncrRefCount(objv[i]);
+            }
 
-        /* No. */
+            if(Tcl_EvalObjv(interp, objc, objv, TCL_EVAL_GLOBAL) != TCL_OK) {
+                error = EINVAL;
+            } else {
+                tD->outObj = Tcl_GetObjResult(interp);
+                Tcl_IncrRefCount(tD->outObj);
+                Tcl_ResetResult(interp);
+            }
 
-        if(tD->cmd != NULL) {
-            ckfree(tD->cmd);
+            for(i = 0; i < objc; i++) {
+                Tcl_DecrRefCount(objv[i]);
+            }
+            if(objv != staticObjv) {
+                ckfree((char *) objv);
+            }
         }
 
-        tD->cmd = (char *)ckalloc(needed + BUFFER_CHUNK);
-        
-        if(tD->cmd == NULL) {
-            tD->cmdLength = 0;
-            return ENOMEM;
+        if((error != 0) && (mode != DP_FILTER_CLOSE)) {
+            return error;
         }
-
-        tD->cmdLength = needed + BUFFER_CHUNK;
-
-    }
-        
-    /* Create the Tcl command. */
-
-    memcpy(tD->cmd, tD->buffer, temp);
-    (tD->cmd)[temp] = ' ';
-    if(inLength == 0) {
-        memcpy(tD->cmd + temp + 1, "\"\"", 2);
-        inLength = 2;
-    } else {
-        memcpy(tD->cmd + temp + 1, inBuf, inLength);
-    }
-    (tD->cmd)[temp + 1 + inLength] = ' ';
-    memcpy(tD->cmd + temp + 1 + inLength + 1, modeStr, strlen(modeStr));
-    (tD->cmd)[temp + 1 + inLength + 1 + strlen(modeStr)] = '\0';
-
-    if(Tcl_GlobalEval(interp, tD->cmd) != TCL_OK) {
-        return EINVAL;
     }
 
-    /* Reserve the space for the result. */
-    needed = strlen(Tcl_GetStringResult(interp));
-
-    if(needed > 0) {
-        *outBuf = (char *)ckalloc(needed);
-
-        if(*outBuf == NULL) {
-            return ENOMEM;
+    if(tD->outObj != NULL) {
+        bytes = Tcl_GetByteArrayFromObj(tD->outObj, &length);
+        if(length > outSize) {
+            *outLengthPtr = length;
+            return ENOSPC;
         }
-	*outLength = needed;
-	memcpy(*outBuf, Tcl_GetStringResult(interp), needed);
+        memcpy(outBuf, bytes, length);
+        *outLengthPtr = length;
+        Tcl_DecrRefCount(tD->outObj);
+        tD->outObj = NULL;
     }
+    *inUsedPtr = inLength;
 
     if(mode == DP_FILTER_CLOSE) {
         /* This was the last call; free filter data. */
-        if(tD->cmd != NULL) {
-            ckfree(tD->cmd);
-        }
 
-        if(tD->buffer != NULL) {
-            ckfree(tD->buffer);
+        if(tD->prefix != NULL) {
+            Tcl_DecrRefCount(tD->prefix);
         }
         ckfree((void *)tD);
+        *data = NULL;
     }
 
-    return 0;
+    return error;
+}
 
-#undef BUFFER_CHUNK
+/*
+ * Value of a hex digit, or -1.
+ */
 
+static int
+HexDigit(c)
+    int c;
+{
+    c = (unsigned char) c;
+    if(isdigit(c)) {
+        return c - '0';
+    }
+    if(isxdigit(c)) {
+        return tolower(c) - 'a' + 10;
+    }
+    return -1;
 }
 
 /*
@@ -1439,7 +1866,8 @@ typedef struct {
  *	Converts a string containg characters that correspond to hexadecimal
  *	digits, into a sequence of bytes consisting of the binary representation
  *	of the given hexadecimal symbols. Each byte will contain two hexadecimal
- *	codes; the length of the input string has to be even.
+ *	codes. If the input ends in the middle of a pair, the odd digit is kept
+ *	until the next call; the stream as a whole has to have an even length.
  *
  * Results:
  *
@@ -1447,24 +1875,32 @@ typedef struct {
  *
  * Side effects:
  *
- *	Allocates memory for output.
+ *	May keep one digit in the filter data.
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-HexOut  (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+HexOut  (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
-			   /*       close modes. Ignored in this case.      */
+			   /*       close modes. */
 {
-    int  i, j;
-    unsigned char t1, t2;
+    /*
+     * *data points to the value of a digit left over from the last call,
+     * if there is one.
+     */
+
+    int *pending = (int *) *data;
+    int  i, j, n, t;
 
     switch(mode) {
 
@@ -1472,49 +1908,67 @@ HexOut  (inBuf, inLength, outBuf, outLength, data, interp, mode)
     case DP_FILTER_FLUSH:
     case DP_FILTER_EOF:
 
-        if(inLength % 2 != 0) {
-            return EINVAL;
-        }
-
-	if(inLength == 0) {
-	  *outBuf = 0;
-	  return 0;
-	}
+        i = 0;
+        j = 0;
 
-        *outBuf = (char *)ckalloc(inLength / 2);
+        /* Finish the pair started by the last call. */
 
-        if(*outBuf == NULL) {
-            return EINVAL;
+        if((pending != NULL) && (*pending >= 0) && (inLength > 0)
+                && (outSize > 0)) {
+            t = HexDigit(inBuf[0]);
+            if(t < 0) {
+                return EINVAL;
+            }
+            outBuf[j++] = (char) ((*pending << 4) | t);
+            *pending = -1;
+            i++;
         }
 
-        *outLength = inLength / 2;
+        /* Whole pairs. */
 
-        for(i = 0, j = 0; i < inLength; i += 2, j++) {
-            if(isxdigit(inBuf[i]) && isxdigit(inBuf[i+1])) {
-                if(isdigit(inBuf[i])) {
-                    t1 = inBuf[i] - '0';
-                } else {
-                    t1 = tolower(inBuf[i]) - 'a' + 10;
-                }
-                if(isdigit(inBuf[i + 1])) {
-                    t2 = inBuf[i + 1] - '0';
-                } else {
-                    t2 = tolower(inBuf[i + 1]) - 'a' + 10;
-                }
+        n = (inLength - i) / 2;
+        if(n > outSize - j) {
+            n = outSize - j;
+        }
+        if(DpHexDecode((unsigned char *) outBuf + j,
+                (unsigned char *) inBuf + i, n) != n) {
+            return EINVAL;
+        }
+        i += 2 * n;
+        j += n;
 
-                (*outBuf)[j] = (t1 << 4) | t2;
+        /* Keep an odd digit for the next call. */
 
-            } else {
+        if(inLength - i == 1) {
+            t = HexDigit(inBuf[i]);
+            if(t < 0) {
                 return EINVAL;
             }
+            if(pending == NULL) {
+                pending = (int *) ckalloc(sizeof(int));
+                *data = (void *) pending;
+            }
+            *pending = t;
+            i++;
+        }
+
+        *inUsedPtr = i;
+        *outLengthPtr = j;
+
+        if((mode == DP_FILTER_EOF) && (i == inLength) && (pending != NULL)
+                && (*pending >= 0)) {
+            return EINVAL;
         }
 
         break;
 
     case DP_FILTER_CLOSE:
- 
-       *outLength = 0;
-       break;
+
+        if(pending != NULL) {
+            ckfree((char *) pending);
+            *data = NULL;
+        }
+        break;
 
     case DP_FILTER_SET:
 
@@ -1522,7 +1976,7 @@ HexOut  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
     case DP_FILTER_GET:
 
-        *outBuf = "{no internal arguments}";
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
 
     default:
         
@@ -1547,26 +2001,26 @@ HexOut  (inBuf, inLength, outBuf, outLength, data, interp, mode)
  *
  * Side effects:
  *
- *	Allocates memory for output.
+ *	None.
  *
  *----------------------------------------------------------------------------- 
  */
 	/* ARGSUSED */ 
 int
-HexIn  (inBuf, inLength, outBuf, outLength, data, interp, mode)
-	char  *inBuf;	   /* (in)  Data to be filtered. */ 
+HexIn  (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
 	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
-	char **outBuf;     /* (out) Address where the filtered data is stored. */
-	int   *outLength;  /* (out) Amount of filtered data. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
 	void **data;       /* (in)  Place where filter function data is stored. */
 	Tcl_Interp *interp;/* (in)  Interpreter in which the filter was created. */
 	int    mode;       /* (in)  Distinguishes between normal, flush and */
 			   /*       close modes. Ignored in this case.      */
 {
-    int  i, j;
-    unsigned char t1, t2;
-
-    char *TranslationTable = "0123456789abcdef";
+    int  n;
 
 
     switch(mode) {
@@ -1575,29 +2029,17 @@ HexIn  (inBuf, inLength, outBuf, outLength, data, interp, mode)
     case DP_FILTER_FLUSH:
     case DP_FILTER_EOF:
 
-	if(inLength == 0) {
-	  *outBuf = 0;
-	  return 0;
-	}
-
-        *outBuf = (char *)ckalloc(2 * inLength);
+        n = (inLength < outSize / 2) ? inLength : outSize / 2;
 
-        if(*outBuf == NULL) {
-            return EINVAL;
-        }
+        DpHexEncode((unsigned char *) outBuf, (unsigned char *) inBuf, n);
 
-        *outLength = 2 * inLength;
-
-        for(i = 0, j = 0; i < inLength; i++, j += 2) {
-            (*outBuf)[j]   = TranslationTable[((unsigned char)(inBuf[i])) >> 4];
-            (*outBuf)[j + 1] = TranslationTable[inBuf[i] & 0x0F];
-        }
+        *inUsedPtr = n;
+        *outLengthPtr = 2 * n;
 
         break;
 
     case DP_FILTER_CLOSE:
  
-       *outLength = 0;
        break;
 
     case DP_FILTER_SET:
@@ -1606,7 +2048,7 @@ HexIn  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
     case DP_FILTER_GET:
 
-        *outBuf = "{no internal arguments}";
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
 
     default:
         
@@ -1618,3 +2060,306 @@ HexIn  (inBuf, inLength, outBuf, outLength, data, interp, mode)
 
 }
 
+#ifdef DP_ZLIB_FILTERS
+
+/*
+ * The compression filters are built on the zlib streams of Tcl 8.6.
+ * deflate and inflate use the raw deflate format (as "zlib deflate"
+ * does), gzip and gunzip the gzip format.
+ */
+
+typedef struct {
+    Tcl_ZlibStream zs;	    /* The stream; NULL until data arrives. */
+    int      level;	    /* Compression level, 0 to 9. */
+    int      finished;	    /* The stream was finalized. */
+    Tcl_Obj *outObj;	    /* Output that did not fit in outBuf, or NULL. */
+} zlibFilterData;
+
+static int ZlibFilter _ANSI_ARGS_((CONST84 char *inBuf, int inLength,
+				int *inUsedPtr, char *outBuf, int outSize,
+				int *outLengthPtr, void **data, int mode,
+				int streamMode, int format));
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ZlibFilter --
+ *
+ *	Compresses or decompresses data with a Tcl zlib stream. The input
+ *	is always consumed completely. DP_FILTER_FLUSH flushes the
+ *	compressor (Z_SYNC_FLUSH); DP_FILTER_EOF and DP_FILTER_CLOSE
+ *	finish the compressed stream (Z_FINISH).
+ *
+ *	If the output does not fit in outBuf, it is kept and ENOSPC is
+ *	returned; the channel then calls again with the same input and a
+ *	larger buffer, and the kept output is returned instead of feeding
+ *	the input to the stream a second time.
+ *
+ * Results:
+ *
+ *	0 if everything is OK, a POSIX error code if there was an error.
+ *
+ * Side effects:
+ *
+ *	Creates the stream on first use, frees it on DP_FILTER_CLOSE.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+ZlibFilter (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	mode, streamMode, format)
+	CONST84 char *inBuf; /* (in)  Data to be filtered. */ 
+	int    inLength;   /* (in)  Amount of data to be filtered in bytes. */
+	int   *inUsedPtr;  /* (out) Amount of data consumed. */
+	char  *outBuf;     /* (in)  Where to store the filtered data. */
+	int    outSize;    /* (in)  Room in outBuf. */
+	int   *outLengthPtr; /* (out) Amount of filtered data. */
+	void **data;       /* (in)  Place where filter function data is stored. */
+	int    mode;       /* (in)  Distinguishes between normal, flush and */
+			   /*       close modes. */
+	int    streamMode; /* (in)  TCL_ZLIB_STREAM_DEFLATE or _INFLATE. */
+	int    format;     /* (in)  TCL_ZLIB_FORMAT_RAW or _GZIP. */
+{
+    zlibFilterData *zD = (zlibFilterData *) *data;
+    Tcl_Obj *inObj;
+    unsigned char *bytes;
+    int flush, length, before, error;
+
+    if(zD == NULL) {
+        if(mode == DP_FILTER_CLOSE) {
+            return 0;
+        }
+        zD = (zlibFilterData *) ckalloc(sizeof(zlibFilterData));
+        zD->zs = NULL;
+        zD->level = 6;
+        zD->finished = 0;
+        zD->outObj = NULL;
+        *data = (void *) zD;
+    }
+
+    switch(mode) {
+
+    case DP_FILTER_NORMAL:
+    case DP_FILTER_FLUSH:
+    case DP_FILTER_EOF:
+    case DP_FILTER_CLOSE:
+
+        error = 0;
+
+        if(zD->outObj == NULL) {
+            if(zD->zs == NULL) {
+                if(Tcl_ZlibStreamInit(NULL, streamMode, format, zD->level,
+                        NULL, &(zD->zs)) != TCL_OK) {
+                    zD->zs = NULL;
+                    return ENOMEM;
+                }
+            }
+
+            /*
+             * The inflater works out for itself where the data ends.
+             */
+
+            if(streamMode == TCL_ZLIB_STREAM_INFLATE) {
+                flush = TCL_ZLIB_NO_FLUSH;
+            } else if(mode == DP_FILTER_FLUSH) {
+                flush = TCL_ZLIB_FLUSH;
+            } else if((mode == DP_FILTER_EOF) || (mode == DP_FILTER_CLOSE)) {
+                flush = TCL_ZLIB_FINALIZE;
+            } else {
+                flush = TCL_ZLIB_NO_FLUSH;
+            }
+
+            if(zD->finished) {
+                if(inLength > 0) {
+                    return EINVAL;
+                }
+            } else if((inLength > 0) || (flush != TCL_ZLIB_NO_FLUSH)) {
+                inObj = Tcl_NewByteArrayObj((unsigned char *) inBuf, inLength);
+                Tcl_IncrRefCount(inObj);
+                if(Tcl_ZlibStreamPut(zD->zs, inObj, flush) != TCL_OK) {
+                    error = EINVAL;
+                }
+                Tcl_DecrRefCount(inObj);
+                if(flush == TCL_ZLIB_FINALIZE) {
+                    zD->finished = 1;
+                }
+            }
+
+            /*
+             * Tcl_ZlibStreamGet hands out at most 64K of inflated data at
+             * a time, so collect until it has no more.
+             */
+
+            zD->outObj = Tcl_NewObj();
+            Tcl_IncrRefCount(zD->outObj);
+            length = 0;
+            while(error == 0) {
+                before = length;
+                if(Tcl_ZlibStreamGet(zD->zs, zD->outObj, -1) != TCL_OK) {
+                    error = EINVAL;
+                    break;
+                }
+                Tcl_GetByteArrayFromObj(zD->outObj, &length);
+                if(length == before) {
+                    break;
+                }
+            }
+            if(error != 0) {
+                Tcl_DecrRefCount(zD->outObj);
+                zD->outObj = NULL;
+                if(mode != DP_FILTER_CLOSE) {
+                    return error;
+                }
+            }
+        }
+
+        if(zD->outObj != NULL) {
+            bytes = Tcl_GetByteArrayFromObj(zD->outObj, &length);
+            if(length > outSize) {
+                *outLengthPtr = length;
+                return ENOSPC;
+            }
+            memcpy(outBuf, bytes, length);
+            *outLengthPtr = length;
+            Tcl_DecrRefCount(zD->outObj);
+            zD->outObj = NULL;
+        }
+        *inUsedPtr = inLength;
+
+        if(mode == DP_FILTER_CLOSE) {
+            Tcl_ZlibStreamClose(zD->zs);
+            ckfree((char *) zD);
+            *data = NULL;
+            return error;
+        }
+
+        break;
+
+    case DP_FILTER_SET:
+
+        /* Set the compression level, before any data is compressed. */
+
+        if((streamMode != TCL_ZLIB_STREAM_DEFLATE) || (zD->zs != NULL)
+                || (inLength != 1) || (inBuf[0] < '0') || (inBuf[0] > '9')) {
+            return EINVAL;
+        }
+        zD->level = inBuf[0] - '0';
+
+        break;
+
+    case DP_FILTER_GET:
+
+        if(streamMode == TCL_ZLIB_STREAM_DEFLATE) {
+            char level[TCL_INTEGER_SPACE];
+
+            sprintf(level, "%d", zD->level);
+            return FilterGetString(level, -1, outBuf, outSize, outLengthPtr);
+        }
+        return FilterGetString(noArgs, -1, outBuf, outSize, outLengthPtr);
+
+    default:
+
+        return EINVAL;
+
+    }
+
+    return 0;
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Deflate, Inflate, Gzip, Gunzip --
+ *
+ *	Compress to and decompress from the raw deflate and the gzip
+ *	formats. The compression level (0 to 9, 6 by default) can be set
+ *	with -inset or -outset before the first data is filtered.
+ *
+ * Results:
+ *
+ *	0 if everything is OK, a POSIX error code if there was an error.
+ *
+ * Side effects:
+ *
+ *	See ZlibFilter.
+ *
+ *-----------------------------------------------------------------------------
+ */
+	/* ARGSUSED */
+int
+Deflate (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf;
+	int    inLength;
+	int   *inUsedPtr;
+	char  *outBuf;
+	int    outSize;
+	int   *outLengthPtr;
+	void **data;
+	Tcl_Interp *interp;
+	int    mode;
+{
+    return ZlibFilter(inBuf, inLength, inUsedPtr, outBuf, outSize,
+	    outLengthPtr, data, mode, TCL_ZLIB_STREAM_DEFLATE,
+	    TCL_ZLIB_FORMAT_RAW);
+}
+
+	/* ARGSUSED */
+int
+Inflate (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf;
+	int    inLength;
+	int   *inUsedPtr;
+	char  *outBuf;
+	int    outSize;
+	int   *outLengthPtr;
+	void **data;
+	Tcl_Interp *interp;
+	int    mode;
+{
+    return ZlibFilter(inBuf, inLength, inUsedPtr, outBuf, outSize,
+	    outLengthPtr, data, mode, TCL_ZLIB_STREAM_INFLATE,
+	    TCL_ZLIB_FORMAT_RAW);
+}
+
+	/* ARGSUSED */
+int
+Gzip (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf;
+	int    inLength;
+	int   *inUsedPtr;
+	char  *outBuf;
+	int    outSize;
+	int   *outLengthPtr;
+	void **data;
+	Tcl_Interp *interp;
+	int    mode;
+{
+    return ZlibFilter(inBuf, inLength, inUsedPtr, outBuf, outSize,
+	    outLengthPtr, data, mode, TCL_ZLIB_STREAM_DEFLATE,
+	    TCL_ZLIB_FORMAT_GZIP);
+}
+
+	/* ARGSUSED */
+int
+Gunzip (inBuf, inLength, inUsedPtr, outBuf, outSize, outLengthPtr, data,
+	interp, mode)
+	CONST84 char *inBuf;
+	int    inLength;
+	int   *inUsedPtr;
+	char  *outBuf;
+	int    outSize;
+	int   *outLengthPtr;
+	void **data;
+	Tcl_Interp *interp;
+	int    mode;
+{
+    return ZlibFilter(inBuf, inLength, inUsedPtr, outBuf, outSize,
+	    outLengthPtr, data, mode, TCL_ZLIB_STREAM_INFLATE,
+	    TCL_ZLIB_FORMAT_GZIP);
+}
+
+#endif /* DP_ZLIB_FILTERS */
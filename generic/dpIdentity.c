@@ -89,7 +89,7 @@ Tcl_ChannelType idChannelType = {
     NULL,	/* Proc to set blocking mode on socket */
     /* Only valid in TCL_CHANNEL_VERSION_2 channels or later */
     NULL,			/* Proc to call to flush a channel */
-    NULL,			/* Proc to call to handle a channel event */
+    DpStackHandler,		/* Proc to call to handle a channel event */
     /* Only valid in TCL_CHANNEL_VERSION_3 channels or later */
     NULL,			/* Proc to call to seek on the channel which can handle 64-bit offsets */
     /* Only valid in TCL_CHANNEL_VERSION_4 channels or later */
@@ -108,6 +108,9 @@ typedef struct {
 
     /* If peek = 0 consume input, otherwise not. */
     int         peek;
+
+    /* Set if the channel is stacked on the subordinated one. */
+    DpStack     stack;
 }
     IdentityInfo;
 
@@ -140,7 +143,7 @@ DpCreateIdChannel (interp, argc, argv)
     CONST84 char **argv;    /* (in) Argument strings. */
 {
     static int    openedChannels = 0;
-    int           i;
+    int           i, stacked;
     IdentityInfo *instanceData;
     Tcl_Channel   newChannel;
     char          chanName [20];
@@ -155,6 +158,9 @@ DpCreateIdChannel (interp, argc, argv)
     }
 
     instanceData->channelPtr = NULL;
+    instanceData->stack.self = NULL;
+    instanceData->stack.timer = NULL;
+    stacked = 0;
 
     for (i = 0; i < argc; i += 2) {
         int v = i+1;
@@ -170,6 +176,14 @@ DpCreateIdChannel (interp, argc, argv)
             if(instanceData->channelPtr == NULL) {
                 goto error1;
             }
+	} else if (strncmp(argv[i], "-stack", len)==0) {
+	    if (v == argc) {
+                goto error2;
+            }
+
+            if (Tcl_GetBoolean(interp, argv[v], &stacked) != TCL_OK) {
+                goto error1;
+            }
 	} else {
     	    Tcl_AppendResult(interp, "unknown option \"",
                              argv[i], "\", must be -channel", NULL);
@@ -186,6 +200,15 @@ DpCreateIdChannel (interp, argc, argv)
     /* No peek by default. */
     instanceData->peek = 0;
 
+    if (stacked) {
+        newChannel = DpStackChannel(interp, &idChannelType,
+		(ClientData)instanceData, TCL_READABLE | TCL_WRITABLE,
+		instanceData->channelPtr, &(instanceData->stack));
+        if (newChannel == NULL) {
+            goto error1;
+        }
+        return newChannel;
+    }
 
     /* Identity filters are both readable and writable. */
     sprintf(chanName, "idfilter%d", openedChannels++);
@@ -235,6 +258,7 @@ CloseIdChannel (instanceData, interp)
     ClientData  instanceData;  /* (in) Pointer to IdentityInfo struct. */
     Tcl_Interp *interp;        /* Pointer to the tcl interpreter. */
 {
+    DpStackRelease(&(((IdentityInfo *)instanceData)->stack));
     ckfree((char *)instanceData);
     return 0;
 }
@@ -272,7 +296,8 @@ InputIdChannel (instanceData, buf, bufsize, errorCodePtr)
 
     Tcl_Channel channelPtr = ((IdentityInfo *)instanceData)->channelPtr;
 
-    tmp = Tcl_Read(channelPtr, buf, bufsize);
+    tmp = DpStackRead(&(((IdentityInfo *)instanceData)->stack), channelPtr,
+	    buf, bufsize);
 
     if(tmp == -1) {
         *errorCodePtr = Tcl_GetErrno();
@@ -315,7 +340,8 @@ OutputIdChannel	(instanceData, buf, toWrite, errorCodePtr)
 
     Tcl_Channel channelPtr = ((IdentityInfo *)instanceData)->channelPtr;
 
-    tmp = Tcl_Write(channelPtr, buf, toWrite);
+    tmp = DpStackWrite(&(((IdentityInfo *)instanceData)->stack), channelPtr,
+	    buf, toWrite);
 
     if(tmp == -1) {
         *errorCodePtr = Tcl_GetErrno();
@@ -354,6 +380,11 @@ GFPIdChannel (instanceData, direction, handlePtr)
     int		direction;
     FileHandle *handlePtr;
 {
+    IdentityInfo *data = (IdentityInfo *)instanceData;
+
+    if (data->stack.self != NULL) {
+	return Tcl_GetChannelHandle(data->channelPtr, direction, handlePtr);
+    }
     *handlePtr = NULL;
     return TCL_OK;
 }
@@ -442,7 +473,17 @@ SOPIdChannel (instanceData, interp, optionName, optionValue)
 			 "is opened", NULL);
 	return TCL_ERROR;
 
+    case DP_STACK:
+
+	Tcl_AppendResult(interp, "can't set stack after identity channel ",
+			 "is opened", NULL);
+	return TCL_ERROR;
+
     default:
+        if (data.stack.self != NULL) {
+	    return DpStackSetOption(data.channelPtr, interp, optionName,
+		    optionValue);
+        }
         Tcl_AppendResult (interp, "illegal option \"", optionName, "\" -- ",
 			  "must be peek, or a standard fconfigure option", NULL);
         return TCL_ERROR;
@@ -502,6 +543,12 @@ GOPIdChannel (instanceData,
 	IGO (instanceData, "-channel", dsPtr);
      	Tcl_DStringAppend (dsPtr, " -peek ", -1);
 	IGO (instanceData, "-peek", dsPtr);
+     	Tcl_DStringAppend (dsPtr, " -stack ", -1);
+	IGO (instanceData, "-stack", dsPtr);
+        if (((IdentityInfo *)instanceData)->stack.self != NULL) {
+	    return DpStackGetOption(((IdentityInfo *)instanceData)->channelPtr,
+		    interp, NULL, dsPtr);
+        }
         return TCL_OK;
     }
 #undef IGO
@@ -533,7 +580,20 @@ GOPIdChannel (instanceData,
 	    Tcl_GetChannelName(((IdentityInfo *)instanceData)->channelPtr), -1);
         break;
 
+    case DP_STACK:
+
+        if (((IdentityInfo *)instanceData)->stack.self != NULL) {
+            Tcl_DStringAppend (dsPtr, "1", -1);
+        } else {
+            Tcl_DStringAppend (dsPtr, "0", -1);
+        }
+        break;
+
     default:
+        if (((IdentityInfo *)instanceData)->stack.self != NULL) {
+	    return DpStackGetOption(((IdentityInfo *)instanceData)->channelPtr,
+		    interp, optionName, dsPtr);
+        }
 #ifndef _TCL76
 	Tcl_AppendResult(interp,
 		"bad option \"", optionName,"\": must be -blocking,",
@@ -591,6 +651,11 @@ WCPIdChannel (instanceData, mask)
 #ifdef _TCL76
     (Tcl_GetChannelType(channelPtr)->watchChannelProc)
                          (Tcl_GetChannelInstanceData(channelPtr), mask);
+#else
+    if (((IdentityInfo *)instanceData)->stack.self != NULL) {
+	DpStackWatch(&(((IdentityInfo *)instanceData)->stack), channelPtr,
+		mask, 0);
+    }
 #endif
 
     return;
@@ -29,15 +29,40 @@ static DpCmd commands[] = {
     {"dp_connect",	Dp_ConnectCmd},
     {"dp_copy",		Dp_CopyCmd},
     {"dp_netinfo",	Dp_NetInfoCmd},
+    {"dp_resolve",	Dp_ResolveCmd},
     {"dp_RDO",		Dp_RDOCmd},
     {"dp_RPC",		Dp_RPCCmd},
     {"dp_admin",	Dp_AdminCmd},
     {"dp_CancelRPC",	Dp_CancelRPCCmd},
     {"dp_send",		Dp_SendCmd},
     {"dp_recv",		Dp_RecvCmd},
+    {"dp_recvBatch",	Dp_RecvBatchCmd},
+    {"dp_recvfrom",	Dp_RecvFromCmd},
+    {"dp_mRPC",		Dp_MRPCCmd},
+    {"dp_mRPCServer",	Dp_MRPCServerCmd},
+    {"dp_loadFilter",	Dp_LoadFilterCmd},
+    {"dp_recvMessages",	Dp_RecvMessagesCmd},
     {(char *) NULL,	(Tcl_CmdProc *) NULL}
 };
 
+typedef struct {
+    CONST char *name;		/* Name of command. */
+    Tcl_ObjCmdProc *objProc;	/* Object-based command procedure. */
+} DpObjCmd;
+
+static DpObjCmd objCommands[] = {
+    {"dp_sendBatch",	Dp_SendBatchCmd},
+    {(char *) NULL,	(Tcl_ObjCmdProc *) NULL}
+};
+
+/*
+ * Guards the one-time choice of the filter kernels, which every
+ * interpreter that loads Dp shares.
+ */
+
+TCL_DECLARE_MUTEX(initMutex)
+static int kernelsChosen = 0;
+
 
 /*
  *----------------------------------------------------------------------
@@ -61,6 +86,7 @@ EXPORT(int,Dp_Init)(interp)
     Tcl_Interp *interp;		/* (in) Interpreter to initialize. */
 {
     DpCmd *cmdPtr;
+    DpObjCmd *objCmdPtr;
 
 #ifdef USE_TCL_STUBS
 
@@ -94,6 +120,10 @@ EXPORT(int,Dp_Init)(interp)
 	Tcl_CreateCommand(interp, cmdPtr->name, cmdPtr->cmdProc,
 		(ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
     }
+    for (objCmdPtr = objCommands; objCmdPtr->name != NULL; objCmdPtr++) {
+	Tcl_CreateObjCommand(interp, objCmdPtr->name, objCmdPtr->objProc,
+		(ClientData) NULL, (Tcl_CmdDeleteProc *) NULL);
+    }
 
     if (DpInitChannels(interp) != TCL_OK) {
 	return TCL_ERROR;
@@ -108,6 +138,18 @@ EXPORT(int,Dp_Init)(interp)
 	return TCL_ERROR;
     }
 
+    /*
+     * Pick the filter kernels once for the whole process, before any
+     * filter can run, so filter threads never see them half set up.
+     */
+
+    Tcl_MutexLock(&initMutex);
+    if (!kernelsChosen) {
+	DpFilterKernels(NULL);
+	kernelsChosen = 1;
+    }
+    Tcl_MutexUnlock(&initMutex);
+
     return TCL_OK;
 }
 
@@ -38,6 +38,19 @@
  */
 
 #define SOCKET_IPM		(1<<31)
+#define SOCKET_REUSEPORT	(1<<30)	/* Set SO_REUSEPORT before binding */
+#define SOCKET_DATAGRAM		(1<<29)	/* UDP/IPM: from* fields are set */
+#define SOCKET_CONNECTED	(1<<28)	/* UDP: connect()ed to sockaddr */
+#define SOCKET_TIMESTAMPS	(1<<27)	/* UDP/IPM: kernel receive times */
+#define SOCKET_SENDSTAMP	(1<<26)	/* UDP/IPM: send times in datagrams */
+#define SOCKET_NONBLOCKING	(1<<25)	/* UDP/IPM: non-blocking mode */
+
+/*
+ * The largest datagram "dp_recvfrom" and IPM group callbacks can
+ * return.
+ */
+
+#define	DP_DATAGRAM_MAX		(64 * 1024)
 
 /*
  * The following are used by the various SetSocketOption and
@@ -60,6 +73,11 @@
 #define DP_REMOTEPORT		12
 #define DP_MYIPADDR		13
 #define DP_REMOTEIPADDR		14
+#define DP_REUSEPORT		15
+#define DP_STATS		16
+#define DP_FROMVAR		17
+#define DP_GSO			18
+#define DP_GRO			19
 
 #define DP_GROUP		20
 #define DP_MULTICAST_TTL	21
@@ -67,6 +85,38 @@
 #define DP_ADD_MEMBERSHIP	23
 #define DP_DROP_MEMBERSHIP	24
 #define DP_BROADCAST		25
+#define DP_PKTINFO		26
+#define DP_MULTICAST_ALL	27
+
+/*
+ * Reliable multicast (rmcast) options
+ */
+
+#define DP_WINDOW		30
+#define DP_RATE			31
+#define DP_NACKDELAY		32
+#define DP_HEARTBEAT		33
+
+/*
+ * UDP message fragmentation options
+ */
+
+#define DP_FRAGMENT		34
+#define DP_FRAGTIMEOUT		35
+#define DP_FRAGMEMORY		36
+
+/*
+ * Connected UDP
+ */
+
+#define DP_CONNECT		37
+
+/*
+ * UDP/IPM timestamps
+ */
+
+#define DP_TIMESTAMPS		38
+#define DP_SENDSTAMP		39
 
 /*
  * Serial port options
@@ -92,6 +142,10 @@
 #define DP_OUTFILTER		212
 #define DP_INSET                213
 #define DP_OUTSET               214
+#define DP_THREADED		215
+#define DP_STACK		216
+#define DP_HEADER		217
+#define DP_MAXMESSAGE		218
 
 #if ( TCL_MAJOR_VERSION < 8 )
 typedef Tcl_File FileHandle;
@@ -100,6 +154,23 @@ typedef Tcl_File FileHandle;
 #if ( TCL_MAJOR_VERSION < 8 ) || !defined(_WIN32)
 typedef struct SocketInfo {int dummy;} SocketInfo;
 #endif
+/*
+ * Traffic counters kept by the socket drivers and returned by
+ * "fconfigure $chan -stats".
+ */
+typedef struct DpSocketStats {
+    Tcl_WideUInt	bytesIn;	/* Bytes received. */
+    Tcl_WideUInt	bytesOut;	/* Bytes sent. */
+    Tcl_WideUInt	packetsIn;	/* Datagrams received (UDP/IPM). */
+    Tcl_WideUInt	packetsOut;	/* Datagrams sent (UDP/IPM). */
+    Tcl_WideUInt	readCalls;	/* Calls to the input proc. */
+    Tcl_WideUInt	writeCalls;	/* Calls to the output proc. */
+    Tcl_WideUInt	eagainIn;	/* Reads that would have blocked. */
+    Tcl_WideUInt	eagainOut;	/* Writes that would have blocked. */
+    Tcl_WideUInt	drops;		/* Datagrams dropped by the kernel
+					 * for lack of buffer space. */
+} DpSocketStats;
+
 /*
  * A collection of all the data necessary for
  * all the different types of sockets.  We buy
@@ -110,17 +181,55 @@ typedef struct SocketState {
     DpSocket 		sock;
     FileHandle		sockFile;
     Tcl_Channel		channel;
-    Tcl_DString		groupList;	/* IPM */
+    Tcl_HashTable *	groupTable;	/* IPM: groups joined, keyed by
+					 * address; see generic/dpSock.c. */
+    int			groupSerial;	/* IPM: joins so far, to list the
+					 * groups in order. */
+    int			groupCommands;	/* IPM: groups with a callback. */
+    int			destGroup;	/* IPM: group the last datagram was
+					 * sent to, or 0 if unknown. */
     DpSocketAddressIP	sockaddr;	/* UDP/IPM */
     SocketInfo *	sockInfo;
     int 		flags;
     int			myIpAddr;
     int			myPort;
-    int			recvBufSize;	/* UDP/IPM */
+    int			recvBufSize;	/* UDP/IPM: SO_RCVBUF, or 0 if
+					 * unknown. */
     int			groupAddr;	/* IPM */
     int 		groupPort;	/* IPM */
     int			destIpAddr;	/* TCP */
     int			destPort;	/* TCP */
+    struct DpSendBuf *	sendHead;	/* TCP: output waiting for the
+					 * socket to become writable. */
+    struct DpSendBuf *	sendTail;	/* TCP */
+    int			sendQueued;	/* TCP: bytes in the send queue. */
+    int			sendError;	/* TCP/UDP: error from a background
+					 * flush, reported on next write. */
+    int			watchMask;	/* TCP/UDP: events Tcl is waiting
+					 * for. */
+    int			gsoSize;	/* UDP: -gso segment size, or 0. */
+    struct DpGroBuf *	groPtr;		/* UDP: coalesced datagrams being
+					 * handed out one at a time, or
+					 * NULL unless -gro is on. */
+    struct DpFragState *fragPtr;	/* UDP: message reassembly, or
+					 * NULL unless -fragment is on. */
+    struct DpRecvBatch *batchPtr;	/* UDP/IPM: dp_recvBatch buffers,
+					 * or NULL before its first call. */
+    int			messageLeft;	/* UDP/IPM: bytes of the current
+					 * message not yet read; only
+					 * -fragment messages span reads. */
+    DpSocketAddressIP	fromAddr;	/* UDP/IPM: last sender. */
+    Tcl_Obj *		fromObj;	/* UDP/IPM: {host port} of fromAddr,
+					 * or NULL before the first datagram. */
+    Tcl_Obj *		fromVarValue;	/* UDP/IPM: fromObj wrapped as the
+					 * value of the -fromvar variable. */
+    Tcl_Obj *		fromVarName;	/* UDP/IPM: -fromvar, or NULL. */
+    Tcl_WideInt		recvStamp;	/* UDP/IPM: kernel receive time of
+					 * the last datagram, in ns since
+					 * the epoch, or 0; -timestamps. */
+    Tcl_WideInt		sendStamp;	/* UDP/IPM: send time the sender
+					 * put in it, or 0; -sendStamp. */
+    DpSocketStats	stats;
 } SocketState;
 
 
@@ -132,6 +241,20 @@ typedef struct SerialState {
     Tcl_Channel		channel;
 } SerialState;
 
+/*
+ * Filter channels (identity, plugfilter and packoff) opened with
+ * "-stack 1" are pushed onto their subordinated channel with
+ * Tcl_StackChannel instead of wrapping it. See generic/dpChan.c.
+ */
+
+typedef struct DpStack {
+    Tcl_Channel		self;		/* The stacked channel, or NULL if
+					 * the subordinated channel is
+					 * wrapped. */
+    Tcl_TimerToken	timer;		/* Raises readable events while the
+					 * filter holds input. */
+} DpStack;
+
 /*
  *----------------------------------------------------------------------
  * Internal procedures shared among DP modules but not exported
@@ -145,15 +268,66 @@ typedef struct SerialState {
  */
 
 EXTERN int              DpTranslateOption _ANSI_ARGS_((CONST84 char *optionName));
+EXTERN Tcl_Channel	DpStackChannel _ANSI_ARGS_((Tcl_Interp *interp,
+			    Tcl_ChannelType *typePtr, ClientData instanceData,
+			    int mask, Tcl_Channel parent, DpStack *stackPtr));
+EXTERN void		DpStackRelease _ANSI_ARGS_((DpStack *stackPtr));
+EXTERN int		DpStackRead _ANSI_ARGS_((DpStack *stackPtr,
+			    Tcl_Channel parent, char *buf, int toRead));
+EXTERN int		DpStackWrite _ANSI_ARGS_((DpStack *stackPtr,
+			    Tcl_Channel parent, CONST84 char *buf,
+			    int toWrite));
+EXTERN void		DpStackWatch _ANSI_ARGS_((DpStack *stackPtr,
+			    Tcl_Channel parent, int mask, int pending));
+EXTERN int		DpStackHandler _ANSI_ARGS_((ClientData instanceData,
+			    int interestMask));
+EXTERN int		DpStackGetOption _ANSI_ARGS_((Tcl_Channel parent,
+			    Tcl_Interp *interp, CONST84 char *optionName,
+			    Tcl_DString *dsPtr));
+EXTERN int		DpStackSetOption _ANSI_ARGS_((Tcl_Channel parent,
+			    Tcl_Interp *interp, CONST char *optionName,
+			    CONST char *optionValue));
 EXTERN int              DpHostToIpAddr _ANSI_ARGS_((CONST84 char *hostname,
 				int *ipAddrPtr));
 EXTERN int              DpIpAddrToHost _ANSI_ARGS_((int ipAddr,
 				char *hostPtr));
+EXTERN int              DpGetService _ANSI_ARGS_((CONST84 char *service,
+				Tcl_DString *namePtr, int *portPtr));
+EXTERN void		DpResolverPrepareFork _ANSI_ARGS_((void));
+EXTERN void		DpResolverAfterFork _ANSI_ARGS_((int child));
+EXTERN void		DpInitFromAddress _ANSI_ARGS_((SocketState *statePtr));
+EXTERN void		DpSetFromAddress _ANSI_ARGS_((SocketState *statePtr,
+				DpSocketAddressIP *addrPtr));
+EXTERN int		DpSetFromVar _ANSI_ARGS_((SocketState *statePtr,
+				CONST char *varName));
+EXTERN void		DpFreeFromAddress _ANSI_ARGS_((SocketState *statePtr));
+EXTERN void		DpIpmInitGroups _ANSI_ARGS_((SocketState *statePtr,
+				CONST char *name, int addr));
+EXTERN int		DpIpmSetGroup _ANSI_ARGS_((Tcl_Interp *interp,
+				SocketState *statePtr,
+				CONST char *optionValue));
+EXTERN void		DpIpmGetGroups _ANSI_ARGS_((SocketState *statePtr,
+				Tcl_DString *dsPtr));
+EXTERN void		DpIpmFreeGroups _ANSI_ARGS_((SocketState *statePtr));
+EXTERN int		DpIpmSetSocketOption _ANSI_ARGS_((
+				SocketState *statePtr, int option,
+				int value));
 
 EXTERN int		DppCloseSocket _ANSI_ARGS_((DpSocket sock));
 EXTERN int		DppSetBlock _ANSI_ARGS_((DpSocket sock, int block));
 EXTERN int		DppGetErrno _ANSI_ARGS_(());
 EXTERN int		DppInit _ANSI_ARGS_((Tcl_Interp *interp));
+EXTERN int		DppCopyChannels _ANSI_ARGS_((Tcl_Channel inChan,
+			    Tcl_Channel *outChans, int numOutChans,
+			    int requested, int *copiedPtr,
+			    Tcl_Channel *errChanPtr));
+EXTERN int		DppRecvBatch _ANSI_ARGS_((SocketState *statePtr,
+			    int maxMsgs, Tcl_Obj *listPtr,
+			    int *errorCodePtr));
+EXTERN int		DppSendBatch _ANSI_ARGS_((SocketState *statePtr,
+			    int numMsgs, DpSocketAddressIP *addrs,
+			    CONST84 char **bufs, int *lengths,
+			    int *errorCodePtr));
 
 /*
  *----------------------------------------------------------------------
@@ -181,8 +355,15 @@ EXTERN Tcl_Channel	DpOpenIpmChannel _ANSI_ARGS_((Tcl_Interp *interp,
 			    int argc, CONST84 char **argv));
 EXTERN Tcl_Channel	DpOpenTcpChannel _ANSI_ARGS_((Tcl_Interp *interp,
 			    int argc, CONST84 char **argv));
+#ifndef _WIN32
+EXTERN Tcl_Channel	DpOpenRmcastChannel _ANSI_ARGS_((Tcl_Interp *interp,
+			    int argc, CONST84 char **argv));
+#endif
 EXTERN Tcl_Channel      Dp_TcpAccept _ANSI_ARGS_((Tcl_Interp *interp,
                             CONST84 char *channelId));
+EXTERN int		DpTcpQueued _ANSI_ARGS_((Tcl_Channel chan));
+EXTERN int		DpIsUdpChannel _ANSI_ARGS_((Tcl_Channel chan));
+EXTERN int		DpIsIpmChannel _ANSI_ARGS_((Tcl_Channel chan));
 
 /*
  *----------------------------------------------------------------------
@@ -200,6 +381,8 @@ EXTERN int	Dp_FromCmd _ANSI_ARGS_((ClientData clientData,
 		    Tcl_Interp *interp, int argc, CONST84 char **argv));
 EXTERN int	Dp_NetInfoCmd _ANSI_ARGS_((ClientData clientData,
 		    Tcl_Interp *interp, int argc, CONST84 char **argv));
+EXTERN int	Dp_ResolveCmd _ANSI_ARGS_((ClientData clientData,
+		    Tcl_Interp *interp, int argc, CONST84 char **argv));
 EXTERN int	Dp_RDOCmd _ANSI_ARGS_((ClientData clientData,
 		    Tcl_Interp *interp, int argc, CONST84 char **argv));
 EXTERN int	Dp_RPCCmd _ANSI_ARGS_((ClientData clientData,
@@ -212,21 +395,75 @@ EXTERN int	Dp_SendCmd _ANSI_ARGS_((ClientData clientData,
 		    Tcl_Interp *interp, int argc, CONST84 char **argv));
 EXTERN int	Dp_RecvCmd _ANSI_ARGS_((ClientData clientData,
 		    Tcl_Interp *interp, int argc, CONST84 char **argv));
+EXTERN int	Dp_SendBatchCmd _ANSI_ARGS_((ClientData clientData,
+		    Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]));
+EXTERN int	Dp_RecvBatchCmd _ANSI_ARGS_((ClientData clientData,
+		    Tcl_Interp *interp, int argc, CONST84 char **argv));
+EXTERN int	Dp_RecvFromCmd _ANSI_ARGS_((ClientData clientData,
+		    Tcl_Interp *interp, int argc, CONST84 char **argv));
+EXTERN int	Dp_MRPCCmd _ANSI_ARGS_((ClientData clientData,
+		    Tcl_Interp *interp, int argc, CONST84 char **argv));
+EXTERN int	Dp_MRPCServerCmd _ANSI_ARGS_((ClientData clientData,
+		    Tcl_Interp *interp, int argc, CONST84 char **argv));
+EXTERN int	Dp_LoadFilterCmd _ANSI_ARGS_((ClientData clientData,
+		    Tcl_Interp *interp, int argc, CONST84 char **argv));
+EXTERN int	Dp_RecvMessagesCmd _ANSI_ARGS_((ClientData clientData,
+		    Tcl_Interp *interp, int argc, CONST84 char **argv));
 
 /*
  * Plug-in filters.
  */
 
-extern Dp_PlugInFilterProc Identity;
-extern Dp_PlugInFilterProc Plug1to2;
-extern Dp_PlugInFilterProc Plug2to1;
-extern Dp_PlugInFilterProc Xor;
-extern Dp_PlugInFilterProc PackOn;
-extern Dp_PlugInFilterProc Uuencode;
-extern Dp_PlugInFilterProc Uudecode;
-extern Dp_PlugInFilterProc TclFilter;
-extern Dp_PlugInFilterProc HexOut;
-extern Dp_PlugInFilterProc HexIn;
+extern Dp_PlugInFilterProc2 Identity;
+extern Dp_PlugInFilterProc2 Plug1to2;
+extern Dp_PlugInFilterProc2 Plug2to1;
+extern Dp_PlugInFilterProc2 Xor;
+extern Dp_PlugInFilterProc2 PackOn;
+extern Dp_PlugInFilterProc2 Uuencode;
+extern Dp_PlugInFilterProc2 Uudecode;
+extern Dp_PlugInFilterProc2 TclFilter;
+extern Dp_PlugInFilterProc2 HexOut;
+extern Dp_PlugInFilterProc2 HexIn;
+extern Dp_PlugInFilterProc2 ChecksumOn;
+extern Dp_PlugInFilterProc2 ChecksumOff;
+
+/*
+ * The compression filters need the zlib streams of Tcl 8.6 or later, and
+ * dp_loadFilter needs its Tcl_LoadFile.
+ */
+
+#if (TCL_MAJOR_VERSION > 8) || \
+	((TCL_MAJOR_VERSION == 8) && (TCL_MINOR_VERSION >= 6))
+#   define DP_ZLIB_FILTERS
+#   define DP_LOAD_FILTERS
+extern Dp_PlugInFilterProc2 Deflate;
+extern Dp_PlugInFilterProc2 Inflate;
+extern Dp_PlugInFilterProc2 Gzip;
+extern Dp_PlugInFilterProc2 Gunzip;
+#endif
+
+/*
+ * Inner loops of the built-in filters, in dpFilterKernels.c. A stream
+ * passed to DpXorBytes holds the key followed by DP_XOR_STREAM_PAD more
+ * bytes of it.
+ */
+
+#define DP_XOR_STREAM_PAD	32
+
+EXTERN CONST char * DpFilterKernels _ANSI_ARGS_((CONST char *name));
+EXTERN void	DpXorBytes _ANSI_ARGS_((unsigned char *to,
+		    CONST unsigned char *from, int length,
+		    CONST unsigned char *stream, int period, int *posPtr));
+EXTERN void	DpHexEncode _ANSI_ARGS_((unsigned char *to,
+		    CONST unsigned char *from, int length));
+EXTERN int	DpHexDecode _ANSI_ARGS_((unsigned char *to,
+		    CONST unsigned char *from, int pairs));
+EXTERN void	DpUuencodeGroups _ANSI_ARGS_((unsigned char *to,
+		    CONST unsigned char *from, int groups));
+EXTERN void	DpUudecodeGroups _ANSI_ARGS_((unsigned char *to,
+		    CONST unsigned char *from, int groups));
+EXTERN unsigned int DpCrc32c _ANSI_ARGS_((unsigned int crc,
+		    CONST unsigned char *from, int length));
 
 
 /*
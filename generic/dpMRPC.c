@@ -0,0 +1,693 @@
+/*
+ * generic/dpMRPC.c --
+ *
+ *	This file implements multicast RPC: "dp_mRPC" sends one Tcl
+ *	command to every server listening on an IP multicast group
+ *	and collects their replies, and "dp_mRPCServer" creates such
+ *	a server.  It replaces the scripts in library/mlbrpc.tcl.
+ *
+ *	A request is a single datagram sent to the group from the
+ *	client's own unicast UDP socket:
+ *
+ *	    MRPC1 <tid> <command>
+ *
+ *	Each server answers with a unicast datagram to the socket the
+ *	request came from:
+ *
+ *	    MRPC1 <tid> <code> <result>
+ *
+ *	where tid is 8 hex digits and code is the Tcl return code of
+ *	the command.  Servers remember the replies they have sent,
+ *	keyed by sender and tid, so a request that arrives twice (it
+ *	may, over several interfaces) is answered from the cache
+ *	instead of being run again.  The cache is bounded; the oldest
+ *	entries are forgotten first.
+ *
+ * Copyright (c) 1995-1996 Cornell University.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include <string.h>
+#include <stdio.h>
+#ifdef _WIN32
+#	include <winsock2.h>
+#else
+#	include <sys/types.h>
+#	include <netinet/in.h>
+#endif
+#include "generic/dpInt.h"
+
+#define MRPC_MAGIC		"MRPC1 "
+#define MRPC_MAGIC_LEN		6
+#define MRPC_TID_LEN		8
+
+/*
+ * Defaults for the dp_mRPC and dp_mRPCServer options.
+ */
+
+#define MRPC_DEFAULT_TTL	1
+#define MRPC_DEFAULT_TIMEOUT	5000
+#define MRPC_DEFAULT_CACHE	256
+
+/*
+ * State of a dp_mRPC call while it waits for replies.
+ */
+
+typedef struct MRPCCall {
+    SocketState *statePtr;	/* Unicast socket the replies come to. */
+    char tid[MRPC_TID_LEN + 1];	/* Transaction id of the request. */
+    int wanted;			/* Replies to wait for, or 0 for all
+				 * that arrive before the deadline. */
+    int done;			/* Set when the call should return. */
+    Tcl_Obj *resultPtr;		/* List of {{host port} code result}. */
+    int numReplies;		/* Replies in resultPtr. */
+} MRPCCall;
+
+/*
+ * State of a server created by dp_mRPCServer.  It is freed when
+ * the server's channel is closed.
+ */
+
+typedef struct MRPCServer {
+    Tcl_Interp *interp;		/* Interpreter that runs the requests. */
+    Tcl_Channel chan;		/* IPM channel the requests come in on. */
+    SocketState *statePtr;	/* Its socket. */
+    char *checkCmd;		/* -check command, or NULL. */
+    Tcl_HashTable cache;	/* Replies sent, keyed by sender and tid;
+				 * values are ckalloc'ed strings. */
+    Tcl_HashEntry **order;	/* Ring of cache entries, oldest first. */
+    int cacheSize;		/* Slots in order. */
+    int cacheFirst;		/* Index of the oldest entry. */
+    int cacheCount;		/* Entries in the cache. */
+} MRPCServer;
+
+static unsigned int tidCount = 0;
+
+static void		MRPCReplyHandler _ANSI_ARGS_((ClientData clientData,
+			    int mask));
+static void		MRPCTimeout _ANSI_ARGS_((ClientData clientData));
+static void		MRPCRequestHandler _ANSI_ARGS_((ClientData clientData,
+			    int mask));
+static void		MRPCServerClose _ANSI_ARGS_((ClientData clientData));
+static void		MRPCCacheReply _ANSI_ARGS_((MRPCServer *serverPtr,
+			    CONST char *key, CONST char *reply, int length));
+static int		MRPCSend _ANSI_ARGS_((SocketState *statePtr,
+			    DpSocketAddressIP *addrPtr, CONST char *buf,
+			    int length));
+
+/* ----------------------------------------------------
+ *
+ *    Dp_MRPCCmd --
+ *
+ *	Implements "dp_mRPC group port ?-ttl ttl? ?-timeout ms?
+ *	?-replies n? command ?args ...?".  The words of the
+ *	command are joined as by eval and sent once to the group, and replies are collected in the
+ *	event loop until n of them have arrived or the timeout
+ *	expires.  -replies 0 waits out the whole timeout.
+ *
+ *    Returns
+ *
+ *	TCL_OK with a list holding a {{host port} code result}
+ *	element per reply, in order of arrival, or TCL_ERROR.
+ *	Running out of time is not an error.
+ *
+ *    Side Effects
+ *
+ *	Other events are processed while waiting.
+ *
+ * -----------------------------------------------------
+ */
+
+int
+Dp_MRPCCmd(dummy, interp, argc, argv)
+    ClientData dummy;			/* Not used. */
+    Tcl_Interp *interp;			/* Current interpreter. */
+    int argc;				/* Number of arguments. */
+    CONST84 char **argv;		/* Argument strings. */
+{
+    Tcl_Channel chan;
+    Tcl_TimerToken timer;
+    Tcl_DString request;
+    DpSocketAddressIP groupAddr;
+    Tcl_Time now;
+    MRPCCall call;
+    char *command;
+    char tid[MRPC_TID_LEN + 1];
+    int i, groupIp, port, errorCode;
+    int ttl = MRPC_DEFAULT_TTL;
+    int timeout = MRPC_DEFAULT_TIMEOUT;
+    int replies = 1;
+
+    if (argc < 4) {
+	goto usage;
+    }
+    if (!DpHostToIpAddr(argv[1], &groupIp)
+	    || ((groupIp & 0xf0000000) != 0xe0000000)) {
+	Tcl_AppendResult(interp, "Illegal multicast group \"", argv[1],
+		"\"", NULL);
+	return TCL_ERROR;
+    }
+    if (Tcl_GetInt(interp, argv[2], &port) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if ((port <= 0) || (port > 65535)) {
+	Tcl_AppendResult(interp, "Port number must be > 0", NULL);
+	return TCL_ERROR;
+    }
+
+    for (i = 3; i < argc; i += 2) {
+	int v = i+1;
+	size_t len = strlen(argv[i]);
+
+	if ((argv[i][0] != '-') || (len < 2)) {
+	    break;
+	}
+	if (strncmp(argv[i], "-ttl", len)==0) {
+	    if (v==argc) {goto arg_missing;}
+	    if (Tcl_GetInt(interp, argv[v], &ttl) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if ((ttl < 0) || (ttl > 255)) {
+		Tcl_AppendResult(interp, "-ttl must be between 0 and 255",
+			NULL);
+		return TCL_ERROR;
+	    }
+	} else if (strncmp(argv[i], "-timeout", len)==0) {
+	    if (v==argc) {goto arg_missing;}
+	    if (Tcl_GetInt(interp, argv[v], &timeout) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if (timeout < 0) {
+		Tcl_AppendResult(interp, "-timeout must be >= 0", NULL);
+		return TCL_ERROR;
+	    }
+	} else if (strncmp(argv[i], "-replies", len)==0) {
+	    if (v==argc) {goto arg_missing;}
+	    if (Tcl_GetInt(interp, argv[v], &replies) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if (replies < 0) {
+		Tcl_AppendResult(interp, "-replies must be >= 0", NULL);
+		return TCL_ERROR;
+	    }
+	} else {
+	    break;
+	}
+    }
+    if (i >= argc) {
+	goto usage;
+    }
+
+    /*
+     * The replies come back to an unused port, so the request
+     * doesn't have to say where to send them.
+     */
+
+    chan = DpOpenUdpChannel(interp, 0, NULL);
+    if (chan == NULL) {
+	return TCL_ERROR;
+    }
+    call.statePtr = (SocketState *) Tcl_GetChannelInstanceData(chan);
+    DpSetFromVar(call.statePtr, "");
+    if ((DpIpmSetSocketOption(call.statePtr, DP_MULTICAST_TTL, ttl) != 0)
+	    || (Tcl_SetChannelOption(interp, chan, "-blocking", "0")
+		!= TCL_OK)) {
+	Tcl_ResetResult(interp);
+	Tcl_AppendResult(interp, "can't set up reply socket: ",
+		Tcl_PosixError(interp), NULL);
+	Tcl_UnregisterChannel(interp, chan);
+	return TCL_ERROR;
+    }
+
+    Tcl_GetTime(&now);
+    sprintf(tid, "%08x", (unsigned int) (now.sec ^ (now.usec << 12))
+	    + tidCount++);
+    command = Tcl_Concat(argc - i, argv + i);
+    Tcl_DStringInit(&request);
+    Tcl_DStringAppend(&request, MRPC_MAGIC, MRPC_MAGIC_LEN);
+    Tcl_DStringAppend(&request, tid, MRPC_TID_LEN);
+    Tcl_DStringAppend(&request, " ", 1);
+    Tcl_DStringAppend(&request, command, -1);
+    ckfree(command);
+
+    memset((char *) &groupAddr, 0, sizeof(groupAddr));
+    groupAddr.sin_family = AF_INET;
+    groupAddr.sin_addr.s_addr = htonl(groupIp);
+    groupAddr.sin_port = htons((unsigned short) port);
+    errorCode = MRPCSend(call.statePtr, &groupAddr,
+	    Tcl_DStringValue(&request), Tcl_DStringLength(&request));
+    Tcl_DStringFree(&request);
+    if (errorCode != 0) {
+	Tcl_SetErrno(errorCode);
+	Tcl_AppendResult(interp, "Error sending to group \"", argv[1],
+		"\": ", Tcl_PosixError(interp), NULL);
+	Tcl_UnregisterChannel(interp, chan);
+	return TCL_ERROR;
+    }
+
+    /*
+     * Collect replies in the event loop until we have enough or
+     * the time is up.
+     */
+
+    strcpy(call.tid, tid);
+    call.wanted = replies;
+    call.done = 0;
+    call.numReplies = 0;
+    call.resultPtr = Tcl_NewObj();
+    Tcl_IncrRefCount(call.resultPtr);
+    Tcl_CreateChannelHandler(chan, TCL_READABLE, MRPCReplyHandler,
+	    (ClientData) &call);
+    timer = Tcl_CreateTimerHandler(timeout, MRPCTimeout, (ClientData) &call);
+    while (!call.done) {
+	Tcl_DoOneEvent(TCL_ALL_EVENTS);
+    }
+    Tcl_DeleteTimerHandler(timer);
+    Tcl_DeleteChannelHandler(chan, MRPCReplyHandler, (ClientData) &call);
+    Tcl_UnregisterChannel(interp, chan);
+
+    Tcl_SetObjResult(interp, call.resultPtr);
+    Tcl_DecrRefCount(call.resultPtr);
+    return TCL_OK;
+
+usage:
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+	    " group port ?-ttl ttl? ?-timeout ms? ?-replies n? ",
+	    "command ?args ...?\"", NULL);
+    return TCL_ERROR;
+
+arg_missing:
+    Tcl_AppendResult(interp, "value for \"", argv[argc-1], "\" missing",
+	    NULL);
+    return TCL_ERROR;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * MRPCReplyHandler --
+ *
+ *	Reads the replies waiting on a dp_mRPC reply socket.
+ *	Datagrams that aren't replies to this call are ignored.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Appends to the call's result, and ends the call once
+ *	enough replies are in.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+MRPCReplyHandler (clientData, mask)
+    ClientData clientData;	/* (in) The MRPCCall */
+    int mask;			/* (in) Not used */
+{
+    MRPCCall *callPtr = (MRPCCall *) clientData;
+    SocketState *statePtr = callPtr->statePtr;
+    Tcl_DriverInputProc *inputProc;
+    Tcl_Obj *reply[3];
+    char buf[DP_DATAGRAM_MAX + 1];
+    char *p;
+    int n, code, errorCode;
+
+    inputProc = Tcl_GetChannelType(statePtr->channel)->inputProc;
+    while (!callPtr->done) {
+	n = (*inputProc)((ClientData) statePtr, buf, DP_DATAGRAM_MAX,
+		&errorCode);
+	if (n < 0) {
+	    break;
+	}
+	buf[n] = '\0';
+	if ((n < MRPC_MAGIC_LEN + MRPC_TID_LEN + 3)
+		|| (strncmp(buf, MRPC_MAGIC, MRPC_MAGIC_LEN) != 0)
+		|| (strncmp(buf + MRPC_MAGIC_LEN, callPtr->tid,
+		    MRPC_TID_LEN) != 0)) {
+	    continue;
+	}
+	p = buf + MRPC_MAGIC_LEN + MRPC_TID_LEN;
+	if (sscanf(p, " %d", &code) != 1) {
+	    continue;
+	}
+	for (p++; (*p != ' ') && (*p != '\0'); p++) {
+	    /* Empty loop body. */
+	}
+	if (*p == ' ') {
+	    p++;
+	}
+	reply[0] = statePtr->fromObj;
+	reply[1] = Tcl_NewIntObj(code);
+	reply[2] = Tcl_NewStringObj(p, n - (p - buf));
+	Tcl_ListObjAppendElement(NULL, callPtr->resultPtr,
+		Tcl_NewListObj(3, reply));
+	callPtr->numReplies++;
+	if (callPtr->numReplies == callPtr->wanted) {
+	    callPtr->done = 1;
+	}
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * MRPCTimeout --
+ *
+ *	Timer callback that ends a dp_mRPC call when its
+ *	-timeout expires.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+MRPCTimeout (clientData)
+    ClientData clientData;	/* (in) The MRPCCall */
+{
+    ((MRPCCall *) clientData)->done = 1;
+}
+
+/* ----------------------------------------------------
+ *
+ *    Dp_MRPCServerCmd --
+ *
+ *	Implements "dp_mRPCServer group port ?-check command?
+ *	?-cache n?", which joins the group and runs each request
+ *	sent to it.  As with dp_admin, -check names a command
+ *	that is called with each request and must return
+ *	without error for the request to run.  -cache bounds
+ *	the number of replies kept to answer duplicate requests.
+ *
+ *    Returns
+ *
+ *	TCL_OK with the name of the server's IPM channel, or
+ *	TCL_ERROR.  Closing the channel stops the server.
+ *
+ *    Side Effects
+ *
+ *	A channel is opened and a handler registered on it.
+ *
+ * -----------------------------------------------------
+ */
+
+int
+Dp_MRPCServerCmd(dummy, interp, argc, argv)
+    ClientData dummy;			/* Not used. */
+    Tcl_Interp *interp;			/* Current interpreter. */
+    int argc;				/* Number of arguments. */
+    CONST84 char **argv;		/* Argument strings. */
+{
+    MRPCServer *serverPtr;
+    Tcl_Channel chan;
+    CONST84 char *ipmArgv[4];
+    CONST84 char *checkCmd = NULL;
+    int i, cacheSize = MRPC_DEFAULT_CACHE;
+
+    if ((argc < 3) || (argc % 2 == 0)) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" group port ?-check command? ?-cache n?\"", NULL);
+	return TCL_ERROR;
+    }
+    for (i = 3; i < argc; i += 2) {
+	size_t len = strlen(argv[i]);
+
+	if ((len > 2) && (strncmp(argv[i], "-check", len)==0)) {
+	    checkCmd = argv[i+1];
+	} else if ((len > 2) && (strncmp(argv[i], "-cache", len)==0)) {
+	    if (Tcl_GetInt(interp, argv[i+1], &cacheSize) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if (cacheSize <= 0) {
+		Tcl_AppendResult(interp, "-cache must be > 0", NULL);
+		return TCL_ERROR;
+	    }
+	} else {
+	    Tcl_AppendResult(interp, "unknown option \"", argv[i],
+		    "\", must be -cache or -check", NULL);
+	    return TCL_ERROR;
+	}
+    }
+
+    ipmArgv[0] = "-group";
+    ipmArgv[1] = argv[1];
+    ipmArgv[2] = "-myport";
+    ipmArgv[3] = argv[2];
+    chan = DpOpenIpmChannel(interp, 4, ipmArgv);
+    if (chan == NULL) {
+	return TCL_ERROR;
+    }
+
+    serverPtr = (MRPCServer *) ckalloc(sizeof(MRPCServer));
+    serverPtr->interp = interp;
+    serverPtr->chan = chan;
+    serverPtr->statePtr = (SocketState *) Tcl_GetChannelInstanceData(chan);
+    serverPtr->checkCmd = NULL;
+    if (checkCmd != NULL && checkCmd[0] != '\0') {
+	serverPtr->checkCmd = ckalloc(strlen(checkCmd) + 1);
+	strcpy(serverPtr->checkCmd, checkCmd);
+    }
+    Tcl_InitHashTable(&serverPtr->cache, TCL_STRING_KEYS);
+    serverPtr->order = (Tcl_HashEntry **)
+	    ckalloc((unsigned) cacheSize * sizeof(Tcl_HashEntry *));
+    serverPtr->cacheSize = cacheSize;
+    serverPtr->cacheFirst = 0;
+    serverPtr->cacheCount = 0;
+
+    DpSetFromVar(serverPtr->statePtr, "");
+    Tcl_SetChannelOption(NULL, chan, "-blocking", "0");
+    Tcl_CreateChannelHandler(chan, TCL_READABLE, MRPCRequestHandler,
+	    (ClientData) serverPtr);
+    Tcl_CreateCloseHandler(chan, MRPCServerClose, (ClientData) serverPtr);
+
+    Tcl_AppendResult(interp, Tcl_GetChannelName(chan), NULL);
+    return TCL_OK;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * MRPCRequestHandler --
+ *
+ *	Reads the requests waiting on a dp_mRPCServer channel,
+ *	runs each one at global level and sends the result back
+ *	to the requester.  A request seen before is answered
+ *	from the cache.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Whatever the requests do.  The global variable
+ *	dp_rpcFile is set to the server's channel while a
+ *	request runs, as for dp_RPC.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+MRPCRequestHandler (clientData, mask)
+    ClientData clientData;	/* (in) The MRPCServer */
+    int mask;			/* (in) Not used */
+{
+    MRPCServer *serverPtr = (MRPCServer *) clientData;
+    SocketState *statePtr = serverPtr->statePtr;
+    Tcl_Interp *interp = serverPtr->interp;
+    Tcl_DriverInputProc *inputProc;
+    Tcl_HashEntry *entryPtr;
+    Tcl_DString reply, check;
+    DpSocketAddressIP fromAddr;
+    char buf[DP_DATAGRAM_MAX + 1];
+    char key[MRPC_TID_LEN + 24];
+    char str[TCL_INTEGER_SPACE + 2];
+    int n, code, errorCode;
+
+    Tcl_Preserve((ClientData) serverPtr);
+    Tcl_Preserve((ClientData) interp);
+    inputProc = Tcl_GetChannelType(statePtr->channel)->inputProc;
+    while (serverPtr->chan != NULL) {
+	n = (*inputProc)((ClientData) statePtr, buf, DP_DATAGRAM_MAX,
+		&errorCode);
+	if (n < 0) {
+	    break;
+	}
+	buf[n] = '\0';
+	if ((n < MRPC_MAGIC_LEN + MRPC_TID_LEN + 1)
+		|| (strncmp(buf, MRPC_MAGIC, MRPC_MAGIC_LEN) != 0)
+		|| (buf[MRPC_MAGIC_LEN + MRPC_TID_LEN] != ' ')) {
+	    continue;
+	}
+	fromAddr = statePtr->fromAddr;
+	sprintf(key, "%08x:%d ", (unsigned int) ntohl(fromAddr.sin_addr.s_addr),
+		ntohs(fromAddr.sin_port));
+	strncat(key, buf + MRPC_MAGIC_LEN, MRPC_TID_LEN);
+
+	entryPtr = Tcl_FindHashEntry(&serverPtr->cache, key);
+	if (entryPtr != NULL) {
+	    char *cached = (char *) Tcl_GetHashValue(entryPtr);
+
+	    MRPCSend(statePtr, &fromAddr, cached, strlen(cached));
+	    continue;
+	}
+
+	Tcl_SetVar(interp, "dp_rpcFile", Tcl_GetChannelName(serverPtr->chan),
+		TCL_GLOBAL_ONLY);
+	code = TCL_OK;
+	if (serverPtr->checkCmd != NULL) {
+	    Tcl_DStringInit(&check);
+	    Tcl_DStringAppend(&check, serverPtr->checkCmd, -1);
+	    Tcl_DStringAppendElement(&check,
+		    buf + MRPC_MAGIC_LEN + MRPC_TID_LEN + 1);
+	    code = Tcl_GlobalEval(interp, Tcl_DStringValue(&check));
+	    Tcl_DStringFree(&check);
+	    if (code != TCL_OK) {
+		Tcl_SetResult(interp, "RPC authorization denied",
+			TCL_STATIC);
+		code = TCL_ERROR;
+	    }
+	}
+	if (code == TCL_OK) {
+	    code = Tcl_GlobalEval(interp,
+		    buf + MRPC_MAGIC_LEN + MRPC_TID_LEN + 1);
+	}
+
+	Tcl_DStringInit(&reply);
+	Tcl_DStringAppend(&reply, buf, MRPC_MAGIC_LEN + MRPC_TID_LEN);
+	sprintf(str, " %d ", code);
+	Tcl_DStringAppend(&reply, str, -1);
+	Tcl_DStringAppend(&reply, Tcl_GetStringResult(interp), -1);
+	Tcl_ResetResult(interp);
+
+	/*
+	 * The request may have closed the server.
+	 */
+
+	if (serverPtr->chan != NULL) {
+	    MRPCSend(statePtr, &fromAddr, Tcl_DStringValue(&reply),
+		    Tcl_DStringLength(&reply));
+	    MRPCCacheReply(serverPtr, key, Tcl_DStringValue(&reply),
+		    Tcl_DStringLength(&reply));
+	}
+	Tcl_DStringFree(&reply);
+    }
+    Tcl_Release((ClientData) interp);
+    Tcl_Release((ClientData) serverPtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * MRPCCacheReply --
+ *
+ *	Remembers the reply sent for a request, forgetting the
+ *	oldest one if the cache is full.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+MRPCCacheReply (serverPtr, key, reply, length)
+    MRPCServer *serverPtr;	/* (in) Server */
+    CONST char *key;		/* (in) Sender and tid */
+    CONST char *reply;		/* (in) Reply datagram */
+    int length;			/* (in) Bytes in reply */
+{
+    Tcl_HashEntry *entryPtr;
+    char *copy;
+    int slot, isNew;
+
+    if (serverPtr->cacheCount == serverPtr->cacheSize) {
+	entryPtr = serverPtr->order[serverPtr->cacheFirst];
+	ckfree((char *) Tcl_GetHashValue(entryPtr));
+	Tcl_DeleteHashEntry(entryPtr);
+	serverPtr->cacheFirst = (serverPtr->cacheFirst + 1)
+		% serverPtr->cacheSize;
+	serverPtr->cacheCount--;
+    }
+    entryPtr = Tcl_CreateHashEntry(&serverPtr->cache, key, &isNew);
+    copy = ckalloc((unsigned) length + 1);
+    memcpy(copy, reply, (size_t) length);
+    copy[length] = '\0';
+    Tcl_SetHashValue(entryPtr, (ClientData) copy);
+    slot = (serverPtr->cacheFirst + serverPtr->cacheCount)
+	    % serverPtr->cacheSize;
+    serverPtr->order[slot] = entryPtr;
+    serverPtr->cacheCount++;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * MRPCServerClose --
+ *
+ *	Close handler for a dp_mRPCServer channel.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The server's state is freed once no request is running.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+MRPCServerClose (clientData)
+    ClientData clientData;	/* (in) The MRPCServer */
+{
+    MRPCServer *serverPtr = (MRPCServer *) clientData;
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+
+    serverPtr->chan = NULL;
+    for (entryPtr = Tcl_FirstHashEntry(&serverPtr->cache, &search);
+	    entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+	ckfree((char *) Tcl_GetHashValue(entryPtr));
+    }
+    Tcl_DeleteHashTable(&serverPtr->cache);
+    ckfree((char *) serverPtr->order);
+    if (serverPtr->checkCmd != NULL) {
+	ckfree(serverPtr->checkCmd);
+    }
+    Tcl_EventuallyFree((ClientData) serverPtr, TCL_DYNAMIC);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * MRPCSend --
+ *
+ *	Sends one datagram from a UDP or IPM socket.
+ *
+ * Results:
+ *	Zero, or a POSIX error code.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+MRPCSend (statePtr, addrPtr, buf, length)
+    SocketState *statePtr;	/* (in) Socket to send from */
+    DpSocketAddressIP *addrPtr;	/* (in) Destination */
+    CONST char *buf;		/* (in) Datagram */
+    int length;			/* (in) Bytes in buf */
+{
+    int errorCode = 0;
+
+    if (DppSendBatch(statePtr, 1, addrPtr, (CONST84 char **) &buf, &length,
+	    &errorCode) != 1) {
+	return errorCode ? errorCode : EIO;
+    }
+    return 0;
+}
@@ -7,6 +7,12 @@
  * makes sense only when reading data, this channel is not writable.
  * These are channels that are created by evaluating "dp_connect dpPackOff".
  *
+ * The packets have either the 6 digit decimal header of packon, or, with
+ * "-header varint", their length as a varint: 7 bits per byte, least
+ * significant first, with the high bit set in every byte but the last.
+ * The dp_recvMessages command, at the end of this file, returns all the
+ * packets that are buffered at once.
+ *
  */
 
 
@@ -64,8 +70,11 @@ static void	WCPPOChannel		_ANSI_ARGS_((ClientData instanceData,
 
 
 
-/* memmove does not seem to be available on all systems */
-static void	mymove 		_ANSI_ARGS_((char *to, char *from, int number));
+static int	POGetHeader	_ANSI_ARGS_((Tcl_Interp *interp,
+                                                     CONST char *value,
+                                                     int *headerPtr));
+
+static int	POPacketReady	_ANSI_ARGS_((ClientData instanceData));
 
 /*
  * This structure stores the names of the functions that tcl calls when certain
@@ -94,7 +103,7 @@ Tcl_ChannelType poChannelType = {
     NULL, 	           /* blockModeProc    */
     /* Only valid in TCL_CHANNEL_VERSION_2 channels or later */
     NULL,			/* Proc to call to flush a channel */
-    NULL,			/* Proc to call to handle a channel event */
+    DpStackHandler,		/* Proc to call to handle a channel event */
     /* Only valid in TCL_CHANNEL_VERSION_3 channels or later */
     NULL,			/* Proc to call to seek on the channel which can handle 64-bit offsets */
     /* Only valid in TCL_CHANNEL_VERSION_4 channels or later */
@@ -113,23 +122,68 @@ typedef struct {
     /* If peek = 0 consume input, otherwise not. */
     int   peek;
 
-    /* The variables below are used in managing the input. Please refer to the
-     * input function to understand their meaning.
+    /* Data read from the subordinated channel and not returned yet. It is
+     * kept in a ring: dataLength bytes starting at offset head of buffer,
+     * wrapping around at bufLength.
      */
 
     char *buffer;
     int   bufLength;
-    int   used;
+    int   head;
     int   dataLength;
-    int   precRead;
-    int   ignoreNextRead;
+
+    /* Bytes of the current packet still to be returned, when the packet
+     * was bigger than the buffer it was read into.
+     */
+    int   partial;
+
+    /* Length of the packet the input procedure returned last. */
+    int   current;
+
+    /* PO_HEADER_DECIMAL or PO_HEADER_VARINT. */
+    int   header;
+
+    /* Largest packet accepted; a bigger one is an error (EMSGSIZE). */
+    int   maxMessage;
+
+    /* Set if the channel is stacked on the subordinated one. */
+    DpStack stack;
 
 } PackOffInfo;
 
 
 /* Arbitrary value, it should not be less then the tcl's buffer size. */
 
-#define BUFFER_CHUNK 8 * 1024
+#define BUFFER_CHUNK (8 * 1024)
+
+/* Packet headers. */
+
+#define PO_HEADER_DECIMAL	0
+#define PO_HEADER_VARINT	1
+
+#define PO_DECIMAL_LENGTH	6	/* Digits in a decimal header. */
+#define PO_VARINT_LENGTH	5	/* Most bytes in a varint header. */
+
+#define DEFAULT_MAX_MESSAGE	(16 * 1024 * 1024)
+
+/* Byte i of the data in the ring of a packoff channel. */
+
+#define PO_BYTE(pD, i) \
+	((unsigned char) (pD)->buffer[((pD)->head + (i)) % (pD)->bufLength])
+
+#ifndef EMSGSIZE
+#define EMSGSIZE EINVAL
+#endif
+
+static int	POParseHeader	_ANSI_ARGS_((PackOffInfo *pD, int *headerPtr,
+                                             int *lengthPtr,
+                                             int *errorCodePtr));
+
+static int	POFill		_ANSI_ARGS_((PackOffInfo *pD,
+                                             int *errorCodePtr));
+
+static void	POTake		_ANSI_ARGS_((PackOffInfo *pD, char *to,
+                                             int number));
 
 
 /*
@@ -159,7 +213,7 @@ DpCreatePOChannel (interp, argc, argv)
     CONST84 char      **argv;           /* (in) Argument strings. */
 {
     static int    openedChannels = 0;
-    int           i;
+    int           i, stacked;
     PackOffInfo  *instanceData;
     Tcl_Channel   newChannel;
     char          chanName [20];
@@ -174,6 +228,11 @@ DpCreatePOChannel (interp, argc, argv)
     }
 
     instanceData->channelPtr = NULL;
+    instanceData->stack.self = NULL;
+    instanceData->stack.timer = NULL;
+    instanceData->header = PO_HEADER_DECIMAL;
+    instanceData->maxMessage = DEFAULT_MAX_MESSAGE;
+    stacked = 0;
 
     for (i = 0; i < argc; i += 2) {
         int v = i+1;
@@ -189,9 +248,41 @@ DpCreatePOChannel (interp, argc, argv)
             if(instanceData->channelPtr == NULL) {
                 goto error1;
             }
+	} else if (strncmp(argv[i], "-stack", len)==0) {
+	    if (v == argc) {
+                goto error2;
+            }
+
+            if (Tcl_GetBoolean(interp, argv[v], &stacked) != TCL_OK) {
+                goto error1;
+            }
+	} else if (strncmp(argv[i], "-header", len)==0) {
+	    if (v == argc) {
+                goto error2;
+            }
+
+            if (POGetHeader(interp, argv[v], &(instanceData->header))
+		    != TCL_OK) {
+                goto error1;
+            }
+	} else if (strncmp(argv[i], "-maxMessage", len)==0) {
+	    if (v == argc) {
+                goto error2;
+            }
+
+            if (Tcl_GetInt(interp, argv[v], &(instanceData->maxMessage))
+		    != TCL_OK) {
+                goto error1;
+            }
+            if (instanceData->maxMessage <= 0) {
+                Tcl_AppendResult(interp, "-maxMessage must be positive",
+			NULL);
+                goto error1;
+            }
 	} else {
-    	    Tcl_AppendResult(interp, "unknown option \"",
-                             argv[i], "\", must be -channel", NULL);
+    	    Tcl_AppendResult(interp, "unknown option \"", argv[i],
+		    "\", must be -channel, -header, -maxMessage or -stack",
+		    NULL);
 	    goto error1;
 	}
     }
@@ -215,10 +306,22 @@ DpCreatePOChannel (interp, argc, argv)
         goto error1;
     }
 
-    instanceData->used       = 0;
+    instanceData->head       = 0;
     instanceData->bufLength  = BUFFER_CHUNK;
     instanceData->dataLength = 0;
-    instanceData->ignoreNextRead = 0;
+    instanceData->partial    = 0;
+    instanceData->current    = 0;
+
+    if (stacked) {
+        newChannel = DpStackChannel(interp, &poChannelType,
+		(ClientData)instanceData, TCL_READABLE,
+		instanceData->channelPtr, &(instanceData->stack));
+        if (newChannel == NULL) {
+            ckfree(instanceData->buffer);
+            goto error1;
+        }
+        return newChannel;
+    }
 
     /* Packoff filters are only readable. */
     sprintf(chanName, "pofilter%d", openedChannels++);
@@ -270,6 +373,7 @@ ClosePOChannel (instanceData, interp)
     Tcl_Interp *interp;        /* Pointer to the tcl interpreter. */
 {
     PackOffInfo *pd = (PackOffInfo *) instanceData;
+    DpStackRelease(&(pd->stack));
     ckfree((char *)pd->buffer);
     ckfree((char *)instanceData);
     return 0;
@@ -284,7 +388,9 @@ ClosePOChannel (instanceData, interp)
  *
  *	Reads in a stream of data that was generated using the packon plugin
  *	filter (or a similar algorithm), and separates the packets, returning them
- *	separately to the tcl level.
+ *	separately to the tcl level. A packet bigger than buf is returned in
+ *	pieces by consecutive calls. Empty packets are skipped, since they
+ *	would look like the end of the file.
  *
  * Results:
  *
@@ -292,7 +398,8 @@ ClosePOChannel (instanceData, interp)
  *
  * Side effects:
  *
- *	1. Calls the read procedure of the subordinated channel.
+ *	1. Calls the read procedure of the subordinated channel, if no whole
+ *	   packet is buffered yet.
  *	2. Stores a POSIX code at errorBuffer if an error occurs.
  *
  * ----------------------------------------------------------------------------
@@ -305,146 +412,45 @@ InputPOChannel (instanceData, buf, bufsize, errorCodePtr)
     int	        bufsize;	   /* (in) Size of buffer. */
     int	       *errorCodePtr;	   /* (out) POSIX error code (if any). */
 {
-
     PackOffInfo *pD = (PackOffInfo *)instanceData;
+    int header, length, status, n;
 
-    char      temp [7], inBufX [BUFFER_CHUNK];
-    int       messLength, inLength;
-
-    char *inBuf = inBufX;
-
-    inLength = Tcl_Read(pD->channelPtr, inBuf, BUFFER_CHUNK);
-
-    if (inLength == -1) {
-        *errorCodePtr = Tcl_GetErrno();
-        return -1;
-    }
-
-    /* Do we have at least a message header in the buffer? */
-
-    if (pD->dataLength - pD->used < 6) {
-
-	/* No. Can we make up a header using the input? */
-
-	int available = pD->dataLength - pD->used;
-
-	if (inLength >= 6 - available) {
-
-            /* Yes. Transfer rest of header and adjust local structures. */
-
-            mymove(pD->buffer, pD->buffer + pD->used, 6 - available);
-            mymove(pD->buffer + available, inBuf, 6 - available);
-
-            pD->dataLength = 6;
-            pD->used = 0;
-
-            inBuf += 6 - available;
-            inLength -= 6 - available;
-
-	} else {
-
-            /* No. Transfer input and return. */
-
-            mymove(pD->buffer, pD->buffer + pD->used, inLength);
-            pD->dataLength += inLength;
-            pD->used = 0;
-
-            *errorCodePtr = EAGAIN;
-            return 0;
-	}
+    /* Finish the packet that did not fit in the last buffer. */
 
+    if (pD->partial > 0) {
+        n = (pD->partial < bufsize) ? pD->partial : bufsize;
+        POTake(pD, buf, n);
+        pD->partial -= n;
+        return n;
     }
 
-    /* See how many bytes we need for the next message. */
-
-    memcpy(temp, pD->buffer + pD->used, 6);
-    temp[6] = '\0';
-
-    if((messLength = atoi(temp)) <= 0) {
-        return -1;
-    }
-
-    /* Do not allow packet sizes that are bigger than what the size of buf is.
-     * This is because we want a packet to be returned as a unit.
-     */
-
-    if(messLength > bufsize) {
-        *errorCodePtr = EINVAL;
-        return -1;
-    }
-
-    /* Do we have enough data in the buffer? */
-
-    if(pD->dataLength - pD->used >= 6 + messLength) {
-
-	/* Yes. Output data and adjust local structures. */
-
-	memcpy(buf, pD->buffer + pD->used + 6, messLength);
-	pD->used += 6 + messLength;
-        pD->ignoreNextRead = 1;
+    for (;;) {
+        status = POParseHeader(pD, &header, &length, errorCodePtr);
+        if (status < 0) {
+            return -1;
+        }
 
-    } else if(pD->dataLength - pD->used + inLength >= 6 + messLength) {
+        if ((status > 0) && (pD->dataLength >= header + length)) {
 
-	/* Do we have enough data in buffer and inBuf together? */
-
-	int useful = pD->dataLength - pD->used - 6;
-
-	memcpy(buf, pD->buffer + pD->used + 6, useful);
-	memcpy(buf +  useful, inBuf, messLength - useful);
-
-	pD->used = pD->dataLength = 0;
-
-	inBuf += messLength - useful;
-	inLength -= messLength - useful;
-
-        pD->ignoreNextRead = 1;
-
-    } else {
-
-        messLength = 0;
-    }
-
-    /* Is there enough space to hold the data? */
-
-    if(pD->bufLength - (pD->dataLength - pD->used) >= inLength) {
-
-	/* If yes, just put everything in place. */
-
-	if(pD->dataLength - pD->used > 0) {
-            mymove(pD->buffer, pD->buffer + pD->used, pD->dataLength - pD->used);
-	}
-
-	mymove(pD->buffer + pD->dataLength - pD->used, inBuf, inLength);
-
-	pD->dataLength = pD->dataLength - pD->used + inLength;
-	pD->used = 0;
-
-    } else {
-
-	/* If no, create a bigger buffer. */
-
-	int   neededSpace = inLength - (pD->bufLength - (pD->dataLength - pD->used));
-
-	char *temp = ckalloc(pD->bufLength + neededSpace + BUFFER_CHUNK);
-
-	if(temp == NULL) {
-            return ENOMEM;
-	}
-
-	memcpy(temp, pD->buffer + pD->used, pD->dataLength - pD->used);
-        memcpy(temp + pD->dataLength - pD->used, inBuf, inLength);
-
-        pD->dataLength = pD->dataLength - pD->used + inLength;
-        pD->bufLength = pD->bufLength + neededSpace + BUFFER_CHUNK;
-        pD->used = 0;
-
-        ckfree(pD->buffer);
-        pD->buffer = temp;
+            /* A whole packet is buffered. */
 
+            POTake(pD, NULL, header);
+            if (length == 0) {
+                continue;
+            }
+            n = (length < bufsize) ? length : bufsize;
+            POTake(pD, buf, n);
+            pD->partial = length - n;
+            pD->current = length;
+            return n;
+        }
+
+        /* Not yet; get more data. */
+
+        if ((n = POFill(pD, errorCodePtr)) <= 0) {
+            return n;
+        }
     }
-
-    return messLength;
-
 }
 
 
@@ -505,6 +511,11 @@ GFPPOChannel (instanceData, direction, handlePtr)
     int		direction;
     FileHandle *handlePtr;
 {
+    PackOffInfo *pD = (PackOffInfo *)instanceData;
+
+    if (pD->stack.self != NULL) {
+	return Tcl_GetChannelHandle(pD->channelPtr, direction, handlePtr);
+    }
     *handlePtr = NULL;
     return TCL_OK;
 }
@@ -525,7 +536,9 @@ GFPPOChannel (instanceData, direction)
  *
  * SOPPOChannel --
  *
- *	There is no non-standard option allowed for packoff filters.
+ *	Sets the header format (-header decimal or varint) or the largest
+ *	packet accepted (-maxMessage) of a packoff channel. A stacked packoff
+ *	channel passes other options to the channel below.
  *
  * Results:
  *
@@ -537,7 +550,7 @@ GFPPOChannel (instanceData, direction)
  *
  * ----------------------------------------------------------------------------
  */
-	/* ARGSUSED */
+
 static int
 SOPPOChannel (instanceData, interp, optionName, optionValue)
     ClientData	 instanceData;	 /* (in) Pointer to PackOffInfo struct. */
@@ -545,10 +558,44 @@ SOPPOChannel (instanceData, interp, optionName, optionValue)
     CONST char	*optionName;
     CONST char	*optionValue;
 {
-    Tcl_AppendResult (interp, "illegal option \"", optionName, "\" -- ",
-                      "must be a standard fconfigure option", NULL);
-    return TCL_ERROR;
+    PackOffInfo *pD = (PackOffInfo *)instanceData;
+    int option = -1, value;
+
+    if (optionName[0] == '-') {
+        option = DpTranslateOption(optionName+1);
+    }
+
+    switch (option) {
+
+    case DP_HEADER:
+        return POGetHeader(interp, optionValue, &(pD->header));
+
+    case DP_MAXMESSAGE:
+        if (Tcl_GetInt(interp, optionValue, &value) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (value <= 0) {
+            Tcl_AppendResult(interp, "-maxMessage must be positive", NULL);
+            return TCL_ERROR;
+        }
+        pD->maxMessage = value;
+        return TCL_OK;
+
+    case DP_STACK:
+        Tcl_AppendResult(interp, "can't set stack after packoff channel ",
+		"is opened", NULL);
+        return TCL_ERROR;
 
+    default:
+        if (pD->stack.self != NULL) {
+	    return DpStackSetOption(pD->channelPtr, interp, optionName,
+		    optionValue);
+        }
+        Tcl_AppendResult (interp, "illegal option \"", optionName, "\" -- ",
+                          "must be -header, -maxMessage or a standard ",
+			  "fconfigure option", NULL);
+        return TCL_ERROR;
+    }
 }
 
 
@@ -558,7 +605,9 @@ SOPPOChannel (instanceData, interp, optionName, optionValue)
  *
  * GOPPOChannel --
  *
- *	There are no non-standard options for a packoff channel.
+ *	Returns the non-standard options of a packoff channel: -header,
+ *	-maxMessage and -stack. A stacked packoff channel passes other
+ *	options to the channel below.
  *
  * Results:
  *
@@ -584,12 +633,48 @@ GOPPOChannel (instanceData,
     CONST84 char	*optionName;
     Tcl_DString *dsPtr;		/* (out) String to store the result in. */
 {
-    if (optionName != NULL) {
+    PackOffInfo *pD = (PackOffInfo *)instanceData;
+    CONST char *header;
+    char maxMessage [16];
+
+    header = (pD->header == PO_HEADER_VARINT) ? "varint" : "decimal";
+    sprintf(maxMessage, "%d", pD->maxMessage);
+
+    if (optionName == NULL) {
+        Tcl_DStringAppend (dsPtr, " -header ", -1);
+        Tcl_DStringAppend (dsPtr, header, -1);
+        Tcl_DStringAppend (dsPtr, " -maxMessage ", -1);
+        Tcl_DStringAppend (dsPtr, maxMessage, -1);
+        Tcl_DStringAppend (dsPtr, " -stack ", -1);
+        Tcl_DStringAppend (dsPtr, (pD->stack.self != NULL) ? "1" : "0", -1);
+        if (pD->stack.self != NULL) {
+	    return DpStackGetOption(pD->channelPtr, interp, NULL, dsPtr);
+        }
+        return TCL_OK;
+    }
+
+    switch ((optionName[0] == '-') ? DpTranslateOption(optionName+1) : -1) {
+
+    case DP_HEADER:
+        Tcl_DStringAppend (dsPtr, header, -1);
+        return TCL_OK;
+
+    case DP_MAXMESSAGE:
+        Tcl_DStringAppend (dsPtr, maxMessage, -1);
+        return TCL_OK;
+
+    case DP_STACK:
+        Tcl_DStringAppend (dsPtr, (pD->stack.self != NULL) ? "1" : "0", -1);
+        return TCL_OK;
+
+    default:
+        if (pD->stack.self != NULL) {
+	    return DpStackGetOption(pD->channelPtr, interp, optionName,
+		    dsPtr);
+        }
         Tcl_SetErrno(EINVAL);
         return TCL_ERROR;
     }
-
-    return TCL_OK;
 }
 
 
@@ -628,6 +713,11 @@ WCPPOChannel (instanceData, mask)
 #ifdef _TCL76
     (Tcl_GetChannelType(channelPtr)->watchChannelProc)
                          (Tcl_GetChannelInstanceData(channelPtr), mask);
+#else
+    if (((PackOffInfo *)instanceData)->stack.self != NULL) {
+	DpStackWatch(&(((PackOffInfo *)instanceData)->stack), channelPtr,
+		mask, POPacketReady(instanceData));
+    }
 #endif
 
     return;
@@ -677,17 +767,390 @@ CRPPOChannel (instanceData, mask)
 }
 
 
-/* memmove does not seem to be available on all systems */
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * POGetHeader --
+ *
+ *	Converts the value of a -header option.
+ *
+ * Results:
+ *
+ *	Standard Tcl result. The header format is stored at headerPtr.
+ *
+ * Side effects:
+ *
+ *	None.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+static int
+POGetHeader (interp, value, headerPtr)
+    Tcl_Interp *interp;		/* (in) For error messages. */
+    CONST char *value;		/* (in) "decimal" or "varint". */
+    int        *headerPtr;	/* (out) PO_HEADER_DECIMAL or PO_HEADER_VARINT. */
+{
+    if (strcmp(value, "decimal") == 0) {
+        *headerPtr = PO_HEADER_DECIMAL;
+    } else if (strcmp(value, "varint") == 0) {
+        *headerPtr = PO_HEADER_VARINT;
+    } else {
+        Tcl_AppendResult(interp, "bad header \"", value,
+		"\": must be decimal or varint", NULL);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * POParseHeader --
+ *
+ *	Decodes the header of the next packet in the buffer of a packoff
+ *	channel.
+ *
+ * Results:
+ *
+ *	1 if the whole header is buffered; its length is stored at headerPtr,
+ *	and the length of the packet at lengthPtr. 0 if more data is needed.
+ *	-1 if the header is wrong (EINVAL) or announces a packet longer than
+ *	-maxMessage (EMSGSIZE); the error code is stored at errorCodePtr.
+ *
+ * Side effects:
+ *
+ *	None. The header stays in the buffer.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+static int
+POParseHeader (pD, headerPtr, lengthPtr, errorCodePtr)
+    PackOffInfo *pD;		/* (in) Packoff channel. */
+    int         *headerPtr;	/* (out) Length of the header. */
+    int         *lengthPtr;	/* (out) Length of the packet. */
+    int         *errorCodePtr;	/* (out) POSIX error code (if any). */
+{
+    unsigned char c;
+    int i, length = 0;
+
+    if (pD->header == PO_HEADER_DECIMAL) {
+        if (pD->dataLength < PO_DECIMAL_LENGTH) {
+            return 0;
+        }
+        for (i = 0; i < PO_DECIMAL_LENGTH; i++) {
+            c = PO_BYTE(pD, i);
+            if ((c < '0') || (c > '9')) {
+                *errorCodePtr = EINVAL;
+                return -1;
+            }
+            length = length * 10 + (c - '0');
+        }
+        *headerPtr = PO_DECIMAL_LENGTH;
+    } else {
+        for (i = 0; ; i++) {
+            if (i == pD->dataLength) {
+                return 0;
+            }
+            c = PO_BYTE(pD, i);
+
+            /* The fifth byte holds bits 28 to 30; a length is an int. */
+
+            if ((i == PO_VARINT_LENGTH - 1) && (c > 7)) {
+                *errorCodePtr = EINVAL;
+                return -1;
+            }
+            length |= (c & 0x7f) << (7 * i);
+            if ((c & 0x80) == 0) {
+                break;
+            }
+        }
+        *headerPtr = i + 1;
+    }
+
+    if (length > pD->maxMessage) {
+        *errorCodePtr = EMSGSIZE;
+        return -1;
+    }
+    *lengthPtr = length;
+    return 1;
+}
+
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * POFill --
+ *
+ *	Reads the subordinated channel once, into the free space that
+ *	follows the data in the ring. The ring is doubled when less than
+ *	BUFFER_CHUNK bytes are free; since this is only done while no whole
+ *	packet is buffered, it never gets much bigger than twice -maxMessage.
+ *
+ * Results:
+ *
+ *	The number of bytes read, 0 at the end of the file, or -1 with a
+ *	POSIX error code (EAGAIN if nothing could be read) at errorCodePtr.
+ *
+ * Side effects:
+ *
+ *	Reads the subordinated channel; may reallocate the ring.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+static int
+POFill (pD, errorCodePtr)
+    PackOffInfo *pD;		/* (in) Packoff channel. */
+    int         *errorCodePtr;	/* (out) POSIX error code (if any). */
+{
+    int tail, room, n;
+
+    if (pD->bufLength - pD->dataLength < BUFFER_CHUNK) {
+        char *buffer = ckalloc(2 * pD->bufLength);
+
+        if (buffer == NULL) {
+            *errorCodePtr = ENOMEM;
+            return -1;
+        }
+        n = pD->dataLength;
+        POTake(pD, buffer, n);
+        ckfree(pD->buffer);
+        pD->buffer = buffer;
+        pD->bufLength *= 2;
+        pD->head = 0;
+        pD->dataLength = n;
+    }
+
+    tail = (pD->head + pD->dataLength) % pD->bufLength;
+    room = (tail >= pD->head) ? pD->bufLength - tail : pD->head - tail;
+    if (room > BUFFER_CHUNK) {
+        room = BUFFER_CHUNK;
+    }
+
+    n = DpStackRead(&(pD->stack), pD->channelPtr, pD->buffer + tail, room);
+
+    if (n < 0) {
+        *errorCodePtr = Tcl_GetErrno();
+        return -1;
+    }
+    if (n == 0) {
+        if (!Tcl_Eof(pD->channelPtr)) {
+            *errorCodePtr = EAGAIN;
+            return -1;
+        }
+        return 0;
+    }
+    pD->dataLength += n;
+    return n;
+}
+
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * POTake --
+ *
+ *	Removes bytes from the front of the ring of a packoff channel,
+ *	copying them first if "to" is not NULL.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	The data in the ring shrinks by number bytes.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
 static void
-mymove (to, from, number)
-     char *to;
-     char *from;
-     int   number;
+POTake (pD, to, number)
+    PackOffInfo *pD;		/* (in) Packoff channel. */
+    char        *to;		/* (in) Where to copy the bytes, or NULL. */
+    int          number;	/* (in) How many; at most pD->dataLength. */
 {
+    int first = pD->bufLength - pD->head;
+
+    if (to != NULL) {
+        if (number <= first) {
+            memcpy(to, pD->buffer + pD->head, number);
+        } else {
+            memcpy(to, pD->buffer + pD->head, first);
+            memcpy(to + first, pD->buffer, number - first);
+        }
+    }
+
+    pD->dataLength -= number;
+    pD->head = (pD->dataLength == 0) ? 0 :
+	    (pD->head + number) % pD->bufLength;
+}
+
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * POPacketReady --
+ *
+ *	Tells whether a packoff channel can be read without reading the
+ *	subordinated channel: a whole packet, the rest of a packet or a bad
+ *	header is waiting in its buffer.
+ *
+ * Results:
+ *
+ *	1 if so, 0 otherwise.
+ *
+ * Side effects:
+ *
+ *	None.
+ *
+ * ----------------------------------------------------------------------------
+ */
 
-  for(/* empty */; number--; *to++ = *from++);
+static int
+POPacketReady (instanceData)
+    ClientData  instanceData;	/* (in) Pointer to PackOffInfo struct. */
+{
+    PackOffInfo *pD = (PackOffInfo *)instanceData;
+    int header, length, errorCode, status;
 
+    if (pD->partial > 0) {
+        return 1;
+    }
+    status = POParseHeader(pD, &header, &length, &errorCode);
+    return (status < 0)
+	    || ((status > 0) && (pD->dataLength >= header + length));
 }
 
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Dp_RecvMessagesCmd --
+ *
+ *	Implements "dp_recvMessages channelId", which returns every packet
+ *	buffered by a packoff channel in one call. The subordinated channel
+ *	is read once first if no whole packet is buffered. Data of a packet
+ *	already read with "read" or "gets" but not consumed yet comes first.
+ *
+ * Results:
+ *
+ *	TCL_OK with a list of packets, empty if none is complete, or
+ *	TCL_ERROR if the channel could not be read, a header is wrong, or
+ *	Tcl has buffered data of more than one packet.
+ *	An error found after some packets were taken is reported by the
+ *	next call.
+ *
+ * Side effects:
+ *
+ *	The channel is read.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+int
+Dp_RecvMessagesCmd (dummy, interp, argc, argv)
+    ClientData  dummy;		/* Not used. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int         argc;		/* Number of arguments. */
+    CONST84 char **argv;	/* Argument strings. */
+{
+    Tcl_Channel  chan;
+    PackOffInfo *pD;
+    Tcl_Obj     *listPtr, *msgPtr;
+    char        *bytes;
+    int          buffered, header, length, status, count, errorCode = 0;
+
+    if (argc != 2) {
+        Tcl_AppendResult(interp, "wrong # args: should be \"",
+		argv[0], " channelId\"", NULL);
+        return TCL_ERROR;
+    }
+    if ((chan = Tcl_GetChannel(interp, argv[1], NULL)) == NULL) {
+        return TCL_ERROR;
+    }
+
+    /* A stacked packoff channel is the top of its stack. */
+
+    chan = Tcl_GetTopChannel(chan);
+    if (Tcl_GetChannelType(chan) != &poChannelType) {
+        Tcl_AppendResult(interp, "channel \"", argv[1],
+		"\" is not a packoff channel", NULL);
+        return TCL_ERROR;
+    }
+    pD = (PackOffInfo *)Tcl_GetChannelInstanceData(chan);
+
+    listPtr = Tcl_NewObj();
+    count = 0;
+
+    /*
+     * What Tcl has buffered, and the rest of the packet it belongs to.
+     * Tcl may have read ahead into the following packets, and the
+     * boundaries between them are lost then.
+     */
+
+    buffered = Tcl_InputBuffered(chan);
+    if (buffered > pD->current - pD->partial) {
+        Tcl_AppendResult(interp, "channel \"", argv[1],
+		"\" has data of several packets buffered; read it first",
+		NULL);
+        Tcl_DecrRefCount(listPtr);
+        return TCL_ERROR;
+    }
+    if (buffered + pD->partial > 0) {
+        msgPtr = Tcl_NewObj();
+        bytes = (char *)Tcl_SetByteArrayLength(msgPtr, buffered + pD->partial);
+        if (buffered > 0) {
+            buffered = Tcl_Read(chan, bytes, buffered);
+            if (buffered < 0) {
+                buffered = 0;
+            }
+        }
+        POTake(pD, bytes + buffered, pD->partial);
+        Tcl_SetByteArrayLength(msgPtr, buffered + pD->partial);
+        pD->partial = 0;
+        Tcl_ListObjAppendElement(NULL, listPtr, msgPtr);
+        count++;
+    }
+
+    if (!POPacketReady((ClientData)pD)) {
+        if ((POFill(pD, &errorCode) < 0) && (errorCode != EAGAIN)
+		&& (count == 0)) {
+            goto error;
+        }
+    }
+
+    while ((status = POParseHeader(pD, &header, &length, &errorCode)) > 0) {
+        if (pD->dataLength < header + length) {
+            break;
+        }
+        POTake(pD, NULL, header);
+        msgPtr = Tcl_NewObj();
+        bytes = (char *)Tcl_SetByteArrayLength(msgPtr, length);
+        POTake(pD, bytes, length);
+        Tcl_ListObjAppendElement(NULL, listPtr, msgPtr);
+        count++;
+    }
+    if ((status < 0) && (count == 0)) {
+        goto error;
+    }
+
+    Tcl_SetObjResult(interp, listPtr);
+    return TCL_OK;
+
+error:
+    Tcl_DecrRefCount(listPtr);
+    Tcl_SetErrno(errorCode);
+    Tcl_AppendResult(interp, "error reading \"", argv[1], "\": ",
+	    Tcl_PosixError(interp), NULL);
+    return TCL_ERROR;
+}
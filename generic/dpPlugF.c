@@ -18,24 +18,100 @@
 
 #define DP_ARBITRARY_LIMIT 500
 
+/*
+ * Filter output is collected in a buffer that belongs to the channel and
+ * is reused from call to call. It starts at DP_FILTER_BUF_SIZE bytes and
+ * grows as needed, up to DP_FILTER_MAX_BUF.
+ */
+
+#define DP_FILTER_BUF_SIZE	(16 * 1024)
+#define DP_FILTER_MAX_BUF	(64 * 1024 * 1024)
+
 typedef struct {
     char *outBuf;
+    int   outSize;
     int   outLength;
     int   outUsed;
     int   eof;
+    int   error;	/* Error to report on the next read, or 0. */
 } FiltBuffer;
 
+/*
+ * The input and output filters of a channel are chains of one or more
+ * stages. Each stage reads what the previous one wrote. Every stage but
+ * the last writes into one of the chain's two scratch buffers, taken
+ * in turn, so a chain costs no more channel layers than a single filter.
+ * The scratch buffers belong to the chain rather than to the channel so
+ * that the output chain can run on a filter thread (see -threaded) while
+ * the input chain runs on the channel's own thread.
+ */
+
+typedef struct {
+    Dp_PlugInFilter2 *filterPtr;	/* Filter run by this stage. */
+    void	    *data;	/* Internal state of the filter. */
+} FiltStage;
+
+typedef struct {
+    int		numStages;
+    FiltStage  *stages;
+    FiltBuffer  scratch[2];
+} FiltChain;
+
 typedef struct {
     Tcl_Channel channelPtr;
     int         peek;
     FiltBuffer  i;
+    FiltBuffer  o;
     Tcl_Interp *interp;
-    Dp_PlugInFilterProc *inFilter;
-    Dp_PlugInFilterProc *outFilter;
-    void       *inData;
-    void       *outData;
+    FiltChain   in;
+    FiltChain   out;
+    struct FiltThread *thread;	/* Filter thread running the output
+				 * chain, or NULL (see -threaded). */
+    DpStack     stack;		/* Set if the channel is stacked on the
+				 * subordinated one (see -stack). */
 } PlugFInfo;
 
+/*
+ * With "-threaded 1" the output chain runs on a thread of its own.
+ * OutputPlugFChannel copies each block into a small ring of jobs and
+ * returns; the filter thread runs the jobs in order and appends the
+ * result to a shared buffer, which the channel's thread writes to the
+ * subordinated channel. The ring is bounded: a writer that gets too far
+ * ahead waits for the filter thread. The channel's thread is told about
+ * new output with an event, and also picks it up on every write and
+ * when the channel is closed. Everything shared is guarded by the mutex.
+ */
+
+#define DP_FILTER_QUEUE_DEPTH	8
+
+typedef struct {
+    char *buf;			/* Data to filter. */
+    int   length;		/* Number of bytes in buf. */
+    int   size;			/* Number of bytes allocated for buf. */
+    int   mode;			/* Mode to run the chain in. */
+} FiltJob;
+
+typedef struct FiltThread {
+    Tcl_ThreadId  threadId;	/* The filter thread. */
+    Tcl_ThreadId  owner;	/* Thread that owns the channel. */
+    Tcl_Mutex     mutex;
+    Tcl_Condition cond;		/* Signalled whenever a job is queued or
+				 * finished, or the thread should stop. */
+    FiltJob	  jobs[DP_FILTER_QUEUE_DEPTH];
+    int		  head;		/* Slot of the oldest job. */
+    int		  count;	/* Jobs queued, including the one running. */
+    FiltBuffer	  work;		/* Output of the running job. */
+    FiltBuffer	  done;		/* Output not written yet. */
+    int		  error;	/* Error to report on the next write. */
+    int		  eventPending;	/* A FiltThreadEvent is queued. */
+    int		  stop;		/* The thread should exit. */
+} FiltThread;
+
+typedef struct {
+    Tcl_Event  header;		/* Must be first. */
+    PlugFInfo *data;		/* Channel with output to write. */
+} FiltThreadEvent;
+
 
 /*
  * Prototypes for functions referenced only in this file.
@@ -83,6 +159,65 @@ static int	CRPPlugFChannel		_ANSI_ARGS_((ClientData instanceData,
 static void	WCPPlugFChannel		_ANSI_ARGS_((ClientData instanceData,
                                                      int mask));
 
+static int	GrowFiltBuffer		_ANSI_ARGS_((FiltBuffer *x, int room));
+
+static int	RunFilter		_ANSI_ARGS_((Tcl_Interp *interp,
+						     Dp_PlugInFilter2 *filterPtr,
+						     void **filterData,
+						     CONST84 char *inBuf,
+						     int inLength, int mode,
+						     FiltBuffer *x));
+
+static int	SetFilterOption		_ANSI_ARGS_((PlugFInfo *data,
+						     Dp_PlugInFilter2 *filterPtr,
+						     void **filterData,
+						     CONST char *value));
+
+static void	GetFilterOption		_ANSI_ARGS_((PlugFInfo *data,
+						     Dp_PlugInFilter2 *filterPtr,
+						     void **filterData,
+						     Tcl_DString *dsPtr));
+
+static int	InitChain		_ANSI_ARGS_((Tcl_Interp *interp,
+						     CONST84 char *names,
+						     FiltChain *chainPtr));
+
+static int	RunChain		_ANSI_ARGS_((Tcl_Interp *interp,
+						     FiltChain *chainPtr,
+						     CONST84 char *inBuf,
+						     int inLength, int mode,
+						     FiltBuffer *x));
+
+static int	SetChainOption		_ANSI_ARGS_((PlugFInfo *data,
+						     FiltChain *chainPtr,
+						     CONST char *value));
+
+static void	GetChainOption		_ANSI_ARGS_((PlugFInfo *data,
+						     FiltChain *chainPtr,
+						     Tcl_DString *dsPtr));
+
+static int	StartFiltThread		_ANSI_ARGS_((Tcl_Interp *interp,
+						     PlugFInfo *data));
+
+static int	StopFiltThread		_ANSI_ARGS_((PlugFInfo *data));
+
+static int	QueueFiltJob		_ANSI_ARGS_((PlugFInfo *data,
+						     CONST84 char *buf,
+						     int length, int mode));
+
+static void	WaitFiltThread		_ANSI_ARGS_((PlugFInfo *data));
+
+static void	WriteFiltOutput		_ANSI_ARGS_((PlugFInfo *data));
+
+static Tcl_ThreadCreateType FiltThreadProc _ANSI_ARGS_((
+			    ClientData clientData));
+
+static int	FiltThreadEventProc	_ANSI_ARGS_((Tcl_Event *evPtr,
+						     int flags));
+
+static int	FiltThreadDeleteProc	_ANSI_ARGS_((Tcl_Event *evPtr,
+						     ClientData clientData));
+
 
 /*
  * This structure stores the names of the functions that Tcl calls when certain
@@ -110,7 +245,7 @@ Tcl_ChannelType plugFChannelType = {
     NULL,			/* Proc to set blocking mode on socket */
     /* Only valid in TCL_CHANNEL_VERSION_2 channels or later */
     NULL,			/* Proc to call to flush a channel */
-    NULL,			/* Proc to call to handle a channel event */
+    DpStackHandler,		/* Proc to call to handle a channel event */
     /* Only valid in TCL_CHANNEL_VERSION_3 channels or later */
     NULL,			/* Proc to call to seek on the channel which can handle 64-bit offsets */
     /* Only valid in TCL_CHANNEL_VERSION_4 channels or later */
@@ -145,7 +280,7 @@ DpCreatePlugFChannel (interp, argc, argv)
     CONST84 char      **argv;           /* (in) Argument strings. */
 {
     static int    openedChannels = 0;
-    int           i;
+    int           i, threaded, stacked;
     PlugFInfo    *instanceData;
     Tcl_Channel   newChannel;
     char          chanName [20];
@@ -163,24 +298,27 @@ DpCreatePlugFChannel (interp, argc, argv)
     /* Install the default identity filters. */
 
     instanceData->channelPtr = NULL;
-    instanceData->inFilter   = Dp_GetFilterPtr (interp, "identity");
-
-    if (instanceData->inFilter == NULL) {
-        Tcl_AppendResult(interp, "unable to find identity plug-in filter",
-		 NULL);
-        return NULL;
-    }
-
-    instanceData->outFilter = Dp_GetFilterPtr (interp, "identity");
-
-    if (instanceData->outFilter == NULL) {
+    instanceData->in.numStages = 0;
+    instanceData->in.stages = NULL;
+    instanceData->out.numStages = 0;
+    instanceData->out.stages = NULL;
+    memset(instanceData->in.scratch, 0, sizeof(instanceData->in.scratch));
+    memset(instanceData->out.scratch, 0, sizeof(instanceData->out.scratch));
+    instanceData->thread = NULL;
+    instanceData->stack.self = NULL;
+    instanceData->stack.timer = NULL;
+
+    if ((InitChain(interp, "identity", &(instanceData->in)) != TCL_OK)
+	    || (InitChain(interp, "identity", &(instanceData->out)) != TCL_OK)) {
         Tcl_AppendResult(interp, "unable to find identity plug-in filter",
 		 NULL);
-        return NULL;
+        goto error1;
     }
 
     /* Identify the given options and take appropriate actions. */
 
+    threaded = 0;
+    stacked = 0;
     for (i = 0; i < argc; i += 2) {
         int v = i+1;
 	size_t len = strlen(argv[i]);
@@ -195,19 +333,25 @@ DpCreatePlugFChannel (interp, argc, argv)
         } else if (strncmp(argv[i], "-infilter", len)==0) {
 	    if (v == argc) {goto error2;}
 
-            instanceData->inFilter =  Dp_GetFilterPtr (interp, argv[v]);
-            if (instanceData->inFilter == NULL) {
-                Tcl_AppendResult(interp, "unable to find plug-in filter ",
-			argv[v], NULL);
+            if (InitChain(interp, argv[v], &(instanceData->in)) != TCL_OK) {
                 goto error1;
             }
         } else if (strncmp(argv[i], "-outfilter", len)==0) {
 	    if (v == argc) {goto error2;}
 
-            instanceData->outFilter =  Dp_GetFilterPtr (interp, argv[v]);
-            if (instanceData->outFilter == NULL) {
-                Tcl_AppendResult(interp, "unable to find plug-in filter ",
-			argv[v], NULL);
+            if (InitChain(interp, argv[v], &(instanceData->out)) != TCL_OK) {
+                goto error1;
+            }
+        } else if (strncmp(argv[i], "-threaded", len)==0) {
+	    if (v == argc) {goto error2;}
+
+            if (Tcl_GetBoolean(interp, argv[v], &threaded) != TCL_OK) {
+                goto error1;
+            }
+        } else if (strncmp(argv[i], "-stack", len)==0) {
+	    if (v == argc) {goto error2;}
+
+            if (Tcl_GetBoolean(interp, argv[v], &stacked) != TCL_OK) {
                 goto error1;
             }
 	} else {
@@ -226,19 +370,11 @@ DpCreatePlugFChannel (interp, argc, argv)
     /* No peek by default. */
     instanceData->peek = 0;
 
-    /*
-     * A PIF channel is always both writable and readable. The real behavior
-     * depends on the properties of the subordinated channel.
-     */
+    instanceData->interp        = interp;
 
-    sprintf(chanName, "plugfilter%d", openedChannels++);
-    newChannel = Tcl_CreateChannel(&plugFChannelType, chanName,
-    		(ClientData)instanceData, TCL_READABLE | TCL_WRITABLE);
-    if (newChannel == NULL) {
-        Tcl_AppendResult(interp, "Unable to create plug-in channel", NULL);
+    if (threaded && (StartFiltThread(interp, instanceData) != TCL_OK)) {
         goto error1;
     }
-    Tcl_RegisterChannel(interp, newChannel);
 
     /*
      * Initialize the data related to buffering. Notice the asymmetry
@@ -246,14 +382,42 @@ DpCreatePlugFChannel (interp, argc, argv)
      */
 
     instanceData->i.outBuf      = NULL;
+    instanceData->i.outSize     = 0;
     instanceData->i.outLength   = 0;
     instanceData->i.outUsed     = 0;
     instanceData->i.eof         = 0;
+    instanceData->i.error       = 0;
+
+    instanceData->o.outBuf      = NULL;
+    instanceData->o.outSize     = 0;
+    instanceData->o.outLength   = 0;
+    instanceData->o.outUsed     = 0;
+    instanceData->o.eof         = 0;
+    instanceData->o.error       = 0;
+
+    if (stacked) {
+        newChannel = DpStackChannel(interp, &plugFChannelType,
+		(ClientData)instanceData, TCL_READABLE | TCL_WRITABLE,
+		instanceData->channelPtr, &(instanceData->stack));
+        if (newChannel == NULL) {
+            goto error1;
+        }
+        return newChannel;
+    }
 
-    instanceData->interp        = interp;
+    /*
+     * A PIF channel is always both writable and readable. The real behavior
+     * depends on the properties of the subordinated channel.
+     */
 
-    instanceData->inData        = NULL;
-    instanceData->outData       = NULL;
+    sprintf(chanName, "plugfilter%d", openedChannels++);
+    newChannel = Tcl_CreateChannel(&plugFChannelType, chanName,
+    		(ClientData)instanceData, TCL_READABLE | TCL_WRITABLE);
+    if (newChannel == NULL) {
+        Tcl_AppendResult(interp, "Unable to create plug-in channel", NULL);
+        goto error1;
+    }
+    Tcl_RegisterChannel(interp, newChannel);
 
     return newChannel;
 
@@ -262,6 +426,15 @@ error2:
     /* continues with error1 */
 
 error1:
+    if (instanceData->thread != NULL) {
+	StopFiltThread(instanceData);
+    }
+    if (instanceData->in.stages != NULL) {
+	ckfree((char *)instanceData->in.stages);
+    }
+    if (instanceData->out.stages != NULL) {
+	ckfree((char *)instanceData->out.stages);
+    }
     ckfree((char *)instanceData);
     return NULL;
 }
@@ -278,7 +451,8 @@ error1:
  * Results:
  *
  *	If everything goes well, returns 0. If any error happens,
- *      it returns a POSIX error code.
+ *      it returns -1 with the POSIX error code in errno. The channel
+ *      is closed either way.
  *
  * Side effects:
  *
@@ -305,14 +479,13 @@ ClosePlugFChannel (instanceData, interp)
 
     status = 0;
 
-    if (data->i.outBuf != NULL) {
-        ckfree(data->i.outBuf);
-        /*
-         * If close fails, and is repeated later, this will prevent
-         * freeing the buffer again.
-         */
-        data->i.outBuf = NULL;
-    }
+    /*
+     * Nobody will read the input that is still buffered.
+     */
+
+    data->i.outLength = 0;
+    data->i.outUsed = 0;
+    data->o.outLength = 0;
 
     /*
      * In case the data was incomplete, and the filter was waiting for
@@ -321,24 +494,37 @@ ClosePlugFChannel (instanceData, interp)
      * by the filter should be released now.
      */
 
-    error = (data->outFilter) (NULL, 0, &outBuf, &outLength,
-                               &(data->outData), data->interp, DP_FILTER_CLOSE);
-    Tcl_SetErrno(error);
+    if (data->thread != NULL) {
+	/*
+	 * The filter thread runs the chain in DP_FILTER_CLOSE mode and
+	 * all its output is written before the thread exits.
+	 */
 
-    if (error != 0) {
-        Tcl_SetErrno(error);
+	error = StopFiltThread(data);
+	outBuf = NULL;
+	outLength = 0;
+    } else {
+	error = RunChain(data->interp, &(data->out), NULL, 0,
+		DP_FILTER_CLOSE, &(data->o));
+	outBuf = data->o.outBuf;
+	outLength = data->o.outLength;
+	data->o.outLength = 0;
+    }
 
-        /*
-         * Do not free instance data - the user might take some corrective
-         * action based on the POSIX error code, could even write to the
-         * channel, and then attept to close it again.
-         */
+    /*
+     * The filters have been told to release their data whatever they
+     * returned, so the channel can't be used again: an error is
+     * reported once the rest of the channel has been torn down.
+     */
 
-        return -1;
+    if (error != 0) {
+        Tcl_SetErrno(error);
+        status = -1;
     }
 
     if (outLength > 0) {
-        tmp = Tcl_Write(data->channelPtr, outBuf, outLength);
+        tmp = DpStackWrite(&(data->stack), data->channelPtr, outBuf,
+		outLength);
 
         if (tmp == -1) {
             status = -1;
@@ -349,38 +535,46 @@ ClosePlugFChannel (instanceData, interp)
              */
             int tmp1;
 
-            tmp1 = Tcl_Write(data->channelPtr, outBuf + tmp, outLength - tmp);
+            tmp1 = DpStackWrite(&(data->stack), data->channelPtr,
+		    outBuf + tmp, outLength - tmp);
             if (tmp1 != (outLength - tmp)) {
                 Tcl_SetErrno(ENOSPC);
                 status = -1;
             }
         }
-	ckfree(outBuf);
     }
 
     /* If the channel is closed, nobody is interested in reading from
      * it anymore. Signall to the filter and ignore the output.
      */
 
-    error = (data->inFilter) (NULL, 0, &outBuf, &outLength,
-                               &(data->inData), data->interp, DP_FILTER_CLOSE);
-    Tcl_SetErrno(error);
+    error = RunChain(data->interp, &(data->in), NULL, 0, DP_FILTER_CLOSE,
+	    &(data->i));
+    data->i.outLength = 0;
 
-    if (error != 0) {
+    if ((error != 0) && (status == 0)) {
         Tcl_SetErrno(error);
+        status = -1;
+    }
 
-        /*
-         * Do not free instance data - the user might take some corrective
-         * action based on the POSIX error code, could even write to the
-         * channel, and then attept to close it again.
-         */
+    DpStackRelease(&(data->stack));
 
-        return -1;
+    if (data->i.outBuf != NULL) {
+        ckfree(data->i.outBuf);
     }
-
-    if (outLength > 0) {
-        ckfree(outBuf);
+    if (data->o.outBuf != NULL) {
+        ckfree(data->o.outBuf);
+    }
+    for (tmp = 0; tmp < 2; tmp++) {
+	if (data->in.scratch[tmp].outBuf != NULL) {
+	    ckfree(data->in.scratch[tmp].outBuf);
+	}
+	if (data->out.scratch[tmp].outBuf != NULL) {
+	    ckfree(data->out.scratch[tmp].outBuf);
+	}
     }
+    ckfree((char *)data->in.stages);
+    ckfree((char *)data->out.stages);
 
     if (instanceData != NULL) {
         ckfree((char *)instanceData);
@@ -438,6 +632,12 @@ InputPlugFChannel (instanceData, buf, bufsize, errorCodePtr)
     transferred = 0;
     count = 0;
 
+    if (x->error != 0) {
+        *errorCodePtr = x->error;
+        x->error = 0;
+        return -1;
+    }
+
     while (transferred < bufsize) {
         if (x->outLength > 0) {
             if (bufsize - transferred < x->outLength - x->outUsed) {
@@ -455,29 +655,27 @@ InputPlugFChannel (instanceData, buf, bufsize, errorCodePtr)
             if (x->outUsed == x->outLength) {
                 x->outLength = 0;
                 x->outUsed = 0;
-                if (x->outBuf != NULL) {
-                    ckfree(x->outBuf);
-		}
-                x->outBuf = NULL;
             }
         } else { /* outLength == 0 */
             /* Try to get some output from the filter. */
 
             int error;
 
-            if(!(x->eof)) {
-                error = (data->inFilter) (inBuf, inUsed, &(x->outBuf),
-                                          &(x->outLength), &(data->inData),
-                                          data->interp, DP_FILTER_NORMAL);
-            } else {
-                error = (data->inFilter) (inBuf, inUsed, &(x->outBuf),
-                                          &(x->outLength), &(data->inData),
-                                          data->interp, DP_FILTER_EOF);
-            }
+            error = RunChain(data->interp, &(data->in), inBuf, inUsed,
+                    x->eof ? DP_FILTER_EOF : DP_FILTER_NORMAL, x);
 
 	    inUsed = 0;
 
             if (error != 0) {
+                if (transferred > 0) {
+                    /*
+                     * Hand out the data we already have; the error is
+                     * reported by the next read.
+                     */
+
+                    x->error = error;
+                    return transferred;
+                }
                 *errorCodePtr = error;
                 return -1;
             }
@@ -491,7 +689,8 @@ InputPlugFChannel (instanceData, buf, bufsize, errorCodePtr)
                 int newData;
 
                 if(!(x->eof)) {
-                    newData = Tcl_Read(data->channelPtr, inBuf, inBufLength);
+                    newData = DpStackRead(&(data->stack), data->channelPtr,
+			    inBuf, inBufLength);
                 } else {
                     newData = 0;
                 }
@@ -507,6 +706,14 @@ InputPlugFChannel (instanceData, buf, bufsize, errorCodePtr)
                     if(!(x->eof)) {
                         if(Tcl_Eof(data->channelPtr)) {
                             x->eof = 1;
+
+                            /*
+                             * Run the filters in DP_FILTER_EOF mode before
+                             * reporting eof, so that they can hand out (or
+                             * complain about) what they still hold.
+                             */
+
+                            continue;
                         }
                     }
 
@@ -560,7 +767,7 @@ OutputPlugFChannel	(instanceData, buf, toWrite, errorCodePtr)
     int  *errorCodePtr;		/* (out) POSIX error code (if any). */
 {
     int   tmp, error, outLength, mode;
-    char *outBuf = NULL;
+    char *outBuf;
     Tcl_DString option;
 
     char *cx;
@@ -584,20 +791,38 @@ OutputPlugFChannel	(instanceData, buf, toWrite, errorCodePtr)
     }
     Tcl_DStringFree(&option);
 
-    error = (data->outFilter) (buf, toWrite, &outBuf, &outLength,
-                               &(data->outData), data->interp, mode);
+    if (data->thread != NULL) {
+        /*
+         * The data is filtered on the filter thread. Errors show up on
+         * a later write.
+         */
+
+        error = QueueFiltJob(data, buf, toWrite, mode);
+        if (error != 0) {
+            *errorCodePtr = error;
+            return -1;
+        }
+        return toWrite;
+    }
+
+    error = RunChain(data->interp, &(data->out), buf, toWrite, mode,
+	    &(data->o));
+    outBuf = data->o.outBuf;
+    outLength = data->o.outLength;
+    data->o.outLength = 0;
 
     if (error != 0) {
         *errorCodePtr = error;
-        goto error1;
+        return -1;
     }
 
     if (outLength > 0) {
-        tmp = Tcl_Write(data->channelPtr, outBuf, outLength);
+        tmp = DpStackWrite(&(data->stack), data->channelPtr, outBuf,
+		outLength);
 
         if (tmp == -1) {
             *errorCodePtr = Tcl_GetErrno();
-            goto error1;
+            return -1;
         } else if (tmp != outLength) {
             /*
              * We could not write everything to the subordinated channel.
@@ -605,25 +830,17 @@ OutputPlugFChannel	(instanceData, buf, toWrite, errorCodePtr)
              */
             int tmp1;
 
-            tmp1 = Tcl_Write(data->channelPtr, outBuf + tmp, outLength - tmp);
+            tmp1 = DpStackWrite(&(data->stack), data->channelPtr,
+		    outBuf + tmp, outLength - tmp);
 
             if (tmp1 != outLength - tmp) {
                 *errorCodePtr = ENOSPC;
-                goto error1;
+                return -1;
             }
         }
     }
 
-    if (outBuf != NULL) {
-        ckfree(outBuf);
-    }
     return toWrite;
-
-error1:
-    if (outBuf != NULL) {
-        ckfree(outBuf);
-    }
-    return -1;
 }
 
 
@@ -654,6 +871,11 @@ GFPPlugFChannel (instanceData, direction, handlePtr)
     int		direction;
     FileHandle *handlePtr;
 {
+    PlugFInfo *data = (PlugFInfo *)instanceData;
+
+    if (data->stack.self != NULL) {
+	return Tcl_GetChannelHandle(data->channelPtr, direction, handlePtr);
+    }
     *handlePtr = NULL;
     return TCL_OK;
 }
@@ -749,9 +971,21 @@ SOPPlugFChannel (instanceData, interp, optionName, optionValue)
 		    " channel is opened", NULL);
 	    return TCL_ERROR;
 
+	case DP_THREADED:
+	    Tcl_AppendResult(interp, "can't set threaded after plug-in",
+		    " channel is opened", NULL);
+	    return TCL_ERROR;
+
+	case DP_STACK:
+	    Tcl_AppendResult(interp, "can't set stack after plug-in",
+		    " channel is opened", NULL);
+	    return TCL_ERROR;
+
 	case DP_OUTSET:
-	    error = (data->outFilter) (optionValue, strlen(optionValue), NULL,
-			NULL, &(data->outData), data->interp, DP_FILTER_SET);
+	    if (data->thread != NULL) {
+		WaitFiltThread(data);
+	    }
+	    error = SetChainOption(data, &(data->out), optionValue);
 
 	    if (error != 0) {
 		Tcl_AppendResult(interp, "can't set option ", optionValue,
@@ -761,8 +995,7 @@ SOPPlugFChannel (instanceData, interp, optionName, optionValue)
 	    break;
 
 	case DP_INSET:
-	    error = (data->inFilter) (optionValue, strlen(optionValue), NULL,
-		       NULL, &(data->inData), data->interp, DP_FILTER_SET);
+	    error = SetChainOption(data, &(data->in), optionValue);
 
 	    if (error != 0) {
 		Tcl_AppendResult(interp, "can't set option ", optionValue,
@@ -772,6 +1005,10 @@ SOPPlugFChannel (instanceData, interp, optionName, optionValue)
 	    break;
 
 	default:
+	    if (data->stack.self != NULL) {
+		return DpStackSetOption(data->channelPtr, interp, optionName,
+			optionValue);
+	    }
 	    Tcl_AppendResult (interp, "bad option \"", optionName,
 		    "\": must be peek, infilter, outfilter or a standard",
 		    "fconfigure option", NULL);
@@ -815,7 +1052,6 @@ GOPPlugFChannel (instanceData,
     Tcl_DString *dsPtr;		/* (out) String to store the result in. */
 {
     int option;
-    char *internal;
 
     PlugFInfo *data = (PlugFInfo *)instanceData;
 
@@ -837,6 +1073,13 @@ GOPPlugFChannel (instanceData,
 	IGO (instanceData, "-inset", dsPtr);
      	Tcl_DStringAppend (dsPtr, " -outset ", -1);
 	IGO (instanceData, "-outset", dsPtr);
+     	Tcl_DStringAppend (dsPtr, " -threaded ", -1);
+	IGO (instanceData, "-threaded", dsPtr);
+     	Tcl_DStringAppend (dsPtr, " -stack ", -1);
+	IGO (instanceData, "-stack", dsPtr);
+	if (data->stack.self != NULL) {
+	    return DpStackGetOption(data->channelPtr, interp, NULL, dsPtr);
+	}
         return TCL_OK;
     }
 #undef IGO
@@ -865,26 +1108,50 @@ GOPPlugFChannel (instanceData,
 	    break;
 
 	case DP_INFILTER:
-	    Tcl_DStringAppend (dsPtr, Dp_GetFilterName(data->inFilter), -1);
-	    break;
-
-	case DP_OUTFILTER:
-	    Tcl_DStringAppend (dsPtr, Dp_GetFilterName(data->outFilter), -1);
+	case DP_OUTFILTER: {
+	    FiltChain *chainPtr;
+	    int k;
+
+	    chainPtr = (option == DP_INFILTER) ? &(data->in) : &(data->out);
+	    for (k = 0; k < chainPtr->numStages; k++) {
+		Tcl_DStringAppendElement (dsPtr,
+			chainPtr->stages[k].filterPtr->name);
+	    }
 	    break;
+	}
 
 	case DP_INSET:
-	    (data->inFilter) (NULL, 0, &internal, NULL,
-                              &(data->inData), data->interp, DP_FILTER_GET);
-	    Tcl_DStringAppend (dsPtr, internal, -1);
+	    GetChainOption(data, &(data->in), dsPtr);
 	    break;
 
 	case DP_OUTSET:
-	    (data->outFilter) (NULL, 0, &internal, NULL,
-                               &(data->outData), data->interp, DP_FILTER_GET);
-	    Tcl_DStringAppend (dsPtr, internal, -1);
+	    if (data->thread != NULL) {
+		WaitFiltThread(data);
+	    }
+	    GetChainOption(data, &(data->out), dsPtr);
+	    break;
+
+	case DP_THREADED:
+	    if (data->thread != NULL) {
+		Tcl_DStringAppend (dsPtr, "1", -1);
+	    } else {
+		Tcl_DStringAppend (dsPtr, "0", -1);
+	    }
+	    break;
+
+	case DP_STACK:
+	    if (data->stack.self != NULL) {
+		Tcl_DStringAppend (dsPtr, "1", -1);
+	    } else {
+		Tcl_DStringAppend (dsPtr, "0", -1);
+	    }
 	    break;
 
 	default:
+	    if (data->stack.self != NULL) {
+		return DpStackGetOption(data->channelPtr, interp, optionName,
+			dsPtr);
+	    }
 #ifndef _TCL76
 	    Tcl_AppendResult(interp,
 		    "bad option \"", optionName,"\": must be -blocking,",
@@ -936,11 +1203,17 @@ WCPPlugFChannel (instanceData, mask)
                                  * the event categories that have to be watched.
                                  */
 {
-    Tcl_Channel channelPtr = ((PlugFInfo *)instanceData)->channelPtr;
+    PlugFInfo *data = (PlugFInfo *)instanceData;
+    Tcl_Channel channelPtr = data->channelPtr;
 
 #ifdef _TCL76
     (Tcl_GetChannelType(channelPtr)->watchChannelProc)
                          (Tcl_GetChannelInstanceData(channelPtr), mask);
+#else
+    if (data->stack.self != NULL) {
+	DpStackWatch(&(data->stack), channelPtr, mask,
+		(data->i.outLength > 0) || (data->i.error != 0));
+    }
 #endif
     return;
 }
@@ -990,6 +1263,944 @@ CRPPlugFChannel (instanceData, mask)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * GrowFiltBuffer --
+ *
+ *	Makes sure that at least "room" bytes are free after the data
+ *	already held in the given filter buffer. The buffer is doubled
+ *	until it is large enough and never shrinks.
+ *
+ * Results:
+ *
+ *	0 if everything went well, ENOSPC if the buffer would have to grow
+ *	beyond DP_FILTER_MAX_BUF.
+ *
+ * Side effects:
+ *
+ *	May reallocate x->outBuf.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+GrowFiltBuffer (x, room)
+    FiltBuffer *x;		/* (in/out) Buffer to grow. */
+    int		room;		/* (in) Number of free bytes needed. */
+{
+    int size;
+
+    size = (x->outSize > 0) ? x->outSize : DP_FILTER_BUF_SIZE;
+    while (size - x->outLength < room) {
+	if (size >= DP_FILTER_MAX_BUF / 2) {
+	    return ENOSPC;
+	}
+	size *= 2;
+    }
+
+    if (x->outBuf == NULL) {
+	x->outBuf = ckalloc(size);
+	x->outSize = size;
+    } else if (size != x->outSize) {
+	x->outBuf = ckrealloc(x->outBuf, size);
+	x->outSize = size;
+    }
+    return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RunFilter --
+ *
+ *	Passes a block of data through a filter and appends the result to
+ *	the given filter buffer. Version 2 filters write straight into the
+ *	buffer, which is grown whenever the filter reports that it needs
+ *	more room. The output of version 1 filters is copied in and the
+ *	buffer they allocated is released.
+ *
+ * Results:
+ *
+ *	0 if everything went well, otherwise the POSIX error code returned
+ *	by the filter.
+ *
+ * Side effects:
+ *
+ *	Calls the filter, updates x->outLength and may grow x->outBuf.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+RunFilter (interp, filterPtr, filterData, inBuf, inLength, mode, x)
+    Tcl_Interp *interp;		/* (in) Interpreter passed to the filter,
+				 * NULL on a filter thread. */
+    Dp_PlugInFilter2 *filterPtr;	/* (in) Filter to run. */
+    void **filterData;		/* (in/out) Internal state of the filter. */
+    CONST84 char *inBuf;	/* (in) Data to filter. */
+    int inLength;		/* (in) Number of bytes in inBuf. */
+    int mode;			/* (in) DP_FILTER_NORMAL, DP_FILTER_FLUSH,
+				 * DP_FILTER_EOF or DP_FILTER_CLOSE. */
+    FiltBuffer *x;		/* (in/out) Buffer receiving the output. */
+{
+    int error, inDone, inUsed, outLength, room;
+    char *outBuf;
+
+    if (filterPtr->plugProc2 == NULL) {
+	outBuf = NULL;
+	outLength = 0;
+	error = (filterPtr->plugProc) (inBuf, inLength, &outBuf, &outLength,
+		filterData, interp, mode);
+	if ((error == 0) && (outLength > 0)) {
+	    error = GrowFiltBuffer(x, outLength);
+	    if (error == 0) {
+		memcpy(x->outBuf + x->outLength, outBuf, outLength);
+		x->outLength += outLength;
+	    }
+	}
+	if (outBuf != NULL) {
+	    ckfree(outBuf);
+	}
+	return error;
+    }
+
+    if (x->outBuf == NULL) {
+	error = GrowFiltBuffer(x, DP_FILTER_BUF_SIZE);
+	if (error != 0) {
+	    return error;
+	}
+    }
+
+    /*
+     * The filter is called at least once, even with no input, so that
+     * it sees DP_FILTER_EOF, DP_FILTER_CLOSE and the like.
+     */
+
+    inDone = 0;
+    for (;;) {
+	room = x->outSize - x->outLength;
+	inUsed = 0;
+	outLength = 0;
+	error = (filterPtr->plugProc2) (
+		(inBuf == NULL) ? NULL : inBuf + inDone, inLength - inDone,
+		&inUsed, x->outBuf + x->outLength, room, &outLength,
+		filterData, interp, mode);
+
+	if (error == ENOSPC) {
+	    /*
+	     * outLength holds the room the filter needs, if it knows.
+	     */
+
+	    if (outLength <= room) {
+		outLength = room + 1;
+	    }
+	    error = GrowFiltBuffer(x, outLength);
+	    if (error != 0) {
+		return error;
+	    }
+	    continue;
+	}
+	if (error != 0) {
+	    return error;
+	}
+
+	x->outLength += outLength;
+	inDone += inUsed;
+	if (inDone >= inLength) {
+	    return 0;
+	}
+
+	if ((inUsed == 0) && (outLength == 0)) {
+	    /*
+	     * The filter made no progress and did not say why; give it
+	     * more room.
+	     */
+
+	    error = GrowFiltBuffer(x, room + 1);
+	    if (error != 0) {
+		return error;
+	    }
+	}
+    }
+}
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SetFilterOption --
+ *
+ *	Passes the value of -inset or -outset to a filter.
+ *
+ * Results:
+ *
+ *	0 if everything went well, otherwise the POSIX error code returned
+ *	by the filter.
+ *
+ * Side effects:
+ *
+ *	Whatever the filter does with its argument.
+ *
+ *-----------------------------------------------------------------------------
+ */
 
+static int
+SetFilterOption (data, filterPtr, filterData, value)
+    PlugFInfo *data;		/* (in) Filter channel. */
+    Dp_PlugInFilter2 *filterPtr;	/* (in) Filter to configure. */
+    void **filterData;		/* (in/out) Internal state of the filter. */
+    CONST char *value;		/* (in) Value of the option. */
+{
+    int inUsed, outLength;
+
+    if (filterPtr->plugProc2 == NULL) {
+	return (filterPtr->plugProc) ((char *) value, strlen(value), NULL,
+		NULL, filterData, data->interp, DP_FILTER_SET);
+    }
+
+    inUsed = 0;
+    outLength = 0;
+    return (filterPtr->plugProc2) (value, strlen(value), &inUsed, NULL, 0,
+	    &outLength, filterData, data->interp, DP_FILTER_SET);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * GetFilterOption --
+ *
+ *	Appends the internal arguments of a filter, as reported for -inset
+ *	or -outset, to the given dynamic string.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	Appends to dsPtr.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+GetFilterOption (data, filterPtr, filterData, dsPtr)
+    PlugFInfo *data;		/* (in) Filter channel. */
+    Dp_PlugInFilter2 *filterPtr;	/* (in) Filter to query. */
+    void **filterData;		/* (in/out) Internal state of the filter. */
+    Tcl_DString *dsPtr;		/* (out) Receives the arguments. */
+{
+    char buf[DP_ARBITRARY_LIMIT];
+    char *outBuf;
+    int inUsed, outLength, outSize, error;
+
+    if (filterPtr->plugProc2 == NULL) {
+	outBuf = NULL;
+	(filterPtr->plugProc) (NULL, 0, &outBuf, NULL, filterData,
+		data->interp, DP_FILTER_GET);
+	if (outBuf != NULL) {
+	    Tcl_DStringAppend (dsPtr, outBuf, -1);
+	}
+	return;
+    }
+
+    outBuf = buf;
+    outSize = sizeof(buf);
+    for (;;) {
+	inUsed = 0;
+	outLength = 0;
+	error = (filterPtr->plugProc2) (NULL, 0, &inUsed, outBuf, outSize,
+		&outLength, filterData, data->interp, DP_FILTER_GET);
+	if ((error != ENOSPC) || (outLength <= outSize)) {
+	    break;
+	}
+	if (outBuf != buf) {
+	    ckfree(outBuf);
+	}
+	outSize = outLength;
+	outBuf = ckalloc(outSize);
+    }
+    if (error == 0) {
+	Tcl_DStringAppend (dsPtr, outBuf, outLength);
+    }
+    if (outBuf != buf) {
+	ckfree(outBuf);
+    }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * InitChain --
+ *
+ *	Looks up the filters named in a Tcl list and installs them as the
+ *	stages of a filter chain.
+ *
+ * Results:
+ *
+ *	Standard Tcl result. On error, a message is left in interp and
+ *	the chain is not changed.
+ *
+ * Side effects:
+ *
+ *	Replaces the stages of the chain.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+InitChain (interp, names, chainPtr)
+    Tcl_Interp *interp;		/* (in) Interpreter for error messages. */
+    CONST84 char *names;	/* (in) List of filter names. */
+    FiltChain *chainPtr;	/* (out) Chain to set up. */
+{
+    CONST84 char **nameArgv;
+    int nameArgc, k;
+    FiltStage *stages;
+
+    if (Tcl_SplitList(interp, names, &nameArgc, &nameArgv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (nameArgc == 0) {
+	Tcl_AppendResult(interp, "empty plug-in filter list", NULL);
+	ckfree((char *) nameArgv);
+	return TCL_ERROR;
+    }
+
+    stages = (FiltStage *) ckalloc(nameArgc * sizeof(FiltStage));
+    for (k = 0; k < nameArgc; k++) {
+	stages[k].filterPtr = Dp_GetFilter(interp, nameArgv[k]);
+	stages[k].data = NULL;
+	if (stages[k].filterPtr == NULL) {
+	    Tcl_AppendResult(interp, "unable to find plug-in filter ",
+		    nameArgv[k], NULL);
+	    ckfree((char *) stages);
+	    ckfree((char *) nameArgv);
+	    return TCL_ERROR;
+	}
+    }
+    ckfree((char *) nameArgv);
+
+    if (chainPtr->stages != NULL) {
+	ckfree((char *) chainPtr->stages);
+    }
+    chainPtr->numStages = nameArgc;
+    chainPtr->stages = stages;
+    return TCL_OK;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RunChain --
+ *
+ *	Passes a block of data through every stage of a filter chain and
+ *	appends the output of the last stage to the given filter buffer.
+ *	In DP_FILTER_CLOSE mode all stages are run even if one of them
+ *	fails, so that each can release its internal state.
+ *
+ * Results:
+ *
+ *	0 if everything went well, otherwise the first POSIX error code
+ *	returned by a stage.
+ *
+ * Side effects:
+ *
+ *	Calls the filters and uses the scratch buffers of the chain.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+RunChain (interp, chainPtr, inBuf, inLength, mode, x)
+    Tcl_Interp *interp;		/* (in) Interpreter passed to the filters,
+				 * NULL on a filter thread. */
+    FiltChain *chainPtr;	/* (in) Chain to run. */
+    CONST84 char *inBuf;	/* (in) Data to filter. */
+    int inLength;		/* (in) Number of bytes in inBuf. */
+    int mode;			/* (in) Mode passed to every stage. */
+    FiltBuffer *x;		/* (in/out) Buffer receiving the output. */
+{
+    FiltBuffer *to;
+    FiltStage *stagePtr;
+    int k, error, status;
+
+    status = 0;
+    for (k = 0; k < chainPtr->numStages; k++) {
+	stagePtr = &(chainPtr->stages[k]);
+	if (k == chainPtr->numStages - 1) {
+	    to = x;
+	} else {
+	    to = &(chainPtr->scratch[k % 2]);
+	    to->outLength = 0;
+	}
+
+	error = RunFilter(interp, stagePtr->filterPtr, &(stagePtr->data),
+		inBuf, inLength, mode, to);
+	if (error != 0) {
+	    if (mode != DP_FILTER_CLOSE) {
+		return error;
+	    }
+	    if (status == 0) {
+		status = error;
+	    }
+	}
+
+	inBuf = to->outBuf;
+	inLength = to->outLength;
+    }
+    return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SetChainOption --
+ *
+ *	Passes the value of -inset or -outset to the stages of a filter
+ *	chain. A chain of one stage gets the value as is. Otherwise the
+ *	value must be a list with one element per stage; stages whose
+ *	element is empty are left alone.
+ *
+ * Results:
+ *
+ *	0 if everything went well, otherwise a POSIX error code.
+ *
+ * Side effects:
+ *
+ *	Whatever the filters do with their arguments.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+SetChainOption (data, chainPtr, value)
+    PlugFInfo *data;		/* (in) Filter channel. */
+    FiltChain *chainPtr;	/* (in) Chain to configure. */
+    CONST char *value;		/* (in) Value of the option. */
+{
+    CONST84 char **valueArgv;
+    int valueArgc, k, error;
+
+    if (chainPtr->numStages == 1) {
+	return SetFilterOption(data, chainPtr->stages[0].filterPtr,
+		&(chainPtr->stages[0].data), value);
+    }
+
+    if (Tcl_SplitList(NULL, (CONST84 char *) value, &valueArgc, &valueArgv)
+	    != TCL_OK) {
+	return EINVAL;
+    }
+    if (valueArgc != chainPtr->numStages) {
+	ckfree((char *) valueArgv);
+	return EINVAL;
+    }
+
+    error = 0;
+    for (k = 0; (k < valueArgc) && (error == 0); k++) {
+	if (valueArgv[k][0] != '\0') {
+	    error = SetFilterOption(data, chainPtr->stages[k].filterPtr,
+		    &(chainPtr->stages[k].data), valueArgv[k]);
+	}
+    }
+    ckfree((char *) valueArgv);
+    return error;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * GetChainOption --
+ *
+ *	Appends the internal arguments of the stages of a filter chain to
+ *	the given dynamic string. A chain of one stage reports them as is,
+ *	a longer one as a list with one element per stage.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	Appends to dsPtr.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+GetChainOption (data, chainPtr, dsPtr)
+    PlugFInfo *data;		/* (in) Filter channel. */
+    FiltChain *chainPtr;	/* (in) Chain to query. */
+    Tcl_DString *dsPtr;		/* (out) Receives the arguments. */
+{
+    Tcl_DString stage;
+    int k;
+
+    if (chainPtr->numStages == 1) {
+	GetFilterOption(data, chainPtr->stages[0].filterPtr,
+		&(chainPtr->stages[0].data), dsPtr);
+	return;
+    }
+
+    Tcl_DStringInit(&stage);
+    for (k = 0; k < chainPtr->numStages; k++) {
+	Tcl_DStringSetLength(&stage, 0);
+	GetFilterOption(data, chainPtr->stages[k].filterPtr,
+		&(chainPtr->stages[k].data), &stage);
+	Tcl_DStringAppendElement(dsPtr, Tcl_DStringValue(&stage));
+    }
+    Tcl_DStringFree(&stage);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * StartFiltThread --
+ *
+ *	Starts the filter thread that runs the output chain of a channel
+ *	opened with "-threaded 1". Filters run there get no interpreter,
+ *	so chains with tclfilter are refused. If DP was built without
+ *	threads, the channel simply filters on its own thread.
+ *
+ * Results:
+ *
+ *	Standard Tcl result, with an error message in interp if the
+ *	thread can't be created.
+ *
+ * Side effects:
+ *
+ *	May create a thread and set data->thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+StartFiltThread (interp, data)
+    Tcl_Interp *interp;		/* (in) Interpreter for error messages. */
+    PlugFInfo *data;		/* (in/out) Filter channel. */
+{
+    FiltThread *t;
+    int k;
+
+    for (k = 0; k < data->out.numStages; k++) {
+	if (data->out.stages[k].filterPtr->plugProc2 == TclFilter) {
+	    Tcl_AppendResult(interp, "plug-in filter ",
+		    data->out.stages[k].filterPtr->name,
+		    " can't run on a filter thread", NULL);
+	    return TCL_ERROR;
+	}
+    }
+
+#ifndef TCL_THREADS
+    /*
+     * Mutexes are no-ops in this build, filter on the channel's thread.
+     */
+
+    return TCL_OK;
+#endif
+
+    t = (FiltThread *) ckalloc(sizeof(FiltThread));
+    memset(t, 0, sizeof(FiltThread));
+    t->owner = Tcl_GetCurrentThread();
+    data->thread = t;
+
+    if (Tcl_CreateThread(&(t->threadId), FiltThreadProc, (ClientData) data,
+	    TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+	data->thread = NULL;
+	ckfree((char *) t);
+	Tcl_AppendResult(interp, "couldn't create filter thread", NULL);
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * StopFiltThread --
+ *
+ *	Runs the output chain in DP_FILTER_CLOSE mode on the filter thread,
+ *	writes everything it produced and waits for the thread to exit.
+ *
+ * Results:
+ *
+ *	0, or the first POSIX error code not reported yet.
+ *
+ * Side effects:
+ *
+ *	Writes to the subordinated channel, frees the filter thread data
+ *	and resets data->thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+StopFiltThread (data)
+    PlugFInfo *data;		/* (in/out) Filter channel. */
+{
+    FiltThread *t = data->thread;
+    int error, result, k;
+
+    QueueFiltJob(data, NULL, 0, DP_FILTER_CLOSE);
+    WaitFiltThread(data);
+
+    Tcl_MutexLock(&(t->mutex));
+    error = t->error;
+    t->stop = 1;
+    Tcl_ConditionNotify(&(t->cond));
+    Tcl_MutexUnlock(&(t->mutex));
+
+    Tcl_JoinThread(t->threadId, &result);
+    Tcl_DeleteEvents(FiltThreadDeleteProc, (ClientData) data);
+
+    for (k = 0; k < DP_FILTER_QUEUE_DEPTH; k++) {
+	if (t->jobs[k].buf != NULL) {
+	    ckfree(t->jobs[k].buf);
+	}
+    }
+    if (t->work.outBuf != NULL) {
+	ckfree(t->work.outBuf);
+    }
+    if (t->done.outBuf != NULL) {
+	ckfree(t->done.outBuf);
+    }
+    Tcl_ConditionFinalize(&(t->cond));
+    Tcl_MutexFinalize(&(t->mutex));
+    ckfree((char *) t);
+    data->thread = NULL;
+    return error;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * QueueFiltJob --
+ *
+ *	Hands a block of data to the filter thread. If the filter thread
+ *	is DP_FILTER_QUEUE_DEPTH blocks behind, waits for it to catch up.
+ *	Output of earlier blocks is written to the subordinated channel
+ *	meanwhile.
+ *
+ * Results:
+ *
+ *	0, or a POSIX error code from an earlier block or from writing
+ *	its output. The error is reported only once.
+ *
+ * Side effects:
+ *
+ *	Queues a job and writes to the subordinated channel.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+QueueFiltJob (data, buf, length, mode)
+    PlugFInfo *data;		/* (in) Filter channel. */
+    CONST84 char *buf;		/* (in) Data to filter, may be NULL. */
+    int length;			/* (in) Number of bytes in buf. */
+    int mode;			/* (in) Mode to run the chain in. */
+{
+    FiltThread *t = data->thread;
+    FiltJob *jobPtr;
+    int error;
+
+    Tcl_MutexLock(&(t->mutex));
+    while (t->count == DP_FILTER_QUEUE_DEPTH) {
+	if (t->done.outLength > 0) {
+	    Tcl_MutexUnlock(&(t->mutex));
+	    WriteFiltOutput(data);
+	    Tcl_MutexLock(&(t->mutex));
+	} else {
+	    Tcl_ConditionWait(&(t->cond), &(t->mutex), NULL);
+	}
+    }
+    jobPtr = &(t->jobs[(t->head + t->count) % DP_FILTER_QUEUE_DEPTH]);
+    Tcl_MutexUnlock(&(t->mutex));
+
+    /*
+     * The filter thread does not look at a slot until it is counted,
+     * so it can be filled without holding the mutex.
+     */
+
+    if (jobPtr->size < length) {
+	if (jobPtr->buf != NULL) {
+	    ckfree(jobPtr->buf);
+	}
+	jobPtr->buf = ckalloc(length);
+	jobPtr->size = length;
+    }
+    if (length > 0) {
+	memcpy(jobPtr->buf, buf, length);
+    }
+    jobPtr->length = length;
+    jobPtr->mode = mode;
+
+    Tcl_MutexLock(&(t->mutex));
+    t->count++;
+    Tcl_ConditionNotify(&(t->cond));
+    Tcl_MutexUnlock(&(t->mutex));
+
+    WriteFiltOutput(data);
+
+    Tcl_MutexLock(&(t->mutex));
+    error = t->error;
+    t->error = 0;
+    Tcl_MutexUnlock(&(t->mutex));
+    return error;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * WaitFiltThread --
+ *
+ *	Waits until the filter thread has run every queued job, and
+ *	writes their output to the subordinated channel. Afterwards the
+ *	output chain can be used safely from the channel's thread, until
+ *	the next job is queued.
+ *
+ * Results:
+ *
+ *	None. Errors are kept for the next write.
+ *
+ * Side effects:
+ *
+ *	Writes to the subordinated channel.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+WaitFiltThread (data)
+    PlugFInfo *data;		/* (in) Filter channel. */
+{
+    FiltThread *t = data->thread;
+
+    Tcl_MutexLock(&(t->mutex));
+    for (;;) {
+	if (t->done.outLength > 0) {
+	    Tcl_MutexUnlock(&(t->mutex));
+	    WriteFiltOutput(data);
+	    Tcl_MutexLock(&(t->mutex));
+	} else if (t->count > 0) {
+	    Tcl_ConditionWait(&(t->cond), &(t->mutex), NULL);
+	} else {
+	    break;
+	}
+    }
+    Tcl_MutexUnlock(&(t->mutex));
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * WriteFiltOutput --
+ *
+ *	Writes the output collected by the filter thread to the
+ *	subordinated channel. Called on the channel's thread only.
+ *
+ * Results:
+ *
+ *	None. An error is kept for the next write.
+ *
+ * Side effects:
+ *
+ *	Writes to the subordinated channel. The shared output buffer is
+ *	swapped with data->o so the filter thread can go on while the
+ *	output is written.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+WriteFiltOutput (data)
+    PlugFInfo *data;		/* (in) Filter channel. */
+{
+    FiltThread *t = data->thread;
+    FiltBuffer tmp;
+    int error, written;
+
+    Tcl_MutexLock(&(t->mutex));
+    tmp = t->done;
+    t->done = data->o;
+    t->done.outLength = 0;
+    data->o = tmp;
+    Tcl_MutexUnlock(&(t->mutex));
+
+    if (data->o.outLength == 0) {
+	return;
+    }
+
+    error = 0;
+    written = DpStackWrite(&(data->stack), data->channelPtr, data->o.outBuf,
+	    data->o.outLength);
+    if (written == -1) {
+	error = Tcl_GetErrno();
+    } else if (written != data->o.outLength) {
+	error = ENOSPC;
+    }
+    data->o.outLength = 0;
+
+    if (error != 0) {
+	Tcl_MutexLock(&(t->mutex));
+	if (t->error == 0) {
+	    t->error = error;
+	}
+	Tcl_MutexUnlock(&(t->mutex));
+    }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FiltThreadProc --
+ *
+ *	Body of the filter thread of a channel. It runs the queued jobs
+ *	through the output chain, one at a time and in order, and tells
+ *	the channel's thread when there is output to write.
+ *
+ * Results:
+ *
+ *	None.
+ *
+ * Side effects:
+ *
+ *	Calls the output filters and queues FiltThreadEvents on the
+ *	channel's thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Tcl_ThreadCreateType
+FiltThreadProc (clientData)
+    ClientData clientData;	/* (in) Filter channel. */
+{
+    PlugFInfo *data = (PlugFInfo *) clientData;
+    FiltThread *t = data->thread;
+    FiltThreadEvent *evPtr;
+    FiltJob *jobPtr;
+    int error;
+
+    Tcl_MutexLock(&(t->mutex));
+    for (;;) {
+	if (t->count == 0) {
+	    if (t->stop) {
+		break;
+	    }
+	    Tcl_ConditionWait(&(t->cond), &(t->mutex), NULL);
+	    continue;
+	}
+	jobPtr = &(t->jobs[t->head]);
+	Tcl_MutexUnlock(&(t->mutex));
+
+	t->work.outLength = 0;
+	error = RunChain(NULL, &(data->out), jobPtr->buf, jobPtr->length,
+		jobPtr->mode, &(t->work));
+
+	Tcl_MutexLock(&(t->mutex));
+	if ((error == 0) && (t->work.outLength > 0)) {
+	    error = GrowFiltBuffer(&(t->done), t->work.outLength);
+	    if (error == 0) {
+		memcpy(t->done.outBuf + t->done.outLength, t->work.outBuf,
+			t->work.outLength);
+		t->done.outLength += t->work.outLength;
+	    }
+	}
+	if ((error != 0) && (t->error == 0)) {
+	    t->error = error;
+	}
+	t->head = (t->head + 1) % DP_FILTER_QUEUE_DEPTH;
+	t->count--;
+
+	if ((t->done.outLength > 0) && !t->eventPending) {
+	    evPtr = (FiltThreadEvent *) ckalloc(sizeof(FiltThreadEvent));
+	    evPtr->header.proc = FiltThreadEventProc;
+	    evPtr->data = data;
+	    Tcl_ThreadQueueEvent(t->owner, (Tcl_Event *) evPtr,
+		    TCL_QUEUE_TAIL);
+	    Tcl_ThreadAlert(t->owner);
+	    t->eventPending = 1;
+	}
+	Tcl_ConditionNotify(&(t->cond));
+    }
+    Tcl_MutexUnlock(&(t->mutex));
+    TCL_THREAD_CREATE_RETURN;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FiltThreadEventProc --
+ *
+ *	Runs on the channel's thread when the filter thread has output
+ *	for the subordinated channel.
+ *
+ * Results:
+ *
+ *	Always 1, the event is handled.
+ *
+ * Side effects:
+ *
+ *	Writes to the subordinated channel.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FiltThreadEventProc (evPtr, flags)
+    Tcl_Event *evPtr;		/* (in) FiltThreadEvent. */
+    int flags;			/* (in) Not used. */
+{
+    PlugFInfo *data = ((FiltThreadEvent *) evPtr)->data;
+    FiltThread *t = data->thread;
+
+    Tcl_MutexLock(&(t->mutex));
+    t->eventPending = 0;
+    Tcl_MutexUnlock(&(t->mutex));
+
+    WriteFiltOutput(data);
+    return 1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FiltThreadDeleteProc --
+ *
+ *	Used with Tcl_DeleteEvents to drop the FiltThreadEvents of a
+ *	channel whose filter thread is gone.
+ *
+ * Results:
+ *
+ *	1 if the event belongs to the channel, 0 otherwise.
+ *
+ * Side effects:
+ *
+ *	None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FiltThreadDeleteProc (evPtr, clientData)
+    Tcl_Event *evPtr;		/* (in) Event in the queue. */
+    ClientData clientData;	/* (in) Filter channel. */
+{
+    return (evPtr->proc == FiltThreadEventProc)
+	    && (((FiltThreadEvent *) evPtr)->data == (PlugFInfo *) clientData);
+}
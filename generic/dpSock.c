@@ -9,6 +9,10 @@
  *  which handle platform-specific error translation and other non-portable
  *  functions.
  *
+ *  It also holds the resolver cache shared by all name lookups in DP
+ *  and the "dp_resolve" command, which can do lookups on a helper
+ *  thread so that a slow DNS server doesn't stall the event loop.
+ *
  * Copyright (c) 1995-1996 Cornell University.
  *
  * See the file "license.terms" for information on usage and redistribution
@@ -17,26 +21,151 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 #ifdef _WIN32
+#	include <winsock2.h>
+#	include <ws2tcpip.h>
 #	include <windows.h>
 #else
+#	include <sys/types.h>
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#	include <arpa/inet.h>
 #	include <netdb.h>
 #endif
 #include "generic/dpInt.h"
 
+/*
+ * Default lifetimes, in seconds, of successful and failed lookups in
+ * the resolver cache.  Both can be changed with "dp_resolve -ttl" and
+ * "dp_resolve -negativettl".  Once a cache table holds more than
+ * DP_RESOLVER_MAX_ENTRIES entries it is emptied, which bounds its
+ * size without having to track the age of every entry.
+ */
+
+#define DP_RESOLVER_TTL			300
+#define DP_RESOLVER_NEGATIVE_TTL	30
+#define DP_RESOLVER_MAX_ENTRIES		1024
+
+/*
+ * One entry of the resolver cache.  The same structure is used for
+ * host names (ipAddr holds the address), reverse lookups (name holds
+ * the host name) and services (name and port).
+ */
+
+typedef struct ResolverEntry {
+    int found;			/* 0 if this is a negative entry. */
+    long expires;		/* Tcl_GetTime seconds when this expires. */
+    int ipAddr;			/* Address, in host byte order. */
+    int port;			/* Port number of a service. */
+    char *name;			/* Host or service name, or NULL. */
+} ResolverEntry;
+
+/*
+ * The caches.  They're shared by every interpreter and thread in the
+ * process, so they are protected by resolverMutex.
+ */
+
+static int resolverInitialized = 0;
+static Tcl_HashTable hostCache;		/* Host name -> address. */
+static Tcl_HashTable addrCache;		/* Address -> host name. */
+static Tcl_HashTable serviceCache;	/* Service name/port -> entry. */
+static int resolverTtl = DP_RESOLVER_TTL;
+static int resolverNegativeTtl = DP_RESOLVER_NEGATIVE_TTL;
+TCL_DECLARE_MUTEX(resolverMutex)
+
+/*
+ * An asynchronous lookup requested with "dp_resolve -command".  The
+ * requests are queued for a single helper thread, which fills in
+ * found/ipAddr and queues a ResolverEvent back to the thread that
+ * made the request.
+ */
+
+typedef struct ResolveRequest {
+    Tcl_Interp *interp;		/* Interp to run the callback in. */
+    Tcl_ThreadId owner;		/* Thread that made the request. */
+    char *host;			/* Host name to look up. */
+    Tcl_Obj *cmdPtr;		/* Callback prefix. */
+    int found;			/* 1 if the lookup succeeded. */
+    int ipAddr;			/* Result, in host byte order. */
+    struct ResolveRequest *nextPtr;
+} ResolveRequest;
+
+typedef struct ResolverEvent {
+    Tcl_Event header;		/* Must be first. */
+    ResolveRequest *reqPtr;
+} ResolverEvent;
+
+static ResolveRequest *requestHead = NULL;
+static ResolveRequest *requestTail = NULL;
+static int resolverThreadRunning = 0;
+static int resolverShutdown = 0;
+static Tcl_Condition resolverCond;
+
+static void		ResolverInit _ANSI_ARGS_((void));
+static ResolverEntry *	ResolverFind _ANSI_ARGS_((Tcl_HashTable *tablePtr,
+			    CONST char *key));
+static void		ResolverStore _ANSI_ARGS_((Tcl_HashTable *tablePtr,
+			    CONST char *key, int found, int ipAddr, int port,
+			    CONST char *name));
+static void		ResolverFlushTable _ANSI_ARGS_((
+			    Tcl_HashTable *tablePtr));
+static int		ResolveHost _ANSI_ARGS_((CONST char *host,
+			    int *ipAddrPtr));
+static Tcl_ThreadCreateType ResolverThread _ANSI_ARGS_((
+			    ClientData clientData));
+static int		ResolverEventProc _ANSI_ARGS_((Tcl_Event *evPtr,
+			    int flags));
+static void		ResolverExitHandler _ANSI_ARGS_((
+			    ClientData clientData));
+static void		ResolverFreeQueue _ANSI_ARGS_((void));
+
+/*
+ * One multicast group joined by an IPM channel.  The groups are kept
+ * in a hash table keyed by address, so a channel can belong to
+ * hundreds of groups and still find the one a datagram was sent to
+ * quickly.
+ */
+
+typedef struct IpmGroup {
+    int addr;			/* Group address, in host byte order. */
+    int serial;			/* Order in which groups were joined. */
+    Tcl_Obj *nameObj;		/* The group as given to -group. */
+    Tcl_Obj *cmdPtr;		/* Callback for the group's datagrams,
+				 * or NULL. */
+    Tcl_Interp *interp;		/* Interp to run cmdPtr in. */
+} IpmGroup;
+
+/*
+ * Most datagrams a group callback handler reads before running the
+ * callbacks.
+ */
+
+#define DP_IPM_DISPATCH_MAX		64
+
+static IpmGroup *	IpmAddGroup _ANSI_ARGS_((SocketState *statePtr,
+			    CONST char *name, int addr));
+static void		IpmFreeGroup _ANSI_ARGS_((IpmGroup *groupPtr));
+static int		IpmCompareGroups _ANSI_ARGS_((CONST VOID *first,
+			    CONST VOID *second));
+static void		IpmGroupHandler _ANSI_ARGS_((ClientData clientData,
+			    int mask));
+
 
 /*
  *--------------------------------------------------------------
  *
  * DpHostToIpAddr --
  *
- *	Find the IP address corresponding to a hostname.
+ *	Find the IP address corresponding to a hostname.  Names
+ *	that need the resolver are looked up in the resolver cache
+ *	first, and the answer (good or bad) is remembered there.
  *
  * Results:
  *	1 on success, 0 if host is unknown
  *
  * Side effects:
- *	None
+ *	May add an entry to the resolver cache.
  *
  *--------------------------------------------------------------
  */
@@ -45,7 +174,8 @@ DpHostToIpAddr (host, ipAddrPtr)
     CONST84 char *host;			/* (in) Hostname (human readable) */
     int *ipAddrPtr;		/* (out) IP address of host */
 {
-    struct hostent *hostent;
+    ResolverEntry *entryPtr;
+    int found;
 
     if (strcmp (host, "localhost") == 0) {
 	*ipAddrPtr = 0x7F000001;
@@ -74,23 +204,26 @@ DpHostToIpAddr (host, ipAddrPtr)
     }
 
     /*
-     * Looking up the host by address failed.  Try looking it up by
-     * name. If successful, the IP address is in network byte order
-     * in hostent->h_addr_list[0]
+     * Looking up the host by address failed.  See if we already
+     * know the answer, and ask the resolver if we don't.
      */
-    hostent = gethostbyname(host);
-    if (hostent != NULL) {
-	memcpy ((char *)ipAddrPtr,
-	       (char *) hostent->h_addr_list[0],
-	       (size_t) hostent->h_length);
-	*ipAddrPtr = ntohl(*ipAddrPtr);
-	return 1;
+    Tcl_MutexLock(&resolverMutex);
+    ResolverInit();
+    entryPtr = ResolverFind(&hostCache, host);
+    if (entryPtr != NULL) {
+	found = entryPtr->found;
+	*ipAddrPtr = entryPtr->ipAddr;
+	Tcl_MutexUnlock(&resolverMutex);
+	return found;
     }
+    Tcl_MutexUnlock(&resolverMutex);
 
-    /*
-     * Total failure
-     */
-    return 0;
+    found = ResolveHost(host, ipAddrPtr);
+
+    Tcl_MutexLock(&resolverMutex);
+    ResolverStore(&hostCache, host, found, *ipAddrPtr, 0, NULL);
+    Tcl_MutexUnlock(&resolverMutex);
+    return found;
 }
 
 /*
@@ -98,13 +231,14 @@ DpHostToIpAddr (host, ipAddrPtr)
  *
  * DpIpAddrToHost --
  *
- *	Find the hostname corresponding to an IP address
+ *	Find the hostname corresponding to an IP address.  Results
+ *	are kept in the resolver cache.
  *
  * Results:
  *	1 on success, 0 for failure
  *
  * Side effects:
- *	None
+ *	May add an entry to the resolver cache.
  *
  *--------------------------------------------------------------
  */
@@ -114,16 +248,1269 @@ DpIpAddrToHost (ipAddr, hostPtr)
     char *hostPtr;		/* (out) Corresponding hostname */
 {
     struct hostent *hEnt;
+    ResolverEntry *entryPtr;
+    char key[16];
+    int found;
 
     if (ipAddr == 0x7F000001) {
     	strcpy(hostPtr, "localhost");
-    } else {
-    	hEnt = gethostbyaddr((char *)&ipAddr, sizeof(int), AF_INET);
-    	if (hEnt == NULL) {
-	    return 0;
+	return 1;
+    }
+
+    sprintf(key, "%08x", ipAddr);
+    Tcl_MutexLock(&resolverMutex);
+    ResolverInit();
+    entryPtr = ResolverFind(&addrCache, key);
+    if (entryPtr != NULL) {
+	found = entryPtr->found;
+	if (found) {
+	    strcpy(hostPtr, entryPtr->name);
 	}
-    	strcpy(hostPtr, hEnt->h_name);
+	Tcl_MutexUnlock(&resolverMutex);
+	return found;
     }
-    return 1;
+    Tcl_MutexUnlock(&resolverMutex);
+
+    hEnt = gethostbyaddr((char *)&ipAddr, sizeof(int), AF_INET);
+    found = (hEnt != NULL);
+    if (found) {
+	strcpy(hostPtr, hEnt->h_name);
+    }
+
+    Tcl_MutexLock(&resolverMutex);
+    ResolverStore(&addrCache, key, found, ipAddr, 0,
+	    found ? hostPtr : NULL);
+    Tcl_MutexUnlock(&resolverMutex);
+    return found;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpGetService --
+ *
+ *	Find a service by name or, failing that, by port number,
+ *	as "dp_netinfo -service" does.  Results are kept in the
+ *	resolver cache.
+ *
+ * Results:
+ *	1 on success with the official service name appended to
+ *	namePtr and the port in *portPtr, 0 if there is no such
+ *	service.
+ *
+ * Side effects:
+ *	May add an entry to the resolver cache.
+ *
+ *--------------------------------------------------------------
+ */
+int
+DpGetService (service, namePtr, portPtr)
+    CONST84 char *service;	/* (in) Service name or port number */
+    Tcl_DString *namePtr;	/* (out) Official name of the service */
+    int *portPtr;		/* (out) Port number of the service */
+{
+    struct servent *serviceEntry;
+    ResolverEntry *entryPtr;
+    int found, port = 0;
+
+    Tcl_MutexLock(&resolverMutex);
+    ResolverInit();
+    entryPtr = ResolverFind(&serviceCache, service);
+    if (entryPtr != NULL) {
+	found = entryPtr->found;
+	if (found) {
+	    Tcl_DStringAppend(namePtr, entryPtr->name, -1);
+	    *portPtr = entryPtr->port;
+	}
+	Tcl_MutexUnlock(&resolverMutex);
+	return found;
+    }
+    Tcl_MutexUnlock(&resolverMutex);
+
+    /*
+     * First try the argument as a name, then as a port number.
+     */
+
+    serviceEntry = getservbyname(service, (char *) NULL);
+    if (serviceEntry == NULL) {
+	serviceEntry = getservbyport(htons((unsigned short) atoi(service)),
+		(char *) NULL);
+    }
+    found = (serviceEntry != NULL);
+    if (found) {
+	Tcl_DStringAppend(namePtr, serviceEntry->s_name, -1);
+	port = ntohs(serviceEntry->s_port);
+	*portPtr = port;
+    }
+
+    Tcl_MutexLock(&resolverMutex);
+    ResolverStore(&serviceCache, service, found, 0, port,
+	    found ? Tcl_DStringValue(namePtr) : NULL);
+    Tcl_MutexUnlock(&resolverMutex);
+    return found;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpInitFromAddress --
+ *
+ *	Sets up the sender-address fields of a new UDP or IPM
+ *	socket.  For compatibility with older releases the
+ *	sender is written to the global "dp_from" until the
+ *	channel's -fromvar option says otherwise.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Marks the socket SOCKET_DATAGRAM.  DpFreeFromAddress
+ *	must be called when it is closed.
+ *
+ *--------------------------------------------------------------
+ */
+void
+DpInitFromAddress (statePtr)
+    SocketState *statePtr;	/* (in) UDP or IPM socket */
+{
+    memset((char *) &statePtr->fromAddr, 0, sizeof(statePtr->fromAddr));
+    statePtr->fromObj = NULL;
+    statePtr->fromVarValue = NULL;
+    statePtr->messageLeft = 0;
+    statePtr->recvStamp = 0;
+    statePtr->sendStamp = 0;
+    statePtr->recvBufSize = 0;
+    statePtr->batchPtr = NULL;
+    statePtr->fromVarName = Tcl_NewStringObj("dp_from", -1);
+    Tcl_IncrRefCount(statePtr->fromVarName);
+    statePtr->flags |= SOCKET_DATAGRAM;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpSetFromAddress --
+ *
+ *	Records the sender of the datagram just received.  The
+ *	{host port} object is only rebuilt when the sender
+ *	changes, so a stream of datagrams from one peer costs
+ *	no formatting or allocation.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Sets the -fromvar variable, if any, which may fire
+ *	traces.
+ *
+ *--------------------------------------------------------------
+ */
+void
+DpSetFromAddress (statePtr, addrPtr)
+    SocketState *statePtr;	/* (in) UDP or IPM socket */
+    DpSocketAddressIP *addrPtr;	/* (in) Sender of the datagram */
+{
+    Tcl_Obj *pair[2];
+    unsigned int fromHost;
+    char str[20];
+
+    if ((statePtr->fromObj == NULL)
+	    || (statePtr->fromAddr.sin_addr.s_addr != addrPtr->sin_addr.s_addr)
+	    || (statePtr->fromAddr.sin_port != addrPtr->sin_port)) {
+	statePtr->fromAddr = *addrPtr;
+	fromHost = ntohl(addrPtr->sin_addr.s_addr);
+	sprintf(str, "%d.%d.%d.%d", (fromHost>>24), (fromHost>>16) & 0xFF,
+		(fromHost>>8) & 0xFF, fromHost & 0xFF);
+	pair[0] = Tcl_NewStringObj(str, -1);
+	pair[1] = Tcl_NewIntObj(ntohs(addrPtr->sin_port));
+	if (statePtr->fromObj != NULL) {
+	    Tcl_DecrRefCount(statePtr->fromObj);
+	    Tcl_DecrRefCount(statePtr->fromVarValue);
+	}
+	statePtr->fromObj = Tcl_NewListObj(2, pair);
+	Tcl_IncrRefCount(statePtr->fromObj);
+
+	/*
+	 * The variable has always held the address braced as a
+	 * one-element list, so keep it that way.
+	 */
+
+	statePtr->fromVarValue = Tcl_NewListObj(1, &statePtr->fromObj);
+	Tcl_IncrRefCount(statePtr->fromVarValue);
+    }
+
+    if ((statePtr->interp != NULL) && (statePtr->fromVarName != NULL)) {
+	Tcl_ObjSetVar2(statePtr->interp, statePtr->fromVarName, NULL,
+		statePtr->fromVarValue, TCL_GLOBAL_ONLY);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpSetFromVar --
+ *
+ *	Implements "fconfigure $chan -fromvar varName" for UDP
+ *	and IPM channels.  An empty name stops the sender being
+ *	stored anywhere; dp_recvfrom still reports it.
+ *
+ * Results:
+ *	TCL_OK.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+int
+DpSetFromVar (statePtr, varName)
+    SocketState *statePtr;	/* (in) UDP or IPM socket */
+    CONST char *varName;	/* (in) Global variable name or "" */
+{
+    if (statePtr->fromVarName != NULL) {
+	Tcl_DecrRefCount(statePtr->fromVarName);
+	statePtr->fromVarName = NULL;
+    }
+    if (varName[0] != '\0') {
+	statePtr->fromVarName = Tcl_NewStringObj(varName, -1);
+	Tcl_IncrRefCount(statePtr->fromVarName);
+    }
+    return TCL_OK;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpFreeFromAddress --
+ *
+ *	Releases the sender-address objects of a UDP or IPM
+ *	socket that is being closed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+void
+DpFreeFromAddress (statePtr)
+    SocketState *statePtr;	/* (in) UDP or IPM socket */
+{
+    if (statePtr->fromObj != NULL) {
+	Tcl_DecrRefCount(statePtr->fromObj);
+	Tcl_DecrRefCount(statePtr->fromVarValue);
+	statePtr->fromObj = NULL;
+    }
+    DpSetFromVar(statePtr, "");
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpIpmInitGroups --
+ *
+ *	Sets up the group table of a new IPM channel, which has
+ *	already joined the group it was opened with.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	DpIpmFreeGroups must be called when the channel is closed.
+ *
+ *--------------------------------------------------------------
+ */
+void
+DpIpmInitGroups (statePtr, name, addr)
+    SocketState *statePtr;	/* (in) IPM socket */
+    CONST char *name;		/* (in) First group, as given */
+    int addr;			/* (in) Its address */
+{
+    statePtr->groupTable = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(statePtr->groupTable, TCL_ONE_WORD_KEYS);
+    statePtr->groupSerial = 0;
+    statePtr->groupCommands = 0;
+    statePtr->destGroup = 0;
+    IpmAddGroup(statePtr, name, addr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpIpmSetGroup --
+ *
+ *	Implements "fconfigure $chan -group" for IPM channels.
+ *	The value is "+group" to join a group, "-group" to leave
+ *	one, or "+group command" to join a group (or change one
+ *	already joined) and have "command payload {host port}"
+ *	evaluated for every datagram sent to it.  An empty
+ *	command removes the callback.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	Joins or leaves the group.  While any group has a
+ *	callback, the channel's datagrams are read by
+ *	IpmGroupHandler instead of the script.
+ *
+ *--------------------------------------------------------------
+ */
+int
+DpIpmSetGroup (interp, statePtr, optionValue)
+    Tcl_Interp *interp;		/* (in) For error reporting */
+    SocketState *statePtr;	/* (in) IPM socket */
+    CONST char *optionValue;	/* (in) {+|-group ?command?} */
+{
+    Tcl_HashEntry *entryPtr;
+    IpmGroup *groupPtr;
+    CONST84 char **argv;
+    CONST char *group;
+    int argc, addr, rc, hadCommand;
+    char c;
+
+    if (Tcl_SplitList(interp, optionValue, &argc, &argv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    c = (argc > 0) ? argv[0][0] : '\0';
+    if (((c != '+') && (c != '-')) || (argc > 2)
+	    || ((c == '-') && (argc != 1))) {
+	ckfree((char *) argv);
+	Tcl_AppendResult (interp, "Expected an add/drop token.  ",
+		"Please see docs on how to add/drop a group.", NULL);
+	return TCL_ERROR;
+    }
+    group = &argv[0][1];
+    if (DpHostToIpAddr (group, &addr) == 0) {
+	Tcl_AppendResult (interp,
+		"Expected IP address or hostname but got \"",
+		optionValue, "\"", NULL);
+	ckfree((char *) argv);
+	return TCL_ERROR;
+    }
+
+    entryPtr = Tcl_FindHashEntry(statePtr->groupTable,
+	    (char *) (size_t) (unsigned int) addr);
+    groupPtr = (entryPtr != NULL)
+	    ? (IpmGroup *) Tcl_GetHashValue(entryPtr) : NULL;
+
+    if (c == '-') {
+	ckfree((char *) argv);
+	if (groupPtr == NULL) {
+	    Tcl_AppendResult(interp, "Group address not found ",
+		    "in list", NULL);
+	    return TCL_ERROR;
+	}
+	rc = DpIpmSetSocketOption(statePtr, DP_DROP_MEMBERSHIP, addr);
+	if (rc != 0) {
+	    goto posixError;
+	}
+	if (groupPtr->cmdPtr != NULL) {
+	    statePtr->groupCommands--;
+	    if (statePtr->groupCommands == 0) {
+		Tcl_DeleteChannelHandler(statePtr->channel, IpmGroupHandler,
+			(ClientData) statePtr);
+	    }
+	}
+	Tcl_DeleteHashEntry(entryPtr);
+	IpmFreeGroup(groupPtr);
+	return TCL_OK;
+    }
+
+    if (groupPtr == NULL) {
+	rc = DpIpmSetSocketOption(statePtr, DP_ADD_MEMBERSHIP, addr);
+	if (rc != 0) {
+	    ckfree((char *) argv);
+	    goto posixError;
+	}
+	groupPtr = IpmAddGroup(statePtr, group, addr);
+    } else if (argc == 1) {
+	ckfree((char *) argv);
+	Tcl_AppendResult(interp, "already a member of group \"", group,
+		"\"", NULL);
+	return TCL_ERROR;
+    }
+
+    /*
+     * Install, replace or remove the group's callback.
+     */
+
+    if (argc == 2) {
+	hadCommand = (groupPtr->cmdPtr != NULL);
+	if (hadCommand) {
+	    Tcl_DecrRefCount(groupPtr->cmdPtr);
+	    groupPtr->cmdPtr = NULL;
+	}
+	if (argv[1][0] != '\0') {
+	    groupPtr->cmdPtr = Tcl_NewStringObj(argv[1], -1);
+	    Tcl_IncrRefCount(groupPtr->cmdPtr);
+	    groupPtr->interp = interp;
+	}
+	if (!hadCommand && (groupPtr->cmdPtr != NULL)) {
+	    if (statePtr->groupCommands++ == 0) {
+		Tcl_CreateChannelHandler(statePtr->channel, TCL_READABLE,
+			IpmGroupHandler, (ClientData) statePtr);
+	    }
+	} else if (hadCommand && (groupPtr->cmdPtr == NULL)) {
+	    if (--statePtr->groupCommands == 0) {
+		Tcl_DeleteChannelHandler(statePtr->channel, IpmGroupHandler,
+			(ClientData) statePtr);
+	    }
+	}
+    }
+    ckfree((char *) argv);
+    return TCL_OK;
+
+posixError:
+    Tcl_SetErrno(rc);
+    Tcl_AppendResult(interp, "can't ", (c == '+') ? "join" : "leave",
+	    " group: ", Tcl_PosixError(interp), NULL);
+    return TCL_ERROR;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpIpmGetGroups --
+ *
+ *	Appends the groups an IPM channel belongs to, in the order
+ *	they were joined, for "fconfigure $chan -group".
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+void
+DpIpmGetGroups (statePtr, dsPtr)
+    SocketState *statePtr;	/* (in) IPM socket */
+    Tcl_DString *dsPtr;		/* (out) Where to put the list */
+{
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+    IpmGroup **groups;
+    int i, n = 0;
+
+    if (statePtr->groupTable == NULL) {
+	return;
+    }
+    groups = (IpmGroup **) ckalloc(
+	    (statePtr->groupTable->numEntries + 1) * sizeof(IpmGroup *));
+    for (entryPtr = Tcl_FirstHashEntry(statePtr->groupTable, &search);
+	    entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+	groups[n++] = (IpmGroup *) Tcl_GetHashValue(entryPtr);
+    }
+    qsort((VOID *) groups, (size_t) n, sizeof(IpmGroup *),
+	    IpmCompareGroups);
+    for (i = 0; i < n; i++) {
+	Tcl_DStringAppendElement(dsPtr, Tcl_GetString(groups[i]->nameObj));
+    }
+    ckfree((char *) groups);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpIpmFreeGroups --
+ *
+ *	Releases the group table of an IPM channel that is being
+ *	closed.  The kernel drops the memberships with the socket.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+void
+DpIpmFreeGroups (statePtr)
+    SocketState *statePtr;	/* (in) IPM socket */
+{
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+
+    if (statePtr->groupTable == NULL) {
+	return;
+    }
+    for (entryPtr = Tcl_FirstHashEntry(statePtr->groupTable, &search);
+	    entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+	IpmFreeGroup((IpmGroup *) Tcl_GetHashValue(entryPtr));
+    }
+    Tcl_DeleteHashTable(statePtr->groupTable);
+    ckfree((char *) statePtr->groupTable);
+    statePtr->groupTable = NULL;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * IpmAddGroup --
+ *
+ *	Records a group the socket has joined.
+ *
+ * Results:
+ *	The new group, with no callback.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+static IpmGroup *
+IpmAddGroup (statePtr, name, addr)
+    SocketState *statePtr;	/* (in) IPM socket */
+    CONST char *name;		/* (in) The group as given */
+    int addr;			/* (in) Its address */
+{
+    Tcl_HashEntry *entryPtr;
+    IpmGroup *groupPtr;
+    int new;
+
+    groupPtr = (IpmGroup *) ckalloc(sizeof(IpmGroup));
+    groupPtr->addr = addr;
+    groupPtr->serial = statePtr->groupSerial++;
+    groupPtr->nameObj = Tcl_NewStringObj(name, -1);
+    Tcl_IncrRefCount(groupPtr->nameObj);
+    groupPtr->cmdPtr = NULL;
+    groupPtr->interp = NULL;
+    entryPtr = Tcl_CreateHashEntry(statePtr->groupTable,
+	    (char *) (size_t) (unsigned int) addr, &new);
+    Tcl_SetHashValue(entryPtr, (ClientData) groupPtr);
+    return groupPtr;
+}
+
+static void
+IpmFreeGroup (groupPtr)
+    IpmGroup *groupPtr;		/* (in) Group to free */
+{
+    Tcl_DecrRefCount(groupPtr->nameObj);
+    if (groupPtr->cmdPtr != NULL) {
+	Tcl_DecrRefCount(groupPtr->cmdPtr);
+    }
+    ckfree((char *) groupPtr);
+}
+
+static int
+IpmCompareGroups (first, second)
+    CONST VOID *first;		/* (in) IpmGroup ** */
+    CONST VOID *second;		/* (in) IpmGroup ** */
+{
+    return (*(IpmGroup **) first)->serial - (*(IpmGroup **) second)->serial;
 }
 
+/*
+ *--------------------------------------------------------------
+ *
+ * IpmGroupHandler --
+ *
+ *	Channel handler installed while any group of an IPM
+ *	channel has a callback.  Reads the datagrams waiting on
+ *	the socket, up to DP_IPM_DISPATCH_MAX, and evaluates the
+ *	callback of the group each was sent to.  Datagrams for a
+ *	group without a callback, or whose destination the system
+ *	can't report, are discarded.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Whatever the callbacks do, which may include closing the
+ *	channel; statePtr is not touched once they start.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+IpmGroupHandler (clientData, mask)
+    ClientData clientData;	/* (in) IPM socket */
+    int mask;			/* (in) Not used */
+{
+    SocketState *statePtr = (SocketState *) clientData;
+    Tcl_ChannelType *typePtr = (Tcl_ChannelType *)
+	    Tcl_GetChannelType(statePtr->channel);
+    Tcl_Obj *cmds[DP_IPM_DISPATCH_MAX];
+    Tcl_Interp *interps[DP_IPM_DISPATCH_MAX];
+    Tcl_Obj *payload, *cmdPtr;
+    Tcl_HashEntry *entryPtr;
+    IpmGroup *groupPtr;
+    Tcl_DString ds;
+    int i, n = 0, nread, errorCode, blocking;
+
+    /*
+     * The socket has a datagram, but a fileevent script may read
+     * it first, so never block here.
+     */
+
+    Tcl_DStringInit(&ds);
+    Tcl_GetChannelOption(NULL, statePtr->channel, "-blocking", &ds);
+    blocking = (Tcl_DStringValue(&ds)[0] == '1');
+    Tcl_DStringFree(&ds);
+    if (blocking) {
+	(typePtr->blockModeProc)(clientData, TCL_MODE_NONBLOCKING);
+    }
+    while (n < DP_IPM_DISPATCH_MAX) {
+	payload = Tcl_NewObj();
+	nread = (typePtr->inputProc)(clientData,
+		(char *) Tcl_SetByteArrayLength(payload, DP_DATAGRAM_MAX),
+		DP_DATAGRAM_MAX, &errorCode);
+	if (nread < 0) {
+	    Tcl_DecrRefCount(payload);
+	    break;
+	}
+	entryPtr = Tcl_FindHashEntry(statePtr->groupTable,
+		(char *) (size_t) (unsigned int) statePtr->destGroup);
+	groupPtr = (entryPtr != NULL)
+		? (IpmGroup *) Tcl_GetHashValue(entryPtr) : NULL;
+	if ((groupPtr == NULL) || (groupPtr->cmdPtr == NULL)) {
+	    Tcl_DecrRefCount(payload);
+	    continue;
+	}
+	Tcl_SetByteArrayLength(payload, nread);
+	cmdPtr = Tcl_DuplicateObj(groupPtr->cmdPtr);
+	Tcl_IncrRefCount(cmdPtr);
+	Tcl_ListObjAppendElement(NULL, cmdPtr, payload);
+	Tcl_ListObjAppendElement(NULL, cmdPtr, statePtr->fromObj);
+	cmds[n] = cmdPtr;
+	interps[n] = groupPtr->interp;
+	Tcl_Preserve((ClientData) interps[n]);
+	n++;
+    }
+    if (blocking) {
+	(typePtr->blockModeProc)(clientData, TCL_MODE_BLOCKING);
+    }
+
+    for (i = 0; i < n; i++) {
+	if (Tcl_EvalObjEx(interps[i], cmds[i], TCL_EVAL_GLOBAL) != TCL_OK) {
+	    Tcl_AddErrorInfo(interps[i],
+		    "\n    (IPM group callback)");
+	    Tcl_BackgroundError(interps[i]);
+	}
+	Tcl_DecrRefCount(cmds[i]);
+	Tcl_Release((ClientData) interps[i]);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * Dp_ResolveCmd --
+ *
+ *	This procedure is invoked to process the "dp_resolve" Tcl
+ *	command:
+ *
+ *	    dp_resolve ?-command callback? host
+ *	    dp_resolve -ttl ?seconds?
+ *	    dp_resolve -negativettl ?seconds?
+ *	    dp_resolve -flush
+ *
+ *	With -command the lookup is done on a helper thread and
+ *	"callback host address" is evaluated when it completes;
+ *	address is empty if the host is unknown.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	See the user documentation.
+ *
+ *--------------------------------------------------------------
+ */
+
+	/* ARGSUSED */
+int
+Dp_ResolveCmd(dummy, interp, argc, argv)
+    ClientData dummy;			/* Not used. */
+    Tcl_Interp *interp;			/* Current interpreter. */
+    int argc;				/* Number of arguments. */
+    CONST84 char **argv;		/* Argument strings. */
+{
+    ResolveRequest *reqPtr;
+    Tcl_ThreadId threadId;
+    char addrStr[16];
+    int addr, *ttlPtr;
+
+    if ((argc == 2) && (strcmp(argv[1], "-flush") == 0)) {
+	Tcl_MutexLock(&resolverMutex);
+	ResolverInit();
+	ResolverFlushTable(&hostCache);
+	ResolverFlushTable(&addrCache);
+	ResolverFlushTable(&serviceCache);
+	Tcl_MutexUnlock(&resolverMutex);
+	return TCL_OK;
+    }
+
+    if (((argc == 2) || (argc == 3)) && ((strcmp(argv[1], "-ttl") == 0)
+	    || (strcmp(argv[1], "-negativettl") == 0))) {
+	ttlPtr = (argv[1][1] == 't') ? &resolverTtl : &resolverNegativeTtl;
+	if (argc == 3) {
+	    if (Tcl_GetInt(interp, argv[2], &addr) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if (addr < 0) {
+		Tcl_AppendResult(interp, "TTL must be >= 0", (char *) NULL);
+		return TCL_ERROR;
+	    }
+	    Tcl_MutexLock(&resolverMutex);
+	    *ttlPtr = addr;
+	    Tcl_MutexUnlock(&resolverMutex);
+	}
+	sprintf(addrStr, "%d", *ttlPtr);
+	Tcl_SetResult(interp, addrStr, TCL_VOLATILE);
+	return TCL_OK;
+    }
+
+    if ((argc == 2) && (argv[1][0] != '-')) {
+	if (!DpHostToIpAddr(argv[1], &addr)) {
+	    Tcl_AppendResult(interp, argv[0], ": unknown host \"", argv[1],
+		    "\"", (char *) NULL);
+	    return TCL_ERROR;
+	}
+	sprintf(addrStr, "%d.%d.%d.%d", (addr>>24)&0xFF, (addr>>16)&0xFF,
+		(addr>>8)&0xFF, addr&0xFF);
+	Tcl_SetResult(interp, addrStr, TCL_VOLATILE);
+	return TCL_OK;
+    }
+
+    if ((argc != 4) || (strcmp(argv[1], "-command") != 0)) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		" ?-command callback? host\", \"", argv[0],
+		" -ttl ?seconds?\", \"", argv[0],
+		" -negativettl ?seconds?\" or \"", argv[0], " -flush\"",
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+
+    reqPtr = (ResolveRequest *) ckalloc(sizeof(ResolveRequest));
+    reqPtr->interp = interp;
+    reqPtr->owner = Tcl_GetCurrentThread();
+    reqPtr->host = ckalloc((unsigned) strlen(argv[3]) + 1);
+    strcpy(reqPtr->host, argv[3]);
+    reqPtr->cmdPtr = Tcl_NewStringObj(argv[2], -1);
+    Tcl_IncrRefCount(reqPtr->cmdPtr);
+    reqPtr->found = 0;
+    reqPtr->ipAddr = 0;
+    reqPtr->nextPtr = NULL;
+    Tcl_Preserve((ClientData) interp);
+
+    /*
+     * Names we can answer without the resolver (addresses, localhost,
+     * cached entries) are answered right away, but the callback is
+     * still run from the event loop so it's never called before
+     * dp_resolve returns.
+     */
+
+    Tcl_MutexLock(&resolverMutex);
+    ResolverInit();
+    if (((int) inet_addr(reqPtr->host) != DP_INADDR_NONE)
+	    || (strcmp(reqPtr->host, "localhost") == 0)
+	    || (ResolverFind(&hostCache, reqPtr->host) != NULL)) {
+	ResolverEvent *evPtr;
+
+	Tcl_MutexUnlock(&resolverMutex);
+	reqPtr->found = DpHostToIpAddr(reqPtr->host, &reqPtr->ipAddr);
+	evPtr = (ResolverEvent *) ckalloc(sizeof(ResolverEvent));
+	evPtr->header.proc = ResolverEventProc;
+	evPtr->reqPtr = reqPtr;
+	Tcl_QueueEvent((Tcl_Event *) evPtr, TCL_QUEUE_TAIL);
+	return TCL_OK;
+    }
+
+    if (requestTail == NULL) {
+	requestHead = reqPtr;
+    } else {
+	requestTail->nextPtr = reqPtr;
+    }
+    requestTail = reqPtr;
+
+    if (!resolverThreadRunning) {
+	if (Tcl_CreateThread(&threadId, ResolverThread, (ClientData) NULL,
+		TCL_THREAD_STACK_DEFAULT, TCL_THREAD_NOFLAGS) != TCL_OK) {
+	    /*
+	     * No threads in this Tcl: do the lookup now and deliver
+	     * the answer through the event queue all the same.
+	     */
+
+	    ResolverEvent *evPtr;
+
+	    requestHead = requestTail = NULL;
+	    Tcl_MutexUnlock(&resolverMutex);
+	    reqPtr->found = DpHostToIpAddr(reqPtr->host, &reqPtr->ipAddr);
+	    evPtr = (ResolverEvent *) ckalloc(sizeof(ResolverEvent));
+	    evPtr->header.proc = ResolverEventProc;
+	    evPtr->reqPtr = reqPtr;
+	    Tcl_QueueEvent((Tcl_Event *) evPtr, TCL_QUEUE_TAIL);
+	    return TCL_OK;
+	}
+	resolverThreadRunning = 1;
+	Tcl_CreateExitHandler(ResolverExitHandler, (ClientData) NULL);
+    }
+    Tcl_ConditionNotify(&resolverCond);
+    Tcl_MutexUnlock(&resolverMutex);
+    return TCL_OK;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolverThread --
+ *
+ *	Body of the helper thread that serves "dp_resolve -command".
+ *	It takes requests off the queue one at a time, resolves them
+ *	with getaddrinfo() and hands each one back to the thread that
+ *	made it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Queues a ResolverEvent on the requesting thread.
+ *
+ *--------------------------------------------------------------
+ */
+
+static Tcl_ThreadCreateType
+ResolverThread(clientData)
+    ClientData clientData;		/* Not used. */
+{
+    ResolveRequest *reqPtr;
+    ResolverEvent *evPtr;
+
+    Tcl_MutexLock(&resolverMutex);
+    while (!resolverShutdown) {
+	if (requestHead == NULL) {
+	    Tcl_ConditionWait(&resolverCond, &resolverMutex, NULL);
+	    continue;
+	}
+	reqPtr = requestHead;
+	requestHead = reqPtr->nextPtr;
+	if (requestHead == NULL) {
+	    requestTail = NULL;
+	}
+	Tcl_MutexUnlock(&resolverMutex);
+
+	reqPtr->found = ResolveHost(reqPtr->host, &reqPtr->ipAddr);
+
+	/*
+	 * If the process is exiting, Tcl may already have been
+	 * finalized, so the request is left alone.
+	 */
+
+	Tcl_MutexLock(&resolverMutex);
+	if (!resolverShutdown) {
+	    evPtr = (ResolverEvent *) ckalloc(sizeof(ResolverEvent));
+	    evPtr->header.proc = ResolverEventProc;
+	    evPtr->reqPtr = reqPtr;
+	    Tcl_ThreadQueueEvent(reqPtr->owner, (Tcl_Event *) evPtr,
+		    TCL_QUEUE_TAIL);
+	    Tcl_ThreadAlert(reqPtr->owner);
+	}
+    }
+    resolverThreadRunning = 0;
+    Tcl_MutexUnlock(&resolverMutex);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolverEventProc --
+ *
+ *	Runs in the thread that called "dp_resolve -command" once
+ *	the answer is known.  Records it in the cache (if it came
+ *	from the resolver) and evaluates the callback.
+ *
+ * Results:
+ *	Always 1, the event is handled.
+ *
+ * Side effects:
+ *	Whatever the callback does.  Errors in it are reported with
+ *	Tcl_BackgroundError.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+ResolverEventProc(evPtr, flags)
+    Tcl_Event *evPtr;			/* ResolverEvent. */
+    int flags;				/* Not used. */
+{
+    ResolveRequest *reqPtr = ((ResolverEvent *) evPtr)->reqPtr;
+    Tcl_Interp *interp = reqPtr->interp;
+    Tcl_Obj *cmdPtr;
+    char addrStr[16];
+    int addr = reqPtr->ipAddr;
+
+    Tcl_MutexLock(&resolverMutex);
+    ResolverInit();
+    if (ResolverFind(&hostCache, reqPtr->host) == NULL) {
+	ResolverStore(&hostCache, reqPtr->host, reqPtr->found,
+		reqPtr->ipAddr, 0, NULL);
+    }
+    Tcl_MutexUnlock(&resolverMutex);
+
+    if (reqPtr->found) {
+	sprintf(addrStr, "%d.%d.%d.%d", (addr>>24)&0xFF, (addr>>16)&0xFF,
+		(addr>>8)&0xFF, addr&0xFF);
+    } else {
+	addrStr[0] = '\0';
+    }
+
+    if (!Tcl_InterpDeleted(interp)) {
+	cmdPtr = Tcl_DuplicateObj(reqPtr->cmdPtr);
+	Tcl_IncrRefCount(cmdPtr);
+	Tcl_ListObjAppendElement(NULL, cmdPtr,
+		Tcl_NewStringObj(reqPtr->host, -1));
+	Tcl_ListObjAppendElement(NULL, cmdPtr, Tcl_NewStringObj(addrStr, -1));
+	if (Tcl_EvalObjEx(interp, cmdPtr, TCL_EVAL_GLOBAL) != TCL_OK) {
+	    Tcl_BackgroundError(interp);
+	}
+	Tcl_DecrRefCount(cmdPtr);
+    }
+
+    Tcl_DecrRefCount(reqPtr->cmdPtr);
+    Tcl_Release((ClientData) interp);
+    ckfree(reqPtr->host);
+    ckfree((char *) reqPtr);
+    return 1;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolverExitHandler --
+ *
+ *	Tells the helper thread to quit when the process exits and
+ *	throws away the requests it hasn't started on.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Wakes up the helper thread.  Frees the queued requests.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+ResolverExitHandler(clientData)
+    ClientData clientData;		/* Not used. */
+{
+    Tcl_MutexLock(&resolverMutex);
+    resolverShutdown = 1;
+    ResolverFreeQueue();
+    Tcl_ConditionNotify(&resolverCond);
+    Tcl_MutexUnlock(&resolverMutex);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolverFreeQueue --
+ *
+ *	Throws away the "dp_resolve -command" requests waiting for
+ *	the helper thread.  Their callbacks are never run.  The
+ *	caller holds resolverMutex.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees memory.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+ResolverFreeQueue()
+{
+    ResolveRequest *reqPtr;
+
+    while (requestHead != NULL) {
+	reqPtr = requestHead;
+	requestHead = reqPtr->nextPtr;
+	Tcl_DecrRefCount(reqPtr->cmdPtr);
+	Tcl_Release((ClientData) reqPtr->interp);
+	ckfree(reqPtr->host);
+	ckfree((char *) reqPtr);
+    }
+    requestTail = NULL;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpResolverPrepareFork --
+ *
+ *	Called by dp_fork just before fork(), so that the child
+ *	doesn't get a copy of resolverMutex held by the helper
+ *	thread, which the child won't have.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Locks resolverMutex; DpResolverAfterFork unlocks it.
+ *
+ *--------------------------------------------------------------
+ */
+
+void
+DpResolverPrepareFork()
+{
+    Tcl_MutexLock(&resolverMutex);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpResolverAfterFork --
+ *
+ *	Called by dp_fork in both processes after fork().  The
+ *	child has no helper thread, so it forgets the parent's:
+ *	lookups still queued are the parent's to answer, and the
+ *	next "dp_resolve -command" starts a thread of its own.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Unlocks resolverMutex.  In the child, frees the queued
+ *	requests and resets the helper thread's state.
+ *
+ *--------------------------------------------------------------
+ */
+
+void
+DpResolverAfterFork(child)
+    int child;				/* 1 in the child process. */
+{
+    if (child) {
+	ResolverFreeQueue();
+	resolverThreadRunning = 0;
+
+	/*
+	 * The helper thread may have been waiting on the condition;
+	 * start over with a new one rather than inherit its waiter.
+	 */
+
+	resolverCond = NULL;
+    }
+    Tcl_MutexUnlock(&resolverMutex);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolveHost --
+ *
+ *	Asks the system resolver for the IPv4 address of a host.
+ *	getaddrinfo() is used because, unlike gethostbyname(), it
+ *	can safely be called from the helper thread.
+ *
+ * Results:
+ *	1 on success with the address (host byte order) in
+ *	*ipAddrPtr, 0 if the host is unknown.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+ResolveHost(host, ipAddrPtr)
+    CONST char *host;			/* Name to look up. */
+    int *ipAddrPtr;			/* (out) Address of host. */
+{
+    struct addrinfo hints, *res;
+
+    memset((char *) &hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((getaddrinfo(host, NULL, &hints, &res) != 0) || (res == NULL)) {
+	*ipAddrPtr = 0;
+	return 0;
+    }
+    *ipAddrPtr = ntohl(((struct sockaddr_in *) res->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(res);
+    return 1;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolverInit --
+ *
+ *	Creates the cache tables the first time they're needed.
+ *	Must be called with resolverMutex held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Initializes the hash tables.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+ResolverInit()
+{
+    if (!resolverInitialized) {
+	Tcl_InitHashTable(&hostCache, TCL_STRING_KEYS);
+	Tcl_InitHashTable(&addrCache, TCL_STRING_KEYS);
+	Tcl_InitHashTable(&serviceCache, TCL_STRING_KEYS);
+	resolverInitialized = 1;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolverFind --
+ *
+ *	Looks up a key in one of the caches.  Expired entries are
+ *	removed and reported as missing.  Must be called with
+ *	resolverMutex held.
+ *
+ * Results:
+ *	The entry, or NULL if there is no live entry for key.
+ *
+ * Side effects:
+ *	May delete an expired entry.
+ *
+ *--------------------------------------------------------------
+ */
+
+static ResolverEntry *
+ResolverFind(tablePtr, key)
+    Tcl_HashTable *tablePtr;		/* Cache to search. */
+    CONST char *key;			/* Name to look for. */
+{
+    Tcl_HashEntry *hPtr;
+    ResolverEntry *entryPtr;
+    Tcl_Time now;
+
+    hPtr = Tcl_FindHashEntry(tablePtr, key);
+    if (hPtr == NULL) {
+	return NULL;
+    }
+    entryPtr = (ResolverEntry *) Tcl_GetHashValue(hPtr);
+    Tcl_GetTime(&now);
+    if (now.sec >= entryPtr->expires) {
+	if (entryPtr->name != NULL) {
+	    ckfree(entryPtr->name);
+	}
+	ckfree((char *) entryPtr);
+	Tcl_DeleteHashEntry(hPtr);
+	return NULL;
+    }
+    return entryPtr;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolverStore --
+ *
+ *	Records the result of a lookup in one of the caches, with
+ *	the TTL for a positive or a negative answer.  Must be called
+ *	with resolverMutex held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Adds or replaces an entry; may empty the table if it has
+ *	grown too big.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+ResolverStore(tablePtr, key, found, ipAddr, port, name)
+    Tcl_HashTable *tablePtr;		/* Cache to update. */
+    CONST char *key;			/* Name that was looked up. */
+    int found;				/* Did the lookup succeed? */
+    int ipAddr;				/* Address found. */
+    int port;				/* Port found (services only). */
+    CONST char *name;			/* Name found, or NULL. */
+{
+    Tcl_HashEntry *hPtr;
+    ResolverEntry *entryPtr;
+    Tcl_Time now;
+    int new, ttl;
+
+    ttl = found ? resolverTtl : resolverNegativeTtl;
+    if (ttl == 0) {
+	return;
+    }
+    if (tablePtr->numEntries >= DP_RESOLVER_MAX_ENTRIES) {
+	ResolverFlushTable(tablePtr);
+    }
+
+    hPtr = Tcl_CreateHashEntry(tablePtr, key, &new);
+    if (new) {
+	entryPtr = (ResolverEntry *) ckalloc(sizeof(ResolverEntry));
+	Tcl_SetHashValue(hPtr, (ClientData) entryPtr);
+    } else {
+	entryPtr = (ResolverEntry *) Tcl_GetHashValue(hPtr);
+	if (entryPtr->name != NULL) {
+	    ckfree(entryPtr->name);
+	}
+    }
+    Tcl_GetTime(&now);
+    entryPtr->found = found;
+    entryPtr->expires = now.sec + ttl;
+    entryPtr->ipAddr = ipAddr;
+    entryPtr->port = port;
+    if (name != NULL) {
+	entryPtr->name = ckalloc((unsigned) strlen(name) + 1);
+	strcpy(entryPtr->name, name);
+    } else {
+	entryPtr->name = NULL;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ResolverFlushTable --
+ *
+ *	Removes every entry from one of the caches.  Must be called
+ *	with resolverMutex held.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees the entries.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+ResolverFlushTable(tablePtr)
+    Tcl_HashTable *tablePtr;		/* Cache to empty. */
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    ResolverEntry *entryPtr;
+
+    for (hPtr = Tcl_FirstHashEntry(tablePtr, &search); hPtr != NULL;
+	    hPtr = Tcl_NextHashEntry(&search)) {
+	entryPtr = (ResolverEntry *) Tcl_GetHashValue(hPtr);
+	if (entryPtr->name != NULL) {
+	    ckfree(entryPtr->name);
+	}
+	ckfree((char *) entryPtr);
+    }
+    Tcl_DeleteHashTable(tablePtr);
+    Tcl_InitHashTable(tablePtr, TCL_STRING_KEYS);
+}
@@ -131,10 +131,51 @@ proc dp_MakeRPCClient {host port {checkCmd none}} {
     return $client
 }
 
-proc dp_MakeRPCServer {{port 0} {loginFunc none} {checkCmd none}
-			{retPort 0}} {
+#
+# dp_MakeRPCServer ?-processes N? ?port? ?loginFunc? ?checkCmd? ?retPort?
+#
+# With -processes N (N > 1), the caller is forked N-1 times before the
+# listener is created.  Every process, parent and children alike, then
+# returns from here with its own -reusePort listener on the same port,
+# and the kernel spreads new connections across them.  The children's
+# process ids are left in the global dp_rpcWorkers (empty in a child).
+#
+
+proc dp_MakeRPCServer {args} {
+    global dp_rpcWorkers
+
+    set processes 1
+    if {[string equal [lindex $args 0] "-processes"]} {
+	set processes [lindex $args 1]
+	set args [lrange $args 2 end]
+    }
+    if {[llength $args] > 4} {
+	error "wrong # args: should be \"dp_MakeRPCServer ?-processes N? ?port? ?loginFunc? ?checkCmd? ?retPort?\""
+    }
+    foreach {port loginFunc checkCmd retPort} \
+	    [concat $args [lrange {0 none none 0} [llength $args] end]] break
     # puts "dp_MakeRPCServer $port $loginFunc $checkCmd $retPort"
-    set rv [dp_connect tcp -server 1 -myport $port]
+
+    if {$processes > 1} {
+	if {$port == 0} {
+	    error "dp_MakeRPCServer: -processes requires a port number"
+	}
+	if {[string length [info commands dp_fork]] == 0} {
+	    error "dp_MakeRPCServer: -processes is not supported on this platform"
+	}
+	set dp_rpcWorkers {}
+	for {set i 1} {$i < $processes} {incr i} {
+	    set pid [dp_fork]
+	    if {$pid == 0} {
+		set dp_rpcWorkers {}
+		break
+	    }
+	    lappend dp_rpcWorkers $pid
+	}
+	set rv [dp_connect tcp -server 1 -myport $port -reusePort 1]
+    } else {
+	set rv [dp_connect tcp -server 1 -myport $port]
+    }
     # puts "rv = $rv"
     set server [lindex $rv 0]
 
@@ -12,6 +12,10 @@
 
 #include "generic/dpPort.h"
 #include "generic/dpInt.h"
+#include <unistd.h>
+
+static int		Dp_ForkCmd _ANSI_ARGS_((ClientData clientData,
+			    Tcl_Interp *interp, int argc, CONST84 char **argv));
 
 
 /*
@@ -20,7 +24,8 @@
  * DppInit --
  *
  *	Performs Unix-specific interpreter initialization related to the
- *      dp_library variable.
+ *      dp_library variable, and creates the commands that only make
+ *	sense on Unix.
  *
  * Results:
  *	Returns a standard Tcl result.  Leaves an error message or result
@@ -28,6 +33,7 @@
  *
  * Side effects:
  *	Sets "dp_library" Tcl variable, runs "tk.tcl" script.
+ *	Creates the "dp_fork" command.
  *
  *----------------------------------------------------------------------
  */
@@ -41,6 +47,70 @@ DppInit(interp)
      * (ToDo) Load in the TCL library
      */
 
+    Tcl_CreateCommand(interp, "dp_fork", Dp_ForkCmd, (ClientData) NULL,
+	    (Tcl_CmdDeleteProc *) NULL);
+
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Dp_ForkCmd --
+ *
+ *	This procedure is invoked to process the "dp_fork" Tcl command.
+ *	It is used by dp_MakeRPCServer to start worker processes that
+ *	inherit the state of the interpreter.  The standard channels
+ *	are flushed first so buffered output isn't written twice.
+ *	The child doesn't inherit the "dp_resolve -command" helper
+ *	thread or its queue.
+ *
+ * Results:
+ *	A standard Tcl result: the child's process id in the parent,
+ *	0 in the child.
+ *
+ * Side effects:
+ *	A new process is created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+	/* ARGSUSED */
+static int
+Dp_ForkCmd(clientData, interp, argc, argv)
+    ClientData clientData;		/* Not used. */
+    Tcl_Interp *interp;			/* Current interpreter. */
+    int argc;				/* Number of arguments. */
+    CONST84 char **argv;		/* Argument strings. */
+{
+    static int stdChannels[] = {TCL_STDOUT, TCL_STDERR};
+    Tcl_Channel chan;
+    char buf[32];
+    int i, pid;
+
+    if (argc != 1) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+		"\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+
+    for (i = 0; i < 2; i++) {
+	chan = Tcl_GetStdChannel(stdChannels[i]);
+	if (chan != NULL) {
+	    Tcl_Flush(chan);
+	}
+    }
+
+    DpResolverPrepareFork();
+    pid = fork();
+    DpResolverAfterFork(pid == 0);
+    if (pid < 0) {
+	Tcl_AppendResult(interp, "couldn't fork: ", Tcl_PosixError(interp),
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+    sprintf(buf, "%d", pid);
+    Tcl_SetResult(interp, buf, TCL_VOLATILE);
     return TCL_OK;
 }
 
@@ -37,6 +37,67 @@ typedef struct sockaddr		DpSocketAddress;
 typedef struct sockaddr_in	DpSocketAddressIP;
 typedef int			SerialHandle;
 
+/*
+ * With "fconfigure -gro 1" the kernel may hand a UDP socket several
+ * datagrams from one sender coalesced into a single buffer, each
+ * "segment" bytes long except the last.  They are kept here and
+ * returned one at a time.
+ */
+
+#define DP_GRO_BUF_SIZE		(64 * 1024)
+
+typedef struct DpGroBuf {
+    int			length;		/* Bytes in buf. */
+    int			offset;		/* Start of the next datagram. */
+    int			segment;	/* Datagram size, or 0 if buf
+					 * holds a single datagram. */
+    DpSocketAddressIP	fromAddr;	/* Sender of the datagrams. */
+    Tcl_TimerToken	timer;		/* Reports the rest as readable. */
+    char		buf[DP_GRO_BUF_SIZE];
+} DpGroBuf;
+
+/*
+ * With "fconfigure -fragment size" a UDP channel sends each write as
+ * a message of numbered datagrams of at most size bytes, and puts
+ * the messages it receives back together.  A DpFragMsg is a message
+ * still being reassembled.
+ */
+
+typedef struct DpFragMsg {
+    struct DpFragMsg *	nextPtr;	/* Next older message. */
+    DpSocketAddressIP	fromAddr;	/* Sender. */
+    unsigned int	msgId;		/* Sender's message number. */
+    int			total;		/* Bytes in the message. */
+    int			count;		/* Fragments in the message. */
+    int			received;	/* Fragments received so far. */
+    long		started;	/* When the first fragment came,
+					 * in ms. */
+    char *		have;		/* have[i] set once fragment i came. */
+    char *		data;		/* The message. */
+} DpFragMsg;
+
+typedef struct DpFragState {
+    int			fragSize;	/* -fragment: payload per datagram. */
+    int			timeout;	/* -fragTimeout, in ms. */
+    int			memLimit;	/* -fragMemory, in bytes. */
+    int			memUsed;	/* Bytes held by partial messages. */
+    unsigned int	nextId;		/* Number of our next message. */
+    DpFragMsg *		partial;	/* Messages being reassembled,
+					 * newest first. */
+    char *		ready;		/* Message being read, or NULL. */
+    int			readyLength;	/* Bytes in ready. */
+    int			readyOffset;	/* Bytes of ready already read. */
+    DpSocketAddressIP	readyFrom;	/* Sender of ready. */
+    Tcl_TimerToken	timer;		/* Reports the rest as readable. */
+    char *		sendBuf;	/* Message a non-blocking write
+					 * couldn't finish, or NULL. */
+    int			sendTotal;	/* Bytes in sendBuf. */
+    int			sendSize;	/* -fragment it was sent with. */
+    unsigned int	sendId;		/* Its message number. */
+    int			sendIndex;	/* Next fragment to send. */
+    char		buf[DP_GRO_BUF_SIZE];
+} DpFragState;
+
 #ifndef _TCL76
 
 typedef ClientData FileHandle;
@@ -49,6 +110,14 @@ int SockBlockMode	_ANSI_ARGS_((ClientData instanceData, int mode));
 void SockWatch		_ANSI_ARGS_((ClientData instanceData, int mask));
 int UdpIpmOutput	_ANSI_ARGS_((ClientData instanceData, CONST84 char *buf,
 					int toWrite, int *errorCodePtr));
+int SockRecvFrom	_ANSI_ARGS_((ClientData instanceData, char *buf,
+					int bufSize, int flags,
+					DpSocketAddressIP *fromAddrPtr));
+void SockGetStats	_ANSI_ARGS_((ClientData instanceData, int datagram,
+					Tcl_DString *dsPtr));
+void DpUdpFreeFragState	_ANSI_ARGS_((DpFragState *fragPtr));
+int DpSetTimestamps	_ANSI_ARGS_((ClientData instanceData, int option,
+					int on));
 
 #endif
 
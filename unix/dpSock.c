@@ -11,9 +11,100 @@
  *
  */
 
+#ifdef __linux__
+#   ifndef _GNU_SOURCE
+#	define _GNU_SOURCE	/* For splice() and tee() */
+#   endif
+#endif
 #include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#ifdef __linux__
+#   include <sys/sendfile.h>
+#endif
 #include "generic/dpInt.h"
 
+/*
+ * The number of bytes DppCopyChannels moves through its pipes at
+ * a time.  This matches the default pipe capacity on Linux, so that
+ * tee() can always duplicate a whole chunk in a single call.
+ */
+
+#define DP_SPLICE_CHUNK		(64 * 1024)
+
+/*
+ * The largest datagram dp_recvBatch can receive without truncating it.
+ * Each slot of its buffer is only as big as the socket's receive
+ * buffer, if that is smaller, unless -gro is on or a datagram came
+ * back truncated.
+ */
+
+#define DP_BATCH_MSG_SIZE	(64 * 1024)
+
+/*
+ * Room for the ancillary data (destination group, drop count, GRO
+ * segment size, receive time) that comes with each datagram.
+ */
+
+#define DP_BATCH_CONTROL_SIZE	128
+
+/*
+ * With -sendStamp on, each datagram starts with DP_STAMP_MAGIC and
+ * the time it was sent, in ns since the epoch, as two 32-bit words,
+ * all in network byte order.
+ */
+
+#define DP_STAMP_MAGIC		0x44507473	/* "DPts" */
+#define DP_STAMP_SIZE		12
+
+/*
+ * dp_recvBatch's buffers, kept with the socket between calls and
+ * only reallocated when a call needs more or bigger slots.
+ */
+
+typedef struct DpRecvBatch {
+    int			numSlots;	/* Datagrams there is room for. */
+    int			slotSize;	/* Bytes per datagram. */
+    int			truncated;	/* Set once a datagram didn't fit;
+					 * slots are DP_BATCH_MSG_SIZE
+					 * from then on. */
+    char *		buffers;
+    DpSocketAddressIP *	addrs;
+    int *		lengths;
+    int *		segments;
+#ifdef __linux__
+    struct mmsghdr *	msgs;
+    struct iovec *	iovs;
+    char *		controls;
+    Tcl_WideInt *	recvStamps;
+#endif
+} DpRecvBatch;
+
+static DpRecvBatch *	RecvBatchGet _ANSI_ARGS_((SocketState *statePtr,
+			    int maxMsgs));
+static void		RecvBatchFree _ANSI_ARGS_((DpRecvBatch *batchPtr));
+static int		RecvBatchAppend _ANSI_ARGS_((Tcl_Obj *listPtr,
+			    char *buf, int length, int segment,
+			    DpSocketAddressIP *addrPtr, Tcl_WideInt *stamps));
+static void		StampHeader _ANSI_ARGS_((char *hdr));
+static int		StampSend _ANSI_ARGS_((SocketState *statePtr,
+			    char *hdr, CONST84 char *buf, int length,
+			    DpSocketAddressIP *addrPtr));
+static int		StampStrip _ANSI_ARGS_((char *buf, int length,
+			    Tcl_WideInt *sendStampPtr));
+static int		StampFromCmsg _ANSI_ARGS_((struct cmsghdr *cmsg,
+			    Tcl_WideInt *stampPtr));
+
+#ifdef __linux__
+static int		SpliceOut _ANSI_ARGS_((int pipeFd, int outFd,
+			    int length));
+#endif
+
 
 
 /*
@@ -93,6 +184,923 @@ DppGetErrno()
     return Tcl_GetErrno();
 }
 
+/*
+ * -------------------------------------------------------------
+ *
+ * DppCopyChannels --
+ *
+ *	Fast path for dp_copy.  Moves up to "requested" bytes from
+ *	inChan to every channel in outChans inside the kernel, using
+ *	sendfile() when a regular file is copied to a single output
+ *	and splice()/tee() through a pipe otherwise.  The caller has
+ *	already checked that the channels are unbuffered, blocking
+ *	OS handles that need no translation.
+ *
+ * Results:
+ *	1 if the copy was done, with the byte count in *copiedPtr.
+ *	0 if the kernel can't do this copy and no data was moved, in
+ *	which case the caller should fall back to Tcl_Read/Tcl_Write.
+ *	-1 on error, with the POSIX error code left in errno and the
+ *	offending channel in *errChanPtr.
+ *
+ * Side effects:
+ *	Data is consumed from inChan and written to the outChans.
+ *
+ * -------------------------------------------------------------
+ */
+
+int
+DppCopyChannels(inChan, outChans, numOutChans, requested, copiedPtr,
+	errChanPtr)
+    Tcl_Channel inChan;		/* Channel to read from */
+    Tcl_Channel *outChans;	/* Channels to write to */
+    int numOutChans;		/* Number of entries in outChans */
+    int requested;		/* Max number of bytes to copy */
+    int *copiedPtr;		/* (out) Number of bytes copied */
+    Tcl_Channel *errChanPtr;	/* (out) Channel that failed (if any) */
+{
+#ifdef __linux__
+    ClientData handle;
+    struct stat inStat;
+    int inFd, *outFds;
+    int (*pipes)[2];
+    int i, n, total, result;
+
+    *copiedPtr = 0;
+    *errChanPtr = inChan;
+
+    if (Tcl_GetChannelHandle(inChan, TCL_READABLE, &handle) != TCL_OK) {
+	return 0;
+    }
+    inFd = (int) (long) handle;
+    outFds = (int *) ckalloc(sizeof(int) * numOutChans);
+    for (i = 0; i < numOutChans; i++) {
+	if (Tcl_GetChannelHandle(outChans[i], TCL_WRITABLE, &handle)
+		!= TCL_OK) {
+	    ckfree((char *) outFds);
+	    return 0;
+	}
+	outFds[i] = (int) (long) handle;
+    }
+
+    total = 0;
+    result = 1;
+
+    /*
+     * A regular file going to a single destination is what sendfile()
+     * was made for.  It reads from the current file offset and
+     * advances it, so Tcl's idea of the position stays correct.
+     */
+
+    if ((numOutChans == 1) && (fstat(inFd, &inStat) == 0)
+	    && S_ISREG(inStat.st_mode)) {
+	while (requested > 0) {
+	    n = sendfile(outFds[0], inFd, NULL, (size_t) requested);
+	    if (n < 0) {
+		if (errno == EINTR) {
+		    continue;
+		}
+		if ((total == 0) && ((errno == EINVAL) || (errno == ENOSYS))) {
+		    result = 0;
+		} else {
+		    *errChanPtr = outChans[0];
+		    result = -1;
+		}
+		break;
+	    }
+	    if (n == 0) {
+		break;
+	    }
+	    total += n;
+	    requested -= n;
+	}
+	ckfree((char *) outFds);
+	*copiedPtr = total;
+	if (result < 0) {
+	    Tcl_SetErrno(errno);
+	}
+	return result;
+    }
+
+    /*
+     * Everything else is spliced into a pipe.  Every output but the
+     * first gets its own pipe that is filled with tee(), which
+     * duplicates the pipe buffer pages without consuming them; the
+     * first output then drains the original pipe.
+     */
+
+    pipes = (int (*)[2]) ckalloc(sizeof(int[2]) * numOutChans);
+    for (i = 0; i < numOutChans; i++) {
+	if (pipe(pipes[i]) < 0) {
+	    while (--i >= 0) {
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	    }
+	    ckfree((char *) pipes);
+	    ckfree((char *) outFds);
+	    return 0;
+	}
+    }
+
+    while (requested > 0) {
+	n = splice(inFd, NULL, pipes[0][1], NULL,
+		(size_t) ((requested < DP_SPLICE_CHUNK)
+			? requested : DP_SPLICE_CHUNK),
+		SPLICE_F_MOVE);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    if ((total == 0) && ((errno == EINVAL) || (errno == ENOSYS))) {
+		result = 0;
+	    } else {
+		*errChanPtr = inChan;
+		result = -1;
+	    }
+	    break;
+	}
+	if (n == 0) {
+	    break;
+	}
+	for (i = 1; i < numOutChans; i++) {
+	    int teed;
+
+	    do {
+		teed = tee(pipes[0][0], pipes[i][1], (size_t) n, 0);
+	    } while ((teed < 0) && (errno == EINTR));
+	    if (teed != n) {
+		if (teed >= 0) {
+		    errno = EIO;
+		}
+		*errChanPtr = outChans[i];
+		result = -1;
+		break;
+	    }
+	    if (SpliceOut(pipes[i][0], outFds[i], n) < 0) {
+		*errChanPtr = outChans[i];
+		result = -1;
+		break;
+	    }
+	}
+	if (result < 0) {
+	    break;
+	}
+	if (SpliceOut(pipes[0][0], outFds[0], n) < 0) {
+	    *errChanPtr = outChans[0];
+	    result = -1;
+	    break;
+	}
+	total += n;
+	requested -= n;
+    }
+    if (result < 0) {
+	Tcl_SetErrno(errno);
+    }
+
+    for (i = 0; i < numOutChans; i++) {
+	close(pipes[i][0]);
+	close(pipes[i][1]);
+    }
+    ckfree((char *) pipes);
+    ckfree((char *) outFds);
+    *copiedPtr = total;
+    return result;
+#else
+    *copiedPtr = 0;
+    *errChanPtr = inChan;
+    return 0;
+#endif
+}
+
+#ifdef __linux__
+/*
+ * -------------------------------------------------------------
+ *
+ * SpliceOut --
+ *
+ *	Drains exactly "length" bytes from a pipe into outFd.  If the
+ *	destination doesn't support splice(), the bytes are moved with
+ *	plain read()/write() instead, since they have already left
+ *	the source and can't be handed back to the generic code.
+ *
+ * Results:
+ *	0 on success, -1 on error with errno set.
+ *
+ * Side effects:
+ *	Writes to outFd.
+ *
+ * -------------------------------------------------------------
+ */
+
+static int
+SpliceOut(pipeFd, outFd, length)
+    int pipeFd;			/* Read end of the pipe */
+    int outFd;			/* Destination descriptor */
+    int length;			/* Number of bytes in the pipe */
+{
+    char buf[4096];
+    int n, written;
+
+    while (length > 0) {
+	n = splice(pipeFd, NULL, outFd, NULL, (size_t) length,
+		SPLICE_F_MOVE | SPLICE_F_MORE);
+	if (n > 0) {
+	    length -= n;
+	    continue;
+	}
+	if (n == 0) {
+	    errno = EPIPE;
+	    return -1;
+	}
+	if (errno == EINTR) {
+	    continue;
+	}
+	if (errno != EINVAL) {
+	    return -1;
+	}
+	n = read(pipeFd, buf,
+		(length < (int) sizeof(buf)) ? length : (int) sizeof(buf));
+	if (n <= 0) {
+	    return -1;
+	}
+	length -= n;
+	for (written = 0; written < n; ) {
+	    int w = write(outFd, buf + written, n - written);
+	    if (w < 0) {
+		if (errno == EINTR) {
+		    continue;
+		}
+		return -1;
+	    }
+	    written += w;
+	}
+    }
+    return 0;
+}
+#endif
+
+/*
+ * -------------------------------------------------------------
+ *
+ * DppRecvBatch --
+ *
+ *	Reads up to maxMsgs datagrams from a UDP or IPM socket for
+ *	dp_recvBatch, using a single recvmmsg() where the system has
+ *	it.  A blocking socket waits for the first datagram only.
+ *	Each datagram is appended to listPtr as a list of its payload
+ *	and the sender's {host port}.
+ *
+ * Results:
+ *	The number of datagrams read, or -1 with the POSIX error in
+ *	*errorCodePtr.
+ *
+ * Side effects:
+ *	Consumes datagrams and updates the socket's counters.
+ *
+ * -------------------------------------------------------------
+ */
+
+int
+DppRecvBatch(statePtr, maxMsgs, listPtr, errorCodePtr)
+    SocketState *statePtr;	/* Socket to read */
+    int maxMsgs;		/* Max number of datagrams to read */
+    Tcl_Obj *listPtr;		/* (out) List to append datagrams to */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    DpRecvBatch *batchPtr;
+    char *buffers;
+    DpSocketAddressIP *addrs;
+    int *lengths, *segments;
+    DpGroBuf *groPtr = statePtr->groPtr;
+    Tcl_WideInt *stamps, stampBuf[2];
+    int i, n, count, slotSize;
+#ifdef __linux__
+    struct mmsghdr *msgs;
+    struct cmsghdr *cmsg;
+#else
+    socklen_t addrLen;
+#endif
+
+    /*
+     * Datagrams left over from a coalesced -gro read come first.
+     */
+
+    stamps = NULL;
+    if (statePtr->flags & (SOCKET_TIMESTAMPS|SOCKET_SENDSTAMP)) {
+	stamps = stampBuf;
+    }
+    if ((groPtr != NULL) && (groPtr->offset < groPtr->length)) {
+	count = 0;
+	stampBuf[0] = statePtr->recvStamp;
+	stampBuf[1] = 0;
+	while ((count < maxMsgs) && (groPtr->offset < groPtr->length)) {
+	    n = groPtr->length - groPtr->offset;
+	    if ((groPtr->segment > 0) && (n > groPtr->segment)) {
+		n = groPtr->segment;
+	    }
+	    count += RecvBatchAppend(listPtr, groPtr->buf + groPtr->offset, n,
+		    n, &groPtr->fromAddr, stamps);
+	    groPtr->offset += n;
+	}
+	return count;
+    }
+
+    batchPtr = RecvBatchGet(statePtr, maxMsgs);
+    slotSize = batchPtr->slotSize;
+    buffers = batchPtr->buffers;
+    addrs = batchPtr->addrs;
+    lengths = batchPtr->lengths;
+    segments = batchPtr->segments;
+    memset((char *) segments, 0, maxMsgs * sizeof(int));
+
+    statePtr->stats.readCalls++;
+#ifdef __linux__
+    msgs = batchPtr->msgs;
+    memset((char *) batchPtr->recvStamps, 0, maxMsgs * sizeof(Tcl_WideInt));
+    for (i = 0; i < maxMsgs; i++) {
+	msgs[i].msg_hdr.msg_namelen = sizeof(DpSocketAddressIP);
+	msgs[i].msg_hdr.msg_controllen = DP_BATCH_CONTROL_SIZE;
+	msgs[i].msg_hdr.msg_flags = 0;
+	msgs[i].msg_len = 0;
+    }
+    do {
+	n = recvmmsg(statePtr->sock, msgs, maxMsgs, MSG_WAITFORONE, NULL);
+    } while ((n < 0) && (errno == EINTR));
+    for (i = 0; i < n; i++) {
+	lengths[i] = msgs[i].msg_len;
+	if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+	    batchPtr->truncated = 1;
+	}
+	for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+		cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+#ifdef UDP_GRO
+	    if ((cmsg->cmsg_level == SOL_UDP)
+		    && (cmsg->cmsg_type == UDP_GRO)) {
+		memcpy((char *) &segments[i], CMSG_DATA(cmsg), sizeof(int));
+	    }
+#endif
+	    StampFromCmsg(cmsg, &batchPtr->recvStamps[i]);
+	}
+    }
+#else
+    /*
+     * No recvmmsg(): read one datagram (waiting if the socket
+     * blocks), then whatever else is already queued.
+     */
+
+    for (n = 0; n < maxMsgs; n++) {
+	addrLen = sizeof(DpSocketAddressIP);
+	lengths[n] = recvfrom(statePtr->sock, buffers + n * slotSize,
+		slotSize, (n == 0) ? 0 : MSG_DONTWAIT,
+		(DpSocketAddress *) &addrs[n], &addrLen);
+	if (lengths[n] < 0) {
+	    if (n == 0) {
+		n = -1;
+	    }
+	    break;
+	}
+    }
+#endif
+
+    count = n;
+    if (n < 0) {
+	*errorCodePtr = DppGetErrno();
+	if ((*errorCodePtr == EAGAIN) || (*errorCodePtr == EWOULDBLOCK)) {
+	    statePtr->stats.eagainIn++;
+	}
+    } else {
+	count = 0;
+	for (i = 0; i < n; i++) {
+#ifdef __linux__
+	    stampBuf[0] = batchPtr->recvStamps[i];
+#else
+	    stampBuf[0] = 0;
+#endif
+	    stampBuf[1] = 0;
+	    if (statePtr->flags & SOCKET_SENDSTAMP) {
+		lengths[i] = StampStrip(buffers + i * slotSize,
+			lengths[i], &stampBuf[1]);
+	    }
+	    statePtr->stats.bytesIn += lengths[i];
+	    count += RecvBatchAppend(listPtr, buffers + i * slotSize,
+		    lengths[i], segments[i], &addrs[i], stamps);
+	}
+	if (n > 0) {
+	    statePtr->recvStamp = stampBuf[0];
+	    statePtr->sendStamp = stampBuf[1];
+	}
+	statePtr->stats.packetsIn += count;
+    }
+    return count;
+}
+
+/*
+ * -------------------------------------------------------------
+ *
+ * RecvBatchGet --
+ *
+ *	Returns the socket's dp_recvBatch buffers, reallocating
+ *	them first if they have fewer than maxMsgs slots or their
+ *	slots are too small.  A slot holds the largest datagram
+ *	the socket can queue, which is its receive buffer size
+ *	up to DP_BATCH_MSG_SIZE.  It is DP_BATCH_MSG_SIZE with
+ *	-gro on, whose buffers hold several datagrams, or once a
+ *	datagram was truncated.
+ *
+ * Results:
+ *	The buffers, with at least maxMsgs slots.
+ *
+ * Side effects:
+ *	May free and reallocate statePtr->batchPtr.
+ *
+ * -------------------------------------------------------------
+ */
+
+static DpRecvBatch *
+RecvBatchGet(statePtr, maxMsgs)
+    SocketState *statePtr;	/* Socket to read */
+    int maxMsgs;		/* Number of datagrams to make room for */
+{
+    DpRecvBatch *batchPtr = statePtr->batchPtr;
+    int slotSize, truncated;
+#ifdef __linux__
+    int i;
+#endif
+
+    truncated = (batchPtr != NULL) && batchPtr->truncated;
+    slotSize = DP_BATCH_MSG_SIZE;
+    if ((statePtr->groPtr == NULL) && !truncated
+	    && (statePtr->recvBufSize > 0)
+	    && (statePtr->recvBufSize < slotSize)) {
+	slotSize = statePtr->recvBufSize;
+    }
+    if ((batchPtr != NULL) && (batchPtr->numSlots >= maxMsgs)
+	    && (batchPtr->slotSize >= slotSize)) {
+	return batchPtr;
+    }
+
+    if (batchPtr != NULL) {
+	if (maxMsgs < batchPtr->numSlots) {
+	    maxMsgs = batchPtr->numSlots;
+	}
+	RecvBatchFree(batchPtr);
+    }
+    batchPtr = (DpRecvBatch *) ckalloc(sizeof(DpRecvBatch));
+    batchPtr->numSlots = maxMsgs;
+    batchPtr->slotSize = slotSize;
+    batchPtr->truncated = truncated;
+    batchPtr->buffers = ckalloc((unsigned) maxMsgs * slotSize);
+    batchPtr->addrs = (DpSocketAddressIP *)
+	    ckalloc((unsigned) maxMsgs * sizeof(DpSocketAddressIP));
+    batchPtr->lengths = (int *) ckalloc((unsigned) maxMsgs * sizeof(int));
+    batchPtr->segments = (int *) ckalloc((unsigned) maxMsgs * sizeof(int));
+#ifdef __linux__
+    batchPtr->msgs = (struct mmsghdr *)
+	    ckalloc((unsigned) maxMsgs * sizeof(struct mmsghdr));
+    batchPtr->iovs = (struct iovec *)
+	    ckalloc((unsigned) maxMsgs * sizeof(struct iovec));
+    batchPtr->controls = ckalloc((unsigned) maxMsgs * DP_BATCH_CONTROL_SIZE);
+    batchPtr->recvStamps = (Tcl_WideInt *)
+	    ckalloc((unsigned) maxMsgs * sizeof(Tcl_WideInt));
+    memset((char *) batchPtr->msgs, 0, maxMsgs * sizeof(struct mmsghdr));
+    for (i = 0; i < maxMsgs; i++) {
+	batchPtr->iovs[i].iov_base = batchPtr->buffers + i * slotSize;
+	batchPtr->iovs[i].iov_len = slotSize;
+	batchPtr->msgs[i].msg_hdr.msg_name = (void *) &batchPtr->addrs[i];
+	batchPtr->msgs[i].msg_hdr.msg_iov = &batchPtr->iovs[i];
+	batchPtr->msgs[i].msg_hdr.msg_iovlen = 1;
+	batchPtr->msgs[i].msg_hdr.msg_control =
+		batchPtr->controls + i * DP_BATCH_CONTROL_SIZE;
+    }
+#endif
+    statePtr->batchPtr = batchPtr;
+    return batchPtr;
+}
+
+/*
+ * -------------------------------------------------------------
+ *
+ * RecvBatchFree --
+ *
+ *	Frees dp_recvBatch's buffers.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ * -------------------------------------------------------------
+ */
+
+static void
+RecvBatchFree(batchPtr)
+    DpRecvBatch *batchPtr;	/* Buffers to free */
+{
+#ifdef __linux__
+    ckfree((char *) batchPtr->recvStamps);
+    ckfree(batchPtr->controls);
+    ckfree((char *) batchPtr->iovs);
+    ckfree((char *) batchPtr->msgs);
+#endif
+    ckfree((char *) batchPtr->segments);
+    ckfree((char *) batchPtr->lengths);
+    ckfree((char *) batchPtr->addrs);
+    ckfree(batchPtr->buffers);
+    ckfree((char *) batchPtr);
+}
+
+/*
+ * -------------------------------------------------------------
+ *
+ * RecvBatchAppend --
+ *
+ *	Appends a received buffer to a dp_recvBatch result.  A
+ *	buffer the kernel coalesced under -gro is split into its
+ *	segment-sized datagrams, which share one address object.
+ *	If stamps isn't NULL its receive and send times are added
+ *	to each datagram's entry.
+ *
+ * Results:
+ *	The number of datagrams appended.
+ *
+ * Side effects:
+ *	None.
+ *
+ * -------------------------------------------------------------
+ */
+
+static int
+RecvBatchAppend(listPtr, buf, length, segment, addrPtr, stamps)
+    Tcl_Obj *listPtr;		/* (out) List to append datagrams to */
+    char *buf;			/* Received data */
+    int length;			/* Bytes in buf */
+    int segment;		/* Datagram size, or 0 for one datagram */
+    DpSocketAddressIP *addrPtr;	/* Sender */
+    Tcl_WideInt *stamps;	/* Receive and send times, or NULL */
+{
+    Tcl_Obj *elemPtr[4];
+    char str[32];
+    unsigned int host;
+    int offset, count, numElems = 2;
+
+    if ((segment <= 0) || (segment > length)) {
+	segment = length;
+    }
+    host = ntohl(addrPtr->sin_addr.s_addr);
+    sprintf(str, "%d.%d.%d.%d %d", (host>>24), (host>>16) & 0xFF,
+	    (host>>8) & 0xFF, host & 0xFF, ntohs(addrPtr->sin_port));
+    elemPtr[1] = Tcl_NewStringObj(str, -1);
+    if (stamps != NULL) {
+	elemPtr[2] = Tcl_NewWideIntObj(stamps[0]);
+	elemPtr[3] = Tcl_NewWideIntObj(stamps[1]);
+	numElems = 4;
+    }
+
+    offset = 0;
+    count = 0;
+    do {
+	elemPtr[0] = Tcl_NewByteArrayObj((unsigned char *) (buf + offset),
+		(length - offset < segment) ? length - offset : segment);
+	Tcl_ListObjAppendElement(NULL, listPtr,
+		Tcl_NewListObj(numElems, elemPtr));
+	offset += segment;
+	count++;
+    } while (offset < length);
+    return count;
+}
+
+/*
+ * -------------------------------------------------------------
+ *
+ * DppSendBatch --
+ *
+ *	Sends numMsgs datagrams on a UDP or IPM socket for
+ *	dp_sendBatch, using sendmmsg() where the system has it.
+ *
+ * Results:
+ *	The number of datagrams sent, which is less than numMsgs if
+ *	a non-blocking socket filled up or an error occurred after
+ *	some were sent, or -1 with the POSIX error in *errorCodePtr
+ *	if none could be sent.
+ *
+ * Side effects:
+ *	Sends datagrams and updates the socket's counters.
+ *
+ * -------------------------------------------------------------
+ */
+
+int
+DppSendBatch(statePtr, numMsgs, addrs, bufs, lengths, errorCodePtr)
+    SocketState *statePtr;	/* Socket to write */
+    int numMsgs;		/* Number of datagrams */
+    DpSocketAddressIP *addrs;	/* Destination of each datagram */
+    CONST84 char **bufs;	/* Payload of each datagram */
+    int *lengths;		/* Length of each payload */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    int i, n, sent;
+    char *hdrs = NULL;
+#ifdef __linux__
+    struct mmsghdr *msgs;
+    struct iovec *iovs, *iovPtr;
+#endif
+
+    if (statePtr->flags & SOCKET_SENDSTAMP) {
+	hdrs = ckalloc((unsigned) numMsgs * DP_STAMP_SIZE);
+	for (i = 0; i < numMsgs; i++) {
+	    StampHeader(hdrs + i * DP_STAMP_SIZE);
+	}
+    }
+#ifdef __linux__
+    msgs = (struct mmsghdr *)
+	    ckalloc((unsigned) numMsgs * sizeof(struct mmsghdr));
+    iovs = (struct iovec *)
+	    ckalloc((unsigned) numMsgs * 2 * sizeof(struct iovec));
+    memset((char *) msgs, 0, numMsgs * sizeof(struct mmsghdr));
+    for (i = 0; i < numMsgs; i++) {
+	iovPtr = &iovs[2 * i];
+	msgs[i].msg_hdr.msg_iov = iovPtr;
+	if (hdrs != NULL) {
+	    iovPtr->iov_base = (void *) (hdrs + i * DP_STAMP_SIZE);
+	    iovPtr->iov_len = DP_STAMP_SIZE;
+	    iovPtr++;
+	}
+	iovPtr->iov_base = (void *) bufs[i];
+	iovPtr->iov_len = lengths[i];
+	msgs[i].msg_hdr.msg_iovlen = (hdrs != NULL) ? 2 : 1;
+	msgs[i].msg_hdr.msg_name = (void *) &addrs[i];
+	msgs[i].msg_hdr.msg_namelen = sizeof(DpSocketAddressIP);
+    }
+#endif
+
+    sent = 0;
+    while (sent < numMsgs) {
+	statePtr->stats.writeCalls++;
+#ifdef __linux__
+	n = sendmmsg(statePtr->sock, msgs + sent, numMsgs - sent, 0);
+#else
+	if (hdrs != NULL) {
+	    n = StampSend(statePtr, hdrs + sent * DP_STAMP_SIZE, bufs[sent],
+		    lengths[sent], &addrs[sent]);
+	} else {
+	    n = sendto(statePtr->sock, bufs[sent], lengths[sent], 0,
+		    (DpSocketAddress *) &addrs[sent],
+		    sizeof(DpSocketAddressIP));
+	}
+	if (n >= 0) {
+	    n = 1;
+	}
+#endif
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    *errorCodePtr = DppGetErrno();
+	    if ((*errorCodePtr == EAGAIN) || (*errorCodePtr == EWOULDBLOCK)) {
+		statePtr->stats.eagainOut++;
+	    }
+	    break;
+	}
+	for (i = sent; i < sent + n; i++) {
+	    statePtr->stats.bytesOut += lengths[i];
+	}
+	statePtr->stats.packetsOut += n;
+	sent += n;
+    }
+
+#ifdef __linux__
+    ckfree((char *) msgs);
+    ckfree((char *) iovs);
+#endif
+    if (hdrs != NULL) {
+	ckfree(hdrs);
+    }
+    if ((sent == 0) && (numMsgs > 0)) {
+	return -1;
+    }
+    return sent;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpSetTimestamps --
+ *
+ *	Turns -timestamps or -sendStamp on or off for a UDP or IPM
+ *	socket.  -timestamps asks the kernel to record the time
+ *	each datagram arrives; -sendStamp puts the send time in
+ *	front of each outgoing datagram and strips it from each
+ *	incoming one.
+ *
+ * Results:
+ *	0 on success, or a POSIX error code.
+ *
+ * Side effects:
+ *	Sets or clears SOCKET_TIMESTAMPS or SOCKET_SENDSTAMP.
+ *
+ *--------------------------------------------------------------
+ */
+int
+DpSetTimestamps(instanceData, option, on)
+    ClientData instanceData;	/* (in) Pointer to socketState struct */
+    int option;			/* (in) DP_TIMESTAMPS or DP_SENDSTAMP */
+    int on;			/* (in) Turn it on? */
+{
+    SocketState *statePtr = (SocketState *) instanceData;
+    int flag;
+
+    if (option == DP_TIMESTAMPS) {
+#if defined(SO_TIMESTAMPNS)
+	if (setsockopt(statePtr->sock, SOL_SOCKET, SO_TIMESTAMPNS,
+		(char *) &on, sizeof(on)) != 0) {
+	    return errno;
+	}
+#elif defined(SO_TIMESTAMP)
+	if (setsockopt(statePtr->sock, SOL_SOCKET, SO_TIMESTAMP,
+		(char *) &on, sizeof(on)) != 0) {
+	    return errno;
+	}
+#else
+	return ENOTSUP;
+#endif
+	flag = SOCKET_TIMESTAMPS;
+    } else {
+	flag = SOCKET_SENDSTAMP;
+    }
+    if (on) {
+	statePtr->flags |= flag;
+    } else {
+	statePtr->flags &= ~flag;
+	if (option == DP_TIMESTAMPS) {
+	    statePtr->recvStamp = 0;
+	} else {
+	    statePtr->sendStamp = 0;
+	}
+    }
+    return 0;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * StampHeader --
+ *
+ *	Fills in the -sendStamp header with the current time.
+ *
+ * Results:
+ *	None
+ *
+ * Side effects:
+ *	Writes DP_STAMP_SIZE bytes to hdr.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+StampHeader(hdr)
+    char *hdr;			/* (out) Header to fill in */
+{
+    struct timespec ts;
+    Tcl_WideInt ns;
+    unsigned int word;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns = (Tcl_WideInt) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    word = htonl(DP_STAMP_MAGIC);
+    memcpy(hdr, (char *) &word, 4);
+    word = htonl((unsigned int) (ns >> 32));
+    memcpy(hdr + 4, (char *) &word, 4);
+    word = htonl((unsigned int) ns);
+    memcpy(hdr + 8, (char *) &word, 4);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * StampSend --
+ *
+ *	Sends one datagram with a -sendStamp header in front of it,
+ *	without copying the data.
+ *
+ * Results:
+ *	The number of bytes sent, header included, or
+ *	DP_SOCKET_ERROR with the error left in errno.
+ *
+ * Side effects:
+ *	None
+ *
+ *--------------------------------------------------------------
+ */
+static int
+StampSend(statePtr, hdr, buf, length, addrPtr)
+    SocketState *statePtr;	/* (in) Socket to send on */
+    char *hdr;			/* (in) Header from StampHeader */
+    CONST84 char *buf;		/* (in) Data */
+    int length;			/* (in) Bytes in buf */
+    DpSocketAddressIP *addrPtr;	/* (in) Destination, or NULL if the
+				 * socket is connected */
+{
+    struct msghdr msg;
+    struct iovec iov[2];
+
+    iov[0].iov_base = (void *) hdr;
+    iov[0].iov_len = DP_STAMP_SIZE;
+    iov[1].iov_base = (void *) buf;
+    iov[1].iov_len = length;
+    memset((char *) &msg, 0, sizeof(msg));
+    if (addrPtr != NULL) {
+	msg.msg_name = (void *) addrPtr;
+	msg.msg_namelen = sizeof(DpSocketAddressIP);
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    return sendmsg(statePtr->sock, &msg, 0);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * StampStrip --
+ *
+ *	Removes the -sendStamp header from a received datagram.  A
+ *	datagram without one is left alone.
+ *
+ * Results:
+ *	The length of the remaining data.
+ *
+ * Side effects:
+ *	Moves the data to the front of buf and sets *sendStampPtr
+ *	to the send time, or to 0 if there was no header.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+StampStrip(buf, length, sendStampPtr)
+    char *buf;			/* (in/out) Received datagram */
+    int length;			/* (in) Bytes in buf */
+    Tcl_WideInt *sendStampPtr;	/* (out) Send time */
+{
+    unsigned int word, hi, lo;
+
+    *sendStampPtr = 0;
+    if (length < DP_STAMP_SIZE) {
+	return length;
+    }
+    memcpy((char *) &word, buf, 4);
+    if (ntohl(word) != DP_STAMP_MAGIC) {
+	return length;
+    }
+    memcpy((char *) &hi, buf + 4, 4);
+    memcpy((char *) &lo, buf + 8, 4);
+    *sendStampPtr = ((Tcl_WideInt) ntohl(hi) << 32) | ntohl(lo);
+    length -= DP_STAMP_SIZE;
+    memmove(buf, buf + DP_STAMP_SIZE, length);
+    return length;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * StampFromCmsg --
+ *
+ *	Picks the kernel receive time out of a control message.
+ *
+ * Results:
+ *	1 if cmsg held the receive time, 0 otherwise.
+ *
+ * Side effects:
+ *	Sets *stampPtr, in ns since the epoch, if cmsg held it.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+StampFromCmsg(cmsg, stampPtr)
+    struct cmsghdr *cmsg;	/* (in) Control message */
+    Tcl_WideInt *stampPtr;	/* (out) Receive time */
+{
+#if defined(SO_TIMESTAMPNS)
+    struct timespec ts;
+
+    if ((cmsg->cmsg_level == SOL_SOCKET)
+	    && (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+	memcpy((char *) &ts, CMSG_DATA(cmsg), sizeof(ts));
+	*stampPtr = (Tcl_WideInt) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return 1;
+    }
+#elif defined(SO_TIMESTAMP)
+    struct timeval tv;
+
+    if ((cmsg->cmsg_level == SOL_SOCKET)
+	    && (cmsg->cmsg_type == SCM_TIMESTAMP)) {
+	memcpy((char *) &tv, CMSG_DATA(cmsg), sizeof(tv));
+	*stampPtr = (Tcl_WideInt) tv.tv_sec * 1000000000
+		+ (Tcl_WideInt) tv.tv_usec * 1000;
+	return 1;
+    }
+#endif
+    return 0;
+}
+
 #ifndef _TCL76
 
 
@@ -122,8 +1130,10 @@ SockBlockMode (instanceData, mode)
     SocketState *statePtr = (SocketState *)instanceData;
 
     if (mode == TCL_MODE_BLOCKING) {
+	statePtr->flags &= ~SOCKET_NONBLOCKING;
 	return DppSetBlock(statePtr->sock, 1);
     } else {
+	statePtr->flags |= SOCKET_NONBLOCKING;
 	return DppSetBlock(statePtr->sock, 0);
     }
 }
@@ -158,6 +1168,10 @@ SockClose (instanceData, interp)
 
     SDBG(("Closing socket %d\n", statePtr->sock));
 
+    if (statePtr->flags & SOCKET_DATAGRAM) {
+	Tcl_DeleteFileHandler(statePtr->sock);
+    }
+
     result = DppCloseSocket(statePtr->sock);
     if ((result != 0) && (interp != NULL)) {
         DppGetErrno();
@@ -168,7 +1182,22 @@ SockClose (instanceData, interp)
      * IPM only
      */
     if (statePtr->flags & SOCKET_IPM) {
-	Tcl_DStringFree(&statePtr->groupList);
+	DpIpmFreeGroups(statePtr);
+    }
+    if (statePtr->flags & SOCKET_DATAGRAM) {
+	DpFreeFromAddress(statePtr);
+	if (statePtr->groPtr != NULL) {
+	    if (statePtr->groPtr->timer != NULL) {
+		Tcl_DeleteTimerHandler(statePtr->groPtr->timer);
+	    }
+	    ckfree((char *) statePtr->groPtr);
+	}
+	if (statePtr->fragPtr != NULL) {
+	    DpUdpFreeFragState(statePtr->fragPtr);
+	}
+	if (statePtr->batchPtr != NULL) {
+	    RecvBatchFree(statePtr->batchPtr);
+	}
     }
 
     ckfree((char *)statePtr);
@@ -247,6 +1276,9 @@ SockGetFile(instanceData, direction, handlePtr)
  *	This function is called by the Tcl channel driver whenever
  *	the user wants to send output to the UDP socket.
  *	The function writes toWrite bytes from buf to the socket.
+ *	A socket with -connect on skips the per-datagram address
+ *	lookup by using send().  With -sendStamp on, the send time
+ *	goes in front of the data.
  *
  * Results:
  *	A nonnegative integer indicating how many bytes were written
@@ -267,14 +1299,185 @@ UdpIpmOutput (instanceData, buf, toWrite, errorCodePtr)
     int *errorCodePtr;		/* (out) POSIX error code (if any) */
 {
     SocketState *statePtr = (SocketState *) instanceData;
+    char hdr[DP_STAMP_SIZE];
     int result;
 
-    result = sendto(statePtr->sock, buf, toWrite, 0,
-	    (struct sockaddr *) &statePtr->sockaddr,
-	    sizeof(statePtr->sockaddr));
+    statePtr->stats.writeCalls++;
+    if (statePtr->flags & SOCKET_SENDSTAMP) {
+	StampHeader(hdr);
+	result = StampSend(statePtr, hdr, buf, toWrite,
+		(statePtr->flags & SOCKET_CONNECTED)
+		? NULL : &statePtr->sockaddr);
+	if (result != DP_SOCKET_ERROR) {
+	    result -= DP_STAMP_SIZE;
+	}
+    } else if (statePtr->flags & SOCKET_CONNECTED) {
+	result = send(statePtr->sock, buf, toWrite, 0);
+    } else {
+	result = sendto(statePtr->sock, buf, toWrite, 0,
+		(struct sockaddr *) &statePtr->sockaddr,
+		sizeof(statePtr->sockaddr));
+    }
     if (result == DP_SOCKET_ERROR) {
 	*errorCodePtr = DppGetErrno();
+	if ((*errorCodePtr == EAGAIN) || (*errorCodePtr == EWOULDBLOCK)) {
+	    statePtr->stats.eagainOut++;
+	}
+    } else {
+	statePtr->stats.bytesOut += result;
+	statePtr->stats.packetsOut++;
+    }
+    return result;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * SockRecvFrom --
+ *
+ *	Receives one datagram for the UDP and IPM drivers and
+ *	updates the channel's traffic counters.  If the socket has
+ *	SO_RXQ_OVFL turned on, the kernel's count of datagrams
+ *	dropped on this socket is recorded as well.
+ *
+ * Results:
+ *	The number of bytes read, or DP_SOCKET_ERROR with the
+ *	error left in errno.
+ *
+ * Side effects:
+ *	Fills in *fromAddrPtr with the sender's address.
+ *
+ *--------------------------------------------------------------
+ */
+int
+SockRecvFrom (instanceData, buf, bufSize, flags, fromAddrPtr)
+    ClientData instanceData;	/* (in) Pointer to socketState struct */
+    char *buf;			/* (in/out) Buffer to fill */
+    int bufSize;		/* (in) Size of buffer */
+    int flags;			/* (in) Flags for recvmsg() */
+    DpSocketAddressIP *fromAddrPtr; /* (out) Sender's address */
+{
+    SocketState *statePtr = (SocketState *) instanceData;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[DP_BATCH_CONTROL_SIZE];
+    int result, error, segment;
+
+    iov.iov_base = buf;
+    iov.iov_len = bufSize;
+    memset((char *) &msg, 0, sizeof(msg));
+    msg.msg_name = (void *) fromAddrPtr;
+    msg.msg_namelen = sizeof(DpSocketAddressIP);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    statePtr->stats.readCalls++;
+    result = recvmsg(statePtr->sock, &msg, flags);
+    if (result == DP_SOCKET_ERROR) {
+	error = errno;
+	if ((error == EAGAIN) || (error == EWOULDBLOCK)) {
+	    statePtr->stats.eagainIn++;
+	}
+	errno = error;
+	return result;
+    }
+
+    segment = 0;
+    if (statePtr->flags & SOCKET_IPM) {
+	statePtr->destGroup = 0;
+    }
+    statePtr->recvStamp = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+#ifdef IP_PKTINFO
+	if ((cmsg->cmsg_level == IPPROTO_IP)
+		&& (cmsg->cmsg_type == IP_PKTINFO)) {
+	    struct in_pktinfo info;
+
+	    memcpy((char *) &info, CMSG_DATA(cmsg), sizeof(info));
+	    statePtr->destGroup = (int) ntohl(info.ipi_addr.s_addr);
+	}
+#endif
+#ifdef SO_RXQ_OVFL
+	if ((cmsg->cmsg_level == SOL_SOCKET)
+		&& (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+	    unsigned int drops;
+
+	    memcpy((char *) &drops, CMSG_DATA(cmsg), sizeof(drops));
+	    statePtr->stats.drops = drops;
+	}
+#endif
+#ifdef UDP_GRO
+	if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+	    memcpy((char *) &segment, CMSG_DATA(cmsg), sizeof(segment));
+	}
+#endif
+	StampFromCmsg(cmsg, &statePtr->recvStamp);
+    }
+    if ((statePtr->flags & SOCKET_DATAGRAM) && (statePtr->groPtr != NULL)) {
+	statePtr->groPtr->segment = segment;
+    }
+    if (statePtr->flags & SOCKET_SENDSTAMP) {
+	result = StampStrip(buf, result, &statePtr->sendStamp);
+    }
+
+    if (!(flags & MSG_PEEK)) {
+	statePtr->stats.bytesIn += result;
+	statePtr->stats.packetsIn += (segment > 0)
+		? (result + segment - 1) / segment : 1;
     }
     return result;
 }
+
+/*
+ *--------------------------------------------------------------
+ *
+ * SockGetStats --
+ *
+ *	Appends the traffic counters of a socket to dsPtr as a
+ *	list of name value pairs, for "fconfigure -stats".  The
+ *	datagram counters are only included for UDP and IPM.
+ *
+ * Results:
+ *	None
+ *
+ * Side effects:
+ *	None
+ *
+ *--------------------------------------------------------------
+ */
+void
+SockGetStats (instanceData, datagram, dsPtr)
+    ClientData instanceData;	/* (in) Pointer to socketState struct */
+    int datagram;		/* (in) Include packet and drop counts? */
+    Tcl_DString *dsPtr;		/* (out) Where to put the counters */
+{
+    SocketState *statePtr = (SocketState *) instanceData;
+    DpSocketStats *statsPtr = &statePtr->stats;
+    char str[64];
+
+#define APPEND_STAT(name, value) \
+    sprintf(str, "%" TCL_LL_MODIFIER "u", (value)); \
+    Tcl_DStringAppendElement(dsPtr, (name)); \
+    Tcl_DStringAppendElement(dsPtr, str)
+
+    APPEND_STAT("bytesIn", statsPtr->bytesIn);
+    APPEND_STAT("bytesOut", statsPtr->bytesOut);
+    if (datagram) {
+	APPEND_STAT("packetsIn", statsPtr->packetsIn);
+	APPEND_STAT("packetsOut", statsPtr->packetsOut);
+    }
+    APPEND_STAT("readCalls", statsPtr->readCalls);
+    APPEND_STAT("writeCalls", statsPtr->writeCalls);
+    APPEND_STAT("eagainIn", statsPtr->eagainIn);
+    APPEND_STAT("eagainOut", statsPtr->eagainOut);
+    if (datagram) {
+	APPEND_STAT("drops", statsPtr->drops);
+    }
+
+#undef APPEND_STAT
+}
 #endif
@@ -113,9 +113,7 @@ DpOpenIpmChannel(interp, argc, argv)
     IpmState *statePtr = NULL;
     char channelName[20];
     CONST char *groupName;
-    char *str;
-    CONST84 char * CONST *av;
-    int i, ac;
+    int i;
 
     /*
      * The default values for the value-option pairs
@@ -198,12 +196,9 @@ DpOpenIpmChannel(interp, argc, argv)
     chan = Tcl_CreateChannel(&ipmChannelType, channelName,
 	    (ClientData)statePtr, TCL_READABLE|TCL_WRITABLE);
     Tcl_RegisterChannel(interp, chan);
+    statePtr->channel = chan;
 
-    ac = 1;
-    av = &groupName;
-    str = Tcl_Merge(ac, av);
-    Tcl_DStringAppendElement(&statePtr->groupList, str);
-    ckfree(str);
+    DpIpmInitGroups(statePtr, groupName, ipAddr);
 
     if (Tcl_SetChannelOption(interp, chan, "-translation", "binary") !=
             TCL_OK) {
@@ -233,6 +228,28 @@ arg_missing:
 #endif
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * DpIsIpmChannel --
+ *
+ *	Tells whether a channel was opened by the DP IP multicast driver.
+ *
+ * Results:
+ *	1 if it was, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+DpIsIpmChannel(chan)
+    Tcl_Channel chan;			/* Any channel. */
+{
+    return (Tcl_GetChannelType(chan) == &ipmChannelType);
+}
+
 
 /*
  *--------------------------------------------------------------
@@ -253,7 +270,7 @@ arg_missing:
  *	POSIX error code).
  *
  * Side effects:
- *	None
+ *	The sender is recorded for dp_recvfrom and -fromvar.
  *
  *--------------------------------------------------------------
  */
@@ -267,26 +284,14 @@ IpmInput(instanceData, buf, bufSize, errorCodePtr)
 {
     IpmState *statePtr = (IpmState *)instanceData;
     DpSocketAddressIP fromAddr;
-    int bytesRead, fromLen;
-    unsigned int fromHost, fromPort;
-    char str[64];
+    int bytesRead;
 
-    fromLen = sizeof(fromAddr);
-    bytesRead = recvfrom(statePtr->sock, buf, bufSize, 0,
-	    (struct sockaddr *)&fromAddr, &fromLen);
+    bytesRead = SockRecvFrom(instanceData, buf, bufSize, 0, &fromAddr);
     if (bytesRead == DP_SOCKET_ERROR) {
 	*errorCodePtr = DppGetErrno();
 	return -1;
     }
-    if (statePtr->interp != NULL) {
-	fromHost = ntohl(fromAddr.sin_addr.s_addr);
-	fromPort = ntohs(fromAddr.sin_port);
-
-	sprintf (str, "{%d.%d.%d.%d %d}",  (fromHost>>24),
-		(fromHost>>16) & 0xFF, (fromHost>>8) & 0xFF, fromHost & 0xFF,
-		fromPort);
-	Tcl_SetVar(statePtr->interp, "dp_from", str, TCL_GLOBAL_ONLY);
-    }
+    DpSetFromAddress(statePtr, &fromAddr);
     return bytesRead;
 }
 
@@ -319,8 +324,6 @@ IpmSetOption (instanceData, interp, optionName, optionValue)
 {
     int option;
     int value;
-    char c;
-    int rc;
     IpmState *statePtr = (IpmState *)instanceData;
 
     /*
@@ -349,61 +352,7 @@ IpmSetOption (instanceData, interp, optionName, optionValue)
             }
             return DpIpmSetSocketOption(statePtr, option, value);
         case DP_GROUP:
-	    c = optionValue[0];
-	    if (c != '+' && c != '-') {
-		Tcl_AppendResult (interp, "Expected an add/drop token.  ",
-			"Please see docs on how to add/drop a group.", NULL);
-		return TCL_ERROR;
-	    }
-	    if (DpHostToIpAddr (&optionValue[1], &value) == 0) {
-		Tcl_AppendResult (interp,
-			"Expected IP address or hostname but got \"",
-			optionValue, "\"", NULL);
-		return TCL_ERROR;
-	    }
-	    if (c == '+') {
-	    	option = DP_ADD_MEMBERSHIP;
-	    } else {
-	    	option = DP_DROP_MEMBERSHIP;
-	    }
-	    rc = DpIpmSetSocketOption(statePtr, option, value);
-	    if (rc == 0) {
-		/*
-		 * Update the group list
-		 */
-		if (option == DP_ADD_MEMBERSHIP) {
-		    Tcl_DStringAppendElement(&statePtr->groupList,
-			    &optionValue[1]);
-		} else {
-		    int argc, i, j = 0;
-		    CONST84 char **argv;
-
-		    Tcl_SplitList(interp,
-			    Tcl_DStringValue(&statePtr->groupList),
-			    &argc, &argv);
-		    for (i=0;i<argc;i++) {
-			if (!strcmp(argv[i], &optionValue[1])) {
-			    while (i<argc) {
-				argv[i] = argv[i+1];
-				i++;
-			    }
-			    j = 1;
-			    break;
-			}
-		    }
-		    if (!j) {
-			Tcl_AppendResult(interp, "Group address not found",
-				"in list", NULL);
-			return TCL_ERROR;
-		    } else {
-			Tcl_DStringFree(&statePtr->groupList);
-			Tcl_DStringInit(&statePtr->groupList);
-			Tcl_DStringAppend(&statePtr->groupList,
-				Tcl_Merge(argc-1, argv), -1);
-		    }
-		}
-	    }
-	    return rc;
+	    return DpIpmSetGroup(interp, statePtr, optionValue);
 	case DP_MULTICAST_LOOP:
             if (Tcl_GetInt(interp, optionValue, &value) != TCL_OK) {
 	    	return TCL_ERROR;
@@ -413,6 +362,26 @@ IpmSetOption (instanceData, interp, optionName, optionValue)
 	    Tcl_AppendResult(interp, "Port may not be changed",
 		    " after creation.", NULL);
 	    return TCL_ERROR;
+	case DP_STATS:
+	    Tcl_AppendResult(interp, "-stats is a read-only option", NULL);
+	    return TCL_ERROR;
+
+	case DP_FROMVAR:
+	    return DpSetFromVar(statePtr, optionValue);
+
+	case DP_TIMESTAMPS:
+	case DP_SENDSTAMP:
+            if (Tcl_GetBoolean(interp, optionValue, &value) != TCL_OK) {
+	    	return TCL_ERROR;
+            }
+	    value = DpSetTimestamps((ClientData) statePtr, option, value);
+	    if (value != 0) {
+		Tcl_SetErrno(value);
+		Tcl_AppendResult(interp, "can't set ", optionName, ": ",
+			Tcl_PosixError(interp), NULL);
+		return TCL_ERROR;
+	    }
+	    return TCL_OK;
 
       	default:
             Tcl_AppendResult (interp, "bad option \"", optionName,
@@ -508,8 +477,7 @@ IpmGetOption (instanceData,
             Tcl_DStringAppend(dsPtr, str, -1);
             break;
 	case DP_GROUP:
-	    Tcl_DStringAppend(dsPtr, Tcl_DStringValue(&statePtr->groupList),
-		    Tcl_DStringLength(&statePtr->groupList));
+	    DpIpmGetGroups(statePtr, dsPtr);
 	    break;
 
 	case DP_MYPORT:
@@ -517,6 +485,17 @@ IpmGetOption (instanceData,
 	    Tcl_DStringAppend(dsPtr, str, -1);
 	    break;
 
+	case DP_STATS:
+	    SockGetStats(instanceData, 1, dsPtr);
+	    break;
+
+	case DP_FROMVAR:
+	    if (statePtr->fromVarName != NULL) {
+		Tcl_DStringAppend(dsPtr,
+			Tcl_GetString(statePtr->fromVarName), -1);
+	    }
+	    break;
+
 	case DP_MULTICAST_LOOP:
 	    if (DpIpmGetSocketOption(statePtr, option, &value) != 0) {
 	    	return TCL_ERROR;
@@ -525,6 +504,16 @@ IpmGetOption (instanceData,
             Tcl_DStringAppend(dsPtr, str, -1);
 	    break;
 
+	case DP_TIMESTAMPS:
+	    Tcl_DStringAppend(dsPtr,
+		    (statePtr->flags & SOCKET_TIMESTAMPS) ? "1" : "0", -1);
+	    break;
+
+	case DP_SENDSTAMP:
+	    Tcl_DStringAppend(dsPtr,
+		    (statePtr->flags & SOCKET_SENDSTAMP) ? "1" : "0", -1);
+	    break;
+
       	default:
 	    Tcl_AppendResult(interp,
 		    "bad option \"", optionName,"\": must be -blocking,",
@@ -583,8 +572,13 @@ CreateIPMSocket(interp, group, port, ttl)
     statePtr->groupAddr	= group;
     statePtr->sock	= sock;
     statePtr->sockFile	= (ClientData)sock;
+    statePtr->flags	= 0;
+    statePtr->groPtr	= NULL;
+    statePtr->fragPtr	= NULL;
+    memset((char *) &statePtr->stats, 0, sizeof(statePtr->stats));
+    DpInitFromAddress(statePtr);
 
-    Tcl_DStringInit(&statePtr->groupList);
+    statePtr->groupTable = NULL;
 
     /*
      * Bind the socket
@@ -603,6 +597,18 @@ CreateIPMSocket(interp, group, port, ttl)
 	goto error;
     }
 
+#ifdef SO_RXQ_OVFL
+    {
+	/*
+	 * Count datagrams the kernel drops for us (see -stats).
+	 */
+
+	int on = 1;
+
+	setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, (char *)&on, sizeof(on));
+    }
+#endif
+
     statePtr->sockaddr.sin_addr.s_addr = htonl(group);
     statePtr->groupPort = (int) ntohs(statePtr->sockaddr.sin_port);
     statePtr->flags |= SOCKET_IPM;
@@ -630,6 +636,22 @@ CreateIPMSocket(interp, group, port, ttl)
     if (DpIpmSetSocketOption(statePtr, DP_MULTICAST_LOOP, 1) != 0) {
 	goto error;
     }
+
+    /*
+     * Have the kernel say which group each datagram was sent to, so
+     * that one socket can serve many groups (see DpIpmSetGroup), and
+     * on Linux only deliver datagrams for groups this socket joined
+     * rather than for any group joined on the host.
+     */
+
+#ifdef IP_PKTINFO
+    if (DpIpmSetSocketOption(statePtr, DP_PKTINFO, 1) != 0) {
+	goto error;
+    }
+#endif
+#ifdef IP_MULTICAST_ALL
+    DpIpmSetSocketOption(statePtr, DP_MULTICAST_ALL, 0);
+#endif
     if (DpIpmSetSocketOption(statePtr, DP_RECV_BUFFER_SIZE,
 	    DP_IPM_RECVBUFSIZE) != 0) {
 	goto error;
@@ -653,6 +675,7 @@ error:
 	if (statePtr->sock != DP_SOCKET_ERROR) {
 	    DppCloseSocket(statePtr->sock);
 	}
+	DpFreeFromAddress(statePtr);
 	ckfree((char*)statePtr);
     }
     return NULL;
@@ -674,7 +697,7 @@ error:
  *	error code if the operation failed.
  *
  * Side effects:
- *	None
+ *	DP_RECV_BUFFER_SIZE updates statePtr->recvBufSize.
  *
  *--------------------------------------------------------------
  */
@@ -723,6 +746,18 @@ DpIpmSetSocketOption(statePtr, option, value)
             result = setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (char *)&value,
                     sizeof(value));
             break;
+#ifdef IP_PKTINFO
+        case DP_PKTINFO:
+            result = setsockopt(sock, IPPROTO_IP, IP_PKTINFO, (char *)&value,
+                    sizeof(value));
+            break;
+#endif
+#ifdef IP_MULTICAST_ALL
+        case DP_MULTICAST_ALL:
+            result = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_ALL,
+		    (char *)&value, sizeof(value));
+            break;
+#endif
       	case DP_MULTICAST_TTL:
 	    result = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (char *)p,
 		    sizeof(unsigned char));
@@ -735,6 +770,10 @@ DpIpmSetSocketOption(statePtr, option, value)
       	case DP_RECV_BUFFER_SIZE:
             result = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)&value,
                     sizeof(value));
+	    if (result == 0) {
+		DpIpmGetSocketOption(statePtr, DP_RECV_BUFFER_SIZE,
+			&statePtr->recvBufSize);
+	    }
             break;
       	case DP_REUSEADDR:
             result = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&value,
@@ -0,0 +1,1724 @@
+/*
+ * unix/dpUnixRmcast.c --
+ *
+ *	This file implements the "rmcast" channel type, reliable IP
+ *	multicast.  Channels are created by evaluating
+ *	"dp_connect rmcast".
+ *
+ *	Every message written to the channel is multicast to the
+ *	group as one datagram carrying the sender's session id and a
+ *	sequence number.  The sender keeps its last -window messages.
+ *	Receivers deliver each sender's messages in order.  When they
+ *	see a gap they multicast a NACK for the missing sequence
+ *	numbers, and the sender multicasts those messages again.
+ *	Because NACKs go to the whole group, a receiver that hears
+ *	another's NACK for the same gap holds its own back.  A sender
+ *	that falls idle sends heartbeats so that receivers also notice
+ *	loss at the end of a burst.  The sender can be limited to
+ *	-rate bytes per second.
+ *
+ *	All of this runs in the channel driver: from the channel's
+ *	file handler and timer when the event loop is running, and
+ *	from the input and output procedures otherwise.
+ *
+ * Copyright (c) 1995-1996 Cornell University.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ *
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "generic/dpInt.h"
+
+#ifndef IN_MULTICAST
+#define IN_MULTICAST(i)		(((i) & 0xf0000000) == 0xe0000000)
+#endif
+
+/*
+ * The header at the front of every rmcast datagram.  All fields are
+ * in network byte order.
+ */
+
+typedef struct RmcastHeader {
+    unsigned char	type;		/* RM_DATA, RM_NACK or RM_HEARTBEAT. */
+    unsigned char	version;	/* RM_VERSION. */
+    unsigned short	count;		/* NACK: number of messages wanted. */
+    unsigned int	session;	/* Sending channel; for a NACK, the
+					 * channel asked to retransmit. */
+    unsigned int	seq;		/* DATA: sequence number.  HEARTBEAT:
+					 * next sequence number to be sent.
+					 * NACK: first message wanted. */
+    unsigned int	origin;		/* NACK: session of the receiver that
+					 * sent it.  Otherwise 0. */
+} RmcastHeader;
+
+#define RM_DATA			1
+#define RM_NACK			2
+#define RM_HEARTBEAT		3
+#define RM_VERSION		1
+
+#define RM_HEADER_SIZE		((int) sizeof(RmcastHeader))
+#define RM_MAX_PACKET		65507
+#define RM_MAX_PAYLOAD		(RM_MAX_PACKET - RM_HEADER_SIZE)
+
+/*
+ * A receiver gives up on a gap after this many NACKs in a row go
+ * unanswered, and counts the missing messages as lost.
+ */
+
+#define RM_MAX_NACKS		10
+
+/*
+ * A receiver forgets a sender it hasn't heard from, not even a
+ * heartbeat, for RM_PEER_TIMEOUT ms, and keeps at most RM_MAX_PEERS
+ * of them, forgetting the longest silent one to make room.
+ */
+
+#define RM_PEER_TIMEOUT		60000	/* ms */
+#define RM_MAX_PEERS		256
+
+/*
+ * Defaults for the dp_connect options.
+ */
+
+#define RM_DEFAULT_WINDOW	1024
+#define RM_DEFAULT_NACK_DELAY	20	/* ms */
+#define RM_DEFAULT_HEARTBEAT	250	/* ms */
+
+/*
+ * A message, either held by the sender for retransmission (data
+ * includes the header) or waiting to be read (payload only).
+ */
+
+typedef struct RmcastMsg {
+    struct RmcastMsg *	nextPtr;	/* Next message to be read. */
+    unsigned int	seq;		/* Sequence number. */
+    int			length;		/* Bytes in data. */
+    int			offset;		/* Bytes already read. */
+    Tcl_WideInt		sentAt;		/* Last (re)transmission, in ms. */
+    char		data[4];	/* Actually length bytes. */
+} RmcastMsg;
+
+/*
+ * What a receiver knows about one sender.
+ */
+
+typedef struct RmcastPeer {
+    struct RmcastPeer *	nextPtr;
+    unsigned int	session;	/* The sender's session id. */
+    unsigned int	expected;	/* Next message to deliver. */
+    unsigned int	highest;	/* One past the newest message the
+					 * sender is known to have sent. */
+    RmcastMsg **	pending;	/* Messages received out of order,
+					 * indexed by seq % window. */
+    int			nackTries;	/* NACKs sent without progress. */
+    Tcl_WideInt		nackDue;	/* When to NACK the gap, or 0. */
+    Tcl_WideInt		lastHeard;	/* Time of its last packet, in ms. */
+} RmcastPeer;
+
+/*
+ * Counters returned by "fconfigure -stats".
+ */
+
+typedef struct RmcastStats {
+    Tcl_WideUInt	bytesIn;	/* Payload bytes delivered. */
+    Tcl_WideUInt	bytesOut;	/* Payload bytes sent. */
+    Tcl_WideUInt	packetsIn;	/* Messages delivered. */
+    Tcl_WideUInt	packetsOut;	/* Messages sent, once each. */
+    Tcl_WideUInt	retransmits;	/* Messages sent again. */
+    Tcl_WideUInt	nacksIn;	/* NACKs received for us. */
+    Tcl_WideUInt	nacksOut;	/* NACKs sent. */
+    Tcl_WideUInt	duplicates;	/* Messages received twice. */
+    Tcl_WideUInt	lost;		/* Messages given up on. */
+    Tcl_WideUInt	rateWaits;	/* Writes delayed by -rate. */
+} RmcastStats;
+
+typedef struct RmcastState {
+    Tcl_Channel		channel;
+    int			sock;
+    DpSocketAddressIP	groupAddr;	/* Where every packet goes. */
+    int			port;
+    int			ttl;
+    unsigned int	session;	/* Our session id. */
+    int			blocking;	/* Channel in blocking mode? */
+    int			watchMask;	/* Events Tcl is waiting for. */
+    Tcl_TimerToken	timer;		/* Runs RmcastTick periodically. */
+    Tcl_TimerToken	notifyTimer;	/* Reports readiness to Tcl. */
+
+    /*
+     * Sender state.
+     */
+
+    unsigned int	nextSeq;	/* Sequence number of next message. */
+    int			window;		/* Size of the rings below. */
+    RmcastMsg **	sent;		/* Sent messages by seq % window. */
+    int			rate;		/* Bytes per second, or 0. */
+    double		tokens;		/* Bytes we may send now. */
+    Tcl_WideInt		lastFill;	/* When tokens was last topped up. */
+    int			heartbeat;	/* Idle time before a heartbeat. */
+    Tcl_WideInt		lastSend;	/* Time of the last packet sent. */
+
+    /*
+     * Receiver state.
+     */
+
+    RmcastPeer *	peers;		/* Senders heard from. */
+    int			numPeers;	/* Length of the list above. */
+    RmcastMsg *		readyHead;	/* Messages delivered in order and */
+    RmcastMsg *		readyTail;	/* waiting to be read. */
+    int			nackDelay;	/* ms to wait before NACKing. */
+
+    RmcastStats		stats;
+    char		buf[RM_MAX_PACKET];
+} RmcastState;
+
+/*
+ * Procedures that are used in this file only.
+ */
+
+static int		RmcastClose _ANSI_ARGS_((ClientData instanceData,
+			    Tcl_Interp *interp));
+static int		RmcastInput _ANSI_ARGS_((ClientData instanceData,
+			    char *buf, int bufSize, int *errorCodePtr));
+static int		RmcastOutput _ANSI_ARGS_((ClientData instanceData,
+			    CONST84 char *buf, int toWrite,
+			    int *errorCodePtr));
+static int		RmcastSetOption _ANSI_ARGS_((ClientData instanceData,
+			    Tcl_Interp *interp, CONST char *optionName,
+			    CONST char *optionValue));
+static int		RmcastGetOption _ANSI_ARGS_((ClientData instanceData,
+			    Tcl_Interp *interp, CONST84 char *optionName,
+			    Tcl_DString *dsPtr));
+static void		RmcastWatch _ANSI_ARGS_((ClientData instanceData,
+			    int mask));
+static int		RmcastGetFile _ANSI_ARGS_((ClientData instanceData,
+			    int direction, ClientData *handlePtr));
+static int		RmcastBlockMode _ANSI_ARGS_((ClientData instanceData,
+			    int mode));
+
+static Tcl_WideInt	RmcastNow _ANSI_ARGS_((void));
+static void		RmcastSend _ANSI_ARGS_((RmcastState *statePtr,
+			    char *packet, int length));
+static void		RmcastSendControl _ANSI_ARGS_((RmcastState *statePtr,
+			    int type, unsigned int session, unsigned int seq,
+			    int count));
+static void		RmcastReceive _ANSI_ARGS_((RmcastState *statePtr));
+static void		RmcastHandleData _ANSI_ARGS_((RmcastState *statePtr,
+			    RmcastPeer *peerPtr, unsigned int seq,
+			    char *payload, int length));
+static void		RmcastHandleNack _ANSI_ARGS_((RmcastState *statePtr,
+			    RmcastHeader *hdrPtr));
+static void		RmcastFreePeer _ANSI_ARGS_((RmcastState *statePtr,
+			    RmcastPeer *peerPtr));
+static void		RmcastForgetPeer _ANSI_ARGS_((RmcastState *statePtr,
+			    RmcastPeer *peerPtr));
+static RmcastPeer *	RmcastFindPeer _ANSI_ARGS_((RmcastState *statePtr,
+			    unsigned int session, unsigned int seq));
+static void		RmcastDeliver _ANSI_ARGS_((RmcastState *statePtr,
+			    RmcastPeer *peerPtr));
+static void		RmcastSkip _ANSI_ARGS_((RmcastState *statePtr,
+			    RmcastPeer *peerPtr, unsigned int upTo));
+static void		RmcastTick _ANSI_ARGS_((RmcastState *statePtr));
+static void		RmcastRefill _ANSI_ARGS_((RmcastState *statePtr));
+static int		RmcastWait _ANSI_ARGS_((RmcastState *statePtr,
+			    int ms));
+static void		RmcastFileProc _ANSI_ARGS_((ClientData clientData,
+			    int mask));
+static void		RmcastTimerProc _ANSI_ARGS_((ClientData clientData));
+static void		RmcastNotifyProc _ANSI_ARGS_((ClientData clientData));
+static void		RmcastScheduleNotify _ANSI_ARGS_((
+			    RmcastState *statePtr));
+
+static Tcl_ChannelType rmcastChannelType = {
+     "rmcast",			/* Name of channel */
+     DP_CHANNEL_VERSION,	/* TCL_CHANNEL_VERSION_1, TCL_CHANNEL_VERSION_2, and so on */
+     RmcastClose,		/* Proc to close a socket */
+     RmcastInput,		/* Proc to get input from a socket */
+     RmcastOutput,		/* Proc to send output to a socket */
+     NULL,			/* Can't seek on a socket! */
+     RmcastSetOption,		/* Proc to set a socket option */
+     RmcastGetOption,		/* Proc to set a socket option */
+     RmcastWatch,		/* Proc called to set event loop wait params */
+     RmcastGetFile,		/* Proc to return a handle assoc with socket */
+     NULL,			/* Proc to call to close the channel if the device
+				 * supports closing the read & write sides */
+     RmcastBlockMode,		/* Proc to set blocking mode on socket */
+     /* Only valid in TCL_CHANNEL_VERSION_2 channels or later */
+     NULL,			/* Proc to call to flush a channel */
+     NULL,			/* Proc to call to handle a channel event */
+     /* Only valid in TCL_CHANNEL_VERSION_3 channels or later */
+     NULL,			/* Proc to call to seek on the channel which can handle 64-bit offsets */
+     /* Only valid in TCL_CHANNEL_VERSION_4 channels or later */
+     NULL			/* Proc to notify the driver of thread specific activity for a channel */
+};
+
+static int rmcastCount = 0;	/* Number of rmcast channels opened -- used
+				 * to generate unique ids for channels */
+
+/*
+ *--------------------------------------------------------------
+ *
+ *  DpOpenRmcastChannel --
+ *
+ *	Opens a new reliable multicast channel.  The options are
+ *
+ *	    -group addr		Multicast group (required)
+ *	    -myport port	UDP port of the group (required)
+ *	    -ttl n		Multicast time-to-live (default 1)
+ *	    -window n		Messages kept for retransmission
+ *	    -rate bytes		Send limit in bytes/second (0 = none)
+ *	    -nackDelay ms	Wait before asking for a missing message
+ *	    -heartbeat ms	Idle time before the sender says so
+ *
+ * Results:
+ *	Returns the new channel, or NULL with an error message in
+ *	interp.
+ *
+ * Side effects:
+ *	A socket is created and joins the group.
+ *
+ *--------------------------------------------------------------
+ */
+
+Tcl_Channel
+DpOpenRmcastChannel(interp, argc, argv)
+    Tcl_Interp *interp;		/* For error reporting; can be NULL. */
+    int argc;			/* Number of arguments. */
+    CONST84 char **argv;	/* Argument strings. */
+{
+    RmcastState *statePtr;
+    Tcl_Channel chan;
+    struct ip_mreq mreq;
+    unsigned char ttlByte, loop = 1;
+    char channelName[20];
+    int i, sock, one = 1;
+    int group = 0, port = -1, ttl = 1, window = RM_DEFAULT_WINDOW;
+    int rate = 0, nackDelay = RM_DEFAULT_NACK_DELAY;
+    int heartbeat = RM_DEFAULT_HEARTBEAT;
+    int setGroup = 0;
+
+    for (i = 0; i < argc; i += 2) {
+	int v = i+1;
+	size_t len = strlen(argv[i]);
+	int *intPtr = NULL, minimum = 0;
+
+	if (v == argc) {
+	    Tcl_AppendResult(interp, "value for \"", argv[i], "\" missing",
+		    NULL);
+	    return NULL;
+	}
+	if (strncmp(argv[i], "-group", len) == 0) {
+	    if (!DpHostToIpAddr(argv[v], &group) || !IN_MULTICAST(group)) {
+		Tcl_AppendResult(interp, "Illegal value for -group \"",
+			argv[v], "\"", NULL);
+		return NULL;
+	    }
+	    setGroup = 1;
+	} else if (strncmp(argv[i], "-myport", len) == 0) {
+	    intPtr = &port;
+	    minimum = 1;
+	} else if (strncmp(argv[i], "-ttl", len) == 0) {
+	    intPtr = &ttl;
+	} else if (strncmp(argv[i], "-window", len) == 0) {
+	    intPtr = &window;
+	    minimum = 16;
+	} else if (strncmp(argv[i], "-rate", len) == 0) {
+	    intPtr = &rate;
+	} else if (strncmp(argv[i], "-nackDelay", len) == 0) {
+	    intPtr = &nackDelay;
+	    minimum = 1;
+	} else if (strncmp(argv[i], "-heartbeat", len) == 0) {
+	    intPtr = &heartbeat;
+	    minimum = 1;
+	} else {
+	    Tcl_AppendResult(interp, "unknown option \"", argv[i],
+		    "\", must be -group, -heartbeat, -myport, -nackDelay, ",
+		    "-rate, -ttl or -window", NULL);
+	    return NULL;
+	}
+	if (intPtr != NULL) {
+	    if (Tcl_GetInt(interp, argv[v], intPtr) != TCL_OK) {
+		return NULL;
+	    }
+	    if (*intPtr < minimum) {
+		char str[20];
+
+		sprintf(str, "%d", minimum);
+		Tcl_AppendResult(interp, argv[i], " must be at least ", str,
+			NULL);
+		return NULL;
+	    }
+	}
+    }
+
+    if (!setGroup) {
+	Tcl_AppendResult(interp, "option -group must be specified", NULL);
+	return NULL;
+    }
+    if (port < 0) {
+	Tcl_AppendResult(interp, "option -myport must be specified", NULL);
+	return NULL;
+    }
+
+    /*
+     * Every member binds the group port, so that senders and
+     * receivers on one host can share it.
+     */
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+	goto error;
+    }
+    statePtr = (RmcastState *) ckalloc(sizeof(RmcastState));
+    memset((char *) statePtr, 0, sizeof(RmcastState) - RM_MAX_PACKET);
+    statePtr->sock = sock;
+    statePtr->port = port;
+    statePtr->ttl = ttl;
+    statePtr->window = window;
+    statePtr->rate = rate;
+    statePtr->nackDelay = nackDelay;
+    statePtr->heartbeat = heartbeat;
+    statePtr->blocking = 1;
+    statePtr->sent = (RmcastMsg **) ckalloc(window * sizeof(RmcastMsg *));
+    memset((char *) statePtr->sent, 0, window * sizeof(RmcastMsg *));
+    statePtr->lastFill = RmcastNow();
+    statePtr->tokens = (rate > 0) ? rate / 10 + 1 : 0;
+    statePtr->session = ((unsigned int) getpid() << 16)
+	    ^ (unsigned int) time(NULL) ^ ((unsigned int) rmcastCount << 8)
+	    ^ (unsigned int) statePtr->lastFill;
+
+    statePtr->groupAddr.sin_family = AF_INET;
+    statePtr->groupAddr.sin_addr.s_addr = htonl(group);
+    statePtr->groupAddr.sin_port = htons((unsigned short) port);
+
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *) &one,
+	    sizeof(one)) != 0) {
+	goto stateError;
+    }
+    {
+	DpSocketAddressIP addr;
+
+	memset((char *) &addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((unsigned short) port);
+	if (bind(sock, (DpSocketAddress *) &addr, sizeof(addr)) != 0) {
+	    goto stateError;
+	}
+    }
+    mreq.imr_multiaddr.s_addr = htonl(group);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    ttlByte = (unsigned char) ttl;
+    if ((setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *) &mreq,
+	    sizeof(mreq)) != 0)
+	    || (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL,
+		(char *) &ttlByte, sizeof(ttlByte)) != 0)
+	    || (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP,
+		(char *) &loop, sizeof(loop)) != 0)) {
+	goto stateError;
+    }
+
+    /*
+     * The socket never blocks; blocking channel I/O waits in
+     * RmcastWait so that NACKs keep being answered meanwhile.
+     */
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    sprintf(channelName, "rmcast%d", rmcastCount++);
+    chan = Tcl_CreateChannel(&rmcastChannelType, channelName,
+	    (ClientData) statePtr, TCL_READABLE|TCL_WRITABLE);
+    statePtr->channel = chan;
+    Tcl_RegisterChannel(interp, chan);
+    Tcl_SetChannelOption(interp, chan, "-translation", "binary");
+    Tcl_SetChannelOption(interp, chan, "-buffering", "none");
+
+    Tcl_CreateFileHandler(sock, TCL_READABLE, RmcastFileProc,
+	    (ClientData) statePtr);
+    statePtr->timer = Tcl_CreateTimerHandler(
+	    (nackDelay < heartbeat) ? nackDelay : heartbeat,
+	    RmcastTimerProc, (ClientData) statePtr);
+    return chan;
+
+stateError:
+    ckfree((char *) statePtr->sent);
+    ckfree((char *) statePtr);
+error:
+    Tcl_AppendResult(interp, "Error creating rmcast socket: ",
+	    Tcl_PosixError(interp), NULL);
+    if (sock >= 0) {
+	close(sock);
+    }
+    return NULL;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastClose --
+ *
+ *	Closes the socket and frees everything.  Messages that
+ *	receivers have not yet recovered can no longer be
+ *	retransmitted.
+ *
+ * Results:
+ *	0 or a POSIX error code.
+ *
+ * Side effects:
+ *	Leaves the group.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+RmcastClose(instanceData, interp)
+    ClientData instanceData;	/* (in) Pointer to RmcastState */
+    Tcl_Interp *interp;		/* (in) For error reporting */
+{
+    RmcastState *statePtr = (RmcastState *) instanceData;
+    RmcastPeer *peerPtr;
+    RmcastMsg *msgPtr;
+    int i, result = 0;
+
+    Tcl_DeleteFileHandler(statePtr->sock);
+    Tcl_DeleteTimerHandler(statePtr->timer);
+    if (statePtr->notifyTimer != NULL) {
+	Tcl_DeleteTimerHandler(statePtr->notifyTimer);
+    }
+    if (close(statePtr->sock) != 0) {
+	result = errno;
+    }
+
+    for (i = 0; i < statePtr->window; i++) {
+	if (statePtr->sent[i] != NULL) {
+	    ckfree((char *) statePtr->sent[i]);
+	}
+    }
+    ckfree((char *) statePtr->sent);
+    while ((peerPtr = statePtr->peers) != NULL) {
+	statePtr->peers = peerPtr->nextPtr;
+	RmcastFreePeer(statePtr, peerPtr);
+    }
+    while ((msgPtr = statePtr->readyHead) != NULL) {
+	statePtr->readyHead = msgPtr->nextPtr;
+	ckfree((char *) msgPtr);
+    }
+    ckfree((char *) statePtr);
+    return result;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastInput --
+ *
+ *	Returns the next message (or as much of it as fits)
+ *	delivered in order from any sender.  A blocking channel
+ *	waits for one; a non-blocking channel returns EAGAIN.
+ *
+ * Results:
+ *	The number of bytes read, or -1 with the POSIX error code
+ *	in *errorCodePtr.
+ *
+ * Side effects:
+ *	Processes any waiting packets, which may send NACKs and
+ *	retransmissions.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+RmcastInput(instanceData, buf, bufSize, errorCodePtr)
+    ClientData instanceData;	/* (in) Pointer to RmcastState */
+    char *buf;			/* (in/out) Buffer to fill */
+    int bufSize;		/* (in) Size of buffer */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    RmcastState *statePtr = (RmcastState *) instanceData;
+    RmcastMsg *msgPtr;
+    int n;
+
+    RmcastReceive(statePtr);
+    RmcastTick(statePtr);
+    while (statePtr->readyHead == NULL) {
+	if (!statePtr->blocking) {
+	    *errorCodePtr = EAGAIN;
+	    return -1;
+	}
+	if (RmcastWait(statePtr, statePtr->nackDelay) < 0) {
+	    *errorCodePtr = errno;
+	    return -1;
+	}
+    }
+
+    msgPtr = statePtr->readyHead;
+    n = msgPtr->length - msgPtr->offset;
+    if (n > bufSize) {
+	n = bufSize;
+    }
+    memcpy(buf, msgPtr->data + msgPtr->offset, n);
+    msgPtr->offset += n;
+    if (msgPtr->offset == msgPtr->length) {
+	statePtr->readyHead = msgPtr->nextPtr;
+	if (statePtr->readyHead == NULL) {
+	    statePtr->readyTail = NULL;
+	}
+	ckfree((char *) msgPtr);
+    }
+    return n;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastOutput --
+ *
+ *	Multicasts buf as the next message and keeps a copy for
+ *	retransmission.  With -rate set, a blocking channel waits
+ *	for its turn and a non-blocking channel returns EAGAIN.
+ *
+ * Results:
+ *	toWrite, or -1 with the POSIX error code in *errorCodePtr.
+ *
+ * Side effects:
+ *	The message replaces the oldest one in the window.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+RmcastOutput(instanceData, buf, toWrite, errorCodePtr)
+    ClientData instanceData;	/* (in) Pointer to RmcastState */
+    CONST84 char *buf;		/* (in) Buffer to write */
+    int toWrite;		/* (in) Number of bytes to write */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    RmcastState *statePtr = (RmcastState *) instanceData;
+    RmcastHeader hdr;
+    RmcastMsg *msgPtr;
+    int slot, waited = 0;
+
+    if (toWrite > RM_MAX_PAYLOAD) {
+	*errorCodePtr = EMSGSIZE;
+	return -1;
+    }
+
+    RmcastReceive(statePtr);
+    RmcastTick(statePtr);
+    if (statePtr->rate > 0) {
+	RmcastRefill(statePtr);
+	while (statePtr->tokens <= 0) {
+	    if (!waited) {
+		statePtr->stats.rateWaits++;
+		waited = 1;
+	    }
+	    if (!statePtr->blocking) {
+		*errorCodePtr = EAGAIN;
+		return -1;
+	    }
+	    if (RmcastWait(statePtr, (int) (-statePtr->tokens * 1000.0
+		    / statePtr->rate) + 1) < 0) {
+		*errorCodePtr = errno;
+		return -1;
+	    }
+	    RmcastRefill(statePtr);
+	}
+    }
+
+    memset((char *) &hdr, 0, sizeof(hdr));
+    hdr.type = RM_DATA;
+    hdr.version = RM_VERSION;
+    hdr.session = htonl(statePtr->session);
+    hdr.seq = htonl(statePtr->nextSeq);
+
+    slot = statePtr->nextSeq % statePtr->window;
+    msgPtr = statePtr->sent[slot];
+    if ((msgPtr == NULL) || (msgPtr->length < RM_HEADER_SIZE + toWrite)) {
+	if (msgPtr != NULL) {
+	    ckfree((char *) msgPtr);
+	}
+	msgPtr = (RmcastMsg *) ckalloc(sizeof(RmcastMsg) + RM_HEADER_SIZE
+		+ toWrite);
+	statePtr->sent[slot] = msgPtr;
+    }
+    msgPtr->seq = statePtr->nextSeq++;
+    msgPtr->length = RM_HEADER_SIZE + toWrite;
+    msgPtr->offset = 0;
+    memcpy(msgPtr->data, (char *) &hdr, RM_HEADER_SIZE);
+    memcpy(msgPtr->data + RM_HEADER_SIZE, buf, toWrite);
+
+    RmcastSend(statePtr, msgPtr->data, msgPtr->length);
+    msgPtr->sentAt = statePtr->lastSend;
+    statePtr->stats.packetsOut++;
+    statePtr->stats.bytesOut += toWrite;
+    return toWrite;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastSetOption --
+ *
+ *	Sets -rate, -nackDelay or -heartbeat.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+RmcastSetOption(instanceData, interp, optionName, optionValue)
+    ClientData instanceData;	/* (in) Pointer to RmcastState */
+    Tcl_Interp *interp;		/* (in) For error reporting */
+    CONST char *optionName;	/* (in) Name of option */
+    CONST char *optionValue;	/* (in) New value */
+{
+    RmcastState *statePtr = (RmcastState *) instanceData;
+    int option, value;
+
+    option = (optionName[0] == '-') ? DpTranslateOption(optionName+1) : -1;
+    switch (option) {
+	case DP_RATE:
+	case DP_NACKDELAY:
+	case DP_HEARTBEAT:
+	    if (Tcl_GetInt(interp, optionValue, &value) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if ((value < 0) || ((value == 0) && (option != DP_RATE))) {
+		Tcl_AppendResult(interp, "bad value for ", optionName,
+			": must be a positive integer", NULL);
+		return TCL_ERROR;
+	    }
+	    if (option == DP_RATE) {
+		statePtr->rate = value;
+		statePtr->tokens = (value > 0) ? value / 10 + 1 : 0;
+		statePtr->lastFill = RmcastNow();
+	    } else if (option == DP_NACKDELAY) {
+		statePtr->nackDelay = value;
+	    } else {
+		statePtr->heartbeat = value;
+	    }
+	    return TCL_OK;
+
+	case DP_GROUP:
+	case DP_MYPORT:
+	case DP_WINDOW:
+	case DP_STATS:
+	    Tcl_AppendResult(interp, optionName,
+		    " can't be changed after the channel is opened", NULL);
+	    return TCL_ERROR;
+
+	default:
+	    Tcl_AppendResult(interp, "bad option \"", optionName,
+		    "\": must be -heartbeat, -nackDelay, -rate ",
+		    "or a standard fconfigure option", NULL);
+	    return TCL_ERROR;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastGetOption --
+ *
+ *	Returns the value of a channel option.  -stats returns
+ *	the channel's counters as a list of names and values.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+RmcastGetOption(instanceData, interp, optionName, dsPtr)
+    ClientData instanceData;	/* (in) Pointer to RmcastState */
+    Tcl_Interp *interp;		/* (in) For error reporting */
+    CONST84 char *optionName;	/* (in) Name of option */
+    Tcl_DString *dsPtr;		/* (out) Value of option */
+{
+    static CONST char *names[] = {
+	"-group", "-myport", "-window", "-rate", "-nackDelay",
+	"-heartbeat", NULL
+    };
+    RmcastState *statePtr = (RmcastState *) instanceData;
+    RmcastStats *statsPtr = &statePtr->stats;
+    unsigned int addr;
+    char str[64];
+    int i, option;
+
+    if (optionName == NULL) {
+	Tcl_DString value;
+
+	Tcl_DStringInit(&value);
+	for (i = 0; names[i] != NULL; i++) {
+	    Tcl_DStringAppendElement(dsPtr, names[i]);
+	    RmcastGetOption(instanceData, interp, names[i], &value);
+	    Tcl_DStringAppendElement(dsPtr, Tcl_DStringValue(&value));
+	    Tcl_DStringSetLength(&value, 0);
+	}
+	Tcl_DStringFree(&value);
+	return TCL_OK;
+    }
+
+    option = (optionName[0] == '-') ? DpTranslateOption(optionName+1) : -1;
+    switch (option) {
+	case DP_GROUP:
+	    addr = ntohl(statePtr->groupAddr.sin_addr.s_addr);
+	    sprintf(str, "%d.%d.%d.%d", (addr >> 24), (addr >> 16) & 0xff,
+		    (addr >> 8) & 0xff, addr & 0xff);
+	    break;
+	case DP_MYPORT:
+	    sprintf(str, "%d", statePtr->port);
+	    break;
+	case DP_WINDOW:
+	    sprintf(str, "%d", statePtr->window);
+	    break;
+	case DP_RATE:
+	    sprintf(str, "%d", statePtr->rate);
+	    break;
+	case DP_NACKDELAY:
+	    sprintf(str, "%d", statePtr->nackDelay);
+	    break;
+	case DP_HEARTBEAT:
+	    sprintf(str, "%d", statePtr->heartbeat);
+	    break;
+	case DP_STATS:
+#define APPEND_STAT(name, value) \
+	    sprintf(str, "%" TCL_LL_MODIFIER "u", (value)); \
+	    Tcl_DStringAppendElement(dsPtr, (name)); \
+	    Tcl_DStringAppendElement(dsPtr, str)
+
+	    APPEND_STAT("bytesIn", statsPtr->bytesIn);
+	    APPEND_STAT("bytesOut", statsPtr->bytesOut);
+	    APPEND_STAT("packetsIn", statsPtr->packetsIn);
+	    APPEND_STAT("packetsOut", statsPtr->packetsOut);
+	    APPEND_STAT("retransmits", statsPtr->retransmits);
+	    APPEND_STAT("nacksIn", statsPtr->nacksIn);
+	    APPEND_STAT("nacksOut", statsPtr->nacksOut);
+	    APPEND_STAT("duplicates", statsPtr->duplicates);
+	    APPEND_STAT("lost", statsPtr->lost);
+	    APPEND_STAT("rateWaits", statsPtr->rateWaits);
+#undef APPEND_STAT
+	    return TCL_OK;
+	default:
+	    Tcl_AppendResult(interp, "bad option \"", optionName,
+		    "\": must be -blocking, -buffering, -buffersize, ",
+		    "-eofchar, -translation, or a channel type specific ",
+		    "option", NULL);
+	    Tcl_SetErrno(EINVAL);
+	    return TCL_ERROR;
+    }
+    Tcl_DStringAppend(dsPtr, str, -1);
+    return TCL_OK;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastWatch --
+ *
+ *	Records the events Tcl is interested in.  The socket's
+ *	file handler stays installed regardless, since NACKs must
+ *	be answered whether or not anyone is reading.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May schedule a notification if a message is already
+ *	waiting or the channel is writable.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastWatch(instanceData, mask)
+    ClientData instanceData;	/* (in) Pointer to RmcastState */
+    int mask;			/* (in) Events of interest */
+{
+    RmcastState *statePtr = (RmcastState *) instanceData;
+
+    statePtr->watchMask = mask;
+    RmcastScheduleNotify(statePtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastGetFile --
+ *
+ *	Returns the channel's socket.
+ *
+ * Results:
+ *	TCL_OK.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+RmcastGetFile(instanceData, direction, handlePtr)
+    ClientData instanceData;	/* (in) Pointer to RmcastState */
+    int direction;		/* (in) Not used */
+    ClientData *handlePtr;	/* (out) The socket */
+{
+    RmcastState *statePtr = (RmcastState *) instanceData;
+
+    *handlePtr = (ClientData) (long) statePtr->sock;
+    return TCL_OK;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastBlockMode --
+ *
+ *	Sets the channel's blocking mode.  The socket itself is
+ *	always non-blocking.
+ *
+ * Results:
+ *	0.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+RmcastBlockMode(instanceData, mode)
+    ClientData instanceData;	/* (in) Pointer to RmcastState */
+    int mode;			/* (in) TCL_MODE_BLOCKING or
+				 * TCL_MODE_NONBLOCKING */
+{
+    RmcastState *statePtr = (RmcastState *) instanceData;
+
+    statePtr->blocking = (mode == TCL_MODE_BLOCKING);
+    return 0;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastNow --
+ *
+ *	Returns the current time in milliseconds.
+ *
+ * Results:
+ *	See above.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static Tcl_WideInt
+RmcastNow()
+{
+    Tcl_Time now;
+
+    Tcl_GetTime(&now);
+    return (Tcl_WideInt) now.sec * 1000 + now.usec / 1000;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastSend --
+ *
+ *	Multicasts one packet to the group.  Errors are ignored:
+ *	a packet that doesn't go out is recovered like one lost
+ *	in the network.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Uses up -rate tokens.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastSend(statePtr, packet, length)
+    RmcastState *statePtr;	/* (in) Channel to send on */
+    char *packet;		/* (in) Header and payload */
+    int length;			/* (in) Bytes in packet */
+{
+    sendto(statePtr->sock, packet, length, 0,
+	    (DpSocketAddress *) &statePtr->groupAddr,
+	    sizeof(statePtr->groupAddr));
+    statePtr->lastSend = RmcastNow();
+    if (statePtr->rate > 0) {
+	statePtr->tokens -= length;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastSendControl --
+ *
+ *	Multicasts a NACK or heartbeat.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastSendControl(statePtr, type, session, seq, count)
+    RmcastState *statePtr;	/* (in) Channel to send on */
+    int type;			/* (in) RM_NACK or RM_HEARTBEAT */
+    unsigned int session;	/* (in) Session the packet is about */
+    unsigned int seq;		/* (in) See RmcastHeader */
+    int count;			/* (in) NACK: messages wanted */
+{
+    RmcastHeader hdr;
+
+    memset((char *) &hdr, 0, sizeof(hdr));
+    hdr.type = (unsigned char) type;
+    hdr.version = RM_VERSION;
+    hdr.count = htons((unsigned short) count);
+    hdr.session = htonl(session);
+    hdr.seq = htonl(seq);
+    hdr.origin = htonl(statePtr->session);
+    RmcastSend(statePtr, (char *) &hdr, RM_HEADER_SIZE);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastReceive --
+ *
+ *	Reads and handles every packet waiting on the socket.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Messages may be delivered, and NACKs answered.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastReceive(statePtr)
+    RmcastState *statePtr;	/* (in) Channel to read */
+{
+    RmcastHeader hdr;
+    RmcastPeer *peerPtr;
+    unsigned int session, seq;
+    int n;
+
+    while ((n = recv(statePtr->sock, statePtr->buf, RM_MAX_PACKET, 0))
+	    >= 0) {
+	if (n < RM_HEADER_SIZE) {
+	    continue;
+	}
+	memcpy((char *) &hdr, statePtr->buf, RM_HEADER_SIZE);
+	if (hdr.version != RM_VERSION) {
+	    continue;
+	}
+	session = ntohl(hdr.session);
+	seq = ntohl(hdr.seq);
+
+	switch (hdr.type) {
+	    case RM_DATA:
+		if (session != statePtr->session) {
+		    peerPtr = RmcastFindPeer(statePtr, session, seq);
+		    RmcastHandleData(statePtr, peerPtr, seq,
+			    statePtr->buf + RM_HEADER_SIZE,
+			    n - RM_HEADER_SIZE);
+		}
+		break;
+
+	    case RM_HEARTBEAT:
+		if (session != statePtr->session) {
+		    peerPtr = RmcastFindPeer(statePtr, session, seq);
+		    if ((int) (seq - peerPtr->highest) > 0) {
+			peerPtr->highest = seq;
+			if (peerPtr->nackDue == 0) {
+			    peerPtr->nackDue = RmcastNow()
+				    + statePtr->nackDelay;
+			}
+		    }
+		}
+		break;
+
+	    case RM_NACK:
+		RmcastHandleNack(statePtr, &hdr);
+		break;
+	}
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastFindPeer --
+ *
+ *	Finds a sender's state, creating it on first contact.  A
+ *	receiver that joins late starts with the message it
+ *	first hears about.
+ *
+ * Results:
+ *	The sender's RmcastPeer.
+ *
+ * Side effects:
+ *	Notes that the sender was heard from.  May allocate a
+ *	new peer, first forgetting the longest silent one if
+ *	there are RM_MAX_PEERS already.
+ *
+ *--------------------------------------------------------------
+ */
+
+static RmcastPeer *
+RmcastFindPeer(statePtr, session, seq)
+    RmcastState *statePtr;	/* (in) Receiving channel */
+    unsigned int session;	/* (in) Sender's session id */
+    unsigned int seq;		/* (in) First sequence number seen */
+{
+    RmcastPeer *peerPtr, *oldestPtr = NULL;
+    Tcl_WideInt now = RmcastNow();
+
+    for (peerPtr = statePtr->peers; peerPtr != NULL;
+	    peerPtr = peerPtr->nextPtr) {
+	if (peerPtr->session == session) {
+	    peerPtr->lastHeard = now;
+	    return peerPtr;
+	}
+	if ((oldestPtr == NULL)
+		|| (peerPtr->lastHeard < oldestPtr->lastHeard)) {
+	    oldestPtr = peerPtr;
+	}
+    }
+    if (statePtr->numPeers >= RM_MAX_PEERS) {
+	RmcastForgetPeer(statePtr, oldestPtr);
+    }
+    peerPtr = (RmcastPeer *) ckalloc(sizeof(RmcastPeer));
+    peerPtr->session = session;
+    peerPtr->expected = seq;
+    peerPtr->highest = seq;
+    peerPtr->nackTries = 0;
+    peerPtr->nackDue = 0;
+    peerPtr->lastHeard = now;
+    peerPtr->pending = (RmcastMsg **)
+	    ckalloc(statePtr->window * sizeof(RmcastMsg *));
+    memset((char *) peerPtr->pending, 0,
+	    statePtr->window * sizeof(RmcastMsg *));
+    peerPtr->nextPtr = statePtr->peers;
+    statePtr->peers = peerPtr;
+    statePtr->numPeers++;
+    return peerPtr;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastForgetPeer --
+ *
+ *	Drops a sender that has gone away.  Messages of its that
+ *	are waiting behind a gap are delivered first; the gap
+ *	is counted as lost.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Frees the peer.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastForgetPeer(statePtr, peerPtr)
+    RmcastState *statePtr;	/* (in) Receiving channel */
+    RmcastPeer *peerPtr;	/* (in) Sender to forget */
+{
+    RmcastPeer **prevPtrPtr;
+
+    RmcastSkip(statePtr, peerPtr, peerPtr->highest);
+    for (prevPtrPtr = &statePtr->peers; *prevPtrPtr != peerPtr;
+	    prevPtrPtr = &(*prevPtrPtr)->nextPtr) {
+	/* Empty loop body. */
+    }
+    *prevPtrPtr = peerPtr->nextPtr;
+    statePtr->numPeers--;
+    RmcastFreePeer(statePtr, peerPtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastFreePeer --
+ *
+ *	Frees a sender's state and any messages still pending.
+ *	The caller has taken it off the channel's list.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastFreePeer(statePtr, peerPtr)
+    RmcastState *statePtr;	/* (in) Receiving channel */
+    RmcastPeer *peerPtr;	/* (in) Sender to free */
+{
+    int i;
+
+    for (i = 0; i < statePtr->window; i++) {
+	if (peerPtr->pending[i] != NULL) {
+	    ckfree((char *) peerPtr->pending[i]);
+	}
+    }
+    ckfree((char *) peerPtr->pending);
+    ckfree((char *) peerPtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastHandleData --
+ *
+ *	Files a message from a sender: delivers it if it is the
+ *	next one expected, keeps it if it is early, and drops it
+ *	if it was already delivered.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	An early message schedules a NACK for the gap before it.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastHandleData(statePtr, peerPtr, seq, payload, length)
+    RmcastState *statePtr;	/* (in) Receiving channel */
+    RmcastPeer *peerPtr;	/* (in) Sender */
+    unsigned int seq;		/* (in) Message's sequence number */
+    char *payload;		/* (in) Message */
+    int length;			/* (in) Bytes in payload */
+{
+    RmcastMsg *msgPtr, **slotPtr;
+    int ahead = (int) (seq - peerPtr->expected);
+
+    if (ahead < 0) {
+	statePtr->stats.duplicates++;
+	return;
+    }
+    if (ahead >= statePtr->window) {
+	/*
+	 * Too far ahead to keep everything in between: give up on
+	 * the oldest missing messages.
+	 */
+
+	RmcastSkip(statePtr, peerPtr, seq - statePtr->window + 1);
+    }
+    slotPtr = &peerPtr->pending[seq % statePtr->window];
+    if (*slotPtr != NULL) {
+	statePtr->stats.duplicates++;
+	return;
+    }
+
+    msgPtr = (RmcastMsg *) ckalloc(sizeof(RmcastMsg) + length);
+    msgPtr->nextPtr = NULL;
+    msgPtr->seq = seq;
+    msgPtr->length = length;
+    msgPtr->offset = 0;
+    memcpy(msgPtr->data, payload, length);
+    *slotPtr = msgPtr;
+
+    if ((int) (seq + 1 - peerPtr->highest) > 0) {
+	peerPtr->highest = seq + 1;
+    }
+    RmcastDeliver(statePtr, peerPtr);
+    if ((peerPtr->expected != peerPtr->highest) && (peerPtr->nackDue == 0)) {
+	peerPtr->nackDue = RmcastNow() + statePtr->nackDelay;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastDeliver --
+ *
+ *	Moves a sender's messages that are now in order to the
+ *	channel's ready queue.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Clears the sender's NACK state once its gap is filled.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastDeliver(statePtr, peerPtr)
+    RmcastState *statePtr;	/* (in) Receiving channel */
+    RmcastPeer *peerPtr;	/* (in) Sender */
+{
+    RmcastMsg *msgPtr, **slotPtr;
+    int progress = 0;
+
+    while (1) {
+	slotPtr = &peerPtr->pending[peerPtr->expected % statePtr->window];
+	msgPtr = *slotPtr;
+	if ((msgPtr == NULL) || (msgPtr->seq != peerPtr->expected)) {
+	    break;
+	}
+	*slotPtr = NULL;
+	if (statePtr->readyTail != NULL) {
+	    statePtr->readyTail->nextPtr = msgPtr;
+	} else {
+	    statePtr->readyHead = msgPtr;
+	}
+	statePtr->readyTail = msgPtr;
+	statePtr->stats.packetsIn++;
+	statePtr->stats.bytesIn += msgPtr->length;
+	peerPtr->expected++;
+	progress = 1;
+    }
+    if (progress) {
+	peerPtr->nackTries = 0;
+	peerPtr->nackDue = 0;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastSkip --
+ *
+ *	Gives up on a sender's missing messages before upTo,
+ *	delivering any that did arrive.  Only the window after
+ *	the next message expected can hold any, so a gap wider
+ *	than that is jumped in one step.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Counts the missing messages as lost.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastSkip(statePtr, peerPtr, upTo)
+    RmcastState *statePtr;	/* (in) Receiving channel */
+    RmcastPeer *peerPtr;	/* (in) Sender */
+    unsigned int upTo;		/* (in) First message not given up on */
+{
+    RmcastMsg *msgPtr;
+    unsigned int stop = upTo;
+
+    if ((int) (upTo - peerPtr->expected) > statePtr->window) {
+	stop = peerPtr->expected + statePtr->window;
+    }
+    while ((int) (stop - peerPtr->expected) > 0) {
+	msgPtr = peerPtr->pending[peerPtr->expected % statePtr->window];
+	if ((msgPtr != NULL) && (msgPtr->seq == peerPtr->expected)) {
+	    RmcastDeliver(statePtr, peerPtr);
+	} else {
+	    statePtr->stats.lost++;
+	    peerPtr->expected++;
+	}
+    }
+    if ((int) (upTo - peerPtr->expected) > 0) {
+	statePtr->stats.lost += upTo - peerPtr->expected;
+	peerPtr->expected = upTo;
+    }
+    RmcastDeliver(statePtr, peerPtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastHandleNack --
+ *
+ *	Retransmits the messages a NACK asks us for, unless they
+ *	were just sent.  A NACK for another sender tells us
+ *	someone has already asked for the same gap, so our own
+ *	NACK for it is put off.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May multicast messages again.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastHandleNack(statePtr, hdrPtr)
+    RmcastState *statePtr;	/* (in) Channel that heard the NACK */
+    RmcastHeader *hdrPtr;	/* (in) The NACK */
+{
+    RmcastPeer *peerPtr;
+    RmcastMsg *msgPtr;
+    unsigned int session = ntohl(hdrPtr->session);
+    unsigned int seq = ntohl(hdrPtr->seq);
+    int i, count = ntohs(hdrPtr->count);
+    Tcl_WideInt now = RmcastNow();
+
+    if (ntohl(hdrPtr->origin) == statePtr->session) {
+	return;
+    }
+    if (session != statePtr->session) {
+	for (peerPtr = statePtr->peers; peerPtr != NULL;
+		peerPtr = peerPtr->nextPtr) {
+	    if ((peerPtr->session == session) && (peerPtr->nackDue != 0)
+		    && (peerPtr->expected == seq)) {
+		peerPtr->nackDue = now + statePtr->nackDelay;
+	    }
+	}
+	return;
+    }
+
+    statePtr->stats.nacksIn++;
+    for (i = 0; i < count; i++, seq++) {
+	msgPtr = statePtr->sent[seq % statePtr->window];
+	if ((msgPtr == NULL) || (msgPtr->seq != seq)
+		|| ((int) (seq - statePtr->nextSeq) >= 0)) {
+	    continue;
+	}
+	if (now - msgPtr->sentAt < statePtr->nackDelay / 2) {
+	    continue;
+	}
+	RmcastSend(statePtr, msgPtr->data, msgPtr->length);
+	msgPtr->sentAt = statePtr->lastSend;
+	statePtr->stats.retransmits++;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastTick --
+ *
+ *	Does the channel's timed work: NACKs gaps that are due,
+ *	gives up on gaps that NACKs haven't filled, and sends a
+ *	heartbeat if the sender has been idle.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May send packets and deliver messages.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastTick(statePtr)
+    RmcastState *statePtr;	/* (in) Channel */
+{
+    RmcastPeer *peerPtr, *nextPtr;
+    RmcastMsg *msgPtr;
+    Tcl_WideInt now = RmcastNow();
+    unsigned int end;
+    int count;
+
+    for (peerPtr = statePtr->peers; peerPtr != NULL; peerPtr = nextPtr) {
+	nextPtr = peerPtr->nextPtr;
+	if (now - peerPtr->lastHeard > RM_PEER_TIMEOUT) {
+	    RmcastForgetPeer(statePtr, peerPtr);
+	    continue;
+	}
+	if ((peerPtr->nackDue == 0) || (peerPtr->nackDue > now)) {
+	    continue;
+	}
+	if (peerPtr->expected == peerPtr->highest) {
+	    peerPtr->nackDue = 0;
+	    continue;
+	}
+	if (peerPtr->nackTries >= RM_MAX_NACKS) {
+	    /*
+	     * Skip the first run of missing messages: up to the next
+	     * one we have, or everything if the window holds none.
+	     */
+
+	    end = peerPtr->expected;
+	    do {
+		end++;
+		if ((int) (end - peerPtr->expected) >= statePtr->window) {
+		    end = peerPtr->highest;
+		    break;
+		}
+		msgPtr = peerPtr->pending[end % statePtr->window];
+	    } while ((end != peerPtr->highest)
+		    && ((msgPtr == NULL) || (msgPtr->seq != end)));
+	    RmcastSkip(statePtr, peerPtr, end);
+	    if (peerPtr->expected == peerPtr->highest) {
+		continue;
+	    }
+	}
+
+	/*
+	 * Ask for everything up to the next message we have.
+	 */
+
+	for (count = 1; count < 0xffff; count++) {
+	    end = peerPtr->expected + count;
+	    msgPtr = peerPtr->pending[end % statePtr->window];
+	    if ((end == peerPtr->highest)
+		    || ((msgPtr != NULL) && (msgPtr->seq == end))) {
+		break;
+	    }
+	}
+	RmcastSendControl(statePtr, RM_NACK, peerPtr->session,
+		peerPtr->expected, count);
+	statePtr->stats.nacksOut++;
+	peerPtr->nackTries++;
+	peerPtr->nackDue = now + statePtr->nackDelay;
+    }
+
+    if ((statePtr->nextSeq != 0)
+	    && (now - statePtr->lastSend >= statePtr->heartbeat)) {
+	RmcastSendControl(statePtr, RM_HEARTBEAT, statePtr->session,
+		statePtr->nextSeq, 0);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastRefill --
+ *
+ *	Adds the -rate tokens earned since the last refill.  At
+ *	most a tenth of a second's worth can be saved up.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastRefill(statePtr)
+    RmcastState *statePtr;	/* (in) Channel */
+{
+    Tcl_WideInt now = RmcastNow();
+    double burst = statePtr->rate / 10 + 1;
+
+    statePtr->tokens += (now - statePtr->lastFill) * statePtr->rate / 1000.0;
+    if (statePtr->tokens > burst) {
+	statePtr->tokens = burst;
+    }
+    statePtr->lastFill = now;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastWait --
+ *
+ *	Waits up to ms milliseconds for a packet, for blocking
+ *	channel I/O, then handles whatever arrived and any timed
+ *	work that is due.
+ *
+ * Results:
+ *	0, or -1 with errno set if poll() failed.
+ *
+ * Side effects:
+ *	See RmcastReceive and RmcastTick.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+RmcastWait(statePtr, ms)
+    RmcastState *statePtr;	/* (in) Channel */
+    int ms;			/* (in) Longest wait */
+{
+    struct pollfd pfd;
+
+    pfd.fd = statePtr->sock;
+    pfd.events = POLLIN;
+    if ((poll(&pfd, 1, ms) < 0) && (errno != EINTR)) {
+	return -1;
+    }
+    RmcastReceive(statePtr);
+    RmcastTick(statePtr);
+    return 0;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastFileProc --
+ *
+ *	Called from the event loop when packets arrive.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Handles the packets and tells Tcl if a message is ready.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastFileProc(clientData, mask)
+    ClientData clientData;	/* (in) Pointer to RmcastState */
+    int mask;			/* (in) Not used */
+{
+    RmcastState *statePtr = (RmcastState *) clientData;
+
+    RmcastReceive(statePtr);
+    if ((statePtr->readyHead != NULL)
+	    && (statePtr->watchMask & TCL_READABLE)) {
+	Tcl_NotifyChannel(statePtr->channel, TCL_READABLE);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastTimerProc --
+ *
+ *	Runs RmcastTick every -nackDelay or -heartbeat
+ *	milliseconds, whichever is shorter.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Reschedules itself.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastTimerProc(clientData)
+    ClientData clientData;	/* (in) Pointer to RmcastState */
+{
+    RmcastState *statePtr = (RmcastState *) clientData;
+
+    statePtr->timer = Tcl_CreateTimerHandler(
+	    (statePtr->nackDelay < statePtr->heartbeat)
+	    ? statePtr->nackDelay : statePtr->heartbeat,
+	    RmcastTimerProc, clientData);
+    RmcastTick(statePtr);
+    RmcastScheduleNotify(statePtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastScheduleNotify --
+ *
+ *	Arranges for Tcl to be told that the channel is readable
+ *	(a message is waiting) or writable (-rate allows sending),
+ *	if it is watching for that.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May create a timer handler.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastScheduleNotify(statePtr)
+    RmcastState *statePtr;	/* (in) Channel */
+{
+    int delay = -1;
+
+    if ((statePtr->watchMask & TCL_READABLE)
+	    && (statePtr->readyHead != NULL)) {
+	delay = 0;
+    } else if (statePtr->watchMask & TCL_WRITABLE) {
+	delay = 0;
+	if (statePtr->rate > 0) {
+	    RmcastRefill(statePtr);
+	    if (statePtr->tokens <= 0) {
+		delay = (int) (-statePtr->tokens * 1000.0 / statePtr->rate)
+			+ 1;
+	    }
+	}
+    }
+    if ((delay >= 0) && (statePtr->notifyTimer == NULL)) {
+	statePtr->notifyTimer = Tcl_CreateTimerHandler(delay,
+		RmcastNotifyProc, (ClientData) statePtr);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * RmcastNotifyProc --
+ *
+ *	Timer callback for RmcastScheduleNotify.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May run channel handlers, which may close the channel.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+RmcastNotifyProc(clientData)
+    ClientData clientData;	/* (in) Pointer to RmcastState */
+{
+    RmcastState *statePtr = (RmcastState *) clientData;
+    int mask = 0;
+
+    statePtr->notifyTimer = NULL;
+    if ((statePtr->watchMask & TCL_READABLE)
+	    && (statePtr->readyHead != NULL)) {
+	mask |= TCL_READABLE;
+    }
+    if (statePtr->watchMask & TCL_WRITABLE) {
+	RmcastRefill(statePtr);
+	if ((statePtr->rate == 0) || (statePtr->tokens > 0)) {
+	    mask |= TCL_WRITABLE;
+	}
+    }
+    if (mask) {
+	Tcl_NotifyChannel(statePtr->channel, mask);
+    }
+}
@@ -22,6 +22,10 @@
 
 #include <string.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
 
 #include "generic/dpInt.h"
 
@@ -43,6 +47,33 @@ typedef SocketState TcpState;
 #define	PEEK_MODE	(1<<1)	/* Read without consuming? */
 #define	ASYNC_CONNECT	(1<<2)	/* Asynchronous connection? */
 #define	IS_SERVER	(1<<3)	/* Is this a server Tcp socket? */
+#define	NONBLOCKING_MODE	(1<<4)	/* Channel is in non-blocking mode? */
+#define	CLOSING		(1<<5)	/* Channel closed, queue still draining? */
+
+/*
+ * Output that a non-blocking socket couldn't take right away is kept
+ * in a queue of these buffers and written with writev() once the
+ * socket becomes writable.  DP_TCP_IOV_MAX buffers are written per
+ * call.
+ */
+
+typedef struct DpSendBuf {
+    struct DpSendBuf *nextPtr;	/* Next buffer in the queue. */
+    int length;			/* Number of bytes in data. */
+    int offset;			/* Number of bytes already sent. */
+    char data[4];		/* The bytes; actually length long. */
+} DpSendBuf;
+
+#define DP_TCP_IOV_MAX 64
+
+/*
+ * The most output the send queue holds.  Beyond it a non-blocking
+ * write takes only part of the data, or fails with EAGAIN, and Tcl's
+ * own buffering and writable events take over, so that a peer that
+ * doesn't read can't make the queue grow without bound.
+ */
+
+#define DP_TCP_QUEUE_MAX (256 * 1024)
 
 /*
  * Procedures that are used in this file only.
@@ -63,7 +94,7 @@ static Tcl_Channel	CreateClientChannel _ANSI_ARGS_((Tcl_Interp *interp,
 			    int destIpAddr, int destPort, int myIpAddr,
 			    int myPort, int async));
 static Tcl_Channel	CreateServerChannel _ANSI_ARGS_((Tcl_Interp *interp,
-			    int myIpAddr, int myPort));
+			    int myIpAddr, int myPort, int reusePort));
 static int		SetDefaultOptions _ANSI_ARGS_((Tcl_Interp * interp,
 			    Tcl_Channel chan));
 static int 		DpTcpSetSocketOption _ANSI_ARGS_((TcpState *statePtr,
@@ -71,22 +102,35 @@ static int 		DpTcpSetSocketOption _ANSI_ARGS_((TcpState *statePtr,
 static int 		DpTcpGetSocketOption _ANSI_ARGS_((TcpState *statePtr,
 			    int option, int *valuePtr));
 static int		DpSetAddress _ANSI_ARGS_((TcpState *statePtr));
+static int		TcpClose _ANSI_ARGS_((ClientData instanceData,
+			    Tcl_Interp *interp));
+static int		TcpBlockMode _ANSI_ARGS_((ClientData instanceData,
+			    int mode));
+static void		TcpWatch _ANSI_ARGS_((ClientData instanceData,
+			    int mask));
+static void		TcpFileProc _ANSI_ARGS_((ClientData clientData,
+			    int mask));
+static void		TcpUpdateHandler _ANSI_ARGS_((TcpState *statePtr));
+static void		TcpQueueOutput _ANSI_ARGS_((TcpState *statePtr,
+			    CONST84 char *buf, int length));
+static int		TcpFlushQueue _ANSI_ARGS_((TcpState *statePtr));
+static void		TcpFreeQueue _ANSI_ARGS_((TcpState *statePtr));
 
 
 static Tcl_ChannelType tcpChannelType = {
      "tcp",		/* Name of channel */
      DP_CHANNEL_VERSION,	/* TCL_CHANNEL_VERSION_1, TCL_CHANNEL_VERSION_2, and so on */
-     SockClose,		/* Proc to close a socket */
+     TcpClose,		/* Proc to close a socket */
      TcpInput,		/* Proc to get input from a socket */
      TcpOutput,		/* Proc to send output to a socket */
      NULL,              /* Can't seek on a socket! */
      TcpSetOption,	/* Proc to set a socket option */
      TcpGetOption,	/* Proc to set a socket option */
-     SockWatch,		/* Proc called to set event loop wait params */
+     TcpWatch,		/* Proc called to set event loop wait params */
      SockGetFile,	/* Proc to return a handle assoc with socket */
      NULL,			/* Proc to call to close the channel if the device
 					 * supports closing the read & write sides */
-     SockBlockMode,	/* Proc to set blocking mode on socket */
+     TcpBlockMode,	/* Proc to set blocking mode on socket */
      /* Only valid in TCL_CHANNEL_VERSION_2 channels or later */
      NULL,			/* Proc to call to flush a channel */
      NULL,			/* Proc to call to handle a channel event */
@@ -139,6 +183,7 @@ DpOpenTcpChannel(interp, argc, argv)
     int myIpAddr   = DP_INADDR_ANY;
     int myPort     = 0;
     int isServer   = 0;
+    int reusePort  = 0;
 
     /*
      * Flags to indicate that a certain option has been set by the
@@ -206,10 +251,17 @@ DpOpenTcpChannel(interp, argc, argv)
 		return NULL;
 	    }
 	}
+	else if (strncmp(argv[i], "-reusePort", len)==0) {
+	    if (v==argc) {goto arg_missing;}
+
+	    if (Tcl_GetBoolean(interp, argv[v], &reusePort) != TCL_OK) {
+		return NULL;
+	    }
+	}
 	else {
     	    Tcl_AppendResult(interp, "unknown option \"",
 		    argv[i], "\", must be -async, -host, -myaddr, -myport ",
-		    "-port or -server", NULL);
+		    "-port, -reusePort or -server", NULL);
 	    return NULL;
 	}
     }
@@ -253,6 +305,11 @@ DpOpenTcpChannel(interp, argc, argv)
 		    NULL);
 	    return NULL;
 	}
+	if (reusePort) {
+	    Tcl_AppendResult(interp, "option -reusePort is only valid ",
+		    "for servers", NULL);
+	    return NULL;
+	}
     }
 
     /*
@@ -260,7 +317,7 @@ DpOpenTcpChannel(interp, argc, argv)
      */
 
     if (isServer) {
-	chan = CreateServerChannel(interp, myIpAddr, myPort);
+	chan = CreateServerChannel(interp, myIpAddr, myPort, reusePort);
     } else {
 	chan = CreateClientChannel(interp, destIpAddr, destPort, myIpAddr,
 		myPort, async);
@@ -353,6 +410,12 @@ Dp_TcpAccept(interp, channelId)
     statePtr->myPort	 = 0;
     statePtr->destIpAddr = 0;
     statePtr->destPort	 = 0;
+    statePtr->sendHead	 = NULL;
+    statePtr->sendTail	 = NULL;
+    statePtr->sendQueued = 0;
+    statePtr->sendError	 = 0;
+    statePtr->watchMask	 = 0;
+    memset((char *) &statePtr->stats, 0, sizeof(statePtr->stats));
 
     sprintf(channelName, "tcp%d", tcpCount++);
     chan = Tcl_CreateChannel(&tcpChannelType, channelName,
@@ -387,6 +450,32 @@ Dp_TcpAccept(interp, channelId)
     return chan;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * DpTcpQueued --
+ *
+ *	Reports how much output a DP TCP channel holds in its own send
+ *	queue, waiting for the socket to become writable.
+ *
+ * Results:
+ *	The number of bytes queued, or 0 if chan isn't a DP TCP channel.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+DpTcpQueued(chan)
+    Tcl_Channel chan;			/* Any channel. */
+{
+    if (Tcl_GetChannelType(chan) != &tcpChannelType) {
+	return 0;
+    }
+    return ((TcpState *) Tcl_GetChannelInstanceData(chan))->sendQueued;
+}
+
 /*
  *--------------------------------------------------------------
  *
@@ -421,6 +510,7 @@ TcpInput (instanceData, buf, bufSize, errorCodePtr)
     TcpState *statePtr = (TcpState *)instanceData;
     int result;
 
+    statePtr->stats.readCalls++;
     result = recv(statePtr->sock, buf, bufSize, 0);
 
 #ifdef SOCKDEBUG
@@ -443,8 +533,12 @@ TcpInput (instanceData, buf, bufSize, errorCodePtr)
 	}
 
 	*errorCodePtr = Tcl_GetErrno();
+	if ((*errorCodePtr == EAGAIN) || (*errorCodePtr == EWOULDBLOCK)) {
+	    statePtr->stats.eagainIn++;
+	}
 	return -1;
     }
+    statePtr->stats.bytesIn += result;
     return result;
 }
 
@@ -457,16 +551,23 @@ TcpInput (instanceData, buf, bufSize, errorCodePtr)
  *	user wants to send output to the TCP socket. The function
  *	writes toWrite bytes from buf to the socket.
  *
+ *	If the channel is non-blocking, whatever the socket won't
+ *	take right away is added to the send queue, up to
+ *	DP_TCP_QUEUE_MAX bytes, which is written out from the event
+ *	loop when the socket becomes writable.
+ *
  * Results:
  *	On success, returns a nonnegative integer indicating how many
- *	bytes were written to the socket. The return value is normally
- *	the same as toWrite, but may be less in some cases such as if
- *	the output operation is interrupted by a signal.
+ *	bytes were written to the socket or queued. The return value
+ *	is normally the same as toWrite, but may be less if the send
+ *	queue is full or the output operation is interrupted by a
+ *	signal.
  *
- *	On failure, returns DP_SOCKET_ERROR;
+ *	On failure, returns DP_SOCKET_ERROR; the error is EAGAIN if
+ *	the send queue is already full.
  *
  * Side effects:
- *	None
+ *	May queue output and create a file handler for the socket.
  *
  *--------------------------------------------------------------
  */
@@ -478,7 +579,7 @@ TcpOutput (instanceData, buf, toWrite, errorCodePtr)
     int *errorCodePtr;		/* (out) POSIX error code (if any) */
 {
     TcpState *statePtr = (TcpState *)instanceData;
-    int result;
+    int result, error;
 
 #ifdef SOCKDEBUG
     {
@@ -488,15 +589,407 @@ TcpOutput (instanceData, buf, toWrite, errorCodePtr)
 	printf("Sending TCP data: %s\n", msg);
     }
 #endif
+
+    /*
+     * Report any error from writing the queue in the background.
+     */
+
+    if (statePtr->sendError != 0) {
+	*errorCodePtr = statePtr->sendError;
+	statePtr->sendError = 0;
+	return DP_SOCKET_ERROR;
+    }
+
+    /*
+     * Older output has to go first.  If it can't all go, the new
+     * output joins the end of the queue.
+     */
+
+    if (statePtr->sendHead != NULL) {
+	result = TcpFlushQueue(statePtr);
+	if (result != 0) {
+	    TcpFreeQueue(statePtr);
+	    TcpUpdateHandler(statePtr);
+	    *errorCodePtr = result;
+	    return DP_SOCKET_ERROR;
+	}
+	if (statePtr->sendHead != NULL) {
+	    if (statePtr->sendQueued >= DP_TCP_QUEUE_MAX) {
+		statePtr->stats.eagainOut++;
+		*errorCodePtr = EAGAIN;
+		return DP_SOCKET_ERROR;
+	    }
+	    if (toWrite > DP_TCP_QUEUE_MAX - statePtr->sendQueued) {
+		toWrite = DP_TCP_QUEUE_MAX - statePtr->sendQueued;
+	    }
+	    TcpQueueOutput(statePtr, buf, toWrite);
+	    return toWrite;
+	}
+	TcpUpdateHandler(statePtr);
+    }
+
+    statePtr->stats.writeCalls++;
     result = send(statePtr->sock, buf, toWrite, 0);
 
     if (result < 0) {
-	result = DP_SOCKET_ERROR;
-	*errorCodePtr = DppGetErrno();
+	error = DppGetErrno();
+	if ((error == EAGAIN) || (error == EWOULDBLOCK)) {
+	    statePtr->stats.eagainOut++;
+	}
+	if (((error != EAGAIN) && (error != EWOULDBLOCK))
+		|| !(statePtr->flags & NONBLOCKING_MODE)) {
+	    *errorCodePtr = error;
+	    return DP_SOCKET_ERROR;
+	}
+	result = 0;
+    } else {
+	statePtr->stats.bytesOut += result;
+    }
+
+    if ((result < toWrite) && (statePtr->flags & NONBLOCKING_MODE)) {
+	if (toWrite - result > DP_TCP_QUEUE_MAX) {
+	    toWrite = result + DP_TCP_QUEUE_MAX;
+	}
+	TcpQueueOutput(statePtr, buf + result, toWrite - result);
+	TcpUpdateHandler(statePtr);
+	result = toWrite;
     }
     return result;
 }
 
+/*
+ *--------------------------------------------------------------
+ *
+ * TcpQueueOutput --
+ *
+ *	Appends a copy of some output to the send queue.
+ *
+ * Results:
+ *	None
+ *
+ * Side effects:
+ *	Allocates memory.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+TcpQueueOutput (statePtr, buf, length)
+    TcpState *statePtr;		/* (in) Socket to queue output for */
+    CONST84 char *buf;		/* (in) Bytes to queue */
+    int length;			/* (in) Number of bytes */
+{
+    DpSendBuf *bufPtr;
+
+    bufPtr = (DpSendBuf *) ckalloc(sizeof(DpSendBuf) + length);
+    bufPtr->nextPtr = NULL;
+    bufPtr->length = length;
+    bufPtr->offset = 0;
+    memcpy(bufPtr->data, buf, length);
+
+    if (statePtr->sendTail == NULL) {
+	statePtr->sendHead = bufPtr;
+    } else {
+	statePtr->sendTail->nextPtr = bufPtr;
+    }
+    statePtr->sendTail = bufPtr;
+    statePtr->sendQueued += length;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * TcpFlushQueue --
+ *
+ *	Writes as much of the send queue as the socket will take,
+ *	gathering up to DP_TCP_IOV_MAX buffers into each writev().
+ *	On a blocking socket this writes the whole queue.
+ *
+ * Results:
+ *	0 if all went well (even if the socket filled up), or a
+ *	POSIX error code.
+ *
+ * Side effects:
+ *	Frees the buffers that were sent.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+TcpFlushQueue (statePtr)
+    TcpState *statePtr;		/* (in) Socket to flush */
+{
+    struct iovec iov[DP_TCP_IOV_MAX];
+    DpSendBuf *bufPtr;
+    int iovCnt, result, error;
+
+    while (statePtr->sendHead != NULL) {
+	iovCnt = 0;
+	for (bufPtr = statePtr->sendHead;
+		(bufPtr != NULL) && (iovCnt < DP_TCP_IOV_MAX);
+		bufPtr = bufPtr->nextPtr) {
+	    iov[iovCnt].iov_base = bufPtr->data + bufPtr->offset;
+	    iov[iovCnt].iov_len = bufPtr->length - bufPtr->offset;
+	    iovCnt++;
+	}
+
+	statePtr->stats.writeCalls++;
+	result = writev(statePtr->sock, iov, iovCnt);
+	if (result < 0) {
+	    error = DppGetErrno();
+	    if (error == EINTR) {
+		continue;
+	    }
+	    if ((error == EAGAIN) || (error == EWOULDBLOCK)) {
+		statePtr->stats.eagainOut++;
+		return 0;
+	    }
+	    return error;
+	}
+
+	statePtr->stats.bytesOut += result;
+	statePtr->sendQueued -= result;
+	while (result > 0) {
+	    bufPtr = statePtr->sendHead;
+	    if (result < bufPtr->length - bufPtr->offset) {
+		bufPtr->offset += result;
+		break;
+	    }
+	    result -= bufPtr->length - bufPtr->offset;
+	    statePtr->sendHead = bufPtr->nextPtr;
+	    ckfree((char *) bufPtr);
+	}
+	if (statePtr->sendHead == NULL) {
+	    statePtr->sendTail = NULL;
+	}
+    }
+    return 0;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * TcpFreeQueue --
+ *
+ *	Throws away whatever is left in the send queue.
+ *
+ * Results:
+ *	None
+ *
+ * Side effects:
+ *	Frees memory.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+TcpFreeQueue (statePtr)
+    TcpState *statePtr;		/* (in) Socket whose queue to free */
+{
+    DpSendBuf *bufPtr;
+
+    while (statePtr->sendHead != NULL) {
+	bufPtr = statePtr->sendHead;
+	statePtr->sendHead = bufPtr->nextPtr;
+	ckfree((char *) bufPtr);
+    }
+    statePtr->sendTail = NULL;
+    statePtr->sendQueued = 0;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * TcpWatch --
+ *
+ *	Called by Tcl to say which events on the channel it is
+ *	interested in.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Creates or deletes the socket's file handler.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+TcpWatch (instanceData, mask)
+    ClientData instanceData;	/* (in) Pointer to tcpState struct */
+    int mask;			/* (in) Events of interest */
+{
+    TcpState *statePtr = (TcpState *)instanceData;
+
+    statePtr->watchMask = mask;
+    TcpUpdateHandler(statePtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * TcpUpdateHandler --
+ *
+ *	(Re)creates the socket's file handler for the events Tcl is
+ *	waiting for, plus writability while the send queue isn't
+ *	empty.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Creates or deletes the socket's file handler.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+TcpUpdateHandler (statePtr)
+    TcpState *statePtr;		/* (in) Socket to watch */
+{
+    int mask = statePtr->watchMask;
+
+    if (statePtr->sendHead != NULL) {
+	mask |= TCL_WRITABLE;
+    }
+    if (mask) {
+	Tcl_CreateFileHandler(statePtr->sock, mask, TcpFileProc,
+		(ClientData) statePtr);
+    } else {
+	Tcl_DeleteFileHandler(statePtr->sock);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * TcpFileProc --
+ *
+ *	File handler for the socket.  Writes out the send queue when
+ *	the socket is writable and passes the events Tcl asked for
+ *	on to the channel.  The channel isn't told it's writable
+ *	until the queue is empty.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Whatever the channel handlers do.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+TcpFileProc (clientData, mask)
+    ClientData clientData;	/* (in) Pointer to tcpState struct */
+    int mask;			/* (in) Events that occurred */
+{
+    TcpState *statePtr = (TcpState *)clientData;
+    int error;
+
+    if ((mask & TCL_WRITABLE) && (statePtr->sendHead != NULL)) {
+	error = TcpFlushQueue(statePtr);
+	if (error != 0) {
+	    statePtr->sendError = error;
+	    TcpFreeQueue(statePtr);
+	}
+	if (statePtr->flags & CLOSING) {
+	    if (statePtr->sendHead == NULL) {
+		Tcl_DeleteFileHandler(statePtr->sock);
+		SockClose((ClientData) statePtr, NULL);
+	    }
+	    return;
+	}
+	if (statePtr->sendHead == NULL) {
+	    TcpUpdateHandler(statePtr);
+	} else {
+	    mask &= ~TCL_WRITABLE;
+	}
+    }
+
+    mask &= statePtr->watchMask;
+    if (mask) {
+	Tcl_NotifyChannel(statePtr->channel, mask);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * TcpBlockMode --
+ *
+ *	Sets the socket to blocking or non-blocking.  Going back to
+ *	blocking mode writes out anything still in the send queue
+ *	first, so that blocking writes stay in order.
+ *
+ * Results:
+ *	Zero if the operation was successful, or a nonzero POSIX
+ *	error code if the operation failed.
+ *
+ * Side effects:
+ *	May block until the send queue is written.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+TcpBlockMode (instanceData, mode)
+    ClientData instanceData;	/* (in) Pointer to tcpState struct */
+    int mode;			/* TCL_MODE_BLOCKING or TCL_MODE_NONBLOCKING */
+{
+    TcpState *statePtr = (TcpState *)instanceData;
+    int result, error;
+
+    result = SockBlockMode(instanceData, mode);
+    if (mode == TCL_MODE_BLOCKING) {
+	statePtr->flags &= ~NONBLOCKING_MODE;
+	if (statePtr->sendHead != NULL) {
+	    error = TcpFlushQueue(statePtr);
+	    if (error != 0) {
+		statePtr->sendError = error;
+		TcpFreeQueue(statePtr);
+	    }
+	    TcpUpdateHandler(statePtr);
+	}
+    } else {
+	statePtr->flags |= NONBLOCKING_MODE;
+    }
+    return result;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * TcpClose --
+ *
+ *	Closes the socket.  Output still in the send queue has
+ *	already been reported as sent, so it isn't thrown away:
+ *	the socket is kept open and the queue is written out from
+ *	the event loop, like Tcl does for its own non-blocking
+ *	channels, and the socket is closed once it's empty.
+ *
+ * Results:
+ *	Zero for success, otherwise a nonzero POSIX error code.
+ *
+ * Side effects:
+ *	Closes the socket and frees its state, now or later.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+TcpClose (instanceData, interp)
+    ClientData instanceData;	/* (in) Pointer to tcpState struct */
+    Tcl_Interp *interp;		/* (in) For error reporting */
+{
+    TcpState *statePtr = (TcpState *)instanceData;
+
+    statePtr->watchMask = 0;
+    if ((statePtr->sendHead != NULL) && (TcpFlushQueue(statePtr) == 0)
+	    && (statePtr->sendHead != NULL)) {
+	statePtr->flags |= CLOSING;
+	statePtr->channel = NULL;
+	statePtr->interp = NULL;
+	TcpUpdateHandler(statePtr);
+	return 0;
+    }
+    Tcl_DeleteFileHandler(statePtr->sock);
+    TcpFreeQueue(statePtr);
+    return SockClose(instanceData, interp);
+}
+
 /*
  *--------------------------------------------------------------
  *
@@ -565,6 +1058,15 @@ TcpSetOption (instanceData, interp, optionName, optionValue)
 	}
 	return DpTcpSetSocketOption(statePtr, option, value);
 
+      case DP_REUSEPORT:
+	Tcl_AppendResult(interp, "Can't set -reusePort after socket is opened",
+		NULL);
+	return TCL_ERROR;
+
+      case DP_STATS:
+	Tcl_AppendResult(interp, "-stats is a read-only option", NULL);
+	return TCL_ERROR;
+
       default:
 	Tcl_AppendResult (interp, "bad option \"", optionName,
   		"\": must be -keepalive, -linger, -recvbuffer, -reuseaddr, ",
@@ -657,6 +1159,7 @@ TcpGetOption (instanceData,
 
       	case DP_KEEP_ALIVE:
       	case DP_REUSEADDR:
+      	case DP_REUSEPORT:
 	    if (DpTcpGetSocketOption(statePtr, option, &value) != 0) {
 		return TCL_ERROR;
 	    }
@@ -681,6 +1184,34 @@ TcpGetOption (instanceData,
 	    Tcl_DStringAppend(dsPtr, str, -1);
 	    break;
 
+	case DP_STATS:
+	    SockGetStats(instanceData, 0, dsPtr);
+	    sprintf(str, " sendQueue %d", statePtr->sendQueued);
+	    Tcl_DStringAppend(dsPtr, str, -1);
+#ifdef TCP_INFO
+	    {
+		/*
+		 * Add what the kernel knows about the connection.  The
+		 * times are in microseconds.  A server socket, or one
+		 * that isn't connected yet, reports zeros.
+		 */
+
+		struct tcp_info info;
+		socklen_t infoLen = sizeof(info);
+
+		memset((char *) &info, 0, sizeof(info));
+		getsockopt(statePtr->sock, IPPROTO_TCP, TCP_INFO,
+			(char *) &info, &infoLen);
+		sprintf(str, "rtt %u rttvar %u retransmits %u cwnd %u "
+			"unacked %u", info.tcpi_rtt, info.tcpi_rttvar,
+			info.tcpi_total_retrans, info.tcpi_snd_cwnd,
+			info.tcpi_unacked);
+		Tcl_DStringAppend(dsPtr, " ", 1);
+		Tcl_DStringAppend(dsPtr, str, -1);
+	    }
+#endif
+	    break;
+
 	default:
 	    Tcl_AppendResult(interp,
 		    "bad option \"", optionName,"\": must be -blocking,",
@@ -801,6 +1332,12 @@ CreateClientChannel(interp, destIpAddr, destPort, myIpAddr, myPort, async)
     statePtr->sock		= sock;
     statePtr->sockFile		= (ClientData)sock;
     statePtr->interp		= interp;
+    statePtr->sendHead	 = NULL;
+    statePtr->sendTail	 = NULL;
+    statePtr->sendQueued = 0;
+    statePtr->sendError	 = 0;
+    statePtr->watchMask	 = 0;
+    memset((char *) &statePtr->stats, 0, sizeof(statePtr->stats));
     /*
      * These variables are set whem they are needed.
      * A call to fconfigure will prompt the call to
@@ -841,7 +1378,10 @@ error:
  * CreateServerChannel --
  *
  *	This function opens a new socket in server mode and
- *	initializes the TcpState structure.
+ *	initializes the TcpState structure.  If reusePort is set,
+ *	SO_REUSEPORT is turned on before binding, so that several
+ *	processes can each have their own listener on the same port
+ *	and let the kernel spread the incoming connections.
  *
  * Results:
  *	Returns a new TcpState, or NULL with an error in interp->result,
@@ -854,10 +1394,11 @@ error:
  */
 
 static Tcl_Channel
-CreateServerChannel(interp, myIpAddr, myPort)
+CreateServerChannel(interp, myIpAddr, myPort, reusePort)
     Tcl_Interp *interp;		/* For error reporting; can be NULL. */
     int myIpAddr;		/* Address of the server. */
     int myPort;			/* Port number to listen to */
+    int reusePort;		/* Share the port with other listeners? */
 {
     int status, sock, len;
     struct sockaddr_in mySockAddr;	/* socket address to use. */
@@ -870,6 +1411,19 @@ CreateServerChannel(interp, myIpAddr, myPort)
     }
     SDBG(("Creating server socket %d\n", sock));
 
+    if (reusePort) {
+#ifdef SO_REUSEPORT
+	status = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+		(char *)&reusePort, sizeof(reusePort));
+	if (status < 0) {
+	    goto error;
+	}
+#else
+	errno = EINVAL;
+	goto error;
+#endif
+    }
+
     memset((char *)&mySockAddr, 0, sizeof(mySockAddr));
     mySockAddr.sin_family = AF_INET;
     if (myIpAddr == DP_INADDR_ANY) {
@@ -894,9 +1448,18 @@ CreateServerChannel(interp, myIpAddr, myPort)
 
     statePtr 			= (TcpState *)ckalloc(sizeof(TcpState));
     statePtr->flags 		= IS_SERVER;
+    if (reusePort) {
+	statePtr->flags		|= SOCKET_REUSEPORT;
+    }
     statePtr->sock 		= sock;
     statePtr->sockFile 		= (ClientData)sock;
     statePtr->interp 		= interp;
+    statePtr->sendHead	 = NULL;
+    statePtr->sendTail	 = NULL;
+    statePtr->sendQueued = 0;
+    statePtr->sendError	 = 0;
+    statePtr->watchMask	 = 0;
+    memset((char *) &statePtr->stats, 0, sizeof(statePtr->stats));
 
     /*
      * These are set in DpSetAddress.
@@ -1113,6 +1676,9 @@ DpTcpGetSocketOption (statePtr, option, valuePtr)
 	    result = getsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)valuePtr,
 		    &len);
 	    break;
+	case DP_REUSEPORT:
+	    *valuePtr = (statePtr->flags & SOCKET_REUSEPORT) ? 1 : 0;
+	    return 0;
 	case DP_SEND_BUFFER_SIZE:
 	    result = getsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char *)valuePtr,
 	   	    &len);
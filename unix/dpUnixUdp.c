@@ -22,8 +22,40 @@
  */
 
 #include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "generic/dpInt.h"
+#include <netinet/udp.h>
+
+/*
+ * Every datagram of a -fragment channel starts with this header, in
+ * network byte order.  fragSize lets the receiver place a fragment
+ * without having seen the others.
+ */
+
+typedef struct FragHeader {
+    unsigned short	magic;		/* FRAG_MAGIC. */
+    unsigned short	fragSize;	/* Payload of all but the last. */
+    unsigned int	msgId;		/* Sender's message number. */
+    unsigned int	total;		/* Bytes in the whole message. */
+    unsigned short	index;		/* This fragment's number. */
+    unsigned short	count;		/* Fragments in the message. */
+} FragHeader;
+
+#define FRAG_MAGIC		0xd9f1
+#define FRAG_HEADER_SIZE	((int) sizeof(FragHeader))
+#define FRAG_MAX_SIZE		(65507 - FRAG_HEADER_SIZE)
+#define FRAG_MAX_COUNT		65535
+
+/*
+ * Defaults for -fragTimeout (ms) and -fragMemory (bytes).
+ */
+
+#define FRAG_DEFAULT_TIMEOUT	2000
+#define FRAG_DEFAULT_MEMORY	(16 * 1024 * 1024)
 
 /*
  * Below are all the channel driver procedures that must be supplied for
@@ -44,6 +76,40 @@ static int		    UdpSetOption _ANSI_ARGS_((ClientData instanceData,
 static int		    UdpGetOption _ANSI_ARGS_((ClientData instanceData,
 					Tcl_Interp *interp, CONST84 char *optionName,
 					Tcl_DString *dsPtr));
+static void		    UdpWatch _ANSI_ARGS_((ClientData instanceData,
+					int mask));
+static int		    UdpGroInput _ANSI_ARGS_((ClientData instanceData,
+					char *buf, int bufSize, int peek,
+					int *errorCodePtr));
+static void		    UdpGroReady _ANSI_ARGS_((ClientData clientData));
+static int		    UdpFragInput _ANSI_ARGS_((ClientData instanceData,
+					char *buf, int bufSize, int peek,
+					int *errorCodePtr));
+static int		    UdpFragOutput _ANSI_ARGS_((ClientData instanceData,
+					CONST84 char *buf, int toWrite,
+					int *errorCodePtr));
+static int		    UdpFragSend _ANSI_ARGS_((SocketState *statePtr,
+					CONST84 char *buf, int total,
+					unsigned int msgId, int fragSize,
+					int *indexPtr, int *errorCodePtr));
+static int		    UdpFragFlush _ANSI_ARGS_((SocketState *statePtr,
+					int *errorCodePtr));
+static void		    UdpUpdateHandler _ANSI_ARGS_((
+					SocketState *statePtr));
+static void		    UdpFileProc _ANSI_ARGS_((ClientData clientData,
+					int mask));
+static void		    UdpFragInsert _ANSI_ARGS_((SocketState *statePtr,
+					char *packet, int length,
+					DpSocketAddressIP *fromAddrPtr));
+static void		    UdpFragDrop _ANSI_ARGS_((DpFragState *fragPtr,
+					DpFragMsg *msgPtr));
+static void		    UdpFragReady _ANSI_ARGS_((ClientData clientData));
+static int		    UdpConnect _ANSI_ARGS_((Tcl_Interp *interp,
+					SocketState *statePtr, int on));
+static int		    UdpSetFragment _ANSI_ARGS_((Tcl_Interp *interp,
+					SocketState *statePtr, int option,
+					CONST char *optionName,
+					CONST char *optionValue));
 
 typedef SocketState UdpState;
 
@@ -52,11 +118,11 @@ static Tcl_ChannelType udpChannelType = {
      DP_CHANNEL_VERSION,	/* TCL_CHANNEL_VERSION_1, TCL_CHANNEL_VERSION_2, and so on */
      SockClose,		/* Proc to close a socket */
      UdpInput,		/* Proc to get input from a socket */
-     UdpIpmOutput,	/* Proc to send output to a socket */
+     UdpOutput,		/* Proc to send output to a socket */
      NULL,              /* Can't seek on a socket! */
      UdpSetOption,	/* Proc to set a socket option */
      UdpGetOption,	/* Proc to set a socket option */
-     SockWatch,		/* Proc called to set event loop wait params */
+     UdpWatch,		/* Proc called to set event loop wait params */
      SockGetFile,	/* Proc to return a handle assoc with socket */
      NULL,			/* Proc to call to close the channel if the device
 					 * supports closing the read & write sides */
@@ -70,75 +136,982 @@ static Tcl_ChannelType udpChannelType = {
      NULL			/* Proc to notify the driver of thread specific activity for a channel */
 };
 
-#define	PEEK_MODE	(1<<1)	/* Read without consuming? */
+#define	PEEK_MODE	(1<<1)	/* Read without consuming? */
+
+static int udpCount = 0;        /* Number of udp files opened -- used to
+                                 * generate unique ids for channels */
+
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpInput --
+ *
+ *	This function is called by the Tcl channel driver whenever
+ *	the user wants to get input from the UDP socket.
+ *	If the socket has some data available but
+ *	less than requested by the bufSize argument, we only read
+ *	as much data as is available and return without blocking.
+ *	If the socket has no data available whatsoever and is
+ *	blocking, we block until at least one byte of data can be
+ *	read from the socket.
+ *
+ * Results:
+ *	A nonnegative integer indicating how many bytes were read,
+ *	or -1 in case of error (with errorCodePtr set to the POSIX
+ *	error code).
+ *
+ * Side effects:
+ *	The sender is recorded for dp_recvfrom and -fromvar.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+UdpInput (instanceData, buf, bufSize, errorCodePtr)
+    ClientData instanceData;	/* (in) Pointer to udpState struct */
+    char *buf;			/* (in/out) Buffer to fill */
+    int bufSize;		/* (in) Size of buffer */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    UdpState *statePtr = (UdpState *)instanceData;
+    int peek;
+    DpSocketAddressIP fromAddr;
+    int bytesRead, flags = 0;
+
+    peek = (statePtr->flags & PEEK_MODE);
+    if (statePtr->fragPtr != NULL) {
+	return UdpFragInput(instanceData, buf, bufSize, peek, errorCodePtr);
+    }
+    if (statePtr->groPtr != NULL) {
+	return UdpGroInput(instanceData, buf, bufSize, peek, errorCodePtr);
+    }
+    if (peek) {
+        flags = MSG_PEEK;
+    } else {
+        flags = 0;
+    }
+    bytesRead = SockRecvFrom(instanceData, buf, bufSize, flags, &fromAddr);
+    if (bytesRead == DP_SOCKET_ERROR) {
+	*errorCodePtr = DppGetErrno();
+	return -1;
+    }
+    DpSetFromAddress(statePtr, &fromAddr);
+    return bytesRead;
+}
+
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpOutput --
+ *
+ *	This function is called by the Tcl channel driver whenever
+ *	the user wants to send output to the UDP socket.  Each
+ *	call sends one datagram, or one fragmented message if
+ *	-fragment is on.
+ *
+ * Results:
+ *	The number of bytes written, or -1 with the POSIX error
+ *	code in *errorCodePtr.
+ *
+ * Side effects:
+ *	None
+ *
+ *--------------------------------------------------------------
+ */
+static int
+UdpOutput (instanceData, buf, toWrite, errorCodePtr)
+    ClientData instanceData;	/* (in) Pointer to udpState struct */
+    CONST84 char *buf;		/* (in) Buffer to write */
+    int toWrite;		/* (in) Number of bytes to write */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    UdpState *statePtr = (UdpState *)instanceData;
+
+    if (statePtr->fragPtr != NULL) {
+	return UdpFragOutput(instanceData, buf, toWrite, errorCodePtr);
+    }
+    return UdpIpmOutput(instanceData, buf, toWrite, errorCodePtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpFragOutput --
+ *
+ *	UdpOutput for channels with -fragment on.  The buffer is
+ *	sent as one message, in datagrams of at most -fragment
+ *	bytes plus a header.  If a non-blocking channel runs out
+ *	of socket buffer space once the first fragment is out,
+ *	the rest of the message is kept and sent from the event
+ *	loop, so that a message is never left half sent; the
+ *	next write fails with EAGAIN until it has gone.
+ *
+ * Results:
+ *	toWrite, or -1 with the POSIX error code in *errorCodePtr.
+ *	EMSGSIZE if the message needs more than 65535 fragments.
+ *
+ * Side effects:
+ *	May keep a copy of the message and create a file handler
+ *	for the socket.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+UdpFragOutput (instanceData, buf, toWrite, errorCodePtr)
+    ClientData instanceData;	/* (in) Pointer to udpState struct */
+    CONST84 char *buf;		/* (in) Buffer to write */
+    int toWrite;		/* (in) Number of bytes to write */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    UdpState *statePtr = (UdpState *)instanceData;
+    DpFragState *fragPtr = statePtr->fragPtr;
+    unsigned int msgId;
+    int index, count;
+
+    /*
+     * Report any error from sending a message in the background,
+     * and finish that message before starting another.
+     */
+
+    if (statePtr->sendError != 0) {
+	*errorCodePtr = statePtr->sendError;
+	statePtr->sendError = 0;
+	return -1;
+    }
+    if ((fragPtr->sendBuf != NULL)
+	    && (UdpFragFlush(statePtr, errorCodePtr) != 0)) {
+	return -1;
+    }
+
+    count = (toWrite + fragPtr->fragSize - 1) / fragPtr->fragSize;
+    if (count == 0) {
+	count = 1;
+    } else if (count > FRAG_MAX_COUNT) {
+	*errorCodePtr = EMSGSIZE;
+	return -1;
+    }
+
+    statePtr->stats.writeCalls++;
+    msgId = fragPtr->nextId++;
+    index = 0;
+    if (UdpFragSend(statePtr, buf, toWrite, msgId, fragPtr->fragSize,
+	    &index, errorCodePtr) != 0) {
+	if ((index == 0) || ((*errorCodePtr != EAGAIN)
+		&& (*errorCodePtr != EWOULDBLOCK))) {
+	    return -1;
+	}
+	fragPtr->sendBuf = ckalloc(toWrite);
+	memcpy(fragPtr->sendBuf, buf, toWrite);
+	fragPtr->sendTotal = toWrite;
+	fragPtr->sendSize = fragPtr->fragSize;
+	fragPtr->sendId = msgId;
+	fragPtr->sendIndex = index;
+	UdpUpdateHandler(statePtr);
+    }
+    statePtr->stats.bytesOut += toWrite;
+    return toWrite;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpFragSend --
+ *
+ *	Sends the fragments of a -fragment message from number
+ *	*indexPtr on.  A blocking channel waits for socket buffer
+ *	space whenever it runs out; a non-blocking one stops.
+ *
+ * Results:
+ *	0 once the last fragment is out, or -1 with the POSIX
+ *	error code in *errorCodePtr (EAGAIN if a non-blocking
+ *	socket is full).  *indexPtr is the first fragment not
+ *	sent.
+ *
+ * Side effects:
+ *	None
+ *
+ *--------------------------------------------------------------
+ */
+static int
+UdpFragSend (statePtr, buf, total, msgId, fragSize, indexPtr, errorCodePtr)
+    UdpState *statePtr;		/* (in) Socket to send on */
+    CONST84 char *buf;		/* (in) The message */
+    int total;			/* (in) Bytes in the message */
+    unsigned int msgId;		/* (in) Its message number */
+    int fragSize;		/* (in) Payload of all but the last */
+    int *indexPtr;		/* (in/out) Next fragment to send */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    FragHeader hdr;
+    struct msghdr msg;
+    struct iovec iov[2];
+    struct pollfd pfd;
+    int index, count, offset, length, error;
+
+    count = (total + fragSize - 1) / fragSize;
+    if (count == 0) {
+	count = 1;
+    }
+
+    hdr.magic = htons(FRAG_MAGIC);
+    hdr.fragSize = htons((unsigned short) fragSize);
+    hdr.msgId = htonl(msgId);
+    hdr.total = htonl((unsigned int) total);
+    hdr.count = htons((unsigned short) count);
+
+    memset((char *) &msg, 0, sizeof(msg));
+    if (!(statePtr->flags & SOCKET_CONNECTED)) {
+	msg.msg_name = (void *) &statePtr->sockaddr;
+	msg.msg_namelen = sizeof(statePtr->sockaddr);
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    iov[0].iov_base = (void *) &hdr;
+    iov[0].iov_len = FRAG_HEADER_SIZE;
+
+    for (index = *indexPtr; index < count; ) {
+	offset = index * fragSize;
+	length = total - offset;
+	if (length > fragSize) {
+	    length = fragSize;
+	}
+	hdr.index = htons((unsigned short) index);
+	iov[1].iov_base = (void *) (buf + offset);
+	iov[1].iov_len = length;
+
+	if (sendmsg(statePtr->sock, &msg, 0) == DP_SOCKET_ERROR) {
+	    error = DppGetErrno();
+	    if (error == EINTR) {
+		continue;
+	    }
+	    if ((error == EAGAIN) || (error == EWOULDBLOCK)) {
+		statePtr->stats.eagainOut++;
+	    }
+	    if (((error != EAGAIN) && (error != EWOULDBLOCK))
+		    || (statePtr->flags & SOCKET_NONBLOCKING)) {
+		*indexPtr = index;
+		*errorCodePtr = error;
+		return -1;
+	    }
+	    pfd.fd = statePtr->sock;
+	    pfd.events = POLLOUT;
+	    poll(&pfd, 1, -1);
+	    continue;
+	}
+	statePtr->stats.packetsOut++;
+	index++;
+    }
+    *indexPtr = index;
+    return 0;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpFragFlush --
+ *
+ *	Sends what is left of a message a non-blocking write
+ *	couldn't finish.
+ *
+ * Results:
+ *	0 once it is all out, or -1 with the POSIX error code in
+ *	*errorCodePtr (EAGAIN if some of it is still waiting).
+ *
+ * Side effects:
+ *	Frees the message when it is out or can't be sent, and
+ *	updates the socket's file handler.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+UdpFragFlush (statePtr, errorCodePtr)
+    UdpState *statePtr;		/* (in) Socket to flush */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    DpFragState *fragPtr = statePtr->fragPtr;
+    int result;
+
+    result = UdpFragSend(statePtr, fragPtr->sendBuf, fragPtr->sendTotal,
+	    fragPtr->sendId, fragPtr->sendSize, &fragPtr->sendIndex,
+	    errorCodePtr);
+    if ((result != 0) && ((*errorCodePtr == EAGAIN)
+	    || (*errorCodePtr == EWOULDBLOCK))) {
+	return -1;
+    }
+    ckfree(fragPtr->sendBuf);
+    fragPtr->sendBuf = NULL;
+    UdpUpdateHandler(statePtr);
+    return result;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpFragInput --
+ *
+ *	UdpInput for channels with -fragment on.  Reads datagrams
+ *	until a message is complete, then returns it over as many
+ *	calls as bufSize requires; statePtr->messageLeft says how
+ *	much of it is still to come.  A blocking channel waits
+ *	for a whole message.
+ *
+ * Results:
+ *	The number of bytes in buf, or -1 with the POSIX error
+ *	in *errorCodePtr.
+ *
+ * Side effects:
+ *	The sender is recorded for dp_recvfrom and -fromvar.
+ *	Partial messages older than -fragTimeout are dropped.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+UdpFragInput (instanceData, buf, bufSize, peek, errorCodePtr)
+    ClientData instanceData;	/* (in) Pointer to udpState struct */
+    char *buf;			/* (in/out) Buffer to fill */
+    int bufSize;		/* (in) Size of buffer */
+    int peek;			/* (in) Leave the message queued? */
+    int *errorCodePtr;		/* (out) POSIX error code (if any) */
+{
+    UdpState *statePtr = (UdpState *)instanceData;
+    DpFragState *fragPtr = statePtr->fragPtr;
+    DpSocketAddressIP fromAddr;
+    int bytesRead, length;
+
+    while (fragPtr->ready == NULL) {
+	bytesRead = SockRecvFrom(instanceData, fragPtr->buf, DP_GRO_BUF_SIZE,
+		0, &fromAddr);
+	if (bytesRead == DP_SOCKET_ERROR) {
+	    *errorCodePtr = DppGetErrno();
+	    return -1;
+	}
+	UdpFragInsert(statePtr, fragPtr->buf, bytesRead, &fromAddr);
+    }
+
+    length = fragPtr->readyLength - fragPtr->readyOffset;
+    if (length > bufSize) {
+	length = bufSize;
+    }
+    memcpy(buf, fragPtr->ready + fragPtr->readyOffset, length);
+    DpSetFromAddress(statePtr, &fragPtr->readyFrom);
+    if (peek) {
+	statePtr->messageLeft = fragPtr->readyLength - fragPtr->readyOffset;
+	return length;
+    }
+    fragPtr->readyOffset += length;
+    statePtr->messageLeft = fragPtr->readyLength - fragPtr->readyOffset;
+    if (statePtr->messageLeft == 0) {
+	ckfree(fragPtr->ready);
+	fragPtr->ready = NULL;
+    } else if ((statePtr->watchMask & TCL_READABLE)
+	    && (fragPtr->timer == NULL)) {
+	fragPtr->timer = Tcl_CreateTimerHandler(0, UdpFragReady,
+		(ClientData) statePtr);
+    }
+    return length;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpFragInsert --
+ *
+ *	Files one received fragment.  Datagrams without a valid
+ *	fragment header are dropped.  A new message that would
+ *	take the partial messages over -fragMemory pushes out the
+ *	oldest ones; one bigger than -fragMemory is dropped.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Sets fragPtr->ready when a message is complete.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+UdpFragInsert (statePtr, packet, length, fromAddrPtr)
+    SocketState *statePtr;	/* (in) UDP socket */
+    char *packet;		/* (in) The datagram */
+    int length;			/* (in) Bytes in packet */
+    DpSocketAddressIP *fromAddrPtr; /* (in) Its sender */
+{
+    DpFragState *fragPtr = statePtr->fragPtr;
+    DpFragMsg *msgPtr, **msgPtrPtr;
+    FragHeader hdr;
+    Tcl_Time now;
+    long nowMs;
+    unsigned int msgId;
+    int fragSize, total, index, count, expected;
+
+    if (length < FRAG_HEADER_SIZE) {
+	return;
+    }
+    memcpy((char *) &hdr, packet, FRAG_HEADER_SIZE);
+    fragSize = ntohs(hdr.fragSize);
+    total = (int) ntohl(hdr.total);
+    index = ntohs(hdr.index);
+    count = ntohs(hdr.count);
+    msgId = ntohl(hdr.msgId);
+    if ((ntohs(hdr.magic) != FRAG_MAGIC) || (fragSize == 0) || (total < 0)
+	    || (count != ((total == 0) ? 1
+		    : (total + fragSize - 1) / fragSize))
+	    || (index >= count)) {
+	return;
+    }
+    expected = total - index * fragSize;
+    if (expected > fragSize) {
+	expected = fragSize;
+    }
+    if (length - FRAG_HEADER_SIZE != expected) {
+	return;
+    }
+
+    /*
+     * Drop partial messages that have timed out.  They are kept
+     * newest first, so stop at the first one that hasn't.
+     */
+
+    Tcl_GetTime(&now);
+    nowMs = now.sec * 1000 + now.usec / 1000;
+    msgPtr = NULL;
+    for (msgPtrPtr = &fragPtr->partial; *msgPtrPtr != NULL; ) {
+	if (nowMs - (*msgPtrPtr)->started > fragPtr->timeout) {
+	    DpFragMsg *oldPtr = *msgPtrPtr;
+
+	    *msgPtrPtr = oldPtr->nextPtr;
+	    UdpFragDrop(fragPtr, oldPtr);
+	    continue;
+	}
+	if (((*msgPtrPtr)->msgId == msgId)
+		&& ((*msgPtrPtr)->fromAddr.sin_addr.s_addr
+		    == fromAddrPtr->sin_addr.s_addr)
+		&& ((*msgPtrPtr)->fromAddr.sin_port == fromAddrPtr->sin_port)) {
+	    msgPtr = *msgPtrPtr;
+	}
+	msgPtrPtr = &(*msgPtrPtr)->nextPtr;
+    }
+
+    if (msgPtr == NULL) {
+	if (total > fragPtr->memLimit) {
+	    return;
+	}
+	while (fragPtr->memUsed + total > fragPtr->memLimit) {
+	    /*
+	     * Push out the oldest partial message.
+	     */
+
+	    for (msgPtrPtr = &fragPtr->partial; (*msgPtrPtr)->nextPtr != NULL;
+		    msgPtrPtr = &(*msgPtrPtr)->nextPtr) {
+		/* Empty loop body. */
+	    }
+	    msgPtr = *msgPtrPtr;
+	    *msgPtrPtr = NULL;
+	    UdpFragDrop(fragPtr, msgPtr);
+	}
+	msgPtr = (DpFragMsg *) ckalloc(sizeof(DpFragMsg));
+	msgPtr->fromAddr = *fromAddrPtr;
+	msgPtr->msgId = msgId;
+	msgPtr->total = total;
+	msgPtr->count = count;
+	msgPtr->received = 0;
+	msgPtr->started = nowMs;
+	msgPtr->have = ckalloc((unsigned) count);
+	memset(msgPtr->have, 0, (size_t) count);
+	msgPtr->data = ckalloc((unsigned) (total ? total : 1));
+	msgPtr->nextPtr = fragPtr->partial;
+	fragPtr->partial = msgPtr;
+	fragPtr->memUsed += total;
+    }
+
+    if (msgPtr->have[index]) {
+	return;
+    }
+    msgPtr->have[index] = 1;
+    msgPtr->received++;
+    memcpy(msgPtr->data + index * fragSize, packet + FRAG_HEADER_SIZE,
+	    (size_t) expected);
+    if (msgPtr->received < msgPtr->count) {
+	return;
+    }
+
+    /*
+     * The message is complete: hand it to UdpFragInput.
+     */
+
+    for (msgPtrPtr = &fragPtr->partial; *msgPtrPtr != msgPtr;
+	    msgPtrPtr = &(*msgPtrPtr)->nextPtr) {
+	/* Empty loop body. */
+    }
+    *msgPtrPtr = msgPtr->nextPtr;
+    fragPtr->memUsed -= msgPtr->total;
+    fragPtr->ready = msgPtr->data;
+    fragPtr->readyLength = msgPtr->total;
+    fragPtr->readyOffset = 0;
+    fragPtr->readyFrom = msgPtr->fromAddr;
+    ckfree(msgPtr->have);
+    ckfree((char *) msgPtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpFragDrop --
+ *
+ *	Frees a partial message that has been unlinked.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+UdpFragDrop (fragPtr, msgPtr)
+    DpFragState *fragPtr;	/* (in) Reassembly state */
+    DpFragMsg *msgPtr;		/* (in) Message to free */
+{
+    fragPtr->memUsed -= msgPtr->total;
+    ckfree(msgPtr->have);
+    ckfree(msgPtr->data);
+    ckfree((char *) msgPtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DpUdpFreeFragState --
+ *
+ *	Frees the reassembly state of a UDP channel when -fragment
+ *	is turned off or the channel is closed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Messages not yet read are lost.
+ *
+ *--------------------------------------------------------------
+ */
+void
+DpUdpFreeFragState (fragPtr)
+    DpFragState *fragPtr;	/* (in) Reassembly state */
+{
+    DpFragMsg *msgPtr;
+
+    while ((msgPtr = fragPtr->partial) != NULL) {
+	fragPtr->partial = msgPtr->nextPtr;
+	UdpFragDrop(fragPtr, msgPtr);
+    }
+    if (fragPtr->ready != NULL) {
+	ckfree(fragPtr->ready);
+    }
+    if (fragPtr->timer != NULL) {
+	Tcl_DeleteTimerHandler(fragPtr->timer);
+    }
+    if (fragPtr->sendBuf != NULL) {
+	ckfree(fragPtr->sendBuf);
+    }
+    ckfree((char *) fragPtr);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpFragReady --
+ *
+ *	Timer callback that tells Tcl a -fragment socket is
+ *	readable while the rest of a message is waiting, since
+ *	the socket itself may have nothing left to read.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May run readable channel handlers.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+UdpFragReady (clientData)
+    ClientData clientData;	/* (in) Pointer to udpState struct */
+{
+    UdpState *statePtr = (UdpState *)clientData;
+    DpFragState *fragPtr = statePtr->fragPtr;
+
+    fragPtr->timer = NULL;
+    if ((fragPtr->ready != NULL) && (statePtr->watchMask & TCL_READABLE)) {
+	Tcl_NotifyChannel(statePtr->channel, TCL_READABLE);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpConnect --
+ *
+ *	Implements -connect: connects the socket to the channel's
+ *	-host and -port, or dissolves the association.  While
+ *	connected, output uses send() instead of sendto(), and
+ *	the kernel drops datagrams from any other sender.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	Sets or clears SOCKET_CONNECTED.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+UdpConnect (interp, statePtr, on)
+    Tcl_Interp *interp;		/* (in) For error reporting */
+    SocketState *statePtr;	/* (in) UDP socket */
+    int on;			/* (in) Connect or disconnect? */
+{
+    DpSocketAddressIP addr;
+
+    if (on) {
+	if ((statePtr->sockaddr.sin_addr.s_addr == 0)
+		|| (statePtr->sockaddr.sin_port == 0)) {
+	    Tcl_AppendResult (interp, "-connect requires -host and -port",
+		    NULL);
+	    return TCL_ERROR;
+	}
+	addr = statePtr->sockaddr;
+    } else {
+	if (!(statePtr->flags & SOCKET_CONNECTED)) {
+	    return TCL_OK;
+	}
+	memset((char *) &addr, 0, sizeof(addr));
+	addr.sin_family = AF_UNSPEC;
+    }
+
+    if ((connect(statePtr->sock, (DpSocketAddress *) &addr, sizeof(addr))
+	    == DP_SOCKET_ERROR) && (on || (errno != EAFNOSUPPORT))) {
+	Tcl_SetErrno (DppGetErrno());
+	Tcl_AppendResult (interp, "can't connect to peer: ",
+		Tcl_PosixError(interp), NULL);
+	statePtr->flags &= ~SOCKET_CONNECTED;
+	return TCL_ERROR;
+    }
+    if (on) {
+	statePtr->flags |= SOCKET_CONNECTED;
+    } else {
+	statePtr->flags &= ~SOCKET_CONNECTED;
+    }
+    return TCL_OK;
+}
 
-static int udpCount = 0;        /* Number of udp files opened -- used to
-                                 * generate unique ids for channels */
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpSetFragment --
+ *
+ *	Sets -fragment, -fragTimeout or -fragMemory.  Setting
+ *	-fragment to 0 turns fragmentation off; the other two
+ *	can only be set while it is on.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	Allocates or frees the channel's DpFragState.
+ *
+ *--------------------------------------------------------------
+ */
+static int
+UdpSetFragment (interp, statePtr, option, optionName, optionValue)
+    Tcl_Interp *interp;		/* (in) For error reporting */
+    SocketState *statePtr;	/* (in) UDP socket */
+    int option;			/* (in) DP_FRAGMENT, DP_FRAGTIMEOUT or
+				 * DP_FRAGMEMORY */
+    CONST char *optionName;	/* (in) Name of the option */
+    CONST char *optionValue;	/* (in) New value */
+{
+    DpFragState *fragPtr = statePtr->fragPtr;
+    char str[20];
+    int value;
+
+    if (Tcl_GetInt(interp, optionValue, &value) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (option != DP_FRAGMENT) {
+	if (fragPtr == NULL) {
+	    Tcl_AppendResult(interp, optionName, " requires -fragment",
+		    NULL);
+	    return TCL_ERROR;
+	}
+	if (value <= 0) {
+	    Tcl_AppendResult(interp, optionName, " must be > 0", NULL);
+	    return TCL_ERROR;
+	}
+	if (option == DP_FRAGTIMEOUT) {
+	    fragPtr->timeout = value;
+	} else {
+	    fragPtr->memLimit = value;
+	}
+	return TCL_OK;
+    }
 
+    if ((value < 0) || (value > FRAG_MAX_SIZE)) {
+	sprintf(str, "%d", FRAG_MAX_SIZE);
+	Tcl_AppendResult(interp, "Fragment size must be between 0 and ",
+		str, NULL);
+	return TCL_ERROR;
+    }
+    if (value == 0) {
+	if (fragPtr != NULL) {
+	    DpUdpFreeFragState(fragPtr);
+	    statePtr->fragPtr = NULL;
+	    statePtr->messageLeft = 0;
+	    UdpUpdateHandler(statePtr);
+	}
+	return TCL_OK;
+    }
+    if ((statePtr->gsoSize != 0) || (statePtr->groPtr != NULL)) {
+	Tcl_AppendResult(interp, "can't use -fragment with -gso or -gro",
+		NULL);
+	return TCL_ERROR;
+    }
+    if (statePtr->flags & SOCKET_SENDSTAMP) {
+	Tcl_AppendResult(interp, "can't use -fragment with -sendStamp",
+		NULL);
+	return TCL_ERROR;
+    }
+    if (fragPtr == NULL) {
+	fragPtr = (DpFragState *) ckalloc(sizeof(DpFragState));
+	fragPtr->timeout = FRAG_DEFAULT_TIMEOUT;
+	fragPtr->memLimit = FRAG_DEFAULT_MEMORY;
+	fragPtr->memUsed = 0;
+	fragPtr->nextId = ((unsigned int) getpid() << 16)
+		^ (unsigned int) time(NULL);
+	fragPtr->partial = NULL;
+	fragPtr->ready = NULL;
+	fragPtr->timer = NULL;
+	fragPtr->sendBuf = NULL;
+	statePtr->fragPtr = fragPtr;
+    }
+    fragPtr->fragSize = value;
+    return TCL_OK;
+}
 
 /*
  *--------------------------------------------------------------
  *
- * UdpInput --
+ * UdpGroInput --
  *
- *	This function is called by the Tcl channel driver whenever
- *	the user wants to get input from the UDP socket.
- *	If the socket has some data available but
- *	less than requested by the bufSize argument, we only read
- *	as much data as is available and return without blocking.
- *	If the socket has no data available whatsoever and is
- *	blocking, we block until at least one byte of data can be
- *	read from the socket.
+ *	UdpInput for sockets with -gro on.  The kernel may return
+ *	several datagrams from one sender in a single buffer; they
+ *	are handed out here one per call, so a coalesced batch
+ *	costs one system call however many datagrams it holds.
+ *	In peek mode the datagram is returned without being
+ *	consumed.
  *
  * Results:
- *	A nonnegative integer indicating how many bytes were read,
- *	or -1 in case of error (with errorCodePtr set to the POSIX
- *	error code).
+ *	The number of bytes in buf, or -1 with the POSIX error
+ *	in *errorCodePtr.
  *
  * Side effects:
- *	None
+ *	The sender is recorded for dp_recvfrom and -fromvar.  If
+ *	more datagrams remain a readable event is scheduled for
+ *	them.
  *
  *--------------------------------------------------------------
  */
 static int
-UdpInput (instanceData, buf, bufSize, errorCodePtr)
+UdpGroInput (instanceData, buf, bufSize, peek, errorCodePtr)
     ClientData instanceData;	/* (in) Pointer to udpState struct */
     char *buf;			/* (in/out) Buffer to fill */
     int bufSize;		/* (in) Size of buffer */
+    int peek;			/* (in) Leave the datagram queued? */
     int *errorCodePtr;		/* (out) POSIX error code (if any) */
 {
     UdpState *statePtr = (UdpState *)instanceData;
-    int result, peek;
-    int fromHost, fromPort;
-    char str[256];
-    DpSocketAddressIP fromAddr;
-    int bytesRead, flags = 0, fromLen;
+    DpGroBuf *groPtr = statePtr->groPtr;
+    int length, bytesRead;
 
-    peek = (statePtr->flags & PEEK_MODE);
-    if (peek) {
-        flags = MSG_PEEK;
-    } else {
-        flags = 0;
+    if (groPtr->offset >= groPtr->length) {
+	bytesRead = SockRecvFrom(instanceData, groPtr->buf, DP_GRO_BUF_SIZE,
+		0, &groPtr->fromAddr);
+	if (bytesRead == DP_SOCKET_ERROR) {
+	    *errorCodePtr = DppGetErrno();
+	    return -1;
+	}
+	groPtr->length = bytesRead;
+	groPtr->offset = 0;
     }
-    fromLen = sizeof(fromAddr);
-    bytesRead = recvfrom(statePtr->sock, buf, bufSize, flags,
-	    (DpSocketAddress *)&fromAddr, &fromLen);
-    if (bytesRead == DP_SOCKET_ERROR) {
-	*errorCodePtr = DppGetErrno();
-	return -1;
+
+    length = groPtr->length - groPtr->offset;
+    if ((groPtr->segment > 0) && (length > groPtr->segment)) {
+	length = groPtr->segment;
     }
-    if (statePtr->interp != NULL) {
-	fromHost = ntohl(fromAddr.sin_addr.s_addr);
-	fromPort = ntohs(fromAddr.sin_port);
+    memcpy(buf, groPtr->buf + groPtr->offset,
+	    (length < bufSize) ? length : bufSize);
+    if (!peek) {
+	groPtr->offset += length;
+    }
+    DpSetFromAddress(statePtr, &groPtr->fromAddr);
 
-	sprintf (str, "{%d.%d.%d.%d %d}",  (fromHost>>24),
-		(fromHost>>16) & 0xFF, (fromHost>>8) & 0xFF, fromHost & 0xFF,
-		fromPort);
-	Tcl_SetVar(statePtr->interp, "dp_from", str, TCL_GLOBAL_ONLY);
+    if ((groPtr->offset < groPtr->length)
+	    && (statePtr->watchMask & TCL_READABLE)
+	    && (groPtr->timer == NULL)) {
+	groPtr->timer = Tcl_CreateTimerHandler(0, UdpGroReady,
+		(ClientData) statePtr);
+    }
+    return (length < bufSize) ? length : bufSize;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpGroReady --
+ *
+ *	Timer callback that tells Tcl a -gro socket is readable
+ *	while datagrams from a coalesced batch are still waiting,
+ *	since the socket itself may have nothing left to read.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	May run readable channel handlers.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+UdpGroReady (clientData)
+    ClientData clientData;	/* (in) Pointer to udpState struct */
+{
+    UdpState *statePtr = (UdpState *)clientData;
+    DpGroBuf *groPtr = statePtr->groPtr;
+
+    groPtr->timer = NULL;
+    if ((groPtr->offset < groPtr->length)
+	    && (statePtr->watchMask & TCL_READABLE)) {
+	Tcl_NotifyChannel(statePtr->channel, TCL_READABLE);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpWatch --
+ *
+ *	Remembers which events Tcl wants, so datagrams waiting in
+ *	a -gro buffer or the rest of a -fragment message can be
+ *	reported, and sets up the socket's file handler.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	See UdpUpdateHandler.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+UdpWatch (instanceData, mask)
+    ClientData instanceData;	/* (in) Pointer to udpState struct */
+    int mask;			/* (in) Events of interest */
+{
+    UdpState *statePtr = (UdpState *)instanceData;
+    DpGroBuf *groPtr = statePtr->groPtr;
+
+    statePtr->watchMask = mask;
+    UdpUpdateHandler(statePtr);
+    if ((groPtr != NULL) && (groPtr->offset < groPtr->length)
+	    && (mask & TCL_READABLE) && (groPtr->timer == NULL)) {
+	groPtr->timer = Tcl_CreateTimerHandler(0, UdpGroReady,
+		(ClientData) statePtr);
+    }
+    if ((statePtr->fragPtr != NULL) && (statePtr->fragPtr->ready != NULL)
+	    && (mask & TCL_READABLE) && (statePtr->fragPtr->timer == NULL)) {
+	statePtr->fragPtr->timer = Tcl_CreateTimerHandler(0, UdpFragReady,
+		(ClientData) statePtr);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpUpdateHandler --
+ *
+ *	(Re)creates the socket's file handler for the events Tcl is
+ *	waiting for, plus writability while the rest of a -fragment
+ *	message is waiting to be sent.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Creates or deletes the socket's file handler.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+UdpUpdateHandler (statePtr)
+    UdpState *statePtr;		/* (in) Socket to watch */
+{
+    int mask = statePtr->watchMask;
+
+    if ((statePtr->fragPtr != NULL) && (statePtr->fragPtr->sendBuf != NULL)) {
+	mask |= TCL_WRITABLE;
+    }
+    if (mask) {
+	Tcl_CreateFileHandler(statePtr->sock, mask, UdpFileProc,
+		(ClientData) statePtr);
+    } else {
+	Tcl_DeleteFileHandler(statePtr->sock);
     }
-    return bytesRead;
 }
 
+/*
+ *--------------------------------------------------------------
+ *
+ * UdpFileProc --
+ *
+ *	File handler for the socket.  Sends the rest of a waiting
+ *	-fragment message when the socket is writable and passes
+ *	the events Tcl asked for on to the channel.  The channel
+ *	isn't told it's writable until the message is out.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Whatever the channel handlers do.
+ *
+ *--------------------------------------------------------------
+ */
+static void
+UdpFileProc (clientData, mask)
+    ClientData clientData;	/* (in) Pointer to udpState struct */
+    int mask;			/* (in) Events that occurred */
+{
+    UdpState *statePtr = (UdpState *)clientData;
+    DpFragState *fragPtr = statePtr->fragPtr;
+    int error;
+
+    if ((mask & TCL_WRITABLE) && (fragPtr != NULL)
+	    && (fragPtr->sendBuf != NULL)) {
+	if (UdpFragFlush(statePtr, &error) != 0) {
+	    if ((error == EAGAIN) || (error == EWOULDBLOCK)) {
+		mask &= ~TCL_WRITABLE;
+	    } else {
+		statePtr->sendError = error;
+	    }
+	}
+    }
+
+    mask &= statePtr->watchMask;
+    if (mask) {
+	Tcl_NotifyChannel(statePtr->channel, mask);
+    }
+}
 
 /*
  *--------------------------------------------------------------
@@ -210,6 +1183,9 @@ UdpSetOption (instanceData, interp, optionName, optionValue)
 		return TCL_ERROR;
 	    }
 	    statePtr->sockaddr.sin_addr.s_addr = htonl(value);
+	    if (statePtr->flags & SOCKET_CONNECTED) {
+		return UdpConnect (interp, statePtr, 1);
+	    }
 	    break;
 
 	case DP_PORT:
@@ -221,13 +1197,94 @@ UdpSetOption (instanceData, interp, optionName, optionValue)
 		return TCL_ERROR;
 	    }
 	    statePtr->sockaddr.sin_port = htons((unsigned short) value);
+	    if (statePtr->flags & SOCKET_CONNECTED) {
+		return UdpConnect (interp, statePtr, 1);
+	    }
 	    break;
 
+	case DP_CONNECT:
+	    if (Tcl_GetBoolean(interp, optionValue, &value) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    return UdpConnect (interp, statePtr, value);
+
 	case DP_MYPORT:
 	    Tcl_AppendResult (interp, "Can't set port after socket is opened",
 		    NULL);
 	    return TCL_ERROR;
 
+	case DP_REUSEPORT:
+	    Tcl_AppendResult (interp,
+		    "Can't set -reusePort after socket is opened", NULL);
+	    return TCL_ERROR;
+
+	case DP_STATS:
+	    Tcl_AppendResult (interp, "-stats is a read-only option", NULL);
+	    return TCL_ERROR;
+
+	case DP_FROMVAR:
+	    return DpSetFromVar (statePtr, optionValue);
+
+	case DP_GSO:
+	case DP_GRO:
+	    if (option == DP_GSO) {
+		if (Tcl_GetInt(interp, optionValue, &value) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if (value < 0) {
+		    Tcl_AppendResult (interp, "Segment size must be >= 0",
+			    NULL);
+		    return TCL_ERROR;
+		}
+	    } else if (Tcl_GetBoolean(interp, optionValue, &value) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if (value && (statePtr->fragPtr != NULL)) {
+		Tcl_AppendResult (interp, "can't use ", optionName,
+			" with -fragment", NULL);
+		return TCL_ERROR;
+	    }
+	    if (value && (statePtr->flags & SOCKET_SENDSTAMP)) {
+		Tcl_AppendResult (interp, "can't use ", optionName,
+			" with -sendStamp", NULL);
+		return TCL_ERROR;
+	    }
+	    value = DpUdpSetSocketOption (statePtr, option, value);
+	    if (value != 0) {
+		Tcl_SetErrno (value);
+		Tcl_AppendResult (interp, "can't set ", optionName, ": ",
+			Tcl_PosixError(interp), NULL);
+		return TCL_ERROR;
+	    }
+	    break;
+
+	case DP_FRAGMENT:
+	case DP_FRAGTIMEOUT:
+	case DP_FRAGMEMORY:
+	    return UdpSetFragment (interp, statePtr, option, optionName,
+		    optionValue);
+
+	case DP_TIMESTAMPS:
+	case DP_SENDSTAMP:
+	    if (Tcl_GetBoolean(interp, optionValue, &value) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if (value && (option == DP_SENDSTAMP)
+		    && ((statePtr->gsoSize != 0) || (statePtr->groPtr != NULL)
+		    || (statePtr->fragPtr != NULL))) {
+		Tcl_AppendResult (interp, "can't use -sendStamp with -gso, ",
+			"-gro or -fragment", NULL);
+		return TCL_ERROR;
+	    }
+	    value = DpSetTimestamps ((ClientData) statePtr, option, value);
+	    if (value != 0) {
+		Tcl_SetErrno (value);
+		Tcl_AppendResult (interp, "can't set ", optionName, ": ",
+			Tcl_PosixError(interp), NULL);
+		return TCL_ERROR;
+	    }
+	    break;
+
 	default:
 	    Tcl_AppendResult (interp, "Illegal option \"", optionName,
 		    "\" -- must be sendBuffer, recvBuffer, peek, ",
@@ -316,6 +1373,71 @@ UdpGetOption (instanceData,
 	    }
 	    break;
 
+	case DP_REUSEPORT:
+	    if (statePtr->flags & SOCKET_REUSEPORT) {
+		Tcl_DStringAppend (dsPtr, "1", -1);
+	    } else {
+		Tcl_DStringAppend (dsPtr, "0", -1);
+	    }
+	    break;
+
+	case DP_CONNECT:
+	    if (statePtr->flags & SOCKET_CONNECTED) {
+		Tcl_DStringAppend (dsPtr, "1", -1);
+	    } else {
+		Tcl_DStringAppend (dsPtr, "0", -1);
+	    }
+	    break;
+
+	case DP_STATS:
+	    SockGetStats(instanceData, 1, dsPtr);
+	    break;
+
+	case DP_FROMVAR:
+	    if (statePtr->fromVarName != NULL) {
+		Tcl_DStringAppend (dsPtr,
+			Tcl_GetString(statePtr->fromVarName), -1);
+	    }
+	    break;
+
+	case DP_GSO:
+	    sprintf (str, "%d", statePtr->gsoSize);
+	    Tcl_DStringAppend (dsPtr, str, -1);
+	    break;
+
+	case DP_GRO:
+	    Tcl_DStringAppend (dsPtr, (statePtr->groPtr != NULL) ? "1" : "0",
+		    -1);
+	    break;
+
+	case DP_FRAGMENT:
+	    sprintf (str, "%d", (statePtr->fragPtr != NULL)
+		    ? statePtr->fragPtr->fragSize : 0);
+	    Tcl_DStringAppend (dsPtr, str, -1);
+	    break;
+
+	case DP_FRAGTIMEOUT:
+	    sprintf (str, "%d", (statePtr->fragPtr != NULL)
+		    ? statePtr->fragPtr->timeout : FRAG_DEFAULT_TIMEOUT);
+	    Tcl_DStringAppend (dsPtr, str, -1);
+	    break;
+
+	case DP_FRAGMEMORY:
+	    sprintf (str, "%d", (statePtr->fragPtr != NULL)
+		    ? statePtr->fragPtr->memLimit : FRAG_DEFAULT_MEMORY);
+	    Tcl_DStringAppend (dsPtr, str, -1);
+	    break;
+
+	case DP_TIMESTAMPS:
+	    Tcl_DStringAppend (dsPtr,
+		    (statePtr->flags & SOCKET_TIMESTAMPS) ? "1" : "0", -1);
+	    break;
+
+	case DP_SENDSTAMP:
+	    Tcl_DStringAppend (dsPtr,
+		    (statePtr->flags & SOCKET_SENDSTAMP) ? "1" : "0", -1);
+	    break;
+
 	case DP_HOST:
 	    addr = ntohl(statePtr->sockaddr.sin_addr.s_addr);
 	    sprintf (str, "%d.%d.%d.%d",
@@ -383,6 +1505,8 @@ DpOpenUdpChannel(interp, argc, argv)
     int port = 0;
     int myIpAddr = DP_INADDR_ANY;
     int myport = 0;
+    int reusePort = 0;
+    int connectPeer = 0;
 
     for (i=0; i<argc; i+=2) {
         int v = i+1;
@@ -423,10 +1547,20 @@ DpOpenUdpChannel(interp, argc, argv)
 			"Port number for -myport must be > 0", NULL);
 		return NULL;
 	    }
+	} else if (strncmp(argv[i], "-reusePort", len)==0) {
+	    if (v==argc) {goto arg_missing;}
+	    if (Tcl_GetBoolean(interp, argv[v], &reusePort) != TCL_OK) {
+		return NULL;
+	    }
+	} else if (strncmp(argv[i], "-connect", len)==0) {
+	    if (v==argc) {goto arg_missing;}
+	    if (Tcl_GetBoolean(interp, argv[v], &connectPeer) != TCL_OK) {
+		return NULL;
+	    }
 	} else {
     	    Tcl_AppendResult(interp, "unknown option \"",
-		    argv[i], "\", must be -host, -myaddr, -myport ",
-		    "or -port", NULL);
+		    argv[i], "\", must be -connect, -host, -myaddr, -myport, ",
+		    "-port or -reusePort", NULL);
 	    return NULL;
 	}
     }
@@ -436,8 +1570,15 @@ DpOpenUdpChannel(interp, argc, argv)
      */
 
     statePtr		    = (UdpState *)ckalloc(sizeof(UdpState));
-    statePtr->flags	    = 0;
+    statePtr->flags	    = reusePort ? SOCKET_REUSEPORT : 0;
     statePtr->interp	    = interp;
+    memset((char *) &statePtr->stats, 0, sizeof(statePtr->stats));
+    DpInitFromAddress(statePtr);
+    statePtr->watchMask	    = 0;
+    statePtr->gsoSize	    = 0;
+    statePtr->groPtr	    = NULL;
+    statePtr->fragPtr	    = NULL;
+    statePtr->sendError	    = 0;
     statePtr->myPort	    = myport;
     statePtr->destPort	    = port;
 
@@ -448,6 +1589,7 @@ DpOpenUdpChannel(interp, argc, argv)
     result = DpCreateUdpSocket(interp, myIpAddr, statePtr);
 
     if (result != TCL_OK) {
+	DpFreeFromAddress(statePtr);
 	ckfree((char *)statePtr);
 	return NULL;
     }
@@ -468,9 +1610,6 @@ DpOpenUdpChannel(interp, argc, argv)
     DpUdpSetSocketOption(statePtr, DP_SEND_BUFFER_SIZE, 8192);
     DpUdpSetSocketOption(statePtr, DP_RECV_BUFFER_SIZE, 8192);
 
-    DpUdpGetSocketOption(statePtr, DP_RECV_BUFFER_SIZE,
-    	    &statePtr->recvBufSize);
-
     if (Tcl_SetChannelOption(interp, chan, "-translation", "binary") !=
             TCL_OK) {
         DpClose(interp, chan);
@@ -489,6 +1628,10 @@ DpOpenUdpChannel(interp, argc, argv)
         ckfree((char *)statePtr);
         return NULL;
     }
+    if (connectPeer && (UdpConnect(interp, statePtr, 1) != TCL_OK)) {
+	Tcl_UnregisterChannel(interp, chan);
+	return NULL;
+    }
 
     return chan;
 
@@ -497,6 +1640,28 @@ arg_missing:
     return NULL;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * DpIsUdpChannel --
+ *
+ *	Tells whether a channel was opened by the DP UDP driver.
+ *
+ * Results:
+ *	1 if it was, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+DpIsUdpChannel(chan)
+    Tcl_Channel chan;			/* Any channel. */
+{
+    return (Tcl_GetChannelType(chan) == &udpChannelType);
+}
+
 /*
  *--------------------------------------------------------------
  *
@@ -507,13 +1672,17 @@ arg_missing:
  *		DP_SEND_BUFFER_SIZE	(int)
  *		DP_RECV_BUFFER_SIZE	(int)
  *		DP_BLOCK		(T/F)
+ *		DP_GSO			(int)
+ *		DP_GRO			(T/F)
  *
  * Results:
  *	Zero if the operation was successful, or a nonzero POSIX
  *	error code if the operation failed.
  *
  * Side effects:
- *	None
+ *	DP_RECV_BUFFER_SIZE updates statePtr->recvBufSize, which
+ *	sizes dp_recvBatch's buffers.  DP_GRO allocates or frees
+ *	the socket's DpGroBuf.
  *
  *--------------------------------------------------------------
  */
@@ -535,7 +1704,46 @@ DpUdpSetSocketOption (clientData, option, value)
 	case DP_RECV_BUFFER_SIZE:
 	    result = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)&value,
 	    	   sizeof(value));
+	    if (result == 0) {
+		DpUdpGetSocketOption(clientData, DP_RECV_BUFFER_SIZE,
+			&statePtr->recvBufSize);
+	    }
+	    break;
+#ifdef UDP_SEGMENT
+	case DP_GSO:
+	    result = setsockopt(sock, SOL_UDP, UDP_SEGMENT, (char *)&value,
+		    sizeof(value));
+	    if (result == 0) {
+		statePtr->gsoSize = value;
+	    }
+	    break;
+#endif
+#ifdef UDP_GRO
+	case DP_GRO:
+	    result = setsockopt(sock, SOL_UDP, UDP_GRO, (char *)&value,
+		    sizeof(value));
+	    if (result != 0) {
+		break;
+	    }
+	    if (value && (statePtr->groPtr == NULL)) {
+		statePtr->groPtr = (DpGroBuf *) ckalloc(sizeof(DpGroBuf));
+		statePtr->groPtr->length = 0;
+		statePtr->groPtr->offset = 0;
+		statePtr->groPtr->segment = 0;
+		statePtr->groPtr->timer = NULL;
+	    } else if (!value && (statePtr->groPtr != NULL)) {
+		/*
+		 * Datagrams still waiting in the buffer are dropped.
+		 */
+
+		if (statePtr->groPtr->timer != NULL) {
+		    Tcl_DeleteTimerHandler(statePtr->groPtr->timer);
+		}
+		ckfree((char *) statePtr->groPtr);
+		statePtr->groPtr = NULL;
+	    }
 	    break;
+#endif
 	default:
 	    return EINVAL;
     }
@@ -629,6 +1837,40 @@ DpCreateUdpSocket(interp, myIpAddr, statePtr)
     }
     statePtr->sock = sock;
 
+    /*
+     * Several sockets may share a port with SO_REUSEPORT, in which
+     * case the kernel hashes incoming datagrams across them.  This
+     * has to be set before the bind.
+     */
+
+    if (statePtr->flags & SOCKET_REUSEPORT) {
+#ifdef SO_REUSEPORT
+	int on = 1;
+
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *)&on,
+		sizeof(on)) == DP_SOCKET_ERROR) {
+	    goto bindError;
+	}
+#else
+	errno = EINVAL;
+	goto bindError;
+#endif
+    }
+
+#ifdef SO_RXQ_OVFL
+    {
+	/*
+	 * Ask for the kernel's count of datagrams dropped on this
+	 * socket, reported by "fconfigure -stats".  Not fatal if the
+	 * kernel doesn't support it.
+	 */
+
+	int on = 1;
+
+	setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, (char *)&on, sizeof(on));
+    }
+#endif
+
     /*
      * Bind the socket.
      * This is a bit of a mess, but it's Berkeley sockets.  The sin_family
@@ -102,9 +102,8 @@ DpOpenIpmChannel(interp, argc, argv)
     Tcl_Channel chan;
     IpmState *statePtr = NULL;
     char channelName[20];
-    char *groupName, *str;
-    char **av;
-    int i, ac;
+    char *groupName;
+    int i;
 
     /*
      * The default values for the value-option pairs
@@ -196,12 +195,9 @@ DpOpenIpmChannel(interp, argc, argv)
 
     DppSetupSocketEvents(statePtr, statePtr->sock, 0, 0);
     statePtr->sockInfo->channel = chan;
+    statePtr->channel = chan;
 
-    ac = 1;
-    av = &groupName;
-    str = Tcl_Merge(ac, av);
-    Tcl_DStringAppendElement(&statePtr->groupList, str);
-    ckfree(str);
+    DpIpmInitGroups(statePtr, groupName, ipAddr);
 
     if (Tcl_SetChannelOption(interp, chan, "-translation", "binary") !=
             TCL_OK) {
@@ -230,6 +226,28 @@ arg_missing:
     return NULL;
 #endif
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DpIsIpmChannel --
+ *
+ *	Tells whether a channel was opened by the DP IP multicast driver.
+ *
+ * Results:
+ *	1 if it was, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+DpIsIpmChannel(chan)
+    Tcl_Channel chan;			/* Any channel. */
+{
+    return (Tcl_GetChannelType(chan) == &ipmChannelType);
+}
 
 /*
  *----------------------------------------------------------------------
@@ -278,8 +296,10 @@ CreateIPMSocket(interp, group, port, ttl)
     statePtr->groupAddr	= group;
     statePtr->sock	= sock;
     statePtr->sockFile	= (ClientData)sock;
+    statePtr->flags	= 0;
+    DpInitFromAddress(statePtr);
 
-    Tcl_DStringInit(&statePtr->groupList);
+    statePtr->groupTable = NULL;
     
     /*
      * Bind the socket
@@ -388,8 +408,6 @@ IpmInput(instanceData, buf, bufSize, errorCodePtr)
     SocketInfo *infoPtr = statePtr->sockInfo;
     DpSocketAddressIP fromAddr;
     int bytesRead, fromLen;
-    unsigned int fromHost, fromPort;
-    char str[64];
 
     while (1) {
 	if (infoPtr->readyEvents & (FD_CLOSE|FD_READ)) {
@@ -427,15 +445,7 @@ IpmInput(instanceData, buf, bufSize, errorCodePtr)
 	}
     }
 
-    if (statePtr->interp != NULL) {
-	fromHost = ntohl(fromAddr.sin_addr.s_addr);
-	fromPort = ntohs(fromAddr.sin_port);
-    
-	sprintf (str, "{%d.%d.%d.%d %d}",  (fromHost>>24),
-		(fromHost>>16) & 0xFF, (fromHost>>8) & 0xFF, 
-		fromHost & 0xFF, fromPort);
-	Tcl_SetVar(statePtr->interp, "dp_from", str, TCL_GLOBAL_ONLY);
-    }	
+    DpSetFromAddress(statePtr, &fromAddr);
     return bytesRead;
 }
 
@@ -468,8 +478,6 @@ IpmSetOption (instanceData, interp, optionName, optionValue)
 {
     int option;
     int value;
-    char c;
-    int rc;
     IpmState *statePtr = (IpmState *)instanceData;
 
     /*
@@ -498,61 +506,7 @@ IpmSetOption (instanceData, interp, optionName, optionValue)
             }
             return DpIpmSetSocketOption(statePtr, option, value);
         case DP_GROUP:
-	    c = optionValue[0];
-	    if (c != '+' && c != '-') {
-		Tcl_AppendResult (interp, "Expected an add/drop token.  ",
-			"Please see docs on how to add/drop a group.", NULL);
-		return TCL_ERROR;
-	    }
-	    if (DpHostToIpAddr (&optionValue[1], &value) == 0) {
-		Tcl_AppendResult (interp,
-			"Expected IP address or hostname but got \"",
-			optionValue, "\"", NULL);
-		return TCL_ERROR;
-	    }
-	    if (c == '+') {
-	    	option = DP_ADD_MEMBERSHIP;
-	    } else {
-	    	option = DP_DROP_MEMBERSHIP;
-	    }
-	    rc = DpIpmSetSocketOption(statePtr, option, value);
-	    if (rc == 0) {
-		/*
-		 * Update the group list
-		 */
-		if (option == DP_ADD_MEMBERSHIP) {
-		    Tcl_DStringAppendElement(&statePtr->groupList, 
-			    &optionValue[1]);
-		} else {
-		    int argc, i, j = 0;
-		    char **argv;
-
-		    Tcl_SplitList(interp, 
-			    Tcl_DStringValue(&statePtr->groupList),
-			    &argc, &argv);
-		    for (i=0;i<argc;i++) {
-			if (!strcmp(argv[i], &optionValue[1])) {
-			    while (i<argc) {
-				argv[i] = argv[i+1];
-				i++;
-			    }
-			    j = 1;
-			    break;
-			}
-		    }
-		    if (!j) {
-			Tcl_AppendResult(interp, "Group address not found",
-				"in list", NULL);
-			return TCL_ERROR;
-		    } else {
-			Tcl_DStringFree(&statePtr->groupList);
-			Tcl_DStringInit(&statePtr->groupList);
-			Tcl_DStringAppend(&statePtr->groupList, 
-				Tcl_Merge(argc-1, argv), -1);
-		    }
-		}
-	    }
-	    return rc;
+	    return DpIpmSetGroup(interp, statePtr, optionValue);
 	case DP_MULTICAST_LOOP:
 	    Tcl_AppendResult(interp, "Loopback may not be turned off in Windows.",
 		    NULL);
@@ -562,6 +516,9 @@ IpmSetOption (instanceData, interp, optionName, optionValue)
 		    " after creation.", NULL);
 	    return TCL_ERROR;
 
+	case DP_FROMVAR:
+	    return DpSetFromVar(statePtr, optionValue);
+
       	default:
             Tcl_AppendResult (interp, "bad option \"", optionName,
                     "\": must be -recvBuffer, -reuseAddr, -group, ",
@@ -656,8 +613,7 @@ IpmGetOption (instanceData,
             Tcl_DStringAppend(dsPtr, str, -1);
             break;
 	case DP_GROUP:
-	    Tcl_DStringAppend(dsPtr, Tcl_DStringValue(&statePtr->groupList),
-		    Tcl_DStringLength(&statePtr->groupList));
+	    DpIpmGetGroups(statePtr, dsPtr);
 	    break;
 
 	case DP_MYPORT:
@@ -665,6 +621,13 @@ IpmGetOption (instanceData,
 	    Tcl_DStringAppend(dsPtr, str, -1);
 	    break;
 
+	case DP_FROMVAR:
+	    if (statePtr->fromVarName != NULL) {
+		Tcl_DStringAppend(dsPtr,
+			Tcl_GetString(statePtr->fromVarName), -1);
+	    }
+	    break;
+
 	case DP_MULTICAST_LOOP:
 	    Tcl_DStringAppend(dsPtr, "1", -1);
 	    break;
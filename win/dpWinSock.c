@@ -694,7 +694,10 @@ SockClose (instanceData, interp)
      */
 
 	if (statePtr->flags & SOCKET_IPM) {
-		Tcl_DStringFree(&statePtr->groupList);
+		DpIpmFreeGroups(statePtr);
+	}
+	if (statePtr->flags & SOCKET_DATAGRAM) {
+		DpFreeFromAddress(statePtr);
 	}
 
     ckfree((char *) infoPtr);
@@ -908,3 +911,141 @@ DppGetErrno ()
     posix = Tcl_GetErrno();
     return posix;
 }
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DppCopyChannels --
+ *
+ *	Fast path for dp_copy.  Windows has no equivalent of
+ *	splice() for arbitrary handles, so the copy is always
+ *	left to the generic Tcl_Read/Tcl_Write loop.
+ *
+ * Results:
+ *	Always 0 (not handled).
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+int
+DppCopyChannels (inChan, outChans, numOutChans, requested, copiedPtr,
+	errChanPtr)
+    Tcl_Channel inChan;
+    Tcl_Channel *outChans;
+    int numOutChans;
+    int requested;
+    int *copiedPtr;
+    Tcl_Channel *errChanPtr;
+{
+    *copiedPtr = 0;
+    *errChanPtr = inChan;
+    return 0;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DppRecvBatch --
+ *
+ *	Reads up to maxMsgs datagrams for dp_recvBatch.  Windows
+ *	has no recvmmsg(), so this is a recvfrom() loop that stops
+ *	at the first datagram that isn't already waiting.
+ *
+ * Results:
+ *	The number of datagrams appended to listPtr as
+ *	{payload {host port}} pairs, or -1 with the error in
+ *	*errorCodePtr if none could be read.
+ *
+ * Side effects:
+ *	Datagrams are consumed from the socket.
+ *
+ *--------------------------------------------------------------
+ */
+int
+DppRecvBatch (statePtr, maxMsgs, listPtr, errorCodePtr)
+    SocketState *statePtr;
+    int maxMsgs;
+    Tcl_Obj *listPtr;
+    int *errorCodePtr;
+{
+    DpSocketAddressIP addr;
+    Tcl_Obj *pair[2];
+    char *buf, str[64];
+    int i, n, addrLen;
+    u_long avail;
+
+    buf = ckalloc(64 * 1024);
+    for (i = 0; i < maxMsgs; i++) {
+	if (i > 0 && (ioctlsocket(statePtr->sock, FIONREAD, &avail) != 0
+		|| avail == 0)) {
+	    break;
+	}
+	addrLen = sizeof(addr);
+	n = recvfrom(statePtr->sock, buf, 64 * 1024, 0,
+		(DpSocketAddress *) &addr, &addrLen);
+	if (n == SOCKET_ERROR) {
+	    if (i == 0) {
+		*errorCodePtr = DppGetErrno();
+		ckfree(buf);
+		return -1;
+	    }
+	    break;
+	}
+	statePtr->stats.bytesIn += n;
+	statePtr->stats.packetsIn++;
+	statePtr->stats.readCalls++;
+	sprintf(str, "%s %d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	pair[0] = Tcl_NewByteArrayObj((unsigned char *) buf, n);
+	pair[1] = Tcl_NewStringObj(str, -1);
+	Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(2, pair));
+    }
+    ckfree(buf);
+    return i;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DppSendBatch --
+ *
+ *	Sends numMsgs datagrams for dp_sendBatch with a sendto()
+ *	loop, since Windows has no sendmmsg().
+ *
+ * Results:
+ *	The number of datagrams sent, or -1 with the error in
+ *	*errorCodePtr if none could be sent.
+ *
+ * Side effects:
+ *	Datagrams are sent.
+ *
+ *--------------------------------------------------------------
+ */
+int
+DppSendBatch (statePtr, numMsgs, addrs, bufs, lengths, errorCodePtr)
+    SocketState *statePtr;
+    int numMsgs;
+    DpSocketAddressIP *addrs;
+    CONST84 char **bufs;
+    int *lengths;
+    int *errorCodePtr;
+{
+    int i;
+
+    for (i = 0; i < numMsgs; i++) {
+	if (sendto(statePtr->sock, bufs[i], lengths[i], 0,
+		(DpSocketAddress *) &addrs[i], sizeof(addrs[i]))
+		== SOCKET_ERROR) {
+	    if (i == 0) {
+		*errorCodePtr = DppGetErrno();
+		return -1;
+	    }
+	    break;
+	}
+	statePtr->stats.bytesOut += lengths[i];
+	statePtr->stats.packetsOut++;
+	statePtr->stats.writeCalls++;
+    }
+    return i;
+}
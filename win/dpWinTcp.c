@@ -379,6 +379,30 @@ Dp_TcpAccept(interp, channelId)
 
     return chan;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DpTcpQueued --
+ *
+ *	Reports how much output a DP TCP channel holds in its own send
+ *	queue.  Windows channels write straight to the socket and never
+ *	queue anything.
+ *
+ * Results:
+ *	The number of bytes queued, or 0 if chan isn't a DP TCP channel.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+DpTcpQueued(chan)
+    Tcl_Channel chan;			/* Any channel. */
+{
+    return 0;
+}
 
 /*
  *--------------------------------------------------------------
@@ -157,6 +157,7 @@ DpOpenUdpChannel(interp, argc, argv)
     statePtr->flags	    = 0;
     statePtr->interp	    = interp;
     statePtr->myPort	    = myport;
+    DpInitFromAddress(statePtr);
 
     result = CreateUdpSocket(interp, myIpAddr, statePtr);
 
@@ -216,6 +217,28 @@ arg_missing:
     Tcl_AppendResult(interp, "value for \"", argv[argc-1], "\" missing", NULL);
     return NULL;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DpIsUdpChannel --
+ *
+ *	Tells whether a channel was opened by the DP UDP driver.
+ *
+ * Results:
+ *	1 if it was, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+DpIsUdpChannel(chan)
+    Tcl_Channel chan;			/* Any channel. */
+{
+    return (Tcl_GetChannelType(chan) == &udpChannelType);
+}
 
 /*
  *--------------------------------------------------------------
@@ -332,8 +355,6 @@ UdpInput (instanceData, buf, bufSize, errorCodePtr)
     UdpState *statePtr = (UdpState *)instanceData;
     SocketInfo *infoPtr = statePtr->sockInfo;
     int peek;
-    int fromHost, fromPort;
-    char str[256];
     DpSocketAddressIP fromAddr;
     int bytesRead, flags = 0, fromLen;
 
@@ -388,15 +409,7 @@ UdpInput (instanceData, buf, bufSize, errorCodePtr)
 	}
     }
 
-    if (statePtr->interp != NULL) {
-	fromHost = ntohl(fromAddr.sin_addr.s_addr);
-	fromPort = ntohs(fromAddr.sin_port);
-    
-	sprintf (str, "{%d.%d.%d.%d %d}",  (fromHost>>24),
-		(fromHost>>16) & 0xFF, (fromHost>>8) & 0xFF, 
-		fromHost & 0xFF, fromPort);
-	Tcl_SetVar(statePtr->interp, "dp_from", str, TCL_GLOBAL_ONLY);
-    }	
+    DpSetFromAddress(statePtr, &fromAddr);
     return bytesRead;
 }
 
@@ -488,6 +501,9 @@ UdpSetOption (instanceData, interp, optionName, optionValue)
 		    NULL);
 	    return TCL_ERROR;
 
+	case DP_FROMVAR:
+	    return DpSetFromVar (statePtr, optionValue);
+
 	default:
 	    Tcl_AppendResult (interp, "Illegal option \"", optionName,
 		    "\" -- must be sendBuffer, recvBuffer, peek, ",
@@ -594,6 +610,13 @@ UdpGetOption (instanceData,
 	    Tcl_DStringAppend (dsPtr, str, -1);
 	    break;
 
+	case DP_FROMVAR:
+	    if (statePtr->fromVarName != NULL) {
+		Tcl_DStringAppend (dsPtr,
+			Tcl_GetString(statePtr->fromVarName), -1);
+	    }
+	    break;
+
 	default:
 	    Tcl_AppendResult(interp, 
 		    "bad option \"", optionName,"\": must be -blocking,",